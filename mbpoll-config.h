@@ -26,12 +26,24 @@ extern "C" {
 #define STARTREF_MIN      1
 #define STARTREF_MAX      65536
 #define NUMOFVALUES_MIN   1
-#define NUMOFVALUES_MAX   125
+#define NUMOFVALUES_MAX   65536
 #define POLLRATE_MIN      100
 #define TIMEOUT_MIN       0.01
 #define TIMEOUT_MAX       10.0
 #define TCP_PORT_MIN      1
 #define TCP_PORT_MAX      65535
+#define TCP_THREADS_MAX   256
+#define OUTPUT_BUFFER_SIZE 32768
+#define RBE_REFRESH_MAX   86400
+#define RBE_STACK_VALUES  256
+#define SHM_SIZE_MIN      64
+#define SHM_SIZE_MAX      1048576
+#define TS_CHUNK_MIN      1
+#define TS_CHUNK_MAX      86400
+#define QUEUE_SIZE_MIN    64
+#define QUEUE_SIZE_MAX    1048576
+#define PUB_QUEUE_MIN     16
+#define PUB_QUEUE_MAX     65536
 #define RTU_BAUDRATE_MIN  1200
 #define RTU_BAUDRATE_MAX  921600
 #define CHIPIO_SLAVEADDR_MIN 0x03
@@ -46,6 +58,14 @@ extern "C" {
 #define DEFAULT_POLLRATE      1000
 #define DEFAULT_TIMEOUT       1.0
 #define DEFAULT_TCP_PORT      "502"
+#define DEFAULT_TCP_WINDOW    1
+#define DEFAULT_TCP_THREADS   1
+#define DEFAULT_MERGE_GAP     0
+#define DEFAULT_SHM_SIZE      1024
+#define DEFAULT_TS_CHUNK      3600
+#define DEFAULT_QUEUE_SIZE    1024
+#define DEFAULT_PUB_QUEUE     256
+#define DEFAULT_METRICS_HOST  "127.0.0.1"
 #define DEFAULT_RTU_BAUDRATE  19200
 #define DEFAULT_RTU_DATABITS  SERIAL_DATABIT_8
 #define DEFAULT_RTU_STOPBITS  SERIAL_STOPBIT_ONE
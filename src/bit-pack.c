@@ -0,0 +1,73 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "bit-pack.h"
+
+/* conditionals ============================================================= */
+#if defined (__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define BIT_PACK_LITTLE_ENDIAN 1
+#endif
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+void
+vBitPack (uint64_t * pullDst, const uint8_t * pucBits, int iCount) {
+  int i;
+
+  memset (pullDst, 0, BIT_WORDS (iCount) * sizeof (uint64_t));
+  i = 0;
+#if defined (BIT_PACK_LITTLE_ENDIAN)
+  // 8 bits à la fois : le bit de poids faible de chaque octet est amené par
+  // la multiplication dans l'octet de poids fort
+  for (; i + 8 <= iCount; i += 8) {
+    uint64_t x;
+
+    memcpy (&x, &pucBits[i], sizeof (x));
+    x = ( (x & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56;
+    pullDst[i / 64] |= x << (i % 64);
+  }
+#endif
+  for (; i < iCount; i++) {
+
+    if (pucBits[i]) {
+      pullDst[i / 64] |= 1ULL << (i % 64);
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+int
+iBitFind (const uint64_t * pullBits, int iFirst, int iCount, bool bSet) {
+  int iWord = iFirst / 64;
+  uint64_t x;
+
+  if (iFirst >= iCount) {
+    return iCount;
+  }
+  x = (bSet ? pullBits[iWord] : ~pullBits[iWord]) & (~0ULL << (iFirst % 64));
+  while (x == 0) {
+
+    if (++iWord >= BIT_WORDS (iCount)) {
+      return iCount;
+    }
+    x = bSet ? pullBits[iWord] : ~pullBits[iWord];
+  }
+  iFirst = iWord * 64 + uBitFirst64 (x);
+  return (iFirst < iCount) ? iFirst : iCount;
+}
+
+/* ========================================================================== */
@@ -0,0 +1,90 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_BIT_PACK_H_
+#define _MBPOLL_BIT_PACK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* constants ================================================================ */
+/*
+ * Bits rangés 64 par mot : le bit i est le bit i % 64 du mot i / 64, les bits
+ * qui suivent le dernier sont nuls. Les octets d'un mot, du poids faible au
+ * poids fort, sont ceux d'une trame Modbus.
+ */
+#define BIT_WORDS(n) ( ( (n) + 63) / 64)
+
+/* internal public functions ================================================ */
+
+/**
+ * Nombre de bits à 1 d'un mot
+ */
+static inline unsigned
+uBitCount64 (uint64_t x) {
+#if defined (__GNUC__)
+  return __builtin_popcountll (x);
+#else
+  unsigned n = 0;
+
+  for (; x; x &= x - 1) {
+    n++;
+  }
+  return n;
+#endif
+}
+
+/**
+ * Rang du premier bit à 1 d'un mot non nul
+ */
+static inline unsigned
+uBitFirst64 (uint64_t x) {
+#if defined (__GNUC__)
+  return __builtin_ctzll (x);
+#else
+  unsigned n = 0;
+
+  for (; ! (x & 1); x >>= 1) {
+    n++;
+  }
+  return n;
+#endif
+}
+
+/**
+ * Range iCount bits fournis un par octet (0 ou 1, comme les lit libmodbus)
+ *
+ * @param pullDst BIT_WORDS(iCount) mots
+ */
+void vBitPack (uint64_t * pullDst, const uint8_t * pucBits, int iCount);
+
+/**
+ * Premier bit à bSet à partir du bit iFirst
+ *
+ * @return son rang, iCount s'il n'y en a pas
+ */
+int iBitFind (const uint64_t * pullBits, int iFirst, int iCount, bool bSet);
+
+/**
+ * Octet i d'une suite de bits, dans l'ordre d'une trame Modbus
+ */
+static inline uint8_t
+ucBitByte (const uint64_t * pullBits, int i) {
+
+  return pullBits[i / 8] >> (8 * (i % 8));
+}
+
+/* ========================================================================== */
+#endif /* _MBPOLL_BIT_PACK_H_ */
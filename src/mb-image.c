@@ -0,0 +1,415 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mb-image.h"
+
+#ifdef MBPOLL_SHM
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* constants ================================================================ */
+// champs de l'en-tête
+#define OFF_BLOCK_SIZE  6
+#define OFF_STREAM_SIZE 8
+#define OFF_COUNT       12
+#define OFF_DIRECTORY   16
+#define OFF_MAP_SIZE    24
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+static inline size_t
+ulAlign (size_t ulLen, size_t ulAlignment) {
+
+  return (ulLen + ulAlignment - 1) & ~ (ulAlignment - 1);
+}
+
+// -----------------------------------------------------------------------------
+// Ordre des blocs : source, esclave, type de données puis référence
+static int
+iCompareKey (const xMbImageBlock * b, unsigned usSource, unsigned ucSlave,
+             unsigned ucFunction, unsigned long ulRef) {
+
+  if (b->usSource != usSource) {
+    return b->usSource < usSource ? -1 : 1;
+  }
+  if (b->ucSlave != ucSlave) {
+    return b->ucSlave < ucSlave ? -1 : 1;
+  }
+  if (b->ucFunction != ucFunction) {
+    return b->ucFunction < ucFunction ? -1 : 1;
+  }
+  if (b->ulRef != ulRef) {
+    return b->ulRef < ulRef ? -1 : 1;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+static int
+iCompareBlock (const void * pvA, const void * pvB) {
+  const xMbImageBlock * b = (const xMbImageBlock *) pvB;
+  int iRet = iCompareKey ( (const xMbImageBlock *) pvA, b->usSource,
+                           b->ucSlave, b->ucFunction, b->ulRef);
+
+  // à référence égale, le plus grand bloc en premier
+  if (iRet == 0) {
+    iRet = (int) b->ulElements - (int) ( (const xMbImageBlock *) pvA)->ulElements;
+  }
+  return iRet;
+}
+
+// -----------------------------------------------------------------------------
+// Dernier bloc qui commence au plus tard à ulRef, s'il contient ulRef
+static long
+lFind (const xMbImageBlock * pxBlock, unsigned long ulCount,
+       unsigned usSource, unsigned ucSlave, unsigned ucFunction,
+       unsigned long ulRef) {
+  long lLow = 0, lHigh = (long) ulCount - 1, lFound = -1;
+
+  while (lLow <= lHigh) {
+    long lMid = (lLow + lHigh) / 2;
+
+    if (iCompareKey (&pxBlock[lMid], usSource, ucSlave, ucFunction,
+                     ulRef) <= 0) {
+
+      lFound = lMid;
+      lLow = lMid + 1;
+    }
+    else {
+
+      lHigh = lMid - 1;
+    }
+  }
+  if (lFound >= 0) {
+    const xMbImageBlock * b = &pxBlock[lFound];
+
+    if ( (b->usSource != usSource) || (b->ucSlave != ucSlave) ||
+         (b->ucFunction != ucFunction) ||
+         (ulRef >= b->ulRef + b->ulElements)) {
+      lFound = -1;
+    }
+  }
+  return lFound;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iMbImageCreate (xMbImageWriter * w, const char * sName,
+                xMbImageBlock * pxBlock, unsigned long ulBlockCount,
+                const void * pvStreamHeader, size_t ulStreamHeaderSize) {
+  size_t ulDirectory = ulAlign (MBIMG_HEADER_SIZE + ulStreamHeaderSize,
+                                MBIMG_HEADER_SIZE);
+  size_t ulData;
+  unsigned long i, j;
+  int iFd;
+
+  memset (w, 0, sizeof (*w));
+
+  // tri, puis réunion des blocs qui se chevauchent
+  qsort (pxBlock, ulBlockCount, sizeof (xMbImageBlock), iCompareBlock);
+  for (i = 0, j = 0; i < ulBlockCount; i++) {
+    xMbImageBlock * b = &pxBlock[i];
+
+    if ( (j > 0) && (pxBlock[j - 1].usSource == b->usSource) &&
+         (pxBlock[j - 1].ucSlave == b->ucSlave) &&
+         (pxBlock[j - 1].ucFunction == b->ucFunction) &&
+         (b->ulRef < pxBlock[j - 1].ulRef + pxBlock[j - 1].ulElements)) {
+      xMbImageBlock * p = &pxBlock[j - 1];
+
+      if (b->ulRef + b->ulElements > p->ulRef + p->ulElements) {
+        p->ulElements = b->ulRef + b->ulElements - p->ulRef;
+      }
+      continue;
+    }
+    pxBlock[j++] = *b;
+  }
+  ulBlockCount = j;
+
+  ulData = ulDirectory + ulBlockCount * sizeof (xMbImageBlock);
+  for (i = 0; i < ulBlockCount; i++) {
+    xMbImageBlock * b = &pxBlock[i];
+
+    ulData = ulAlign (ulData, 8);
+    b->ulSeq = 0;
+    b->ucQuality = 0;
+    b->lStatus = 0;
+    b->ulData = ulData;
+    b->ulReserved = 0;
+    b->ullMonotonic = b->ullRealtime = b->ullAttempt = b->ullUpdates = 0;
+    ulData += (size_t) b->ulElements * b->ucElementSize;
+    if (ulData > UINT32_MAX) {
+
+      errno = EFBIG;
+      return -1;
+    }
+  }
+
+  shm_unlink (sName);
+  iFd = shm_open (sName, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (iFd < 0) {
+    return -1;
+  }
+  w->ulMapSize = ulAlign (ulData, 8);
+  if (ftruncate (iFd, w->ulMapSize) != 0) {
+
+    close (iFd);
+    shm_unlink (sName);
+    return -1;
+  }
+  w->pucMap = mmap (NULL, w->ulMapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    iFd, 0);
+  close (iFd);
+  if (w->pucMap == MAP_FAILED) {
+
+    w->pucMap = NULL;
+    shm_unlink (sName);
+    return -1;
+  }
+  w->sName = strdup (sName);
+  w->pxBlock = (xMbImageBlock *) &w->pucMap[ulDirectory];
+  w->ulBlockCount = ulBlockCount;
+
+  // la signature est écrite en dernier, un lecteur ne voit pas d'en-tête
+  // incomplet
+  * (uint16_t *) &w->pucMap[4] = MBIMG_VERSION;
+  * (uint16_t *) &w->pucMap[OFF_BLOCK_SIZE] = sizeof (xMbImageBlock);
+  * (uint32_t *) &w->pucMap[OFF_STREAM_SIZE] = ulStreamHeaderSize;
+  * (uint32_t *) &w->pucMap[OFF_COUNT] = ulBlockCount;
+  * (uint32_t *) &w->pucMap[OFF_DIRECTORY] = ulDirectory;
+  * (uint64_t *) &w->pucMap[OFF_MAP_SIZE] = w->ulMapSize;
+  memcpy (&w->pucMap[MBIMG_HEADER_SIZE], pvStreamHeader, ulStreamHeaderSize);
+  memcpy (w->pxBlock, pxBlock, ulBlockCount * sizeof (xMbImageBlock));
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  memcpy (w->pucMap, MBIMG_MAGIC, 4);
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbImageUpdate (xMbImageWriter * w, const xMbRecord * r, const void * pvData) {
+  long lBlock = lFind (w->pxBlock, w->ulBlockCount, r->usSource, r->ucSlave,
+                       r->ucFunction, r->ulRef);
+  xMbImageBlock * b;
+  uint32_t ulSeq;
+
+  if (lBlock < 0) {
+    return;
+  }
+  b = &w->pxBlock[lBlock];
+  if (r->ulRef + r->ulElements > b->ulRef + b->ulElements) {
+    return;
+  }
+
+  // entrée dans la section d'écriture : ulSeq devient impair. L'échange
+  // protège d'un autre thread qui mettrait à jour le même bloc.
+  do {
+    ulSeq = __atomic_load_n (&b->ulSeq, __ATOMIC_RELAXED) & ~1U;
+  }
+  while (!__atomic_compare_exchange_n (&b->ulSeq, &ulSeq, ulSeq + 1, false,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  // ulSeq impair est visible avant toute modification du bloc
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  if (r->lStatus == 0) {
+
+    memcpy (&w->pucMap[b->ulData + (r->ulRef - b->ulRef) * b->ucElementSize],
+            pvData, (size_t) r->ulElements * b->ucElementSize);
+    b->ucQuality = MBIMG_QUALITY_VALID;
+    b->ullMonotonic = r->ullMonotonic;
+    b->ullRealtime = r->ullRealtime;
+  }
+  else {
+
+    b->ucQuality |= MBIMG_QUALITY_ERROR;
+  }
+  b->lStatus = r->lStatus;
+  b->ullAttempt = r->ullMonotonic;
+  b->ullUpdates++;
+
+  __atomic_store_n (&b->ulSeq, ulSeq + 2, __ATOMIC_RELEASE);
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbImageDelete (xMbImageWriter * w) {
+
+  // les lecteurs déjà ouverts voient l'image jusqu'à leur fermeture
+  if (w->sName) {
+
+    shm_unlink (w->sName);
+    free (w->sName);
+    w->sName = NULL;
+  }
+  if (w->pucMap) {
+
+    munmap (w->pucMap, w->ulMapSize);
+    w->pucMap = NULL;
+  }
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbImageOpen (xMbImageReader * r, const char * sName) {
+  struct stat xStat;
+  size_t ulDirectory;
+  unsigned long i;
+  int iFd;
+
+  memset (r, 0, sizeof (*r));
+  iFd = shm_open (sName, O_RDONLY, 0);
+  if (iFd < 0) {
+    return -1;
+  }
+  if (fstat (iFd, &xStat) != 0) {
+
+    close (iFd);
+    return -1;
+  }
+  r->ulMapSize = xStat.st_size;
+  if (r->ulMapSize < MBIMG_HEADER_SIZE) {
+
+    close (iFd);
+    errno = EPROTO;
+    return -1;
+  }
+  r->pucMap = mmap (NULL, r->ulMapSize, PROT_READ, MAP_SHARED, iFd, 0);
+  close (iFd);
+  if (r->pucMap == MAP_FAILED) {
+
+    r->pucMap = NULL;
+    return -1;
+  }
+
+  ulDirectory = * (uint32_t *) &r->pucMap[OFF_DIRECTORY];
+  r->ulBlockCount = * (uint32_t *) &r->pucMap[OFF_COUNT];
+  r->ulStreamHeaderSize = * (uint32_t *) &r->pucMap[OFF_STREAM_SIZE];
+  if ( (memcmp (r->pucMap, MBIMG_MAGIC, 4) != 0) ||
+       (* (uint16_t *) &r->pucMap[4] != MBIMG_VERSION) ||
+       (* (uint16_t *) &r->pucMap[OFF_BLOCK_SIZE] != sizeof (xMbImageBlock)) ||
+       (ulDirectory < MBIMG_HEADER_SIZE + r->ulStreamHeaderSize) ||
+       (ulDirectory + r->ulBlockCount * sizeof (xMbImageBlock) >
+        r->ulMapSize)) {
+
+    vMbImageClose (r);
+    errno = EPROTO;
+    return -1;
+  }
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  r->pxBlock = (const xMbImageBlock *) &r->pucMap[ulDirectory];
+  r->pucStreamHeader = &r->pucMap[MBIMG_HEADER_SIZE];
+
+  // les éléments de chaque bloc doivent être dans la projection
+  for (i = 0; i < r->ulBlockCount; i++) {
+    const xMbImageBlock * b = &r->pxBlock[i];
+
+    if ( (size_t) b->ulData + (size_t) b->ulElements * b->ucElementSize >
+         r->ulMapSize) {
+
+      vMbImageClose (r);
+      errno = EPROTO;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+long
+lMbImageFind (const xMbImageReader * r, unsigned usSource, unsigned ucSlave,
+              unsigned ucFunction, unsigned long ulRef) {
+
+  return lFind (r->pxBlock, r->ulBlockCount, usSource, ucSlave, ucFunction,
+                ulRef);
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbImageRead (const xMbImageReader * r, long lBlock, unsigned long ulRef,
+              unsigned long ulElements, void * pvDst,
+              xMbImageBlock * pxInfo) {
+  const xMbImageBlock * b;
+  xMbImageBlock xInfo;
+  uint32_t ulSeq;
+
+  if ( (lBlock < 0) || ( (unsigned long) lBlock >= r->ulBlockCount)) {
+    return -1;
+  }
+  b = &r->pxBlock[lBlock];
+  if ( (ulRef < b->ulRef) || (ulRef + ulElements > b->ulRef + b->ulElements)) {
+    return -1;
+  }
+
+  for (;;) {
+    ulSeq = __atomic_load_n (&b->ulSeq, __ATOMIC_ACQUIRE);
+    if (ulSeq & 1) {
+      // mise à jour en cours, elle dure le temps d'une copie
+      continue;
+    }
+    memcpy (pvDst, &r->pucMap[b->ulData + (ulRef - b->ulRef) * b->ucElementSize],
+            ulElements * b->ucElementSize);
+    memcpy (&xInfo, b, sizeof (xInfo));
+
+    // la copie n'est valable que si aucune mise à jour ne l'a traversée
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (__atomic_load_n (&b->ulSeq, __ATOMIC_RELAXED) == ulSeq) {
+      break;
+    }
+  }
+  if (pxInfo) {
+
+    xInfo.ulSeq = ulSeq;
+    *pxInfo = xInfo;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t
+ullMbImageAge (const xMbImageBlock * pxInfo) {
+  struct timespec ts;
+  uint64_t ullNow;
+
+  if (! (pxInfo->ucQuality & MBIMG_QUALITY_VALID)) {
+    return UINT64_MAX;
+  }
+  // même horloge que celle de mbpoll
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  ullNow = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  return ullNow > pxInfo->ullMonotonic ? ullNow - pxInfo->ullMonotonic : 0;
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbImageClose (xMbImageReader * r) {
+
+  if (r->pucMap) {
+
+    munmap (r->pucMap, r->ulMapSize);
+    r->pucMap = NULL;
+  }
+}
+
+#endif /* MBPOLL_SHM defined */
+/* ========================================================================== */
@@ -0,0 +1,193 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_MB_IMAGE_H_
+#define _MBPOLL_MB_IMAGE_H_
+
+#include "mb-shm.h"
+
+#ifdef MBPOLL_SHM
+#include <stddef.h>
+#include <stdint.h>
+#include "mb-record.h"
+
+/* constants ================================================================ */
+/*
+ * Image des dernières valeurs lues en mémoire partagée (shm_open). Les champs
+ * sont dans l'ordre de l'hôte, l'image ne quitte pas la machine.
+ *
+ * En-tête (MBIMG_HEADER_SIZE octets)
+ *   0  char[4] "MBPI"
+ *   4  u16     version (MBIMG_VERSION)
+ *   6  u16     taille d'un descripteur de bloc (sizeof (xMbImageBlock))
+ *   8  u32     taille de l'en-tête de flux qui suit l'en-tête (mb-record.h)
+ *  12  u32     nombre de blocs
+ *  16  u32     position des descripteurs depuis le début de la projection
+ *  20  u32     réservé (0)
+ *  24  u64     taille de la projection
+ * suivi de l'en-tête de flux de mb-record.h (en-tête et table des sources),
+ * puis des descripteurs de blocs alignés sur MBIMG_HEADER_SIZE, puis des
+ * éléments de chaque bloc : un octet par bit ou un u16 par registre.
+ *
+ * Les blocs sont les plages lues (-r, -c et --group) de chaque esclave de
+ * chaque source, les plages qui se chevauchent sont réunies. Ils sont triés
+ * par source, esclave, type de données et référence : la table d'un esclave
+ * pour un type de données est la suite de ses blocs.
+ *
+ * Chaque bloc est protégé par un seqlock : ulSeq est impair pendant une mise
+ * à jour. Un lecteur recommence sa copie si ulSeq était impair ou a changé,
+ * il n'attend jamais l'écrivain qui, lui, n'attend jamais les lecteurs.
+ */
+#define MBIMG_MAGIC "MBPI"
+#define MBIMG_VERSION 1
+#define MBIMG_HEADER_SIZE 64
+
+// Les valeurs du bloc proviennent d'une lecture réussie
+#define MBIMG_QUALITY_VALID 0x01
+// La dernière lecture a échoué (lStatus), les valeurs sont les précédentes
+#define MBIMG_QUALITY_ERROR 0x02
+
+/* structures =============================================================== */
+/**
+ * Descripteur d'un bloc de l'image (64 octets)
+ */
+typedef struct xMbImageBlock {
+  uint32_t ulSeq; /**< Seqlock, impair pendant une mise à jour */
+  uint16_t usSource; /**< Indice de la source */
+  uint8_t ucSlave;
+  uint8_t ucFunction; /**< Type de données (-t) */
+  uint8_t ucFormat; /**< eMbRecFormat */
+  uint8_t ucFlags; /**< MBREC_FLAG_xxx */
+  uint8_t ucQuality; /**< MBIMG_QUALITY_xxx, 0 si jamais lu */
+  uint8_t ucElementSize; /**< 1 octet par bit, 2 par registre */
+  uint32_t ulRef; /**< Référence du premier élément */
+  uint32_t ulElements; /**< Nombre d'éléments */
+  int32_t lStatus; /**< 0 ou code d'erreur de la dernière lecture */
+  uint32_t ulData; /**< Position des éléments depuis le début de la projection */
+  uint32_t ulReserved;
+  uint64_t ullMonotonic; /**< Dernière lecture réussie, horloge monotone en ns */
+  uint64_t ullRealtime; /**< Dernière lecture réussie, heure UTC en ns */
+  uint64_t ullAttempt; /**< Dernière lecture, horloge monotone en ns */
+  uint64_t ullUpdates; /**< Nombre de mises à jour */
+} xMbImageBlock;
+
+/**
+ * Ecrivain : l'image est créée par mbpoll
+ *
+ * Plusieurs threads peuvent mettre à jour l'image, un bloc n'est modifié que
+ * par un thread à la fois.
+ */
+typedef struct xMbImageWriter {
+  char * sName;
+  uint8_t * pucMap; /**< Projection complète */
+  size_t ulMapSize;
+  xMbImageBlock * pxBlock; /**< Descripteurs, dans la projection */
+  unsigned long ulBlockCount;
+} xMbImageWriter;
+
+/**
+ * Lecteur
+ */
+typedef struct xMbImageReader {
+  uint8_t * pucMap;
+  size_t ulMapSize;
+  const xMbImageBlock * pxBlock;
+  unsigned long ulBlockCount;
+  const uint8_t * pucStreamHeader; /**< En-tête de flux de mb-record.h */
+  size_t ulStreamHeaderSize;
+} xMbImageReader;
+
+/* internal public functions ================================================ */
+
+/**
+ * Crée l'image, remplace une image existante du même nom
+ *
+ * @param pxBlock blocs à publier : usSource, ucSlave, ucFunction, ucFormat,
+ * ucFlags, ucElementSize, ulRef et ulElements sont renseignés, les autres
+ * champs sont ignorés. Le tableau est trié et les blocs qui se chevauchent
+ * sont réunis.
+ * @param pvStreamHeader en-tête de flux et table des sources (mb-record.h)
+ * @return 0, -1 si erreur (errno)
+ */
+int iMbImageCreate (xMbImageWriter * w, const char * sName,
+                    xMbImageBlock * pxBlock, unsigned long ulBlockCount,
+                    const void * pvStreamHeader, size_t ulStreamHeaderSize);
+
+/**
+ * Met à jour l'image avec le résultat d'une lecture
+ *
+ * Les champs ulSize, ucFormat, ucFlags et ulCount de r sont ignorés. Les
+ * éléments qui ne sont pas dans un bloc de l'image sont ignorés.
+ *
+ * @param r source, esclave, type de données, référence, nombre d'éléments,
+ * état et heures de la lecture
+ * @param pvData les r->ulElements éléments lus (bits ou registres dans l'ordre
+ * de l'hôte), non utilisé si r->lStatus n'est pas nul
+ */
+void vMbImageUpdate (xMbImageWriter * w, const xMbRecord * r,
+                     const void * pvData);
+
+/**
+ * Ferme et supprime l'image, plus aucun thread ne doit la mettre à jour
+ */
+void vMbImageDelete (xMbImageWriter * w);
+
+/**
+ * Ouvre une image existante
+ *
+ * @return 0, -1 si erreur (errno, EPROTO si ce n'est pas une image mbpoll)
+ */
+int iMbImageOpen (xMbImageReader * r, const char * sName);
+
+/**
+ * Recherche le bloc qui contient une référence
+ *
+ * @return l'indice du bloc, -1 si aucun bloc ne la contient
+ */
+long lMbImageFind (const xMbImageReader * r, unsigned usSource,
+                   unsigned ucSlave, unsigned ucFunction, unsigned long ulRef);
+
+/**
+ * Copie cohérente d'éléments d'un bloc et de son descripteur
+ *
+ * La copie est recommencée tant qu'une mise à jour du bloc la traverse : deux
+ * registres d'une valeur 32 bits proviennent toujours de la même lecture.
+ *
+ * @param lBlock indice du bloc
+ * @param ulRef référence du premier élément à copier
+ * @param ulElements nombre d'éléments à copier
+ * @param pvDst reçoit les éléments (bits ou registres dans l'ordre de l'hôte)
+ * @param pxInfo reçoit le descripteur du bloc, peut être NULL
+ * @return 0, -1 si les éléments ne sont pas dans le bloc
+ */
+int iMbImageRead (const xMbImageReader * r, long lBlock, unsigned long ulRef,
+                  unsigned long ulElements, void * pvDst,
+                  xMbImageBlock * pxInfo);
+
+/**
+ * Age des valeurs d'un bloc, en ns depuis la dernière lecture réussie
+ *
+ * @return l'âge, UINT64_MAX si le bloc n'a jamais été lu
+ */
+uint64_t ullMbImageAge (const xMbImageBlock * pxInfo);
+
+/**
+ * Ferme l'image
+ */
+void vMbImageClose (xMbImageReader * r);
+
+#endif /* MBPOLL_SHM defined */
+/* ========================================================================== */
+#endif /* _MBPOLL_MB_IMAGE_H_ */
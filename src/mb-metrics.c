@@ -0,0 +1,829 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mb-metrics.h"
+
+#ifdef MBPOLL_METRICS
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/* constants ================================================================ */
+#define LISTEN_BACKLOG 16
+#define REQUEST_MAX 2048
+// délai accordé à un client pour envoyer sa requête ou recevoir la page
+#define CLIENT_TIMEOUT_S 2
+// place réservée au texte d'une valeur et à son saut de ligne
+#define VALUE_TEXT_MAX 32
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const uint32_t ulLatencyBound[MBMET_BUCKETS - 1] = {
+  MBMET_LATENCY_BOUNDS
+};
+
+static const char * sFunctionLabel[] = {
+  "coil",
+  "discrete-input",
+  "",
+  "input-register",
+  "holding-register"
+};
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+// Valeur d'étiquette : \, " et saut de ligne sont échappés
+static char *
+sEscapeLabel (const char * s, size_t ulLen) {
+  char * sOut = malloc (2 * ulLen + 1);
+  size_t i, j = 0;
+
+  if (sOut == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < ulLen; i++) {
+
+    if ( (s[i] == '\\') || (s[i] == '"')) {
+
+      sOut[j++] = '\\';
+      sOut[j++] = s[i];
+    }
+    else if (s[i] == '\n') {
+
+      sOut[j++] = '\\';
+      sOut[j++] = 'n';
+    }
+    else {
+
+      sOut[j++] = s[i];
+    }
+  }
+  sOut[j] = 0;
+  return sOut;
+}
+
+// -----------------------------------------------------------------------------
+static const char *
+sSourceLabel (const xMbMetricsServer * m, unsigned usSource) {
+
+  return (usSource < (unsigned) m->iSourceCount) ? m->psSource[usSource] : "";
+}
+
+// -----------------------------------------------------------------------------
+// FNV-1a de la clé d'un bloc, d'une série ou d'un esclave
+static unsigned
+uHash (unsigned usSource, unsigned ucSlave, unsigned ucFunction,
+       uint32_t ulRef) {
+  uint32_t ulKey[4] = { usSource, ucSlave, ucFunction, ulRef };
+  const uint8_t * p = (const uint8_t *) ulKey;
+  uint32_t h = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < sizeof (ulKey); i++) {
+
+    h ^= p[i];
+    h *= 16777619u;
+  }
+  return h % MBMET_HASH_SIZE;
+}
+
+// -----------------------------------------------------------------------------
+// Valeur au format OpenMetrics : les entiers de 64 bits en entier, les
+// entiers 32 bits sont exacts avec 10 chiffres, les doubles gardent leur
+// précision
+static void
+vFormatValue (xMbMetricsValue * v) {
+  int iDigits = (uMbRecFormatWidth (v->ucFormat) == 4) ? 15 : 10;
+  double d;
+  int n;
+
+  memcpy (&d, &v->ullValue, sizeof (d));
+  if (v->ucFormat == eMbRecFormatInt64) {
+
+    n = snprintf (v->sText, sizeof (v->sText), "%" PRId64,
+                  (int64_t) v->ullValue);
+  }
+  else if (v->ucFormat == eMbRecFormatUInt64) {
+
+    n = snprintf (v->sText, sizeof (v->sText), "%" PRIu64, v->ullValue);
+  }
+  else if (isnan (d)) {
+
+    n = snprintf (v->sText, sizeof (v->sText), "NaN");
+  }
+  else if (isinf (d)) {
+
+    n = snprintf (v->sText, sizeof (v->sText), d > 0 ? "+Inf" : "-Inf");
+  }
+  else {
+
+    n = snprintf (v->sText, sizeof (v->sText), "%.*g", iDigits, d);
+  }
+  v->ucTextLen = n;
+  v->bDirty = false;
+}
+
+// -----------------------------------------------------------------------------
+// Lignes d'un bloc, seules les valeurs modifiées sont reformatées
+static void
+vRenderBlock (xMbMetricsBlock * b) {
+  char * p = b->pcText;
+  uint32_t i;
+
+  for (i = 0; i < b->ulOwned; i++) {
+    xMbMetricsValue * v = &b->pxValue[i];
+
+    if (v->bDirty) {
+      vFormatValue (v);
+    }
+    memcpy (p, v->pcPrefix, v->usPrefixLen);
+    p += v->usPrefixLen;
+    memcpy (p, v->sText, v->ucTextLen);
+    p += v->ucTextLen;
+    *p++ = '\n';
+  }
+  b->ulTextLen = p - b->pcText;
+  b->bDirty = false;
+}
+
+// -----------------------------------------------------------------------------
+// Série d'une référence, NULL si aucun bloc ne l'a encore créée
+static xMbMetricsValue *
+pxFindValue (const xMbMetricsServer * m, const xMbRecord * r, uint32_t ulRef) {
+  unsigned h = uHash (r->usSource, r->ucSlave, r->ucFunction, ulRef);
+  xMbMetricsValue * v;
+
+  for (v = m->ppxValue[h]; v; v = v->pxNext) {
+
+    if ( (v->usSource == r->usSource) && (v->ucSlave == r->ucSlave) &&
+         (v->ucFunction == r->ucFunction) && (v->ulRef == ulRef)) {
+      return v;
+    }
+  }
+  return NULL;
+}
+
+// -----------------------------------------------------------------------------
+// Libère un bloc
+static void
+vFreeBlock (xMbMetricsBlock * b) {
+
+  free (b->pxValue);
+  free (b->ppxValue);
+  free (b->pcPrefix);
+  free (b->pcText);
+  free (b);
+}
+
+// -----------------------------------------------------------------------------
+// Bloc d'une lecture, créé à sa première mise à jour. Il reprend les séries
+// des lectures qui le recouvrent et crée les autres, avec leurs étiquettes.
+static xMbMetricsBlock *
+pxBlock (xMbMetricsServer * m, const xMbRecord * r) {
+  unsigned h = uHash (r->usSource, r->ucSlave, r->ucFunction, r->ulRef);
+  unsigned uStep = uMbRecFormatWidth (r->ucFormat);
+  const char * sType = (r->ucFunction <= 4) ?
+                       sFunctionLabel[r->ucFunction] : "";
+  const char * sSource = sSourceLabel (m, r->usSource);
+  xMbMetricsBlock * b;
+  size_t ulPrefixSize = 0, ulPos = 0;
+  uint32_t i;
+
+  for (b = m->ppxBlock[h]; b; b = b->pxNext) {
+
+    if ( (b->usSource == r->usSource) && (b->ucSlave == r->ucSlave) &&
+         (b->ucFunction == r->ucFunction) && (b->ucFormat == r->ucFormat) &&
+         (b->ulRef == r->ulRef) && (b->ulCount == r->ulCount)) {
+      return b;
+    }
+  }
+
+  b = calloc (1, sizeof (xMbMetricsBlock));
+  if (b == NULL) {
+    return NULL;
+  }
+  b->usSource = r->usSource;
+  b->ucSlave = r->ucSlave;
+  b->ucFunction = r->ucFunction;
+  b->ucFormat = r->ucFormat;
+  b->ulRef = r->ulRef;
+  b->ulCount = r->ulCount;
+  b->bDirty = true;
+  b->pxValue = calloc (r->ulCount, sizeof (xMbMetricsValue));
+  b->ppxValue = calloc (r->ulCount, sizeof (xMbMetricsValue *));
+  if ( (b->pxValue == NULL) || (b->ppxValue == NULL)) {
+
+    vFreeBlock (b);
+    return NULL;
+  }
+
+  // première passe : séries existantes et taille des préfixes des autres
+  for (i = 0; i < r->ulCount; i++) {
+    uint32_t ulRef = r->ulRef + i * uStep;
+
+    b->ppxValue[i] = pxFindValue (m, r, ulRef);
+    if (b->ppxValue[i] == NULL) {
+
+      ulPrefixSize += snprintf (NULL, 0,
+                                "mbpoll_value{source=\"%s\",slave=\"%u\","
+                                "type=\"%s\",ref=\"%lu\"} ", sSource,
+                                r->ucSlave, sType,
+                                (unsigned long) ulRef) + 1;
+      b->ulOwned++;
+    }
+  }
+  b->pcPrefix = malloc (ulPrefixSize + 1);
+  b->ulTextSize = ulPrefixSize + b->ulOwned * VALUE_TEXT_MAX + 1;
+  b->pcText = malloc (b->ulTextSize);
+  if ( (b->pcPrefix == NULL) || (b->pcText == NULL)) {
+
+    vFreeBlock (b);
+    return NULL;
+  }
+  b->ulOwned = 0;
+  for (i = 0; i < r->ulCount; i++) {
+    uint32_t ulRef = r->ulRef + i * uStep;
+    xMbMetricsValue * v;
+    unsigned hv;
+    int n;
+
+    if (b->ppxValue[i]) {
+      continue;
+    }
+    v = &b->pxValue[b->ulOwned++];
+    n = snprintf (&b->pcPrefix[ulPos], ulPrefixSize - ulPos + 1,
+                  "mbpoll_value{source=\"%s\",slave=\"%u\","
+                  "type=\"%s\",ref=\"%lu\"} ", sSource, r->ucSlave, sType,
+                  (unsigned long) ulRef);
+    v->pxOwner = b;
+    v->usSource = r->usSource;
+    v->ucSlave = r->ucSlave;
+    v->ucFunction = r->ucFunction;
+    v->ulRef = ulRef;
+    v->ucFormat = r->ucFormat;
+    v->pcPrefix = &b->pcPrefix[ulPos];
+    v->usPrefixLen = n;
+    v->bDirty = true;
+    ulPos += n + 1;
+
+    hv = uHash (v->usSource, v->ucSlave, v->ucFunction, v->ulRef);
+    v->pxNext = m->ppxValue[hv];
+    m->ppxValue[hv] = v;
+    b->ppxValue[i] = v;
+  }
+
+  b->pxNext = m->ppxBlock[h];
+  m->ppxBlock[h] = b;
+  *m->ppxLastBlock = b;
+  m->ppxLastBlock = &b->pxNextOrder;
+  return b;
+}
+
+// -----------------------------------------------------------------------------
+// Compteurs d'un esclave, créés à sa première transaction
+static xMbMetricsSlave *
+pxSlave (xMbMetricsServer * m, unsigned usSource, unsigned ucSlave) {
+  unsigned h = uHash (usSource, ucSlave, 0, 0);
+  const char * sSource = sSourceLabel (m, usSource);
+  xMbMetricsSlave * s;
+  size_t ulSize;
+
+  for (s = m->ppxSlave[h]; s; s = s->pxNext) {
+
+    if ( (s->usSource == usSource) && (s->ucSlave == ucSlave)) {
+      return s;
+    }
+  }
+
+  s = calloc (1, sizeof (xMbMetricsSlave));
+  if (s == NULL) {
+    return NULL;
+  }
+  ulSize = strlen (sSource) + 32;
+  s->sLabels = malloc (ulSize);
+  if (s->sLabels == NULL) {
+
+    free (s);
+    return NULL;
+  }
+  snprintf (s->sLabels, ulSize, "source=\"%s\",slave=\"%u\"", sSource,
+            ucSlave);
+  s->usSource = usSource;
+  s->ucSlave = ucSlave;
+
+  s->pxNext = m->ppxSlave[h];
+  m->ppxSlave[h] = s;
+  *m->ppxLastSlave = s;
+  m->ppxLastSlave = &s->pxNextOrder;
+  return s;
+}
+
+// -----------------------------------------------------------------------------
+// Ajout à la page, false si la mémoire manque
+static bool
+bPageWrite (xMbMetricsServer * m, const char * pcData, size_t ulLen) {
+
+  if (m->ulPageSize - m->ulPageLen < ulLen) {
+    size_t ulSize = m->ulPageSize ? m->ulPageSize : 4096;
+    char * pcPage;
+
+    while (ulSize - m->ulPageLen < ulLen) {
+      ulSize *= 2;
+    }
+    pcPage = realloc (m->pcPage, ulSize);
+    if (pcPage == NULL) {
+      return false;
+    }
+    m->pcPage = pcPage;
+    m->ulPageSize = ulSize;
+  }
+  memcpy (&m->pcPage[m->ulPageLen], pcData, ulLen);
+  m->ulPageLen += ulLen;
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+static bool
+bPagePrintf (xMbMetricsServer * m, const char * sFormat, ...)
+__attribute__ ( (format (printf, 2, 3)));
+
+static bool
+bPagePrintf (xMbMetricsServer * m, const char * sFormat, ...) {
+  char sLine[512];
+  va_list xArgs;
+  int n;
+
+  va_start (xArgs, sFormat);
+  n = vsnprintf (sLine, sizeof (sLine), sFormat, xArgs);
+  va_end (xArgs);
+  if (n >= (int) sizeof (sLine)) {
+    n = sizeof (sLine) - 1;
+  }
+  return bPageWrite (m, sLine, n);
+}
+
+// -----------------------------------------------------------------------------
+// Limite d'une classe de l'histogramme, un réel comme l'exige OpenMetrics
+static void
+vFormatBound (char * sBuf, size_t ulSize, uint32_t ulBound) {
+
+  snprintf (sBuf, ulSize, "%g", ulBound / 1e6);
+  if (strpbrk (sBuf, ".e") == NULL) {
+
+    strncat (sBuf, ".0", ulSize - strlen (sBuf) - 1);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Construction de la page, appelée sous le verrou
+static bool
+bRenderPage (xMbMetricsServer * m) {
+  xMbMetricsBlock * b;
+  const xMbMetricsSlave * s;
+  bool bOk = true;
+  int i;
+
+  m->ulPageLen = 0;
+  bOk &= bPagePrintf (m, "# TYPE mbpoll_value gauge\n"
+                      "# HELP mbpoll_value Last value read.\n");
+  for (b = m->pxFirstBlock; b; b = b->pxNextOrder) {
+
+    if (b->bDirty) {
+      vRenderBlock (b);
+    }
+    bOk &= bPageWrite (m, b->pcText, b->ulTextLen);
+  }
+
+  bOk &= bPagePrintf (m, "# TYPE mbpoll_up gauge\n"
+                      "# HELP mbpoll_up Whether the last transaction with the "
+                      "slave succeeded.\n");
+  for (s = m->pxFirstSlave; s; s = s->pxNextOrder) {
+    bOk &= bPagePrintf (m, "mbpoll_up{%s} %d\n", s->sLabels, s->bUp);
+  }
+  bOk &= bPagePrintf (m, "# TYPE mbpoll_transactions counter\n"
+                      "# HELP mbpoll_transactions Requests sent to the "
+                      "slave.\n");
+  for (s = m->pxFirstSlave; s; s = s->pxNextOrder) {
+    bOk &= bPagePrintf (m, "mbpoll_transactions_total{%s} %lu\n", s->sLabels,
+                        s->ulTxCount);
+  }
+  bOk &= bPagePrintf (m, "# TYPE mbpoll_errors counter\n"
+                      "# HELP mbpoll_errors Requests that failed.\n");
+  for (s = m->pxFirstSlave; s; s = s->pxNextOrder) {
+    bOk &= bPagePrintf (m, "mbpoll_errors_total{%s} %lu\n", s->sLabels,
+                        s->ulErrorCount);
+  }
+  bOk &= bPagePrintf (m, "# TYPE mbpoll_latency_seconds histogram\n"
+                      "# UNIT mbpoll_latency_seconds seconds\n"
+                      "# HELP mbpoll_latency_seconds Response time of the "
+                      "slave.\n");
+  for (s = m->pxFirstSlave; s; s = s->pxNextOrder) {
+    uint64_t ullCount = 0;
+
+    for (i = 0; i < MBMET_BUCKETS - 1; i++) {
+      char sBound[32];
+
+      ullCount += s->ullBucket[i];
+      vFormatBound (sBound, sizeof (sBound), ulLatencyBound[i]);
+      bOk &= bPagePrintf (m, "mbpoll_latency_seconds_bucket{%s,le=\"%s\"} "
+                          "%llu\n", s->sLabels, sBound,
+                          (unsigned long long) ullCount);
+    }
+    ullCount += s->ullBucket[MBMET_BUCKETS - 1];
+    bOk &= bPagePrintf (m, "mbpoll_latency_seconds_bucket{%s,le=\"+Inf\"} "
+                        "%llu\n", s->sLabels, (unsigned long long) ullCount);
+    bOk &= bPagePrintf (m, "mbpoll_latency_seconds_count{%s} %llu\n",
+                        s->sLabels, (unsigned long long) ullCount);
+    bOk &= bPagePrintf (m, "mbpoll_latency_seconds_sum{%s} %.9g\n",
+                        s->sLabels, s->ullLatencySum / 1e9);
+  }
+  bOk &= bPagePrintf (m, "# EOF\n");
+  return bOk;
+}
+
+// -----------------------------------------------------------------------------
+// Envoi complet, false si le client est perdu
+static bool
+bSendAll (int iFd, const char * pcData, size_t ulLen) {
+
+  while (ulLen > 0) {
+    ssize_t n = send (iFd, pcData, ulLen, MSG_NOSIGNAL);
+
+    if (n < 0) {
+
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    pcData += n;
+    ulLen -= n;
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// Réponse HTTP/1.1 sans maintien de la connexion
+static void
+vReply (int iFd, const char * sStatus, const char * sType, const char * pcBody,
+        size_t ulLen) {
+  char sHeader[256];
+  int n = snprintf (sHeader, sizeof (sHeader),
+                    "HTTP/1.1 %s\r\n"
+                    "Content-Type: %s\r\n"
+                    "Content-Length: %lu\r\n"
+                    "Connection: close\r\n\r\n", sStatus, sType,
+                    (unsigned long) ulLen);
+
+  if (bSendAll (iFd, sHeader, n)) {
+    bSendAll (iFd, pcBody, ulLen);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Traitement d'une connexion : GET /metrics (ou /) seulement
+static void
+vServe (xMbMetricsServer * m, int iFd) {
+  struct timeval xTimeout = { CLIENT_TIMEOUT_S, 0 };
+  char sReq[REQUEST_MAX + 1];
+  size_t ulLen = 0;
+  char * sPath, * sEnd;
+  int iFlags = fcntl (iFd, F_GETFL, 0);
+
+  // le descripteur accepté peut hériter de O_NONBLOCK
+  if (iFlags >= 0) {
+    fcntl (iFd, F_SETFL, iFlags & ~O_NONBLOCK);
+  }
+  setsockopt (iFd, SOL_SOCKET, SO_RCVTIMEO, &xTimeout, sizeof (xTimeout));
+  setsockopt (iFd, SOL_SOCKET, SO_SNDTIMEO, &xTimeout, sizeof (xTimeout));
+#ifdef SO_NOSIGPIPE
+  {
+    int iOn = 1;
+
+    setsockopt (iFd, SOL_SOCKET, SO_NOSIGPIPE, &iOn, sizeof (iOn));
+  }
+#endif
+
+  // seule la ligne de requête est utile, les en-têtes sont lus puis ignorés
+  for (;;) {
+    ssize_t n = recv (iFd, &sReq[ulLen], REQUEST_MAX - ulLen, 0);
+
+    if (n < 0) {
+
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if (n == 0) {
+      return;
+    }
+    ulLen += n;
+    sReq[ulLen] = 0;
+    if ( (strstr (sReq, "\r\n\r\n")) || (strstr (sReq, "\n\n"))) {
+      break;
+    }
+    if (ulLen == REQUEST_MAX) {
+
+      vReply (iFd, "431 Request Header Fields Too Large", "text/plain", "", 0);
+      return;
+    }
+  }
+
+  if (strncmp (sReq, "GET ", 4) != 0) {
+
+    vReply (iFd, "405 Method Not Allowed", "text/plain", "", 0);
+    return;
+  }
+  sPath = &sReq[4];
+  sEnd = strpbrk (sPath, " ?\r\n");
+  if (sEnd) {
+    *sEnd = 0;
+  }
+  if ( (strcmp (sPath, "/metrics") != 0) && (strcmp (sPath, "/") != 0)) {
+
+    vReply (iFd, "404 Not Found", "text/plain", "", 0);
+    return;
+  }
+
+  // la page n'est utilisée que par ce thread, elle est envoyée sans le verrou
+  pthread_mutex_lock (&m->xLock);
+  if (!bRenderPage (m)) {
+
+    pthread_mutex_unlock (&m->xLock);
+    vReply (iFd, "500 Internal Server Error", "text/plain", "", 0);
+    return;
+  }
+  m->ulScrapes++;
+  pthread_mutex_unlock (&m->xLock);
+  vReply (iFd, "200 OK", MBMET_CONTENT_TYPE, m->pcPage, m->ulPageLen);
+}
+
+// -----------------------------------------------------------------------------
+// Thread du serveur : une connexion à la fois
+static void *
+pvServerThread (void * pvArg) {
+  xMbMetricsServer * m = (xMbMetricsServer *) pvArg;
+
+  for (;;) {
+    struct pollfd xFd[2] = {
+      { .fd = m->iWakeFd[0], .events = POLLIN },
+      { .fd = m->iListenFd, .events = POLLIN }
+    };
+    int iFd;
+
+    if (poll (xFd, 2, -1) < 0) {
+      continue;
+    }
+    if (xFd[0].revents) {
+      break;
+    }
+    iFd = accept (m->iListenFd, NULL, NULL);
+    if (iFd >= 0) {
+
+      vServe (m, iFd);
+      close (iFd);
+    }
+  }
+  return NULL;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iMbMetricsCreate (xMbMetricsServer * m, const char * sHost,
+                  const char * sPort, const void * pvStreamHeader,
+                  size_t ulStreamHeaderSize) {
+  const uint8_t * pucHeader = (const uint8_t *) pvStreamHeader;
+  uint16_t usHeaderSize, usRecordHeaderSize, usSourceCount;
+  struct addrinfo xHints, * xAddr = NULL;
+  size_t ulPos;
+  int i, iErr, iOn = 1;
+
+  memset (m, 0, sizeof (*m));
+  m->iListenFd = m->iWakeFd[0] = m->iWakeFd[1] = -1;
+  m->ppxLastBlock = &m->pxFirstBlock;
+  m->ppxLastSlave = &m->pxFirstSlave;
+
+  // les noms des sources sont ceux de la table de l'en-tête de flux
+  if ( (ulStreamHeaderSize < MBREC_STREAM_HEADER_SIZE) ||
+       (iMbRecStreamHeaderDecode (pucHeader, &usHeaderSize,
+                                  &usRecordHeaderSize, &usSourceCount) != 0)) {
+
+    errno = EINVAL;
+    return -1;
+  }
+  m->psSource = calloc (usSourceCount + 1, sizeof (char *));
+  m->ppxBlock = calloc (MBMET_HASH_SIZE, sizeof (xMbMetricsBlock *));
+  m->ppxValue = calloc (MBMET_HASH_SIZE, sizeof (xMbMetricsValue *));
+  m->ppxSlave = calloc (MBMET_HASH_SIZE, sizeof (xMbMetricsSlave *));
+  if ( (m->psSource == NULL) || (m->ppxBlock == NULL) ||
+       (m->ppxValue == NULL) || (m->ppxSlave == NULL)) {
+
+    errno = ENOMEM;
+    goto error;
+  }
+  ulPos = usHeaderSize;
+  for (i = 0; i < usSourceCount; i++) {
+    uint16_t usLen;
+
+    if (ulPos + 2 > ulStreamHeaderSize) {
+      break;
+    }
+    usLen = usMbRecGet16 (&pucHeader[ulPos]);
+    if (ulPos + 2 + usLen > ulStreamHeaderSize) {
+      break;
+    }
+    m->psSource[i] = sEscapeLabel ( (const char *) &pucHeader[ulPos + 2],
+                                    usLen);
+    if (m->psSource[i] == NULL) {
+
+      errno = ENOMEM;
+      goto error;
+    }
+    m->iSourceCount++;
+    ulPos += 2 + usLen;
+  }
+
+  memset (&xHints, 0, sizeof (xHints));
+  xHints.ai_family = AF_UNSPEC;
+  xHints.ai_socktype = SOCK_STREAM;
+  xHints.ai_flags = AI_PASSIVE;
+  iErr = getaddrinfo (sHost, sPort, &xHints, &xAddr);
+  if (iErr != 0) {
+
+    errno = (iErr == EAI_SYSTEM) ? errno : EADDRNOTAVAIL;
+    goto error;
+  }
+  m->iListenFd = socket (xAddr->ai_family, xAddr->ai_socktype,
+                         xAddr->ai_protocol);
+  if (m->iListenFd >= 0) {
+    setsockopt (m->iListenFd, SOL_SOCKET, SO_REUSEADDR, &iOn, sizeof (iOn));
+  }
+  if ( (m->iListenFd < 0) ||
+       (bind (m->iListenFd, xAddr->ai_addr, xAddr->ai_addrlen) != 0) ||
+       (listen (m->iListenFd, LISTEN_BACKLOG) != 0) ||
+       (pipe (m->iWakeFd) != 0)) {
+    goto error;
+  }
+  freeaddrinfo (xAddr);
+  xAddr = NULL;
+
+  pthread_mutex_init (&m->xLock, NULL);
+  iErr = pthread_create (&m->xThread, NULL, pvServerThread, m);
+  if (iErr != 0) {
+
+    pthread_mutex_destroy (&m->xLock);
+    errno = iErr;
+    goto error;
+  }
+  return 0;
+
+error:
+  iErr = errno;
+  if (xAddr) {
+    freeaddrinfo (xAddr);
+  }
+  if (m->iListenFd >= 0) {
+    close (m->iListenFd);
+  }
+  if (m->iWakeFd[0] >= 0) {
+
+    close (m->iWakeFd[0]);
+    close (m->iWakeFd[1]);
+  }
+  if (m->psSource) {
+
+    for (i = 0; i < m->iSourceCount; i++) {
+      free (m->psSource[i]);
+    }
+  }
+  free (m->psSource);
+  free (m->ppxBlock);
+  free (m->ppxValue);
+  free (m->ppxSlave);
+  errno = iErr;
+  return -1;
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbMetricsUpdate (xMbMetricsServer * m, const xMbRecord * r,
+                  const uint64_t * pullValue) {
+  xMbMetricsBlock * b;
+  uint32_t i;
+
+  pthread_mutex_lock (&m->xLock);
+  b = pxBlock (m, r);
+  if (b) {
+
+    for (i = 0; i < r->ulCount; i++) {
+      xMbMetricsValue * v = b->ppxValue[i];
+
+      // NaN n'est égal à rien, les bits sont comparés
+      if ( (v->ullValue != pullValue[i]) || (v->ucFormat != r->ucFormat)) {
+
+        v->ullValue = pullValue[i];
+        v->ucFormat = r->ucFormat;
+        v->bDirty = true;
+        v->pxOwner->bDirty = true;
+      }
+    }
+  }
+  pthread_mutex_unlock (&m->xLock);
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbMetricsTransaction (xMbMetricsServer * m, unsigned usSource,
+                       unsigned ucSlave, bool bOk, uint64_t ullLatency) {
+  xMbMetricsSlave * s;
+
+  pthread_mutex_lock (&m->xLock);
+  s = pxSlave (m, usSource, ucSlave);
+  if (s) {
+
+    s->ulTxCount++;
+    if (!bOk) {
+      s->ulErrorCount++;
+    }
+    s->bUp = bOk;
+    if (ullLatency > 0) {
+      int i;
+
+      for (i = 0; (i < MBMET_BUCKETS - 1) &&
+           (ullLatency > ulLatencyBound[i] * 1000ULL); i++) {
+      }
+      s->ullBucket[i]++;
+      s->ullLatencySum += ullLatency;
+    }
+  }
+  pthread_mutex_unlock (&m->xLock);
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbMetricsDelete (xMbMetricsServer * m) {
+  xMbMetricsBlock * b;
+  xMbMetricsSlave * s;
+  char c = 0;
+  int i;
+
+  if (write (m->iWakeFd[1], &c, 1) < 0) {
+    // le thread du serveur ne peut plus être réveillé
+  }
+  pthread_join (m->xThread, NULL);
+
+  close (m->iListenFd);
+  close (m->iWakeFd[0]);
+  close (m->iWakeFd[1]);
+  while ( (b = m->pxFirstBlock)) {
+
+    m->pxFirstBlock = b->pxNextOrder;
+    vFreeBlock (b);
+  }
+  while ( (s = m->pxFirstSlave)) {
+
+    m->pxFirstSlave = s->pxNextOrder;
+    free (s->sLabels);
+    free (s);
+  }
+  for (i = 0; i < m->iSourceCount; i++) {
+    free (m->psSource[i]);
+  }
+  free (m->psSource);
+  free (m->ppxBlock);
+  free (m->ppxValue);
+  free (m->ppxSlave);
+  free (m->pcPage);
+  pthread_mutex_destroy (&m->xLock);
+}
+
+#endif /* MBPOLL_METRICS defined */
+/* ========================================================================== */
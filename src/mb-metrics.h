@@ -0,0 +1,188 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_MB_METRICS_H_
+#define _MBPOLL_MB_METRICS_H_
+
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#define MBPOLL_METRICS
+#endif
+
+#ifdef MBPOLL_METRICS
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "mb-record.h"
+
+/* constants ================================================================ */
+/*
+ * Point d'accès HTTP de --metrics, au format texte OpenMetrics :
+ *   mbpoll_value{source,slave,type,ref}             dernière valeur lue
+ *   mbpoll_up{source,slave}                         1 si la dernière
+ *                                                   transaction a réussi
+ *   mbpoll_transactions_total{source,slave}         requêtes transmises
+ *   mbpoll_errors_total{source,slave}               requêtes en échec
+ *   mbpoll_latency_seconds{source,slave}            histogramme des délais
+ *                                                   de réponse
+ *
+ * Le rendu est incrémental : les étiquettes d'une série sont construites à
+ * sa création, le texte d'une valeur n'est reconstruit que si elle a changé,
+ * celui d'un bloc que si l'une de ses valeurs a changé. Une lecture de la
+ * page ne fait alors que recopier les blocs.
+ */
+#define MBMET_CONTENT_TYPE \
+  "application/openmetrics-text; version=1.0.0; charset=utf-8"
+// limites des classes de l'histogramme des délais en µs, +Inf en plus
+#define MBMET_LATENCY_BOUNDS \
+  1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, \
+  2500000
+#define MBMET_BUCKETS 12
+#define MBMET_HASH_SIZE 1024
+
+/* structures =============================================================== */
+/**
+ * Série d'une valeur (source, esclave, type de données et référence)
+ *
+ * Une série n'existe qu'une fois, même si plusieurs lectures se
+ * recouvrent : elle est affichée par le bloc qui l'a créée et mise à jour par
+ * tous ceux qui la lisent, la dernière lecture l'emporte.
+ */
+typedef struct xMbMetricsValue {
+  struct xMbMetricsValue * pxNext; /**< Série suivante de la même alvéole */
+  struct xMbMetricsBlock * pxOwner; /**< Bloc qui affiche la série */
+  uint16_t usSource;
+  uint8_t ucSlave;
+  uint8_t ucFunction;
+  uint32_t ulRef;
+  uint64_t ullValue; /**< Valeur sur 64 bits (vMbMetricsUpdate()) */
+  const char * pcPrefix; /**< Nom et étiquettes suivis d'un espace */
+  uint16_t usPrefixLen;
+  uint8_t ucFormat; /**< Format de la dernière lecture (eMbRecFormat) */
+  uint8_t ucTextLen;
+  bool bDirty; /**< Texte à reconstruire */
+  char sText[30]; /**< Valeur au format OpenMetrics */
+} xMbMetricsValue;
+
+/**
+ * Plage lue (source, esclave, type de données, format et références)
+ */
+typedef struct xMbMetricsBlock {
+  struct xMbMetricsBlock * pxNext; /**< Bloc suivant de la même alvéole */
+  struct xMbMetricsBlock * pxNextOrder; /**< Bloc suivant dans la page */
+  uint16_t usSource;
+  uint8_t ucSlave;
+  uint8_t ucFunction;
+  uint8_t ucFormat; /**< Format des valeurs (eMbRecFormat) */
+  uint32_t ulRef;
+  uint32_t ulCount;
+  bool bDirty; /**< Texte du bloc à reconstruire */
+  char * pcPrefix; /**< Préfixes des séries créées par le bloc */
+  char * pcText; /**< Lignes du bloc */
+  size_t ulTextLen;
+  size_t ulTextSize;
+  xMbMetricsValue * pxValue; /**< Séries créées par le bloc */
+  uint32_t ulOwned; /**< Nombre de séries créées par le bloc */
+  xMbMetricsValue ** ppxValue; /**< Série de chacune des ulCount valeurs */
+} xMbMetricsBlock;
+
+/**
+ * Compteurs d'un esclave
+ */
+typedef struct xMbMetricsSlave {
+  struct xMbMetricsSlave * pxNext; /**< Esclave suivant de la même alvéole */
+  struct xMbMetricsSlave * pxNextOrder;
+  uint16_t usSource;
+  uint8_t ucSlave;
+  bool bUp;
+  char * sLabels; /**< source="...",slave="..." */
+  unsigned long ulTxCount;
+  unsigned long ulErrorCount;
+  uint64_t ullBucket[MBMET_BUCKETS]; /**< Réponses par classe de délai */
+  uint64_t ullLatencySum; /**< Somme des délais en ns */
+} xMbMetricsSlave;
+
+/**
+ * Serveur
+ *
+ * Les threads de scrutation mettent les séries à jour sous xLock, le thread
+ * du serveur construit la page sous xLock et l'envoie sans le verrou.
+ */
+typedef struct xMbMetricsServer {
+  int iListenFd;
+  int iWakeFd[2]; /**< Tube qui arrête le thread du serveur */
+  char ** psSource; /**< Noms des sources, étiquettes échappées */
+  int iSourceCount;
+  xMbMetricsBlock ** ppxBlock; /**< Alvéoles des blocs */
+  xMbMetricsValue ** ppxValue; /**< Alvéoles des séries */
+  xMbMetricsBlock * pxFirstBlock;
+  xMbMetricsBlock ** ppxLastBlock;
+  xMbMetricsSlave ** ppxSlave; /**< Alvéoles des esclaves */
+  xMbMetricsSlave * pxFirstSlave;
+  xMbMetricsSlave ** ppxLastSlave;
+  char * pcPage; /**< Dernière page construite */
+  size_t ulPageLen;
+  size_t ulPageSize;
+  unsigned long ulScrapes; /**< Pages servies */
+  pthread_mutex_t xLock;
+  pthread_t xThread;
+} xMbMetricsServer;
+
+/* internal public functions ================================================ */
+
+/**
+ * Ouvre le point d'accès et démarre le thread du serveur
+ *
+ * @param sHost adresse d'écoute, par exemple "127.0.0.1"
+ * @param sPort port TCP
+ * @param pvStreamHeader en-tête de flux et table des sources (mb-record.h),
+ * les noms des sources sont les valeurs de l'étiquette source
+ * @return 0, -1 si erreur (errno)
+ */
+int iMbMetricsCreate (xMbMetricsServer * m, const char * sHost,
+                      const char * sPort, const void * pvStreamHeader,
+                      size_t ulStreamHeaderSize);
+
+/**
+ * Met à jour les valeurs d'une lecture réussie
+ *
+ * @param r source, esclave, type de données, format, référence et nombre de
+ * valeurs. Une valeur de 32 ou 64 bits occupe 2 ou 4 références.
+ * @param pullValue les r->ulCount valeurs sur 64 bits : l'entier pour les
+ * formats int64 et uint64, affiché exactement, les bits du double décodé sinon
+ */
+void vMbMetricsUpdate (xMbMetricsServer * m, const xMbRecord * r,
+                       const uint64_t * pullValue);
+
+/**
+ * Compte une transaction avec un esclave
+ *
+ * @param ullLatency délai de réponse en ns, 0 si aucune réponse n'est
+ * parvenue (il n'entre pas dans l'histogramme)
+ */
+void vMbMetricsTransaction (xMbMetricsServer * m, unsigned usSource,
+                            unsigned ucSlave, bool bOk, uint64_t ullLatency);
+
+/**
+ * Ferme le point d'accès et arrête le thread du serveur
+ *
+ * Les threads qui mettent à jour doivent être terminés, le serveur ne doit
+ * plus être utilisé.
+ */
+void vMbMetricsDelete (xMbMetricsServer * m);
+
+#endif /* MBPOLL_METRICS defined */
+/* ========================================================================== */
+#endif /* _MBPOLL_MB_METRICS_H_ */
@@ -0,0 +1,574 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mb-pub.h"
+
+#ifdef MBPOLL_PUB
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* constants ================================================================ */
+#define LISTEN_BACKLOG 16
+
+// une déconnexion du client ne doit pas envoyer SIGPIPE à mbpoll
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+static int
+iSetNonBlocking (int iFd) {
+  int iFlags = fcntl (iFd, F_GETFL, 0);
+
+  if (iFlags < 0) {
+    return -1;
+  }
+  return fcntl (iFd, F_SETFL, iFlags | O_NONBLOCK);
+}
+
+// -----------------------------------------------------------------------------
+// Réveil du thread du serveur, un octet suffit s'il en reste un dans le tube
+static void
+vWake (xMbPubServer * s) {
+  char c = 0;
+
+  if (write (s->iWakeFd[1], &c, 1) < 0) {
+    // tube plein : le thread du serveur sera réveillé de toutes façons
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Envoi d'une partie de ulLen octets sans attendre
+// retourne le nombre d'octets envoyés, -1 si le client est perdu
+static long
+lSend (xMbPubClient * c, const uint8_t * pucData, size_t ulLen) {
+  size_t ulSent = 0;
+
+  while (ulSent < ulLen) {
+    ssize_t n = send (c->iFd, &pucData[ulSent], ulLen - ulSent,
+                      MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if (n < 0) {
+
+      if (errno == EINTR) {
+        continue;
+      }
+      if ( (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        break;
+      }
+      return -1;
+    }
+    ulSent += n;
+  }
+  return ulSent;
+}
+
+// -----------------------------------------------------------------------------
+// Envoi de la file d'un client
+static void
+vFlush (xMbPubClient * c) {
+  long n = lSend (c, &c->pucQueue[c->ulSent], c->ulLen - c->ulSent);
+
+  if (n < 0) {
+
+    c->bClosing = true;
+    return;
+  }
+  c->ulSent += n;
+  if (c->ulSent == c->ulLen) {
+
+    c->ulSent = c->ulLen = 0;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Envoi de ulLen octets à un client, directement si sa file est vide, sinon
+// à la suite de sa file. Le client est déconnecté si sa file déborde.
+// retourne true s'il faut réveiller le thread du serveur
+static bool
+bEnqueue (xMbPubServer * s, xMbPubClient * c, const uint8_t * pucData,
+          size_t ulLen) {
+
+  if (c->ulLen == 0) {
+    long n = lSend (c, pucData, ulLen);
+
+    if (n < 0) {
+
+      c->bClosing = true;
+      return true;
+    }
+    pucData += n;
+    ulLen -= n;
+    if (ulLen == 0) {
+      return false;
+    }
+  }
+
+  if (s->ulQueueSize - c->ulLen < ulLen) {
+
+    // les octets déjà envoyés libèrent le début de la file
+    memmove (c->pucQueue, &c->pucQueue[c->ulSent], c->ulLen - c->ulSent);
+    c->ulLen -= c->ulSent;
+    c->ulSent = 0;
+  }
+  if (s->ulQueueSize - c->ulLen < ulLen) {
+
+    // client trop lent : il ne reçoit plus rien et sera déconnecté
+    c->bClosing = true;
+    s->ulEvicted++;
+    return true;
+  }
+  memcpy (&c->pucQueue[c->ulLen], pucData, ulLen);
+  c->ulLen += ulLen;
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// Lecture d'une référence ou d'un esclave, false si la chaîne est incorrecte
+static bool
+bParseUint (const char * s, unsigned long ulMax, unsigned long * pulValue) {
+  char * pcEnd;
+
+  if ( (*s < '0') || (*s > '9')) {
+    return false;
+  }
+  errno = 0;
+  *pulValue = strtoul (s, &pcEnd, 10);
+  return (errno == 0) && (*pcEnd == 0) && (*pulValue <= ulMax);
+}
+
+// -----------------------------------------------------------------------------
+// Exécution d'une commande reçue d'un client
+static void
+vCommand (xMbPubClient * c, char * sLine) {
+  char * sSave = NULL;
+  char * sCmd = strtok_r (sLine, " \t\r", &sSave);
+  char * sSlave, * sRange, * sLast;
+  unsigned long ulSlave, ulFirst = 0, ulLast = UINT32_MAX;
+  xMbPubSub * p;
+
+  if (sCmd == NULL) {
+    return;
+  }
+  if (strcmp (sCmd, "unsub") == 0) {
+
+    c->iSubCount = 0;
+    return;
+  }
+  if ( (strcmp (sCmd, "sub") != 0) || (c->iSubCount >= MBPUB_SUB_MAX)) {
+    return;
+  }
+
+  sSlave = strtok_r (NULL, " \t\r", &sSave);
+  sRange = strtok_r (NULL, " \t\r", &sSave);
+  if ( (sSlave == NULL) || (strtok_r (NULL, " \t\r", &sSave) != NULL)) {
+    return;
+  }
+  if (strcmp (sSlave, "*") != 0) {
+
+    if (!bParseUint (sSlave, 255, &ulSlave)) {
+      return;
+    }
+  }
+  if (sRange) {
+
+    sLast = strchr (sRange, '-');
+    if (sLast) {
+      *sLast++ = 0;
+    }
+    if (!bParseUint (sRange, UINT32_MAX, &ulFirst)) {
+      return;
+    }
+    ulLast = ulFirst;
+    if ( (sLast) && ( (!bParseUint (sLast, UINT32_MAX, &ulLast)) ||
+                      (ulLast < ulFirst))) {
+      return;
+    }
+  }
+
+  p = &c->xSub[c->iSubCount++];
+  p->iSlave = (strcmp (sSlave, "*") == 0) ? -1 : (int) ulSlave;
+  p->ulFirst = ulFirst;
+  p->ulLast = ulLast;
+}
+
+// -----------------------------------------------------------------------------
+// Réception des commandes d'un client, une ligne par commande
+static void
+vReceive (xMbPubClient * c) {
+  char cBuf[256];
+  ssize_t n = recv (c->iFd, cBuf, sizeof (cBuf), MSG_DONTWAIT);
+  ssize_t i;
+
+  if (n < 0) {
+
+    if ( (errno != EINTR) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+      c->bClosing = true;
+    }
+    return;
+  }
+  if (n == 0) {
+
+    // le client s'est déconnecté
+    c->bClosing = true;
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+
+    if (cBuf[i] == '\n') {
+
+      c->sLine[c->ulLineLen] = 0;
+      vCommand (c, c->sLine);
+      c->ulLineLen = 0;
+    }
+    else if (c->ulLineLen < sizeof (c->sLine) - 1) {
+
+      c->sLine[c->ulLineLen++] = cBuf[i];
+    }
+    // une ligne trop longue est tronquée
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Nouveaux clients, ils reçoivent d'abord l'en-tête de flux
+static void
+vAccept (xMbPubServer * s) {
+
+  while (s->iClientCount < MBPUB_CLIENT_MAX) {
+    xMbPubClient * c;
+    int iFd = accept (s->iListenFd, NULL, NULL);
+
+    if (iFd < 0) {
+      return;
+    }
+    c = calloc (1, sizeof (xMbPubClient));
+    if (c) {
+      c->pucQueue = malloc (s->ulQueueSize);
+    }
+    if ( (c == NULL) || (c->pucQueue == NULL) ||
+         (iSetNonBlocking (iFd) != 0)) {
+
+      free (c ? c->pucQueue : NULL);
+      free (c);
+      close (iFd);
+      continue;
+    }
+#ifdef SO_NOSIGPIPE
+    {
+      int iOn = 1;
+
+      setsockopt (iFd, SOL_SOCKET, SO_NOSIGPIPE, &iOn, sizeof (iOn));
+    }
+#endif
+    c->iFd = iFd;
+    c->pxNext = s->pxClient;
+    s->pxClient = c;
+    s->iClientCount++;
+    s->ulAccepted++;
+    bEnqueue (s, c, s->pucStreamHeader, s->ulStreamHeaderSize);
+  }
+}
+
+// -----------------------------------------------------------------------------
+static void
+vClientFree (xMbPubClient * c) {
+
+  close (c->iFd);
+  free (c->pucQueue);
+  free (c);
+}
+
+// -----------------------------------------------------------------------------
+// Thread du serveur : la liste des descripteurs est reconstruite à chaque tour
+// sous le verrou, seul ce thread libère les clients
+static void *
+pvServerThread (void * pvArg) {
+  xMbPubServer * s = (xMbPubServer *) pvArg;
+  struct pollfd xFd[2 + MBPUB_CLIENT_MAX];
+  xMbPubClient * pxPoll[MBPUB_CLIENT_MAX];
+
+  for (;;) {
+    xMbPubClient ** ppx;
+    int i, n = 0;
+
+    pthread_mutex_lock (&s->xLock);
+    if (s->bStop) {
+
+      pthread_mutex_unlock (&s->xLock);
+      break;
+    }
+    for (ppx = &s->pxClient; *ppx;) {
+      xMbPubClient * c = *ppx;
+
+      if (c->bClosing) {
+
+        *ppx = c->pxNext;
+        vClientFree (c);
+        s->iClientCount--;
+        continue;
+      }
+      xFd[2 + n].fd = c->iFd;
+      xFd[2 + n].events = POLLIN | ( (c->ulLen > c->ulSent) ? POLLOUT : 0);
+      pxPoll[n++] = c;
+      ppx = &c->pxNext;
+    }
+    xFd[0].fd = s->iWakeFd[0];
+    xFd[0].events = POLLIN;
+    // au-delà de MBPUB_CLIENT_MAX, les connexions attendent dans la file
+    xFd[1].fd = (s->iClientCount < MBPUB_CLIENT_MAX) ? s->iListenFd : -1;
+    xFd[1].events = POLLIN;
+    pthread_mutex_unlock (&s->xLock);
+
+    if (poll (xFd, 2 + n, -1) < 0) {
+      continue;
+    }
+
+    pthread_mutex_lock (&s->xLock);
+    if (xFd[0].revents) {
+      char cBuf[64];
+
+      while (read (s->iWakeFd[0], cBuf, sizeof (cBuf)) > 0) {
+      }
+    }
+    for (i = 0; i < n; i++) {
+      xMbPubClient * c = pxPoll[i];
+
+      if ( (!c->bClosing) && (xFd[2 + i].revents & (POLLIN | POLLHUP | POLLERR))) {
+        vReceive (c);
+      }
+      if ( (!c->bClosing) && (xFd[2 + i].revents & POLLOUT)) {
+        vFlush (c);
+      }
+    }
+    if (xFd[1].revents & POLLIN) {
+      vAccept (s);
+    }
+    pthread_mutex_unlock (&s->xLock);
+  }
+  return NULL;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iMbPubCreate (xMbPubServer * s, const char * sPath, size_t ulQueueSize,
+              const void * pvStreamHeader, size_t ulStreamHeaderSize) {
+  struct sockaddr_un xAddr;
+  int iErr;
+
+  memset (s, 0, sizeof (*s));
+  s->iListenFd = s->iWakeFd[0] = s->iWakeFd[1] = -1;
+  if (strlen (sPath) >= sizeof (xAddr.sun_path)) {
+
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset (&xAddr, 0, sizeof (xAddr));
+  xAddr.sun_family = AF_UNIX;
+  strcpy (xAddr.sun_path, sPath);
+
+  s->sPath = strdup (sPath);
+  s->pucStreamHeader = malloc (ulStreamHeaderSize);
+  s->ulQueueSize = ulQueueSize;
+  s->ulStreamHeaderSize = ulStreamHeaderSize;
+  if ( (s->sPath == NULL) || (s->pucStreamHeader == NULL)) {
+
+    errno = ENOMEM;
+    goto error;
+  }
+  memcpy (s->pucStreamHeader, pvStreamHeader, ulStreamHeaderSize);
+
+  // une socket laissée par une exécution précédente est remplacée
+  unlink (sPath);
+  s->iListenFd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if ( (s->iListenFd < 0) ||
+       (bind (s->iListenFd, (struct sockaddr *) &xAddr, sizeof (xAddr)) != 0) ||
+       (listen (s->iListenFd, LISTEN_BACKLOG) != 0) ||
+       (iSetNonBlocking (s->iListenFd) != 0) ||
+       (pipe (s->iWakeFd) != 0) ||
+       (iSetNonBlocking (s->iWakeFd[0]) != 0) ||
+       (iSetNonBlocking (s->iWakeFd[1]) != 0)) {
+    goto error;
+  }
+
+  pthread_mutex_init (&s->xLock, NULL);
+  iErr = pthread_create (&s->xThread, NULL, pvServerThread, s);
+  if (iErr != 0) {
+
+    pthread_mutex_destroy (&s->xLock);
+    errno = iErr;
+    goto error;
+  }
+  return 0;
+
+error:
+  iErr = errno;
+  if (s->iListenFd >= 0) {
+
+    close (s->iListenFd);
+    unlink (sPath);
+  }
+  if (s->iWakeFd[0] >= 0) {
+
+    close (s->iWakeFd[0]);
+    close (s->iWakeFd[1]);
+  }
+  free (s->pucStreamHeader);
+  free (s->sPath);
+  errno = iErr;
+  return -1;
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbPubPublish (xMbPubServer * s, const void * pvRecord, size_t ulLen) {
+  xMbRecord r;
+  uint32_t ulLast;
+  xMbPubClient * c;
+  bool bWake = false;
+
+  vMbRecHeaderDecode (pvRecord, &r);
+  // une lecture en erreur n'a pas d'éléments, elle couvre ses valeurs
+  ulLast = r.ulRef + ( (r.ulElements > 0) ? r.ulElements : r.ulCount);
+  if (ulLast > r.ulRef) {
+    ulLast--;
+  }
+
+  pthread_mutex_lock (&s->xLock);
+  for (c = s->pxClient; c; c = c->pxNext) {
+    int i;
+
+    if (c->bClosing) {
+      continue;
+    }
+    for (i = 0; i < c->iSubCount; i++) {
+      const xMbPubSub * p = &c->xSub[i];
+
+      if ( ( (p->iSlave < 0) || (p->iSlave == r.ucSlave)) &&
+           (p->ulFirst <= ulLast) && (p->ulLast >= r.ulRef)) {
+
+        bWake |= bEnqueue (s, c, pvRecord, ulLen);
+        s->ulRecords++;
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock (&s->xLock);
+
+  if (bWake) {
+    vWake (s);
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbPubDelete (xMbPubServer * s) {
+  xMbPubClient * c;
+
+  pthread_mutex_lock (&s->xLock);
+  s->bStop = true;
+  pthread_mutex_unlock (&s->xLock);
+  vWake (s);
+  pthread_join (s->xThread, NULL);
+
+  while ( (c = s->pxClient)) {
+
+    s->pxClient = c->pxNext;
+    vClientFree (c);
+  }
+  s->iClientCount = 0;
+  close (s->iListenFd);
+  close (s->iWakeFd[0]);
+  close (s->iWakeFd[1]);
+  unlink (s->sPath);
+  free (s->pucStreamHeader);
+  free (s->sPath);
+  s->sPath = NULL;
+  pthread_mutex_destroy (&s->xLock);
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbPubConnect (const char * sPath) {
+  struct sockaddr_un xAddr;
+  int iFd;
+
+  if (strlen (sPath) >= sizeof (xAddr.sun_path)) {
+
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset (&xAddr, 0, sizeof (xAddr));
+  xAddr.sun_family = AF_UNIX;
+  strcpy (xAddr.sun_path, sPath);
+
+  iFd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (iFd < 0) {
+    return -1;
+  }
+  if (connect (iFd, (struct sockaddr *) &xAddr, sizeof (xAddr)) != 0) {
+    int iErr = errno;
+
+    close (iFd);
+    errno = iErr;
+    return -1;
+  }
+  return iFd;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbPubSubscribe (int iFd, int iSlave, uint32_t ulFirst, uint32_t ulLast) {
+  char sLine[MBPUB_LINE_MAX];
+  size_t ulSent = 0, ulLen;
+
+  if (iSlave < 0) {
+
+    ulLen = snprintf (sLine, sizeof (sLine), "sub * %lu-%lu\n",
+                      (unsigned long) ulFirst, (unsigned long) ulLast);
+  }
+  else {
+
+    ulLen = snprintf (sLine, sizeof (sLine), "sub %d %lu-%lu\n", iSlave,
+                      (unsigned long) ulFirst, (unsigned long) ulLast);
+  }
+  while (ulSent < ulLen) {
+    ssize_t n = send (iFd, &sLine[ulSent], ulLen - ulSent, MSG_NOSIGNAL);
+
+    if (n < 0) {
+
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    ulSent += n;
+  }
+  return 0;
+}
+
+#endif /* MBPOLL_PUB defined */
+/* ========================================================================== */
@@ -0,0 +1,151 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_MB_PUB_H_
+#define _MBPOLL_MB_PUB_H_
+
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#define MBPOLL_PUB
+#endif
+
+#ifdef MBPOLL_PUB
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "mb-record.h"
+
+/* constants ================================================================ */
+/*
+ * Publication des lectures sur une socket Unix (SOCK_STREAM).
+ *
+ * A la connexion, le serveur envoie l'en-tête de flux de mb-record.h (en-tête
+ * et table des sources). Le client envoie ses abonnements, une ligne de texte
+ * par commande :
+ *   sub esclave [première[-dernière]]   reçoit les lectures de l'esclave (ou
+ *                                       de tous avec *) qui touchent la plage
+ *                                       de références, quel que soit le type
+ *                                       de données et la source
+ *   unsub                               supprime tous les abonnements
+ * Les lignes incorrectes sont ignorées. Un client sans abonnement ne reçoit
+ * rien.
+ *
+ * Chaque lecture qui correspond à un abonnement est envoyée en entier sous la
+ * forme d'un enregistrement de mb-record.h, préfixé par sa taille (u32 en
+ * tête de l'enregistrement) : le flux reçu est celui de --output=binary.
+ *
+ * Les envois ne bloquent jamais la scrutation : ce qui ne peut être envoyé
+ * immédiatement attend dans la file du client, un client dont la file
+ * déborde est déconnecté.
+ */
+#define MBPUB_CLIENT_MAX 64
+#define MBPUB_SUB_MAX 32
+#define MBPUB_LINE_MAX 128
+
+/* structures =============================================================== */
+/**
+ * Abonnement
+ */
+typedef struct xMbPubSub {
+  int iSlave; /**< -1 pour tous */
+  uint32_t ulFirst;
+  uint32_t ulLast;
+} xMbPubSub;
+
+/**
+ * Client connecté
+ */
+typedef struct xMbPubClient {
+  struct xMbPubClient * pxNext;
+  int iFd;
+  bool bClosing; /**< A déconnecter par le thread du serveur */
+  uint8_t * pucQueue; /**< Octets en attente d'envoi */
+  size_t ulSent; /**< Début des octets en attente */
+  size_t ulLen; /**< Fin des octets en attente */
+  xMbPubSub xSub[MBPUB_SUB_MAX];
+  int iSubCount;
+  char sLine[MBPUB_LINE_MAX]; /**< Commande en cours de réception */
+  size_t ulLineLen;
+} xMbPubClient;
+
+/**
+ * Serveur
+ *
+ * Les threads de scrutation publient sous xLock. Le thread du serveur
+ * accepte les clients, reçoit leurs commandes et vide leurs files.
+ */
+typedef struct xMbPubServer {
+  char * sPath;
+  int iListenFd;
+  int iWakeFd[2]; /**< Tube qui réveille le thread du serveur */
+  size_t ulQueueSize; /**< Taille maximale de la file d'un client */
+  uint8_t * pucStreamHeader; /**< Envoyé à chaque connexion */
+  size_t ulStreamHeaderSize;
+  xMbPubClient * pxClient;
+  int iClientCount;
+  bool bStop;
+  unsigned long ulAccepted; /**< Clients acceptés depuis la création */
+  unsigned long ulEvicted; /**< Clients déconnectés car trop lents */
+  unsigned long ulRecords; /**< Enregistrements envoyés ou mis en file */
+  pthread_mutex_t xLock;
+  pthread_t xThread;
+} xMbPubServer;
+
+/* internal public functions ================================================ */
+
+/**
+ * Crée la socket, remplace une socket existante du même chemin, et démarre
+ * le thread du serveur
+ *
+ * @param ulQueueSize taille maximale de la file d'un client en octets
+ * @param pvStreamHeader en-tête de flux et table des sources (mb-record.h)
+ * @return 0, -1 si erreur (errno)
+ */
+int iMbPubCreate (xMbPubServer * s, const char * sPath, size_t ulQueueSize,
+                  const void * pvStreamHeader, size_t ulStreamHeaderSize);
+
+/**
+ * Envoie un enregistrement aux clients abonnés
+ *
+ * @param pvRecord enregistrement complet de mb-record.h (en-tête et éléments)
+ */
+void vMbPubPublish (xMbPubServer * s, const void * pvRecord, size_t ulLen);
+
+/**
+ * Déconnecte les clients, arrête le thread du serveur et supprime la socket
+ *
+ * Les threads qui publient doivent être terminés, le serveur ne doit plus
+ * être utilisé.
+ */
+void vMbPubDelete (xMbPubServer * s);
+
+/**
+ * Se connecte au serveur
+ *
+ * @return le descripteur de la socket, -1 si erreur (errno)
+ */
+int iMbPubConnect (const char * sPath);
+
+/**
+ * Ajoute un abonnement
+ *
+ * @param iSlave esclave, -1 pour tous
+ * @return 0, -1 si erreur (errno)
+ */
+int iMbPubSubscribe (int iFd, int iSlave, uint32_t ulFirst, uint32_t ulLast);
+
+#endif /* MBPOLL_PUB defined */
+/* ========================================================================== */
+#endif /* _MBPOLL_MB_PUB_H_ */
@@ -0,0 +1,96 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "mb-record.h"
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+size_t
+ulMbRecStreamHeaderEncode (uint8_t * pucBuf, uint16_t usSourceCount) {
+
+  memcpy (pucBuf, MBREC_MAGIC, 4);
+  vMbRecPut16 (&pucBuf[4], MBREC_VERSION);
+  vMbRecPut16 (&pucBuf[6], MBREC_STREAM_HEADER_SIZE);
+  vMbRecPut16 (&pucBuf[8], MBREC_RECORD_HEADER_SIZE);
+  vMbRecPut16 (&pucBuf[10], usSourceCount);
+  vMbRecPut32 (&pucBuf[12], 0);
+  return MBREC_STREAM_HEADER_SIZE;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbRecStreamHeaderDecode (const uint8_t * pucBuf, uint16_t * pusHeaderSize,
+                          uint16_t * pusRecordHeaderSize,
+                          uint16_t * pusSourceCount) {
+
+  if ( (memcmp (pucBuf, MBREC_MAGIC, 4) != 0) ||
+       (usMbRecGet16 (&pucBuf[4]) != MBREC_VERSION)) {
+
+    return -1;
+  }
+  *pusHeaderSize = usMbRecGet16 (&pucBuf[6]);
+  *pusRecordHeaderSize = usMbRecGet16 (&pucBuf[8]);
+  *pusSourceCount = usMbRecGet16 (&pucBuf[10]);
+  if ( (*pusHeaderSize < MBREC_STREAM_HEADER_SIZE) ||
+       (*pusRecordHeaderSize < MBREC_RECORD_HEADER_SIZE)) {
+
+    return -1;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+size_t
+ulMbRecHeaderEncode (uint8_t * pucBuf, const xMbRecord * r) {
+
+  vMbRecPut32 (&pucBuf[0], r->ulSize);
+  vMbRecPut16 (&pucBuf[4], r->usSource);
+  pucBuf[6] = r->ucSlave;
+  pucBuf[7] = r->ucFunction;
+  pucBuf[8] = r->ucFormat;
+  pucBuf[9] = r->ucFlags;
+  vMbRecPut16 (&pucBuf[10], r->usElementSize);
+  vMbRecPut32 (&pucBuf[12], r->ulRef);
+  vMbRecPut32 (&pucBuf[16], r->ulCount);
+  vMbRecPut32 (&pucBuf[20], r->ulElements);
+  vMbRecPut32 (&pucBuf[24], (uint32_t) r->lStatus);
+  vMbRecPut32 (&pucBuf[28], 0);
+  vMbRecPut64 (&pucBuf[32], r->ullMonotonic);
+  vMbRecPut64 (&pucBuf[40], r->ullRealtime);
+  return MBREC_RECORD_HEADER_SIZE;
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbRecHeaderDecode (const uint8_t * pucBuf, xMbRecord * r) {
+
+  r->ulSize = ulMbRecGet32 (&pucBuf[0]);
+  r->usSource = usMbRecGet16 (&pucBuf[4]);
+  r->ucSlave = pucBuf[6];
+  r->ucFunction = pucBuf[7];
+  r->ucFormat = pucBuf[8];
+  r->ucFlags = pucBuf[9];
+  r->usElementSize = usMbRecGet16 (&pucBuf[10]);
+  r->ulRef = ulMbRecGet32 (&pucBuf[12]);
+  r->ulCount = ulMbRecGet32 (&pucBuf[16]);
+  r->ulElements = ulMbRecGet32 (&pucBuf[20]);
+  r->lStatus = (int32_t) ulMbRecGet32 (&pucBuf[24]);
+  r->ullMonotonic = ullMbRecGet64 (&pucBuf[32]);
+  r->ullRealtime = ullMbRecGet64 (&pucBuf[40]);
+}
+
+/* ========================================================================== */
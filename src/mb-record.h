@@ -0,0 +1,207 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_MB_RECORD_H_
+#define _MBPOLL_MB_RECORD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* constants ================================================================ */
+/*
+ * Flux binaire de --output=binary, tous les entiers sont little endian :
+ *
+ * En-tête de flux (MBREC_STREAM_HEADER_SIZE octets)
+ *   0  char[4] "MBPR"
+ *   4  u16     version (MBREC_VERSION)
+ *   6  u16     taille de l'en-tête de flux
+ *   8  u16     taille de l'en-tête d'un enregistrement
+ *  10  u16     nombre de sources
+ *  12  u32     réservé (0)
+ * suivi de la table des sources : pour chacune, u16 longueur puis le nom
+ * (port série ou hôte:port) sans zéro final.
+ *
+ * Enregistrement : en-tête (MBREC_RECORD_HEADER_SIZE octets)
+ *   0  u32     taille totale de l'enregistrement, en-tête compris
+ *   4  u16     indice de la source
+ *   6  u8      esclave
+ *   7  u8      type de données (option -t : 0, 1, 3 ou 4)
+ *   8  u8      format (eMbRecFormat)
+ *   9  u8      options (MBREC_FLAG_xxx)
+ *  10  u16     taille d'un élément (1 octet par bit, 2 par registre)
+ *  12  u32     référence de départ
+ *  16  u32     nombre de valeurs
+ *  20  u32     nombre d'éléments qui suivent l'en-tête
+ *  24  i32     état : 0 ou code d'erreur (errno)
+ *  28  u32     réservé (0)
+ *  32  u64     horloge monotone en ns
+ *  40  u64     heure UTC en ns depuis 1970
+ * suivi des éléments bruts : un octet par bit ou un u16 par registre.
+ *
+ * Un lecteur utilise les tailles de l'en-tête de flux pour ignorer les champs
+ * ajoutés par une version ultérieure.
+ */
+#define MBREC_MAGIC "MBPR"
+#define MBREC_VERSION 1
+#define MBREC_STREAM_HEADER_SIZE 16
+#define MBREC_RECORD_HEADER_SIZE 48
+
+// Les valeurs de 32 et 64 bits sont lues avec les mots inversés (option -B,
+// --order=ABCD ou BADC)
+#define MBREC_FLAG_WORD_SWAP 0x01
+// Les octets de chaque registre d'une valeur de 32 ou 64 bits sont inversés
+// (--order=BADC ou DCBA)
+#define MBREC_FLAG_BYTE_SWAP 0x02
+
+/* structures =============================================================== */
+/**
+ * Format d'affichage des valeurs d'un enregistrement
+ */
+typedef enum {
+  eMbRecFormatBin = 0,
+  eMbRecFormatDec,
+  eMbRecFormatInt16,
+  eMbRecFormatHex,
+  eMbRecFormatString,
+  eMbRecFormatInt,
+  eMbRecFormatFloat,
+  eMbRecFormatInt64,
+  eMbRecFormatUInt64,
+  eMbRecFormatDouble,
+} eMbRecFormat;
+
+/**
+ * En-tête d'un enregistrement, dans l'ordre de l'hôte
+ */
+typedef struct xMbRecord {
+  uint32_t ulSize; /**< Taille totale de l'enregistrement */
+  uint16_t usSource; /**< Indice de la source */
+  uint8_t ucSlave;
+  uint8_t ucFunction; /**< Type de données (-t) */
+  uint8_t ucFormat; /**< eMbRecFormat */
+  uint8_t ucFlags; /**< MBREC_FLAG_xxx */
+  uint16_t usElementSize; /**< 1 ou 2 octets */
+  uint32_t ulRef; /**< Référence de départ */
+  uint32_t ulCount; /**< Nombre de valeurs */
+  uint32_t ulElements; /**< Nombre d'éléments bruts */
+  int32_t lStatus; /**< 0 ou errno */
+  uint64_t ullMonotonic; /**< Horloge monotone en ns */
+  uint64_t ullRealtime; /**< Heure UTC en ns */
+} xMbRecord;
+
+/* internal public functions ================================================ */
+
+/**
+ * Encode l'en-tête de flux dans pucBuf
+ *
+ * @param pucBuf au moins MBREC_STREAM_HEADER_SIZE octets
+ * @return le nombre d'octets écrits
+ */
+size_t ulMbRecStreamHeaderEncode (uint8_t * pucBuf, uint16_t usSourceCount);
+
+/**
+ * Décode un en-tête de flux
+ *
+ * @return 0, -1 si la signature ou la version ne conviennent pas
+ */
+int iMbRecStreamHeaderDecode (const uint8_t * pucBuf, uint16_t * pusHeaderSize,
+                              uint16_t * pusRecordHeaderSize,
+                              uint16_t * pusSourceCount);
+
+/**
+ * Encode l'en-tête d'un enregistrement
+ *
+ * @param pucBuf au moins MBREC_RECORD_HEADER_SIZE octets
+ * @return le nombre d'octets écrits
+ */
+size_t ulMbRecHeaderEncode (uint8_t * pucBuf, const xMbRecord * r);
+
+/**
+ * Décode l'en-tête d'un enregistrement
+ */
+void vMbRecHeaderDecode (const uint8_t * pucBuf, xMbRecord * r);
+
+/**
+ * Ecrit un u16 little endian
+ */
+static inline void
+vMbRecPut16 (uint8_t * p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+/**
+ * Lit un u16 little endian
+ */
+static inline uint16_t
+usMbRecGet16 (const uint8_t * p) {
+  return p[0] | (p[1] << 8);
+}
+
+/**
+ * Ecrit un u32 little endian
+ */
+static inline void
+vMbRecPut32 (uint8_t * p, uint32_t v) {
+  vMbRecPut16 (p, v & 0xFFFF);
+  vMbRecPut16 (p + 2, v >> 16);
+}
+
+/**
+ * Ecrit un u64 little endian
+ */
+static inline void
+vMbRecPut64 (uint8_t * p, uint64_t v) {
+  vMbRecPut32 (p, v & 0xFFFFFFFF);
+  vMbRecPut32 (p + 4, v >> 32);
+}
+
+/**
+ * Lit un u32 little endian
+ */
+static inline uint32_t
+ulMbRecGet32 (const uint8_t * p) {
+  return usMbRecGet16 (p) | ( (uint32_t) usMbRecGet16 (p + 2) << 16);
+}
+
+/**
+ * Lit un u64 little endian
+ */
+static inline uint64_t
+ullMbRecGet64 (const uint8_t * p) {
+  return ulMbRecGet32 (p) | ( (uint64_t) ulMbRecGet32 (p + 4) << 32);
+}
+
+/**
+ * Nombre de registres d'une valeur d'un format (eMbRecFormat)
+ */
+static inline unsigned
+uMbRecFormatWidth (uint8_t ucFormat) {
+
+  switch (ucFormat) {
+    case eMbRecFormatInt:
+    case eMbRecFormatFloat:
+      return 2;
+    case eMbRecFormatInt64:
+    case eMbRecFormatUInt64:
+    case eMbRecFormatDouble:
+      return 4;
+    default:
+      return 1;
+  }
+}
+
+/* ========================================================================== */
+#endif /* _MBPOLL_MB_RECORD_H_ */
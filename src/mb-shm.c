@@ -0,0 +1,350 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mb-shm.h"
+
+#ifdef MBPOLL_SHM
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* constants ================================================================ */
+// champs de l'en-tête
+#define OFF_STREAM_SIZE 8
+#define OFF_RING        12
+#define OFF_SIZE        16
+#define OFF_TAIL        32
+#define OFF_HEAD        40
+#define OFF_SEQ         48
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+static inline uint64_t *
+pulField (uint8_t * pucMap, int iOffset) {
+
+  return (uint64_t *) &pucMap[iOffset];
+}
+
+// -----------------------------------------------------------------------------
+static inline size_t
+ulAlign (size_t ulLen, size_t ulAlignment) {
+
+  return (ulLen + ulAlignment - 1) & ~ (ulAlignment - 1);
+}
+
+// -----------------------------------------------------------------------------
+// Copie depuis l'anneau, en deux parties si la fin de l'anneau est atteinte
+static void
+vRingRead (const uint8_t * pucRing, uint64_t ulSize, uint64_t ulPos,
+           void * pvDst, size_t ulLen) {
+  size_t ulOffset = ulPos & (ulSize - 1);
+  size_t ulFirst = ulSize - ulOffset;
+
+  if (ulFirst >= ulLen) {
+
+    memcpy (pvDst, &pucRing[ulOffset], ulLen);
+  }
+  else {
+
+    memcpy (pvDst, &pucRing[ulOffset], ulFirst);
+    memcpy ( (uint8_t *) pvDst + ulFirst, pucRing, ulLen - ulFirst);
+  }
+}
+
+// -----------------------------------------------------------------------------
+static void
+vRingWrite (uint8_t * pucRing, uint64_t ulSize, uint64_t ulPos,
+            const void * pvSrc, size_t ulLen) {
+  size_t ulOffset = ulPos & (ulSize - 1);
+  size_t ulFirst = ulSize - ulOffset;
+
+  if (ulFirst >= ulLen) {
+
+    memcpy (&pucRing[ulOffset], pvSrc, ulLen);
+  }
+  else {
+
+    memcpy (&pucRing[ulOffset], pvSrc, ulFirst);
+    memcpy (pucRing, (const uint8_t *) pvSrc + ulFirst, ulLen - ulFirst);
+  }
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iMbShmCreate (xMbShmWriter * w, const char * sName, size_t ulSize,
+              const void * pvStreamHeader, size_t ulStreamHeaderSize) {
+  size_t ulRing = ulAlign (MBSHM_HEADER_SIZE + ulStreamHeaderSize,
+                           MBSHM_HEADER_SIZE);
+  uint64_t ulRingSize = MBSHM_HEADER_SIZE;
+  int iFd;
+
+  while (ulRingSize < ulSize) {
+    ulRingSize <<= 1;
+  }
+
+  memset (w, 0, sizeof (*w));
+  shm_unlink (sName);
+  iFd = shm_open (sName, O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (iFd < 0) {
+    return -1;
+  }
+  w->ulMapSize = ulRing + ulRingSize;
+  if (ftruncate (iFd, w->ulMapSize) != 0) {
+
+    close (iFd);
+    shm_unlink (sName);
+    return -1;
+  }
+  w->pucMap = mmap (NULL, w->ulMapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    iFd, 0);
+  close (iFd);
+  if (w->pucMap == MAP_FAILED) {
+
+    shm_unlink (sName);
+    return -1;
+  }
+  w->sName = strdup (sName);
+  w->pucRing = &w->pucMap[ulRing];
+  w->ulSize = ulRingSize;
+  pthread_mutex_init (&w->xLock, NULL);
+
+  // la signature est écrite en dernier, un lecteur ne voit pas d'en-tête
+  // incomplet
+  * (uint16_t *) &w->pucMap[4] = MBSHM_VERSION;
+  * (uint32_t *) &w->pucMap[OFF_STREAM_SIZE] = ulStreamHeaderSize;
+  * (uint32_t *) &w->pucMap[OFF_RING] = ulRing;
+  *pulField (w->pucMap, OFF_SIZE) = ulRingSize;
+  memcpy (&w->pucMap[MBSHM_HEADER_SIZE], pvStreamHeader, ulStreamHeaderSize);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  memcpy (w->pucMap, MBSHM_MAGIC, 4);
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbShmBegin (xMbShmWriter * w, size_t ulLen) {
+  size_t ulTotal = ulAlign (MBSHM_PREFIX_SIZE + ulLen, 8);
+  uint32_t ulPrefix[2] = { ulTotal, 0 };
+  uint64_t ulEnd;
+
+  if (ulTotal > w->ulSize) {
+
+    errno = EMSGSIZE;
+    return -1;
+  }
+  pthread_mutex_lock (&w->xLock);
+
+  // les enregistrements qui vont être écrasés sont retirés avant
+  ulEnd = w->ulHead + ulTotal;
+  if (ulEnd - w->ulTail > w->ulSize) {
+
+    while (ulEnd - w->ulTail > w->ulSize) {
+      uint32_t ulOld;
+
+      vRingRead (w->pucRing, w->ulSize, w->ulTail, &ulOld, sizeof (ulOld));
+      w->ulTail += ulOld;
+    }
+    __atomic_store_n (pulField (w->pucMap, OFF_TAIL), w->ulTail,
+                      __ATOMIC_RELAXED);
+    // le nouveau début est visible avant toute écriture dans l'anneau
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+  }
+
+  w->ulPos = w->ulHead;
+  vRingWrite (w->pucRing, w->ulSize, w->ulPos, ulPrefix, sizeof (ulPrefix));
+  vRingWrite (w->pucRing, w->ulSize, w->ulPos + sizeof (ulPrefix), &w->ulSeq,
+              sizeof (w->ulSeq));
+  w->ulPos += MBSHM_PREFIX_SIZE;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbShmAppend (xMbShmWriter * w, const void * pvData, size_t ulLen) {
+
+  vRingWrite (w->pucRing, w->ulSize, w->ulPos, pvData, ulLen);
+  w->ulPos += ulLen;
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbShmCommit (xMbShmWriter * w) {
+  uint32_t ulTotal;
+
+  vRingRead (w->pucRing, w->ulSize, w->ulHead, &ulTotal, sizeof (ulTotal));
+  w->ulHead += ulTotal;
+  w->ulSeq++;
+  __atomic_store_n (pulField (w->pucMap, OFF_SEQ), w->ulSeq, __ATOMIC_RELAXED);
+  __atomic_store_n (pulField (w->pucMap, OFF_HEAD), w->ulHead,
+                    __ATOMIC_RELEASE);
+  pthread_mutex_unlock (&w->xLock);
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbShmDelete (xMbShmWriter * w) {
+
+  if (w->pucMap == NULL) {
+    return;
+  }
+  pthread_mutex_destroy (&w->xLock);
+  munmap (w->pucMap, w->ulMapSize);
+  shm_unlink (w->sName);
+  free (w->sName);
+  w->pucMap = NULL;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbShmOpen (xMbShmReader * r, const char * sName) {
+  struct stat xStat;
+  size_t ulRing;
+  int iFd;
+
+  memset (r, 0, sizeof (*r));
+  iFd = shm_open (sName, O_RDONLY, 0);
+  if (iFd < 0) {
+    return -1;
+  }
+  if (fstat (iFd, &xStat) != 0) {
+
+    close (iFd);
+    return -1;
+  }
+  r->ulMapSize = xStat.st_size;
+  if (r->ulMapSize < MBSHM_HEADER_SIZE) {
+
+    close (iFd);
+    errno = EPROTO;
+    return -1;
+  }
+  r->pucMap = mmap (NULL, r->ulMapSize, PROT_READ, MAP_SHARED, iFd, 0);
+  close (iFd);
+  if (r->pucMap == MAP_FAILED) {
+
+    r->pucMap = NULL;
+    return -1;
+  }
+
+  ulRing = * (uint32_t *) &r->pucMap[OFF_RING];
+  r->ulSize = *pulField (r->pucMap, OFF_SIZE);
+  r->ulStreamHeaderSize = * (uint32_t *) &r->pucMap[OFF_STREAM_SIZE];
+  if ( (memcmp (r->pucMap, MBSHM_MAGIC, 4) != 0) ||
+       (* (uint16_t *) &r->pucMap[4] != MBSHM_VERSION) ||
+       (r->ulSize == 0) || ( (r->ulSize & (r->ulSize - 1)) != 0) ||
+       (ulRing < MBSHM_HEADER_SIZE + r->ulStreamHeaderSize) ||
+       (ulRing + r->ulSize > r->ulMapSize)) {
+
+    vMbShmClose (r);
+    errno = EPROTO;
+    return -1;
+  }
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  r->pucRing = &r->pucMap[ulRing];
+  r->pucStreamHeader = &r->pucMap[MBSHM_HEADER_SIZE];
+  r->ulPos = __atomic_load_n (pulField (r->pucMap, OFF_HEAD), __ATOMIC_ACQUIRE);
+  r->ulSeq = UINT64_MAX;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+long
+lMbShmRead (xMbShmReader * r, void * pvBuf, size_t ulSize) {
+
+  for (;;) {
+    uint64_t ulHead = __atomic_load_n (pulField (r->pucMap, OFF_HEAD),
+                                       __ATOMIC_ACQUIRE);
+    uint64_t ulTail = __atomic_load_n (pulField (r->pucMap, OFF_TAIL),
+                                       __ATOMIC_ACQUIRE);
+    uint32_t ulPrefix[2];
+    uint64_t ulSeq;
+    size_t ulLen = 0;
+
+    if (r->ulPos == ulHead) {
+      return 0;
+    }
+    if (r->ulPos < ulTail) {
+
+      // dépassé par l'écrivain
+      r->ulPos = ulTail;
+      continue;
+    }
+
+    vRingRead (r->pucRing, r->ulSize, r->ulPos, ulPrefix, sizeof (ulPrefix));
+    vRingRead (r->pucRing, r->ulSize, r->ulPos + sizeof (ulPrefix), &ulSeq,
+               sizeof (ulSeq));
+    if ( (ulPrefix[0] >= MBSHM_PREFIX_SIZE + MBREC_RECORD_HEADER_SIZE) &&
+         (ulPrefix[0] <= r->ulSize)) {
+      uint8_t ucHeader[MBREC_RECORD_HEADER_SIZE];
+      xMbRecord xRec;
+
+      // taille exacte de l'enregistrement, sans l'alignement
+      vRingRead (r->pucRing, r->ulSize, r->ulPos + MBSHM_PREFIX_SIZE,
+                 ucHeader, sizeof (ucHeader));
+      vMbRecHeaderDecode (ucHeader, &xRec);
+      ulLen = xRec.ulSize;
+      if ( (ulLen <= ulPrefix[0] - MBSHM_PREFIX_SIZE) && (ulLen <= ulSize)) {
+
+        vRingRead (r->pucRing, r->ulSize, r->ulPos + MBSHM_PREFIX_SIZE,
+                   pvBuf, ulLen);
+      }
+    }
+
+    // la copie n'est valable que si l'écrivain ne l'a pas écrasée entre temps
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    ulTail = __atomic_load_n (pulField (r->pucMap, OFF_TAIL), __ATOMIC_RELAXED);
+    if (r->ulPos < ulTail) {
+
+      r->ulPos = ulTail;
+      continue;
+    }
+
+    if ( (ulPrefix[0] < MBSHM_PREFIX_SIZE + MBREC_RECORD_HEADER_SIZE) ||
+         (ulPrefix[0] > r->ulSize)) {
+
+      // anneau incohérent (écrivain redémarré ?), on repart du plus récent
+      r->ulPos = ulHead;
+      r->ulSeq = UINT64_MAX;
+      return -1;
+    }
+    if (r->ulSeq != UINT64_MAX) {
+      r->ulLost += ulSeq - r->ulSeq;
+    }
+    r->ulSeq = ulSeq + 1;
+    r->ulPos += ulPrefix[0];
+    return (ulLen > 0) && (ulLen <= ulSize) ? (long) ulLen : -1;
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbShmClose (xMbShmReader * r) {
+
+  if (r->pucMap) {
+
+    munmap (r->pucMap, r->ulMapSize);
+    r->pucMap = NULL;
+  }
+}
+
+#endif /* MBPOLL_SHM defined */
+/* ========================================================================== */
@@ -0,0 +1,161 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_MB_SHM_H_
+#define _MBPOLL_MB_SHM_H_
+
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#define MBPOLL_SHM
+#endif
+
+#ifdef MBPOLL_SHM
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "mb-record.h"
+
+/* constants ================================================================ */
+/*
+ * Anneau en mémoire partagée (shm_open), un seul écrivain, lecteurs
+ * quelconques sans verrou. Les champs de contrôle sont dans l'ordre de
+ * l'hôte, l'anneau ne quitte pas la machine.
+ *
+ * En-tête (MBSHM_HEADER_SIZE octets)
+ *   0  char[4] "MBPS"
+ *   4  u16     version (MBSHM_VERSION)
+ *   6  u16     réservé (0)
+ *   8  u32     taille de l'en-tête de flux qui suit l'en-tête (ci-dessous)
+ *  12  u32     position de l'anneau depuis le début de la projection
+ *  16  u64     taille de l'anneau en octets (puissance de 2)
+ *  24  u64     réservé (0)
+ *  32  u64     position du plus ancien enregistrement présent
+ *  40  u64     fin du dernier enregistrement publié
+ *  48  u64     numéro de séquence du prochain enregistrement
+ * suivi de l'en-tête de flux de mb-record.h (en-tête et table des
+ * sources), puis de l'anneau aligné sur MBSHM_HEADER_SIZE.
+ *
+ * Les positions croissent indéfiniment, l'octet n est à n % taille. Chaque
+ * enregistrement de mb-record.h est précédé de u32 taille totale (alignée
+ * sur 8, préfixe compris), u32 réservé, u64 numéro de séquence.
+ *
+ * L'écrivain avance la position du plus ancien enregistrement avant
+ * d'écraser quoi que ce soit. Un lecteur vérifie après sa copie que
+ * l'enregistrement n'est pas devenu plus ancien : sinon il a été dépassé,
+ * il repart du plus ancien enregistrement et compte ceux qu'il a perdus.
+ */
+#define MBSHM_MAGIC "MBPS"
+#define MBSHM_VERSION 1
+#define MBSHM_HEADER_SIZE 64
+#define MBSHM_PREFIX_SIZE 16
+
+/* structures =============================================================== */
+/**
+ * Ecrivain : l'anneau est créé par mbpoll
+ *
+ * Plusieurs threads peuvent publier, ils sont sérialisés par xLock.
+ */
+typedef struct xMbShmWriter {
+  char * sName;
+  uint8_t * pucMap; /**< Projection complète */
+  size_t ulMapSize;
+  uint8_t * pucRing; /**< Début de l'anneau */
+  uint64_t ulSize; /**< Taille de l'anneau */
+  uint64_t ulTail; /**< Plus ancien enregistrement présent */
+  uint64_t ulHead; /**< Fin du dernier enregistrement publié */
+  uint64_t ulPos; /**< Position d'écriture dans l'enregistrement en cours */
+  uint64_t ulSeq; /**< Numéro de séquence de l'enregistrement en cours */
+  pthread_mutex_t xLock;
+} xMbShmWriter;
+
+/**
+ * Lecteur
+ */
+typedef struct xMbShmReader {
+  uint8_t * pucMap;
+  size_t ulMapSize;
+  const uint8_t * pucRing;
+  uint64_t ulSize;
+  uint64_t ulPos; /**< Prochain enregistrement à lire */
+  uint64_t ulSeq; /**< Numéro de séquence attendu, UINT64_MAX au départ */
+  uint64_t ulLost; /**< Nombre d'enregistrements écrasés avant lecture */
+  const uint8_t * pucStreamHeader; /**< En-tête de flux de mb-record.h */
+  size_t ulStreamHeaderSize;
+} xMbShmReader;
+
+/* internal public functions ================================================ */
+
+/**
+ * Crée l'anneau, remplace un anneau existant du même nom
+ *
+ * @param sName nom POSIX, par exemple "/mbpoll"
+ * @param ulSize taille de l'anneau, arrondie à la puissance de 2 supérieure
+ * @param pvStreamHeader en-tête de flux et table des sources (mb-record.h)
+ * @return 0, -1 si erreur (errno)
+ */
+int iMbShmCreate (xMbShmWriter * w, const char * sName, size_t ulSize,
+                  const void * pvStreamHeader, size_t ulStreamHeaderSize);
+
+/**
+ * Commence un enregistrement de ulLen octets (en-tête mb-record compris)
+ *
+ * Le verrou de l'écrivain est pris jusqu'à vMbShmCommit().
+ * @return 0, -1 si l'enregistrement est plus grand que l'anneau
+ */
+int iMbShmBegin (xMbShmWriter * w, size_t ulLen);
+
+/**
+ * Ajoute des octets à l'enregistrement commencé
+ */
+void vMbShmAppend (xMbShmWriter * w, const void * pvData, size_t ulLen);
+
+/**
+ * Publie l'enregistrement commencé
+ */
+void vMbShmCommit (xMbShmWriter * w);
+
+/**
+ * Ferme et supprime l'anneau
+ *
+ * Les threads qui publient doivent être terminés, l'écrivain ne doit plus
+ * être utilisé.
+ */
+void vMbShmDelete (xMbShmWriter * w);
+
+/**
+ * Ouvre un anneau existant, la lecture commence après le dernier
+ * enregistrement publié
+ *
+ * @return 0, -1 si erreur (errno, EPROTO si ce n'est pas un anneau mbpoll)
+ */
+int iMbShmOpen (xMbShmReader * r, const char * sName);
+
+/**
+ * Lit l'enregistrement suivant, sans attendre
+ *
+ * @param pvBuf reçoit l'enregistrement (en-tête mb-record et valeurs)
+ * @param ulSize taille de pvBuf
+ * @return la taille de l'enregistrement, 0 si aucun n'est disponible, -1 si
+ * pvBuf est trop petit (l'enregistrement est sauté)
+ */
+long lMbShmRead (xMbShmReader * r, void * pvBuf, size_t ulSize);
+
+/**
+ * Ferme l'anneau
+ */
+void vMbShmClose (xMbShmReader * r);
+
+#endif /* MBPOLL_SHM defined */
+/* ========================================================================== */
+#endif /* _MBPOLL_MB_SHM_H_ */
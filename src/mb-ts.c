@@ -0,0 +1,749 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include "mb-ts.h"
+
+/* constants ================================================================ */
+#define TS_BUCKET_COUNT 1024
+
+#ifdef MBPOLL_TS_LOCK
+#define TS_LOCK(w)   pthread_mutex_lock (&(w)->xLock)
+#define TS_UNLOCK(w) pthread_mutex_unlock (&(w)->xLock)
+#else
+#define TS_LOCK(w)
+#define TS_UNLOCK(w)
+#endif
+
+/* structures =============================================================== */
+// Lecture d'une suite de bits
+typedef struct xBitReader {
+  const uint8_t * pucData;
+  size_t ulBits;
+  size_t ulPos;
+} xBitReader;
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+// Nombre de bits à 0 en tête d'un mot non nul
+static inline int
+iLeadingZeros (uint64_t x) {
+#if defined (__GNUC__)
+  return __builtin_clzll (x);
+#else
+  int n = 0;
+
+  for (; ! (x & (1ULL << 63)); x <<= 1) {
+    n++;
+  }
+  return n;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Nombre de bits à 0 en queue d'un mot non nul
+static inline int
+iTrailingZeros (uint64_t x) {
+#if defined (__GNUC__)
+  return __builtin_ctzll (x);
+#else
+  int n = 0;
+
+  for (; ! (x & 1); x >>= 1) {
+    n++;
+  }
+  return n;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Ajoute les iCount bits de poids faible de v, poids fort en premier
+static int
+iBitsPut (xMbTsBits * b, uint64_t v, int iCount) {
+  size_t ulNeed = (b->ulBits + iCount + 7) / 8;
+
+  if (ulNeed > b->ulSize) {
+    size_t ulSize = b->ulSize ? b->ulSize * 2 : 64;
+    uint8_t * p;
+
+    while (ulSize < ulNeed) {
+      ulSize *= 2;
+    }
+    p = realloc (b->pucData, ulSize);
+    if (p == NULL) {
+      return -1;
+    }
+    memset (&p[b->ulSize], 0, ulSize - b->ulSize);
+    b->pucData = p;
+    b->ulSize = ulSize;
+  }
+
+  while (iCount > 0) {
+    int iFree = 8 - (b->ulBits & 7);
+    int iTake = iCount < iFree ? iCount : iFree;
+    unsigned uBits = (v >> (iCount - iTake)) & ( (1U << iTake) - 1);
+
+    b->pucData[b->ulBits >> 3] |= uBits << (iFree - iTake);
+    b->ulBits += iTake;
+    iCount -= iTake;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Vide la suite en conservant la zone allouée
+static void
+vBitsClear (xMbTsBits * b) {
+
+  if (b->pucData) {
+    memset (b->pucData, 0, (b->ulBits + 7) / 8);
+  }
+  b->ulBits = 0;
+}
+
+// -----------------------------------------------------------------------------
+static int
+iBitsGet (xBitReader * r, int iCount, uint64_t * pullValue) {
+  uint64_t v = 0;
+
+  if (r->ulPos + iCount > r->ulBits) {
+    return -1;
+  }
+  while (iCount > 0) {
+    int iAvail = 8 - (r->ulPos & 7);
+    int iTake = iCount < iAvail ? iCount : iAvail;
+    unsigned uByte = r->pucData[r->ulPos >> 3];
+
+    v = (v << iTake) | ( (uByte >> (iAvail - iTake)) & ( (1U << iTake) - 1));
+    r->ulPos += iTake;
+    iCount -= iTake;
+  }
+  *pullValue = v;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Nombre de '1' qui précèdent un '0', au plus iMax
+static int
+iBitsGetPrefix (xBitReader * r, int iMax) {
+  int i;
+
+  for (i = 0; i < iMax; i++) {
+    uint64_t b;
+
+    if (iBitsGet (r, 1, &b) != 0) {
+      return -1;
+    }
+    if (b == 0) {
+      break;
+    }
+  }
+  return i;
+}
+
+// -----------------------------------------------------------------------------
+static inline int64_t
+llSignExtend (uint64_t v, int iBits) {
+
+  return (int64_t) (v << (64 - iBits)) >> (64 - iBits);
+}
+
+// -----------------------------------------------------------------------------
+// Heure d'une ligne : différence entre deux écarts successifs
+static int
+iPutTime (xMbTsSeries * s, uint64_t ullTime) {
+  int64_t llDelta, d;
+  int iRet = 0;
+
+  if (s->ulRows == 0) {
+
+    s->ullLastTime = ullTime;
+    s->llLastDelta = 0;
+    return iBitsPut (&s->xTime, ullTime, 64);
+  }
+  llDelta = (int64_t) (ullTime - s->ullLastTime);
+  d = llDelta - s->llLastDelta;
+  s->ullLastTime = ullTime;
+  s->llLastDelta = llDelta;
+
+  if (d == 0) {
+
+    iRet = iBitsPut (&s->xTime, 0, 1);
+  }
+  else if ( (d >= -64) && (d <= 63)) {
+
+    iRet = iBitsPut (&s->xTime, 0x2, 2) | iBitsPut (&s->xTime, d & 0x7F, 7);
+  }
+  else if ( (d >= -256) && (d <= 255)) {
+
+    iRet = iBitsPut (&s->xTime, 0x6, 3) | iBitsPut (&s->xTime, d & 0x1FF, 9);
+  }
+  else if ( (d >= -2048) && (d <= 2047)) {
+
+    iRet = iBitsPut (&s->xTime, 0xE, 4) | iBitsPut (&s->xTime, d & 0xFFF, 12);
+  }
+  else {
+
+    // un tronçon dure au plus un jour, l'écart tient sur 32 bits
+    iRet = iBitsPut (&s->xTime, 0xF, 4) |
+           iBitsPut (&s->xTime, d & 0xFFFFFFFF, 32);
+  }
+  return iRet;
+}
+
+// -----------------------------------------------------------------------------
+// Valeur d'une ligne : ou exclusif avec la précédente
+static int
+iPutValue (xMbTsColumn * c, uint64_t v, bool bFirst) {
+  uint64_t x;
+  int iLeading, iTrailing, iLen;
+
+  if (bFirst) {
+
+    c->ullLast = v;
+    c->iLeading = -1;
+    return iBitsPut (&c->xBits, v, 64);
+  }
+  x = v ^ c->ullLast;
+  c->ullLast = v;
+  if (x == 0) {
+    return iBitsPut (&c->xBits, 0, 1);
+  }
+
+  iLeading = iLeadingZeros (x);
+  iTrailing = iTrailingZeros (x);
+  if (iLeading > 31) {
+    iLeading = 31;
+  }
+  if ( (c->iLeading >= 0) && (iLeading >= c->iLeading) &&
+       (iTrailing >= c->iTrailing)) {
+
+    // les bits significatifs tiennent dans la fenêtre précédente
+    iLen = 64 - c->iLeading - c->iTrailing;
+    return iBitsPut (&c->xBits, 0x2, 2) |
+           iBitsPut (&c->xBits, x >> c->iTrailing, iLen);
+  }
+  iLen = 64 - iLeading - iTrailing;
+  c->iLeading = iLeading;
+  c->iTrailing = iTrailing;
+  return iBitsPut (&c->xBits, 0x3, 2) | iBitsPut (&c->xBits, iLeading, 5) |
+         iBitsPut (&c->xBits, iLen - 1, 6) |
+         iBitsPut (&c->xBits, x >> iTrailing, iLen);
+}
+
+// -----------------------------------------------------------------------------
+static unsigned
+uHash (const xMbRecord * k) {
+  unsigned h = 2166136261u;
+
+  h = (h ^ k->usSource) * 16777619u;
+  h = (h ^ k->ucSlave) * 16777619u;
+  h = (h ^ k->ucFunction) * 16777619u;
+  h = (h ^ k->ucFormat) * 16777619u;
+  h = (h ^ k->ulRef) * 16777619u;
+  h = (h ^ k->ulCount) * 16777619u;
+  return h;
+}
+
+// -----------------------------------------------------------------------------
+static bool
+bKeyEqual (const xMbRecord * a, const xMbRecord * b) {
+
+  return (a->usSource == b->usSource) && (a->ucSlave == b->ucSlave) &&
+         (a->ucFunction == b->ucFunction) && (a->ucFormat == b->ucFormat) &&
+         (a->ucFlags == b->ucFlags) && (a->ulRef == b->ulRef) &&
+         (a->ulCount == b->ulCount);
+}
+
+// -----------------------------------------------------------------------------
+// Bloc d'une plage, créé si nécessaire
+static xMbTsSeries *
+pxSeries (xMbTsWriter * w, const xMbRecord * r) {
+  xMbTsSeries ** ppxHead = &w->ppxBucket[uHash (r) % TS_BUCKET_COUNT];
+  xMbTsSeries * s;
+
+  for (s = *ppxHead; s; s = s->pxNext) {
+
+    if (bKeyEqual (&s->xKey, r)) {
+      return s;
+    }
+  }
+
+  s = calloc (1, sizeof (xMbTsSeries));
+  if (s == NULL) {
+    return NULL;
+  }
+  s->pxColumn = calloc (r->ulCount, sizeof (xMbTsColumn));
+  if (s->pxColumn == NULL) {
+
+    free (s);
+    return NULL;
+  }
+  s->xKey.usSource = r->usSource;
+  s->xKey.ucSlave = r->ucSlave;
+  s->xKey.ucFunction = r->ucFunction;
+  s->xKey.ucFormat = r->ucFormat;
+  s->xKey.ucFlags = r->ucFlags;
+  s->xKey.ulRef = r->ulRef;
+  s->xKey.ulCount = r->ulCount;
+  s->pxNext = *ppxHead;
+  *ppxHead = s;
+  *w->ppxLast = s;
+  w->ppxLast = &s->pxNextOrder;
+  return s;
+}
+
+// -----------------------------------------------------------------------------
+static inline size_t
+ulBitsBytes (const xMbTsBits * b) {
+
+  return (b->ulBits + 7) / 8;
+}
+
+// -----------------------------------------------------------------------------
+static int
+iWriteColumn (FILE * f, const xMbTsBits * b) {
+  uint8_t ucLen[4];
+
+  vMbRecPut32 (ucLen, ulBitsBytes (b));
+  if ( (fwrite (ucLen, sizeof (ucLen), 1, f) != 1) ||
+       ( (b->ulBits > 0) &&
+         (fwrite (b->pucData, ulBitsBytes (b), 1, f) != 1))) {
+    return -1;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Ecrit le tronçon en cours et vide les blocs
+static int
+iWriteChunk (xMbTsWriter * w) {
+  uint8_t ucHeader[MBTS_CHUNK_HEADER_SIZE];
+  size_t ulSize = MBTS_CHUNK_HEADER_SIZE;
+  uint32_t ulBlockCount = 0, i;
+  xMbTsSeries * s;
+  int iRet = 0;
+
+  for (s = w->pxFirst; s; s = s->pxNextOrder) {
+
+    if (s->ulRows) {
+
+      ulBlockCount++;
+      ulSize += MBTS_BLOCK_HEADER_SIZE + 4 + ulBitsBytes (&s->xTime);
+      for (i = 0; i < s->xKey.ulCount; i++) {
+        ulSize += 4 + ulBitsBytes (&s->pxColumn[i].xBits);
+      }
+    }
+  }
+  if (ulBlockCount == 0) {
+    return 0;
+  }
+
+  memcpy (ucHeader, MBTS_CHUNK_MAGIC, 4);
+  vMbRecPut32 (&ucHeader[4], ulSize);
+  vMbRecPut64 (&ucHeader[8], w->ullChunkStart);
+  vMbRecPut32 (&ucHeader[16], ulBlockCount);
+  vMbRecPut32 (&ucHeader[20], 0);
+  if (fwrite (ucHeader, sizeof (ucHeader), 1, w->xFile) != 1) {
+    iRet = -1;
+  }
+
+  for (s = w->pxFirst; s; s = s->pxNextOrder) {
+
+    if (s->ulRows == 0) {
+      continue;
+    }
+    vMbRecPut16 (&ucHeader[0], s->xKey.usSource);
+    ucHeader[2] = s->xKey.ucSlave;
+    ucHeader[3] = s->xKey.ucFunction;
+    ucHeader[4] = s->xKey.ucFormat;
+    ucHeader[5] = s->xKey.ucFlags;
+    vMbRecPut16 (&ucHeader[6], 0);
+    vMbRecPut32 (&ucHeader[8], s->xKey.ulRef);
+    vMbRecPut32 (&ucHeader[12], s->xKey.ulCount);
+    vMbRecPut32 (&ucHeader[16], s->ulRows);
+    vMbRecPut32 (&ucHeader[20], 0);
+    if ( (iRet == 0) &&
+         ( (fwrite (ucHeader, MBTS_BLOCK_HEADER_SIZE, 1, w->xFile) != 1) ||
+           (iWriteColumn (w->xFile, &s->xTime) != 0))) {
+      iRet = -1;
+    }
+    vBitsClear (&s->xTime);
+    for (i = 0; i < s->xKey.ulCount; i++) {
+
+      if ( (iRet == 0) &&
+           (iWriteColumn (w->xFile, &s->pxColumn[i].xBits) != 0)) {
+        iRet = -1;
+      }
+      vBitsClear (&s->pxColumn[i].xBits);
+    }
+    s->ulRows = 0;
+  }
+  if (fflush (w->xFile) != 0) {
+    iRet = -1;
+  }
+  return iRet;
+}
+
+// -----------------------------------------------------------------------------
+// Colonne i d'un bloc lu (0 pour les heures)
+static int
+iColumn (const xMbTsBlock * b, uint32_t ulColumn, xBitReader * r) {
+  size_t ulPos = 0;
+  uint32_t i;
+
+  for (i = 0; ; i++) {
+    uint32_t ulLen;
+
+    if (ulPos + 4 > b->ulSize) {
+      return -1;
+    }
+    ulLen = ulMbRecGet32 (&b->pucColumns[ulPos]);
+    ulPos += 4;
+    if (ulPos + ulLen > b->ulSize) {
+      return -1;
+    }
+    if (i == ulColumn) {
+
+      r->pucData = &b->pucColumns[ulPos];
+      r->ulBits = (size_t) ulLen * 8;
+      r->ulPos = 0;
+      return 0;
+    }
+    ulPos += ulLen;
+  }
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iMbTsCreate (xMbTsWriter * w, const char * sPath, unsigned long ulPeriod,
+             const void * pvStreamHeader, size_t ulStreamHeaderSize) {
+  uint8_t ucHeader[MBTS_FILE_HEADER_SIZE];
+
+  memset (w, 0, sizeof (*w));
+  w->ppxBucket = calloc (TS_BUCKET_COUNT, sizeof (xMbTsSeries *));
+  if (w->ppxBucket == NULL) {
+    return -1;
+  }
+  w->xFile = fopen (sPath, "wb");
+  if (w->xFile == NULL) {
+
+    free (w->ppxBucket);
+    return -1;
+  }
+  w->ullPeriod = (uint64_t) ulPeriod * 1000ULL;
+  w->ppxLast = &w->pxFirst;
+#ifdef MBPOLL_TS_LOCK
+  pthread_mutex_init (&w->xLock, NULL);
+#endif
+
+  memcpy (ucHeader, MBTS_MAGIC, 4);
+  vMbRecPut16 (&ucHeader[4], MBTS_VERSION);
+  vMbRecPut16 (&ucHeader[6], MBTS_FILE_HEADER_SIZE);
+  vMbRecPut32 (&ucHeader[8], ulPeriod);
+  vMbRecPut32 (&ucHeader[12], 0);
+  if ( (fwrite (ucHeader, sizeof (ucHeader), 1, w->xFile) != 1) ||
+       (fwrite (pvStreamHeader, ulStreamHeaderSize, 1, w->xFile) != 1) ||
+       (fflush (w->xFile) != 0)) {
+
+    fclose (w->xFile);
+    free (w->ppxBucket);
+    return -1;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTsAppend (xMbTsWriter * w, const xMbRecord * r,
+             const uint64_t * pullValue) {
+  uint64_t ullTime = r->ullRealtime / 1000000ULL;
+  xMbTsSeries * s;
+  uint32_t i;
+  int iRet = 0;
+
+  TS_LOCK (w);
+  if ( (w->ullChunkEnd == 0) || (ullTime < w->ullChunkStart) ||
+       (ullTime >= w->ullChunkEnd)) {
+
+    // nouvelle période, les tronçons sont alignés sur leur durée
+    if (iWriteChunk (w) != 0) {
+      iRet = -1;
+    }
+    w->ullChunkStart = ullTime - ullTime % w->ullPeriod;
+    w->ullChunkEnd = w->ullChunkStart + w->ullPeriod;
+  }
+
+  s = pxSeries (w, r);
+  if (s == NULL) {
+
+    TS_UNLOCK (w);
+    errno = ENOMEM;
+    return -1;
+  }
+  iRet |= iPutTime (s, ullTime);
+  for (i = 0; i < s->xKey.ulCount; i++) {
+    iRet |= iPutValue (&s->pxColumn[i], pullValue[i], s->ulRows == 0);
+  }
+  s->ulRows++;
+  w->ulRowCount++;
+  TS_UNLOCK (w);
+  return iRet;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTsClose (xMbTsWriter * w) {
+  xMbTsSeries * s;
+  int iRet;
+  uint32_t i;
+
+  if (w->xFile == NULL) {
+    return 0;
+  }
+  iRet = iWriteChunk (w);
+  if (fclose (w->xFile) != 0) {
+    iRet = -1;
+  }
+  w->xFile = NULL;
+
+  for (s = w->pxFirst; s; ) {
+    xMbTsSeries * pxNext = s->pxNextOrder;
+
+    for (i = 0; i < s->xKey.ulCount; i++) {
+      free (s->pxColumn[i].xBits.pucData);
+    }
+    free (s->pxColumn);
+    free (s->xTime.pucData);
+    free (s);
+    s = pxNext;
+  }
+  free (w->ppxBucket);
+  w->ppxBucket = NULL;
+  w->pxFirst = NULL;
+#ifdef MBPOLL_TS_LOCK
+  pthread_mutex_destroy (&w->xLock);
+#endif
+  return iRet;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTsReadHeader (FILE * f, uint32_t * pulPeriod) {
+  uint8_t ucHeader[MBTS_FILE_HEADER_SIZE];
+  uint16_t usSize, i;
+
+  if ( (fread (ucHeader, sizeof (ucHeader), 1, f) != 1) ||
+       (memcmp (ucHeader, MBTS_MAGIC, 4) != 0) ||
+       (usMbRecGet16 (&ucHeader[4]) != MBTS_VERSION)) {
+    return -1;
+  }
+  usSize = usMbRecGet16 (&ucHeader[6]);
+  *pulPeriod = ulMbRecGet32 (&ucHeader[8]);
+
+  // champs ajoutés par une version ultérieure
+  for (i = MBTS_FILE_HEADER_SIZE; i < usSize; i++) {
+
+    if (fgetc (f) == EOF) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTsReadChunk (FILE * f, xMbTsChunk * c) {
+  uint8_t ucHeader[MBTS_CHUNK_HEADER_SIZE];
+  size_t n;
+
+  memset (c, 0, sizeof (*c));
+  n = fread (ucHeader, 1, sizeof (ucHeader), f);
+  if (n == 0) {
+    return 0;
+  }
+  if ( (n != sizeof (ucHeader)) ||
+       (memcmp (ucHeader, MBTS_CHUNK_MAGIC, 4) != 0)) {
+    return -1;
+  }
+  c->ulSize = ulMbRecGet32 (&ucHeader[4]);
+  if (c->ulSize < MBTS_CHUNK_HEADER_SIZE) {
+    return -1;
+  }
+  c->pucData = malloc (c->ulSize);
+  if (c->pucData == NULL) {
+    return -1;
+  }
+  memcpy (c->pucData, ucHeader, sizeof (ucHeader));
+  if ( (c->ulSize > sizeof (ucHeader)) &&
+       (fread (&c->pucData[sizeof (ucHeader)], c->ulSize - sizeof (ucHeader),
+               1, f) != 1)) {
+
+    vMbTsChunkFree (c);
+    return -1;
+  }
+  c->ullStart = ullMbRecGet64 (&ucHeader[8]);
+  c->ulBlockCount = ulMbRecGet32 (&ucHeader[16]);
+  c->ulPos = MBTS_CHUNK_HEADER_SIZE;
+  return 1;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTsNextBlock (xMbTsChunk * c, xMbTsBlock * b) {
+  const uint8_t * p = &c->pucData[c->ulPos];
+  size_t ulPos;
+  uint32_t i;
+
+  if (c->ulBlock >= c->ulBlockCount) {
+    return 0;
+  }
+  if (c->ulPos + MBTS_BLOCK_HEADER_SIZE > c->ulSize) {
+    return -1;
+  }
+  b->usSource = usMbRecGet16 (&p[0]);
+  b->ucSlave = p[2];
+  b->ucFunction = p[3];
+  b->ucFormat = p[4];
+  b->ucFlags = p[5];
+  b->ulRef = ulMbRecGet32 (&p[8]);
+  b->ulCount = ulMbRecGet32 (&p[12]);
+  b->ulRows = ulMbRecGet32 (&p[16]);
+
+  // la colonne des heures puis une colonne par valeur
+  ulPos = c->ulPos + MBTS_BLOCK_HEADER_SIZE;
+  b->pucColumns = &c->pucData[ulPos];
+  for (i = 0; i <= b->ulCount; i++) {
+
+    if (ulPos + 4 > c->ulSize) {
+      return -1;
+    }
+    ulPos += 4 + ulMbRecGet32 (&c->pucData[ulPos]);
+    if (ulPos > c->ulSize) {
+      return -1;
+    }
+  }
+  b->ulSize = &c->pucData[ulPos] - b->pucColumns;
+  c->ulPos = ulPos;
+  c->ulBlock++;
+  return 1;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTsDecodeTime (const xMbTsBlock * b, uint64_t * pullTime) {
+  xBitReader r;
+  uint64_t ullTime = 0, v;
+  int64_t llDelta = 0;
+  uint32_t i;
+
+  if (iColumn (b, 0, &r) != 0) {
+    return -1;
+  }
+  for (i = 0; i < b->ulRows; i++) {
+
+    if (i == 0) {
+
+      if (iBitsGet (&r, 64, &ullTime) != 0) {
+        return -1;
+      }
+    }
+    else {
+      static const int iBits[] = { 0, 7, 9, 12, 32 };
+      int iPrefix = iBitsGetPrefix (&r, 4);
+
+      if (iPrefix < 0) {
+        return -1;
+      }
+      if (iPrefix > 0) {
+
+        if (iBitsGet (&r, iBits[iPrefix], &v) != 0) {
+          return -1;
+        }
+        llDelta += llSignExtend (v, iBits[iPrefix]);
+      }
+      ullTime += llDelta;
+    }
+    pullTime[i] = ullTime;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTsDecodeValues (const xMbTsBlock * b, uint32_t ulColumn,
+                   uint64_t * pullValue) {
+  xBitReader r;
+  uint64_t ullLast = 0, v;
+  int iLeading = 0, iTrailing = 0;
+  uint32_t i;
+
+  if ( (ulColumn >= b->ulCount) || (iColumn (b, ulColumn + 1, &r) != 0)) {
+    return -1;
+  }
+  for (i = 0; i < b->ulRows; i++) {
+
+    if (i == 0) {
+
+      if (iBitsGet (&r, 64, &ullLast) != 0) {
+        return -1;
+      }
+    }
+    else {
+      int iPrefix = iBitsGetPrefix (&r, 2);
+
+      if (iPrefix < 0) {
+        return -1;
+      }
+      if (iPrefix == 2) {
+        uint64_t ullLeading, ullLen;
+
+        // nouvelle fenêtre
+        if ( (iBitsGet (&r, 5, &ullLeading) != 0) ||
+             (iBitsGet (&r, 6, &ullLen) != 0) ||
+             (ullLeading + ullLen + 1 > 64)) {
+          return -1;
+        }
+        iLeading = ullLeading;
+        iTrailing = 64 - iLeading - (ullLen + 1);
+      }
+      if (iPrefix > 0) {
+
+        if (iBitsGet (&r, 64 - iLeading - iTrailing, &v) != 0) {
+          return -1;
+        }
+        ullLast ^= v << iTrailing;
+      }
+    }
+    pullValue[i] = ullLast;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+void
+vMbTsChunkFree (xMbTsChunk * c) {
+
+  free (c->pucData);
+  c->pucData = NULL;
+}
+
+/* ========================================================================== */
@@ -0,0 +1,247 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_MB_TS_H_
+#define _MBPOLL_MB_TS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mb-record.h"
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#include <pthread.h>
+#define MBPOLL_TS_LOCK
+#endif
+
+/* constants ================================================================ */
+/*
+ * Fichier de séries temporelles de --ts, en colonnes compressées. Tous les
+ * entiers des en-têtes sont little endian.
+ *
+ * En-tête de fichier (MBTS_FILE_HEADER_SIZE octets)
+ *   0  char[4] "MBPT"
+ *   4  u16     version (MBTS_VERSION)
+ *   6  u16     taille de l'en-tête de fichier
+ *   8  u32     durée d'un tronçon en s
+ *  12  u32     réservé (0)
+ * suivi de l'en-tête de flux de mb-record.h (en-tête et table des sources),
+ * puis des tronçons.
+ *
+ * Tronçon : toutes les lectures d'une période de temps alignée sur sa durée
+ *   0  char[4] "MBTC"
+ *   4  u32     taille totale du tronçon, en-tête compris
+ *   8  u64     début de la période, heure UTC en ms depuis 1970
+ *  16  u32     nombre de blocs
+ *  20  u32     réservé (0)
+ * suivi des blocs. Un bloc regroupe les lectures réussies d'une même plage
+ * (source, esclave, type de données et références) :
+ *   0  u16     indice de la source
+ *   2  u8      esclave
+ *   3  u8      type de données (option -t : 0, 1, 3 ou 4)
+ *   4  u8      format (eMbRecFormat)
+ *   5  u8      options (MBREC_FLAG_xxx)
+ *   6  u16     réservé (0)
+ *   8  u32     référence de départ
+ *  12  u32     nombre de valeurs, donc de colonnes de valeurs
+ *  16  u32     nombre de lignes (lectures)
+ *  20  u32     réservé (0)
+ * suivi de la colonne des heures puis d'une colonne par valeur, chacune
+ * précédée de sa taille en octets (u32) pour pouvoir être sautée.
+ *
+ * Les colonnes sont des suites de bits, bit de poids fort en premier :
+ * - heures en ms : la première sur 64 bits, puis la différence entre deux
+ *   écarts successifs (le premier écart est comparé à 0) : '0' si elle est
+ *   nulle, '10' et 7 bits, '110' et 9 bits, '1110' et 12 bits, '1111' et 32
+ *   bits (complément à 2).
+ * - valeurs sur 64 bits, l'entier lui-même pour les formats int64 et uint64,
+ *   les bits du double décodé pour les autres : la première sur 64 bits, puis
+ *   le ou exclusif avec la précédente : '0' s'il est nul, '10' et les bits significatifs
+ *   s'ils tiennent dans la fenêtre précédente, '11', 5 bits de zéros de tête,
+ *   6 bits de longueur moins un et les bits significatifs sinon.
+ */
+#define MBTS_MAGIC "MBPT"
+#define MBTS_CHUNK_MAGIC "MBTC"
+#define MBTS_VERSION 1
+#define MBTS_FILE_HEADER_SIZE 16
+#define MBTS_CHUNK_HEADER_SIZE 24
+#define MBTS_BLOCK_HEADER_SIZE 24
+
+/* structures =============================================================== */
+/**
+ * Suite de bits en cours de construction
+ */
+typedef struct xMbTsBits {
+  uint8_t * pucData;
+  size_t ulBits; /**< Nombre de bits écrits */
+  size_t ulSize; /**< Taille allouée en octets */
+} xMbTsBits;
+
+/**
+ * Colonne d'une valeur
+ */
+typedef struct xMbTsColumn {
+  uint64_t ullLast; /**< Bits de la valeur précédente */
+  int iLeading; /**< Fenêtre précédente, -1 si aucune */
+  int iTrailing;
+  xMbTsBits xBits;
+} xMbTsColumn;
+
+/**
+ * Bloc en cours de construction
+ */
+typedef struct xMbTsSeries {
+  struct xMbTsSeries * pxNext; /**< Bloc suivant de la même alvéole */
+  struct xMbTsSeries * pxNextOrder; /**< Bloc suivant dans le fichier */
+  xMbRecord xKey; /**< Source, esclave, type, format, options, plage */
+  uint32_t ulRows;
+  uint64_t ullLastTime; /**< Heure de la dernière ligne en ms */
+  int64_t llLastDelta; /**< Dernier écart entre deux lignes en ms */
+  xMbTsBits xTime;
+  xMbTsColumn * pxColumn; /**< Une colonne par valeur */
+} xMbTsSeries;
+
+/**
+ * Ecrivain
+ *
+ * Plusieurs threads peuvent ajouter des lignes, ils sont sérialisés par
+ * xLock.
+ */
+typedef struct xMbTsWriter {
+  FILE * xFile;
+  uint64_t ullPeriod; /**< Durée d'un tronçon en ms */
+  uint64_t ullChunkStart; /**< Début du tronçon en cours en ms */
+  uint64_t ullChunkEnd; /**< Fin du tronçon en cours, 0 si aucun */
+  xMbTsSeries ** ppxBucket;
+  xMbTsSeries * pxFirst; /**< Blocs dans l'ordre de leur création */
+  xMbTsSeries ** ppxLast;
+  unsigned long ulRowCount; /**< Nombre total de lignes écrites */
+#ifdef MBPOLL_TS_LOCK
+  pthread_mutex_t xLock;
+#endif
+} xMbTsWriter;
+
+/**
+ * Tronçon lu
+ */
+typedef struct xMbTsChunk {
+  uint8_t * pucData; /**< Tronçon complet, en-tête compris */
+  size_t ulSize;
+  uint64_t ullStart; /**< Début de la période en ms */
+  uint32_t ulBlockCount;
+  uint32_t ulBlock; /**< Blocs déjà parcourus */
+  size_t ulPos; /**< Position du bloc suivant */
+} xMbTsChunk;
+
+/**
+ * Bloc lu, les colonnes restent dans le tronçon
+ */
+typedef struct xMbTsBlock {
+  uint16_t usSource;
+  uint8_t ucSlave;
+  uint8_t ucFunction;
+  uint8_t ucFormat; /**< eMbRecFormat */
+  uint8_t ucFlags; /**< MBREC_FLAG_xxx */
+  uint32_t ulRef;
+  uint32_t ulCount; /**< Nombre de valeurs */
+  uint32_t ulRows; /**< Nombre de lignes */
+  const uint8_t * pucColumns; /**< Colonne des heures, puis des valeurs */
+  size_t ulSize; /**< Taille des colonnes */
+} xMbTsBlock;
+
+/* internal public functions ================================================ */
+
+/**
+ * Crée le fichier et écrit son en-tête
+ *
+ * @param ulPeriod durée d'un tronçon en s
+ * @param pvStreamHeader en-tête de flux et table des sources (mb-record.h)
+ * @return 0, -1 si erreur (errno)
+ */
+int iMbTsCreate (xMbTsWriter * w, const char * sPath, unsigned long ulPeriod,
+                 const void * pvStreamHeader, size_t ulStreamHeaderSize);
+
+/**
+ * Ajoute une ligne au bloc d'une plage
+ *
+ * Le tronçon en cours est écrit lorsque la lecture appartient à une période
+ * suivante.
+ *
+ * @param r source, esclave, type de données, format, options, référence,
+ * nombre de valeurs et heure UTC de la lecture
+ * @param pullValue les r->ulCount valeurs sur 64 bits : l'entier pour les
+ * formats int64 et uint64, les bits du double décodé sinon
+ * @return 0, -1 si erreur d'écriture ou d'allocation (errno)
+ */
+int iMbTsAppend (xMbTsWriter * w, const xMbRecord * r,
+                 const uint64_t * pullValue);
+
+/**
+ * Ecrit le tronçon en cours, ferme le fichier et libère l'écrivain
+ *
+ * Les threads qui ajoutent des lignes doivent être terminés, l'écrivain ne
+ * doit plus être utilisé.
+ *
+ * @return 0, -1 si erreur d'écriture
+ */
+int iMbTsClose (xMbTsWriter * w);
+
+/**
+ * Lit l'en-tête de fichier, l'en-tête de flux de mb-record.h suit
+ *
+ * @param pulPeriod reçoit la durée d'un tronçon en s
+ * @return 0, -1 si ce n'est pas un fichier --ts
+ */
+int iMbTsReadHeader (FILE * f, uint32_t * pulPeriod);
+
+/**
+ * Lit le tronçon suivant
+ *
+ * @return 1, 0 en fin de fichier, -1 si le tronçon est incohérent
+ */
+int iMbTsReadChunk (FILE * f, xMbTsChunk * c);
+
+/**
+ * Bloc suivant d'un tronçon
+ *
+ * @return 1, 0 s'il n'y en a plus, -1 si le bloc est incohérent
+ */
+int iMbTsNextBlock (xMbTsChunk * c, xMbTsBlock * b);
+
+/**
+ * Décode la colonne des heures d'un bloc
+ *
+ * @param pullTime reçoit les b->ulRows heures en ms
+ * @return 0, -1 si la colonne est incohérente
+ */
+int iMbTsDecodeTime (const xMbTsBlock * b, uint64_t * pullTime);
+
+/**
+ * Décode une colonne de valeurs d'un bloc
+ *
+ * @param ulColumn indice de la valeur (0 à b->ulCount - 1)
+ * @param pullValue reçoit les b->ulRows valeurs sur 64 bits, comme
+ * iMbTsAppend() les a reçues
+ * @return 0, -1 si la colonne est incohérente
+ */
+int iMbTsDecodeValues (const xMbTsBlock * b, uint32_t ulColumn,
+                       uint64_t * pullValue);
+
+/**
+ * Libère un tronçon lu
+ */
+void vMbTsChunkFree (xMbTsChunk * c);
+
+/* ========================================================================== */
+#endif /* _MBPOLL_MB_TS_H_ */
@@ -0,0 +1,788 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * mbpoll-dump : affiche en csv un flux écrit par mbpoll --output=binary
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include <modbus.h>
+#include "mb-record.h"
+#include "mb-shm.h"
+#include "mb-image.h"
+#include "mb-ts.h"
+#include "mb-pub.h"
+#ifdef MBPOLL_SHM
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+/* constants ================================================================ */
+#define RECORD_HEADER_MAX 256
+// le plus grand enregistrement de mbpoll : 65536 valeurs de 2 registres
+#define RECORD_MAX (MBREC_RECORD_HEADER_SIZE + 65536 * 4)
+// attente lorsque l'anneau est vide
+#define SHM_POLL_US 10000
+
+static const char * sFunctionKeyList[] = {
+  "coil",
+  "discrete-input",
+  "",
+  "input-register",
+  "holding-register"
+};
+
+/* private variables ======================================================== */
+static const char * progname;
+static bool bHeader;
+static uint16_t usRecordHeaderSize;
+static uint16_t usSourceCount;
+static char ** psSource;
+#ifdef MBPOLL_SHM
+static volatile sig_atomic_t bStop;
+#endif
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+static void
+vUsage (FILE * stream, int iExit) {
+
+  fprintf (stream,
+           "usage : %s [ -H ] [ -s name | -i name | -t file |\n"
+           "         -u path [ -S sub ]... | file ]\n"
+           "Prints as csv the records written by mbpoll --output=binary,\n"
+           "from file or from the standard input.\n"
+           "  -H            Print the stream header and the sources first\n"
+           "  -s name       Follow the shared memory ring of mbpoll --shm=name\n"
+           "                until Ctrl-C, lost records are reported on stderr\n"
+           "  -i name       Print once the blocks of the register image of\n"
+           "                mbpoll --image=name that were read at least once. The\n"
+           "                time is that of the last successful read, the status\n"
+           "                that of the last read\n"
+           "  -t file       Print the time series file of mbpoll --ts=file, chunk\n"
+           "                by chunk and block by block within a chunk\n"
+           "  -u path       Follow the records sent on the Unix socket of mbpoll\n"
+           "                --pub=path until mbpoll stops or Ctrl-C\n"
+           "  -S sub        Subscription for -u, can be repeated : slave[:first\n"
+           "                reference[-last reference]], * for all slaves. All\n"
+           "                the records are received if there is none\n"
+           "  -h            Print this help summary page\n", progname);
+  exit (iExit);
+}
+
+// -----------------------------------------------------------------------------
+static void
+vFatal (const char * sMsg) {
+
+  fprintf (stderr, "%s: %s.\n", progname, sMsg);
+  exit (EXIT_FAILURE);
+}
+
+// -----------------------------------------------------------------------------
+// Lecture de ulLen octets, false en fin de flux
+static bool
+bRead (FILE * f, void * pvBuf, size_t ulLen) {
+  size_t n = fread (pvBuf, 1, ulLen, f);
+
+  if ( (n > 0) && (n < ulLen)) {
+
+    vFatal ("truncated stream");
+  }
+  return n == ulLen;
+}
+
+// -----------------------------------------------------------------------------
+// Chaîne csv, entre guillemets si elle contient un séparateur
+static void
+vPrintCsvString (const char * str) {
+
+  if (strpbrk (str, ",\"\r\n") == NULL) {
+
+    fputs (str, stdout);
+    return;
+  }
+  putchar ('"');
+  for (; *str; str++) {
+
+    if (*str == '"') {
+      putchar ('"');
+    }
+    putchar (*str);
+  }
+  putchar ('"');
+}
+
+// -----------------------------------------------------------------------------
+// Valeurs d'un enregistrement, décodées comme le fait mbpoll
+static void
+vPrintValues (const xMbRecord * r, const uint8_t * pucData) {
+  unsigned uWidth = uMbRecFormatWidth (r->ucFormat);
+  unsigned i;
+
+  if (r->ucFormat == eMbRecFormatString) {
+
+    putchar (',');
+    for (i = 0; i < r->ulElements; i++) {
+      uint16_t v = usMbRecGet16 (&pucData[2 * i]);
+
+      if (v >> 8) {
+        putchar (v >> 8);
+      }
+      if (v & 0xFF) {
+        putchar (v & 0xFF);
+      }
+    }
+    return;
+  }
+
+  for (i = 0; i < r->ulCount; i++) {
+
+    if (r->usElementSize == 1) {
+
+      printf (",%c", pucData[i] ? '1' : '0');
+      continue;
+    }
+
+    if (uWidth > 1) {
+      uint64_t ullBits = 0;
+      unsigned j;
+
+      // le premier mot est celui de poids faible, sauf si -B
+      for (j = 0; j < uWidth; j++) {
+        unsigned k = (r->ucFlags & MBREC_FLAG_WORD_SWAP) ? j : uWidth - 1 - j;
+        uint16_t usWord = usMbRecGet16 (&pucData[2 * (uWidth * i + k)]);
+
+        if (r->ucFlags & MBREC_FLAG_BYTE_SWAP) {
+          usWord = (usWord << 8) | (usWord >> 8);
+        }
+        ullBits = (ullBits << 16) | usWord;
+      }
+
+      switch (r->ucFormat) {
+        case eMbRecFormatInt:
+          printf (",%d", (int) (int32_t) ullBits);
+          break;
+        case eMbRecFormatFloat: {
+          uint32_t ulBits = ullBits;
+          float f;
+
+          memcpy (&f, &ulBits, sizeof (f));
+          printf (",%g", f);
+        }
+        break;
+        case eMbRecFormatInt64:
+          printf (",%"PRId64, (int64_t) ullBits);
+          break;
+        case eMbRecFormatUInt64:
+          printf (",%"PRIu64, ullBits);
+          break;
+        default: {
+          double d;
+
+          memcpy (&d, &ullBits, sizeof (d));
+          printf (",%.15g", d);
+        }
+        break;
+      }
+      continue;
+    }
+
+    switch (r->ucFormat) {
+      case eMbRecFormatInt16:
+        printf (",%d", (int16_t) usMbRecGet16 (&pucData[2 * i]));
+        break;
+      case eMbRecFormatHex:
+        printf (",0x%04X", usMbRecGet16 (&pucData[2 * i]));
+        break;
+      default:
+        printf (",%u", usMbRecGet16 (&pucData[2 * i]));
+        break;
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+// En-tête de flux et table des sources
+static void
+vReadStreamHeader (FILE * f) {
+  uint8_t ucHeader[MBREC_STREAM_HEADER_SIZE];
+  uint16_t usHeaderSize, usLen;
+  int i;
+
+  if ( (!bRead (f, ucHeader, MBREC_STREAM_HEADER_SIZE)) ||
+       (iMbRecStreamHeaderDecode (ucHeader, &usHeaderSize,
+                                  &usRecordHeaderSize, &usSourceCount) != 0) ||
+       (usRecordHeaderSize > RECORD_HEADER_MAX)) {
+
+    vFatal ("not an mbpoll binary stream");
+  }
+  for (i = MBREC_STREAM_HEADER_SIZE; i < usHeaderSize; i++) {
+
+    if (fgetc (f) == EOF) {
+      vFatal ("truncated stream");
+    }
+  }
+  psSource = calloc (usSourceCount, sizeof (char *));
+  if ( (psSource == NULL) && (usSourceCount > 0)) {
+    vFatal ("out of memory");
+  }
+  for (i = 0; i < usSourceCount; i++) {
+
+    if (!bRead (f, ucHeader, 2)) {
+      vFatal ("truncated stream");
+    }
+    usLen = usMbRecGet16 (ucHeader);
+    psSource[i] = calloc (usLen + 1, 1);
+    if ( (psSource[i] == NULL) || (!bRead (f, psSource[i], usLen))) {
+      vFatal ("truncated stream");
+    }
+  }
+  if (bHeader) {
+
+    printf ("# mbpoll binary stream version %d, %d source(s)\n",
+            MBREC_VERSION, usSourceCount);
+    for (i = 0; i < usSourceCount; i++) {
+      printf ("# source %d: %s\n", i, psSource[i]);
+    }
+  }
+  printf ("time,source,slave,function,reference,count,status,values\n");
+}
+
+// -----------------------------------------------------------------------------
+// Décode l'en-tête d'un enregistrement, false s'il est incohérent
+static bool
+bDecodeRecord (const uint8_t * pucHeader, xMbRecord * r) {
+
+  vMbRecHeaderDecode (pucHeader, r);
+  return (r->ulSize >= usRecordHeaderSize) &&
+         (r->ulElements * r->usElementSize <= r->ulSize - usRecordHeaderSize) &&
+         ( (r->usElementSize == 1) || (r->usElementSize == 2));
+}
+
+// -----------------------------------------------------------------------------
+// Colonnes d'un enregistrement qui précèdent les valeurs
+static void
+vPrintRecordStart (const xMbRecord * r) {
+  time_t t = r->ullRealtime / 1000000000ULL;
+  struct tm xTm;
+  char sTime[32];
+
+#ifdef _WIN32
+  gmtime_s (&xTm, &t);
+#else
+  gmtime_r (&t, &xTm);
+#endif
+  strftime (sTime, sizeof (sTime), "%Y-%m-%dT%H:%M:%S", &xTm);
+  printf ("%s.%03uZ,", sTime,
+          (unsigned) ( (r->ullRealtime / 1000000ULL) % 1000));
+  vPrintCsvString (r->usSource < usSourceCount ? psSource[r->usSource] : "");
+  printf (",%u,%s,%u,%u,", r->ucSlave,
+          r->ucFunction <= 4 ? sFunctionKeyList[r->ucFunction] : "",
+          r->ulRef, r->ulCount);
+  vPrintCsvString (r->lStatus ? modbus_strerror (r->lStatus) : "ok");
+}
+
+// -----------------------------------------------------------------------------
+// Une ligne csv par enregistrement
+static void
+vPrintRecord (xMbRecord * r, const uint8_t * pucData) {
+
+  vPrintRecordStart (r);
+  if (r->lStatus == 0) {
+    // jamais plus de valeurs que d'éléments présents
+    if ( (r->ucFormat != eMbRecFormatString) &&
+         (r->ulCount > r->ulElements / uMbRecFormatWidth (r->ucFormat))) {
+
+      r->ulCount = r->ulElements / uMbRecFormatWidth (r->ucFormat);
+    }
+    vPrintValues (r, pucData);
+  }
+  putchar ('\n');
+}
+
+// -----------------------------------------------------------------------------
+// Lecture d'un fichier ou de l'entrée standard
+static void
+vDumpFile (FILE * f) {
+  uint8_t ucHeader[RECORD_HEADER_MAX];
+  uint8_t * pucData = NULL;
+  size_t ulDataSize = 0;
+
+  vReadStreamHeader (f);
+  while (bRead (f, ucHeader, usRecordHeaderSize)) {
+    xMbRecord r;
+    size_t ulLen;
+
+    if (!bDecodeRecord (ucHeader, &r)) {
+      vFatal ("corrupted record");
+    }
+    ulLen = r.ulSize - usRecordHeaderSize;
+    if (ulLen > ulDataSize) {
+
+      pucData = realloc (pucData, ulLen);
+      if (pucData == NULL) {
+        vFatal ("out of memory");
+      }
+      ulDataSize = ulLen;
+    }
+    if ( (ulLen > 0) && (!bRead (f, pucData, ulLen))) {
+      vFatal ("truncated stream");
+    }
+    vPrintRecord (&r, pucData);
+  }
+  free (pucData);
+}
+
+// -----------------------------------------------------------------------------
+// Valeur décodée d'un fichier --ts, affichée comme le fait mbpoll. Les
+// entiers de 64 bits sont rangés tels quels, les autres valeurs en double.
+static void
+vPrintTsValue (const xMbTsBlock * b, uint64_t ullValue) {
+  double v;
+
+  memcpy (&v, &ullValue, sizeof (v));
+  switch (b->ucFormat) {
+    case eMbRecFormatBin:
+      printf (",%c", v != 0 ? '1' : '0');
+      break;
+    case eMbRecFormatHex:
+      printf (",0x%04X", (unsigned) v);
+      break;
+    case eMbRecFormatFloat:
+      printf (",%g", v);
+      break;
+    case eMbRecFormatDouble:
+      printf (",%.15g", v);
+      break;
+    case eMbRecFormatInt64:
+      printf (",%"PRId64, (int64_t) ullValue);
+      break;
+    case eMbRecFormatUInt64:
+      printf (",%"PRIu64, ullValue);
+      break;
+    default:
+      printf (",%.0f", v);
+      break;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Lecture d'un fichier de séries temporelles (mbpoll --ts), une ligne csv par
+// lecture. Chaque colonne d'un bloc est décodée en une fois.
+static void
+vDumpTs (const char * sPath) {
+  FILE * f = fopen (sPath, "rb");
+  uint32_t ulPeriod;
+  xMbTsChunk c;
+  int iRet;
+
+  if (f == NULL) {
+
+    perror (sPath);
+    exit (EXIT_FAILURE);
+  }
+  if (iMbTsReadHeader (f, &ulPeriod) != 0) {
+    vFatal ("not an mbpoll time series file");
+  }
+  if (bHeader) {
+    printf ("# mbpoll time series version %d, %u s chunks\n", MBTS_VERSION,
+            ulPeriod);
+  }
+  vReadStreamHeader (f);
+
+  while ( (iRet = iMbTsReadChunk (f, &c)) > 0) {
+    xMbTsBlock b;
+
+    while ( (iRet = iMbTsNextBlock (&c, &b)) > 0) {
+      uint64_t * pullTime = malloc ( (b.ulRows + 1) * sizeof (uint64_t));
+      uint64_t * pullValue = malloc ( ( (size_t) b.ulRows * b.ulCount + 1) *
+                                      sizeof (uint64_t));
+      xMbRecord r = {
+        .usSource = b.usSource,
+        .ucSlave = b.ucSlave,
+        .ucFunction = b.ucFunction,
+        .ulRef = b.ulRef,
+        .ulCount = b.ulCount
+      };
+      char * sString = malloc (2 * b.ulCount + 1);
+      uint32_t i, j;
+
+      if ( (pullTime == NULL) || (pullValue == NULL) || (sString == NULL)) {
+        vFatal ("out of memory");
+      }
+      if (iMbTsDecodeTime (&b, pullTime) != 0) {
+        vFatal ("corrupted time column");
+      }
+      for (j = 0; j < b.ulCount; j++) {
+
+        if (iMbTsDecodeValues (&b, j,
+                               &pullValue[ (size_t) j * b.ulRows]) != 0) {
+          vFatal ("corrupted value column");
+        }
+      }
+      for (i = 0; i < b.ulRows; i++) {
+
+        r.ullRealtime = pullTime[i] * 1000000ULL;
+        vPrintRecordStart (&r);
+        if (b.ucFormat == eMbRecFormatString) {
+          size_t ulLen = 0;
+
+          // les caractères nuls de remplissage sont omis, comme par mbpoll
+          for (j = 0; j < b.ulCount; j++) {
+            uint64_t ullValue = pullValue[ (size_t) j * b.ulRows + i];
+            unsigned v;
+            double d;
+
+            memcpy (&d, &ullValue, sizeof (d));
+            v = (unsigned) d;
+
+            if ( (v >> 8) & 0xFF) {
+              sString[ulLen++] = (v >> 8) & 0xFF;
+            }
+            if (v & 0xFF) {
+              sString[ulLen++] = v & 0xFF;
+            }
+          }
+          sString[ulLen] = 0;
+          putchar (',');
+          vPrintCsvString (sString);
+        }
+        else for (j = 0; j < b.ulCount; j++) {
+
+          vPrintTsValue (&b, pullValue[ (size_t) j * b.ulRows + i]);
+        }
+        putchar ('\n');
+      }
+      free (pullTime);
+      free (pullValue);
+      free (sString);
+    }
+    vMbTsChunkFree (&c);
+    if (iRet < 0) {
+      break;
+    }
+  }
+  if (iRet < 0) {
+    vFatal ("corrupted chunk");
+  }
+  fclose (f);
+}
+
+#ifdef MBPOLL_SHM
+// -----------------------------------------------------------------------------
+static void
+vSigIntHandler (int sig) {
+
+  bStop = true;
+}
+
+// -----------------------------------------------------------------------------
+// Suivi d'un anneau en mémoire partagée (mbpoll --shm) jusqu'à CTRL+C
+static void
+vDumpShm (const char * sName) {
+  xMbShmReader xReader;
+  uint8_t * pucRecord = malloc (RECORD_MAX);
+  uint64_t ulLost = 0;
+  FILE * f;
+
+  if (pucRecord == NULL) {
+    vFatal ("out of memory");
+  }
+  if (iMbShmOpen (&xReader, sName) != 0) {
+
+    perror (sName);
+    exit (EXIT_FAILURE);
+  }
+  // la table des sources est lue comme celle d'un fichier
+  f = fmemopen ( (void *) xReader.pucStreamHeader, xReader.ulStreamHeaderSize,
+                 "rb");
+  if (f == NULL) {
+    vFatal ("out of memory");
+  }
+  vReadStreamHeader (f);
+  fclose (f);
+
+  signal (SIGINT, vSigIntHandler);
+  while (!bStop) {
+    long lLen = lMbShmRead (&xReader, pucRecord, RECORD_MAX);
+    xMbRecord r;
+
+    if (xReader.ulLost != ulLost) {
+
+      fflush (stdout);
+      fprintf (stderr, "%s: %llu record(s) lost\n", progname,
+               (unsigned long long) (xReader.ulLost - ulLost));
+      ulLost = xReader.ulLost;
+    }
+    if (lLen == 0) {
+
+      // rien de nouveau
+      fflush (stdout);
+      usleep (SHM_POLL_US);
+      continue;
+    }
+    if ( (lLen > 0) && (bDecodeRecord (pucRecord, &r)) &&
+         (r.ulSize <= (unsigned long) lLen)) {
+
+      vPrintRecord (&r, pucRecord + usRecordHeaderSize);
+    }
+  }
+  vMbShmClose (&xReader);
+  free (pucRecord);
+}
+
+// -----------------------------------------------------------------------------
+// Copie de l'image des registres (mbpoll --image), un enregistrement par bloc
+static void
+vDumpImage (const char * sName) {
+  xMbImageReader xReader;
+  uint8_t * pucElements = malloc (RECORD_MAX);
+  uint8_t * pucData = malloc (RECORD_MAX);
+  unsigned long i, j;
+  FILE * f;
+
+  if ( (pucElements == NULL) || (pucData == NULL)) {
+    vFatal ("out of memory");
+  }
+  if (iMbImageOpen (&xReader, sName) != 0) {
+
+    perror (sName);
+    exit (EXIT_FAILURE);
+  }
+  f = fmemopen ( (void *) xReader.pucStreamHeader, xReader.ulStreamHeaderSize,
+                 "rb");
+  if (f == NULL) {
+    vFatal ("out of memory");
+  }
+  vReadStreamHeader (f);
+  fclose (f);
+
+  for (i = 0; i < xReader.ulBlockCount; i++) {
+    const xMbImageBlock * b = &xReader.pxBlock[i];
+    xMbImageBlock xInfo;
+    xMbRecord r;
+
+    if ( ( (size_t) b->ulElements * b->ucElementSize > RECORD_MAX) ||
+         (iMbImageRead (&xReader, i, b->ulRef, b->ulElements, pucElements,
+                        &xInfo) != 0) ||
+         (! (xInfo.ucQuality & MBIMG_QUALITY_VALID))) {
+      continue;
+    }
+
+    memset (&r, 0, sizeof (r));
+    r.usSource = xInfo.usSource;
+    r.ucSlave = xInfo.ucSlave;
+    r.ucFunction = xInfo.ucFunction;
+    r.ucFormat = xInfo.ucFormat;
+    r.ucFlags = xInfo.ucFlags;
+    r.usElementSize = xInfo.ucElementSize;
+    r.ulRef = xInfo.ulRef;
+    r.ulElements = xInfo.ulElements;
+    r.ulCount = r.ulElements / uMbRecFormatWidth (r.ucFormat);
+    r.lStatus = xInfo.lStatus;
+    r.ullMonotonic = xInfo.ullMonotonic;
+    r.ullRealtime = xInfo.ullRealtime;
+
+    // les registres de l'image sont dans l'ordre de l'hôte
+    if (r.usElementSize == 1) {
+
+      memcpy (pucData, pucElements, r.ulElements);
+    }
+    else for (j = 0; j < r.ulElements; j++) {
+
+      vMbRecPut16 (&pucData[2 * j], ( (const uint16_t *) pucElements) [j]);
+    }
+    vPrintRecord (&r, pucData);
+  }
+  vMbImageClose (&xReader);
+  free (pucElements);
+  free (pucData);
+}
+#endif
+
+#ifdef MBPOLL_PUB
+// -----------------------------------------------------------------------------
+// Abonnement slave[:first[-last]] de -S
+static void
+vSubscribe (int iFd, const char * sSub) {
+  unsigned long ulFirst = 0, ulLast = UINT32_MAX;
+  int iSlave = -1;
+  char * p;
+
+  if (strncmp (sSub, "*", 1) != 0) {
+
+    iSlave = strtol (sSub, &p, 10);
+    if ( (p == sSub) || (iSlave < 0) || (iSlave > 255)) {
+      vUsage (stderr, EXIT_FAILURE);
+    }
+  }
+  else {
+    p = (char *) sSub + 1;
+  }
+  if (*p == ':') {
+    const char * sFirst = p + 1;
+
+    ulFirst = ulLast = strtoul (sFirst, &p, 10);
+    if (p == sFirst) {
+      vUsage (stderr, EXIT_FAILURE);
+    }
+    if (*p == '-') {
+      const char * sLast = p + 1;
+
+      ulLast = strtoul (sLast, &p, 10);
+      if (p == sLast) {
+        vUsage (stderr, EXIT_FAILURE);
+      }
+    }
+  }
+  if ( (*p != 0) || (ulLast < ulFirst) || (ulLast > UINT32_MAX)) {
+    vUsage (stderr, EXIT_FAILURE);
+  }
+  if (iMbPubSubscribe (iFd, iSlave, ulFirst, ulLast) != 0) {
+
+    perror ("subscribe");
+    exit (EXIT_FAILURE);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Suivi de la socket de mbpoll --pub : le flux reçu est celui d'un fichier
+static void
+vDumpPub (const char * sPath, const char ** psSub, int iSubCount) {
+  int i, iFd = iMbPubConnect (sPath);
+  FILE * f;
+
+  if (iFd < 0) {
+
+    perror (sPath);
+    exit (EXIT_FAILURE);
+  }
+  if (iSubCount == 0) {
+
+    vSubscribe (iFd, "*");
+  }
+  for (i = 0; i < iSubCount; i++) {
+
+    vSubscribe (iFd, psSub[i]);
+  }
+  f = fdopen (iFd, "rb");
+  if (f == NULL) {
+    vFatal ("out of memory");
+  }
+  // chaque ligne est transmise dès sa réception
+  setvbuf (stdout, NULL, _IOLBF, 0);
+  vDumpFile (f);
+  fclose (f);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+int
+main (int argc, char ** argv) {
+  const char * sShmName = NULL;
+  const char * sImageName = NULL;
+  const char * sTsPath = NULL;
+  const char * sPubPath = NULL;
+  const char ** psSub = NULL;
+  int iSubCount = 0;
+  FILE * f = stdin;
+  int i;
+
+  progname = argv[0];
+  for (i = 1; i < argc; i++) {
+
+    if (strcmp (argv[i], "-H") == 0) {
+      bHeader = true;
+    }
+    else if (strcmp (argv[i], "-h") == 0) {
+      vUsage (stdout, EXIT_SUCCESS);
+    }
+    else if ( (strcmp (argv[i], "-t") == 0) && (i + 1 < argc)) {
+      sTsPath = argv[++i];
+    }
+#ifdef MBPOLL_SHM
+    else if ( (strcmp (argv[i], "-s") == 0) && (i + 1 < argc)) {
+      sShmName = argv[++i];
+    }
+    else if ( (strcmp (argv[i], "-i") == 0) && (i + 1 < argc)) {
+      sImageName = argv[++i];
+    }
+#endif
+#ifdef MBPOLL_PUB
+    else if ( (strcmp (argv[i], "-u") == 0) && (i + 1 < argc)) {
+      sPubPath = argv[++i];
+    }
+    else if ( (strcmp (argv[i], "-S") == 0) && (i + 1 < argc)) {
+      psSub = realloc (psSub, (iSubCount + 1) * sizeof (char *));
+      if (psSub == NULL) {
+        vFatal ("out of memory");
+      }
+      psSub[iSubCount++] = argv[++i];
+    }
+#endif
+    else if ( (argv[i][0] == '-') || (f != stdin)) {
+      vUsage (stderr, EXIT_FAILURE);
+    }
+    else {
+      f = fopen (argv[i], "rb");
+      if (f == NULL) {
+        perror (argv[i]);
+        exit (EXIT_FAILURE);
+      }
+    }
+  }
+
+  if (sTsPath) {
+
+    vDumpTs (sTsPath);
+  }
+#ifdef MBPOLL_SHM
+  else if (sShmName) {
+
+    vDumpShm (sShmName);
+  }
+  else if (sImageName) {
+
+    vDumpImage (sImageName);
+  }
+#endif
+#ifdef MBPOLL_PUB
+  else if (sPubPath) {
+
+    vDumpPub (sPubPath, psSub, iSubCount);
+  }
+#endif
+  else {
+
+    vDumpFile (f);
+  }
+
+  for (i = 0; i < usSourceCount; i++) {
+    free (psSource[i]);
+  }
+  free (psSource);
+  free (psSub);
+  if (f != stdin) {
+    fclose (f);
+  }
+  return 0;
+}
+
+/* ========================================================================== */
@@ -24,7 +24,9 @@
 #include <getopt.h>
 #include <signal.h>
 #include <float.h>
+#include <math.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <assert.h>
 #include <modbus.h>
 #include <stdbool.h>
@@ -33,18 +35,38 @@
 #if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
 #include <unistd.h>
 #include <sys/time.h>
+#include <pthread.h>
 #endif
 #ifdef _WIN32
 #include <windows.h>
 #endif
 #include "serial.h"
 #include "custom-rts.h"
+#include "poll-timer.h"
+#include "mbtcp.h"
+#include "tcp-engine.h"
+#include "read-plan.h"
+#include "reg-decode.h"
+#include "reg-map.h"
+#include "bit-pack.h"
+#include "out-buffer.h"
+#include "out-queue.h"
+#include "mb-record.h"
+#include "rbe.h"
+#include "mb-shm.h"
+#include "mb-image.h"
+#include "mb-ts.h"
+#include "mb-pub.h"
+#include "mb-metrics.h"
 #include "version-git.h"
 #include "mbpoll-config.h"
 
 /* constants ================================================================ */
 #define AUTHORS "Pascal JEAN"
 #define WEBSITE "https://github.com/epsilonrt/mbpoll"
+#ifndef STDOUT_FILENO
+#define STDOUT_FILENO 1
+#endif
 
 /* conditionals ============================================================= */
 #if defined(__GNUC__) && __SIZEOF_FLOAT__ != 4 && !defined (__STDC_IEC_559__)
@@ -52,6 +74,11 @@
 # define MBPOLL_FLOAT_DISABLE
 #endif
 
+// Chaque bus série supplémentaire est scruté par un thread POSIX
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#define MBPOLL_SERIAL_BUSES 1
+#endif
+
 /* macros =================================================================== */
 #define BASENAME(f) (f)
 
@@ -61,6 +88,17 @@
 # define BASENAME(f) basename(f)
 #endif
 
+// l'affichage des threads (bus, workers) est sérialisé par le verrou de stdout
+#define LOCK_OUTPUT()
+#define UNLOCK_OUTPUT()
+
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+# undef LOCK_OUTPUT
+# undef UNLOCK_OUTPUT
+# define LOCK_OUTPUT() flockfile (stdout)
+# define UNLOCK_OUTPUT() funlockfile (stdout)
+#endif
+
 #ifndef NDEBUG
 #define PDEBUG(fmt,...) printf("%s:%d: %s(): " fmt, BASENAME(__FILE__), __LINE__, __FUNCTION__, ##__VA_ARGS__)
 #else
@@ -97,9 +135,50 @@ typedef enum {
   eFormatInt,
   eFormatFloat,
   eFormatBin,
+  eFormatInt64,
+  eFormatUInt64,
+  eFormatDouble,
   eFormatUnknown = -1,
 } eFormats;
 
+typedef enum {
+  eOutputText,
+  eOutputCsv,
+  eOutputJsonl,
+  eOutputBinary,
+} eOutputs;
+
+// affichage des bobines et des entrées
+typedef enum {
+  eBitsList,
+  eBitsHex,
+  eBitsString,
+} eBits;
+
+// options longues sans équivalent court
+typedef enum {
+  eOptOverrun = 0x100,
+  eOptSweep,
+  eOptGap,
+  eOptGroup,
+  eOptWindow,
+  eOptBus,
+  eOptThreads,
+  eOptMerge,
+  eOptOutput,
+  eOptRbe,
+  eOptDeadband,
+  eOptShm,
+  eOptImage,
+  eOptTs,
+  eOptQueue,
+  eOptPub,
+  eOptMetrics,
+  eOptOrder,
+  eOptMap,
+  eOptBits,
+} eLongOptions;
+
 /* macros =================================================================== */
 #define SIZEOF_ILIST(list) (sizeof(list)/sizeof(int))
 /*
@@ -110,6 +189,13 @@ typedef enum {
 #define DUINT16(p,i) ((uint16_t *)(p))[i]
 #define DINT32(p,i) ((int32_t *)(p))[i]
 #define DFLOAT(p,i) ((float *)(p))[i]
+#define DINT64(p,i) ((int64_t *)(p))[i]
+#define DUINT64(p,i) ((uint64_t *)(p))[i]
+#define DDOUBLE(p,i) ((double *)(p))[i]
+// chiffres significatifs affichés pour un double
+#define DOUBLE_DIGITS 15
+// entête "-- Polling slave" du mode texte
+#define HEADER_SIZE 320
 
 /* constants ================================================================ */
 static const char * sModeList[] = {
@@ -151,13 +237,17 @@ static const char * sFormatList[] = {
   "int16",
   "hex",
   "string",
-  "int"
+  "int",
+  "int64",
+  "uint64"
 };
 static const int iFormatList[] = {
   eFormatInt16,
   eFormatHex,
   eFormatString,
-  eFormatInt
+  eFormatInt,
+  eFormatInt64,
+  eFormatUInt64
 };
 #else
 static const char * sFormatList[] = {
@@ -165,16 +255,42 @@ static const char * sFormatList[] = {
   "hex",
   "string",
   "int",
-  "float"
+  "float",
+  "int64",
+  "uint64",
+  "double"
 };
 static const int iFormatList[] = {
   eFormatInt16,
   eFormatHex,
   eFormatString,
   eFormatInt,
-  eFormatFloat
+  eFormatFloat,
+  eFormatInt64,
+  eFormatUInt64,
+  eFormatDouble
 };
 #endif
+static const char * sOrderList[] = {
+  "ABCD",
+  "CDAB",
+  "BADC",
+  "DCBA"
+};
+static const int iOrderList[] = {
+  eRegOrderABCD,
+  eRegOrderCDAB,
+  eRegOrderBADC,
+  eRegOrderDCBA
+};
+static const char * sOverrunList[] = {
+  "skip",
+  "catchup"
+};
+static const int iOverrunList[] = {
+  ePollOverrunSkip,
+  ePollOverrunCatchUp
+};
 static const char * sFunctionList[] = {
   "discrete output (coil)",
   "discrete input",
@@ -187,6 +303,35 @@ static const int iFunctionList[] = {
   eFuncInputReg,
   eFuncHoldingReg
 };
+// noms des fonctions dans les enregistrements csv et jsonl
+static const char * sFunctionKeyList[] = {
+  "coil",
+  "discrete-input",
+  "input-register",
+  "holding-register"
+};
+static const char * sOutputList[] = {
+  "text",
+  "csv",
+  "jsonl",
+  "binary"
+};
+static const int iOutputList[] = {
+  eOutputText,
+  eOutputCsv,
+  eOutputJsonl,
+  eOutputBinary
+};
+static const char * sBitsList[] = {
+  "list",
+  "hex",
+  "string"
+};
+static const int iBitsList[] = {
+  eBitsList,
+  eBitsHex,
+  eBitsString
+};
 
 static const char sModeStr[] = "mode";
 static const char sSlaveAddrStr[] = "slave address";
@@ -197,6 +342,25 @@ static const char sRtuBaudrateStr[] = "rtu baudrate";
 static const char sTcpPortStr[] = "tcp port";
 static const char sTimeoutStr[] = "timeout";
 static const char sPollRateStr[] = "poll rate";
+static const char sOverrunStr[] = "overrun policy";
+static const char sGapStr[] = "inter-slave gap";
+static const char sGroupStr[] = "poll group";
+static const char sWindowStr[] = "tcp window";
+static const char sBusStr[] = "serial bus";
+static const char sThreadsStr[] = "number of threads";
+static const char sMergeStr[] = "merge gap";
+static const char sOutputStr[] = "output format";
+static const char sRbeStr[] = "full refresh interval";
+static const char sDeadbandStr[] = "deadband";
+static const char sShmStr[] = "shared memory ring";
+static const char sImageStr[] = "register image";
+static const char sTsStr[] = "time series file";
+static const char sQueueStr[] = "output queue";
+static const char sPubStr[] = "publish socket";
+static const char sMetricsStr[] = "metrics endpoint";
+static const char sOrderStr[] = "byte order";
+static const char sMapStr[] = "register map";
+static const char sBitsStr[] = "bit output format";
 static const char sFunctionStr[] = "function";
 static const char sFormatStr[] = "format";
 static const char sNumOfValuesStr[] = "number of values";
@@ -205,6 +369,9 @@ static const char sDataStr[] = "data";
 static const char sUnknownStr[] = "unknown";
 static const char sIntStr[] = "32-bit integer";
 static const char sFloatStr[] = "32-bit float";
+static const char sInt64Str[] = "64-bit integer";
+static const char sUInt64Str[] = "64-bit unsigned integer";
+static const char sDoubleStr[] = "64-bit float";
 static const char sWordStr[] = "16-bit register";
 static const char sLittleEndianStr[] = "(little endian)";
 static const char sBigEndianStr[] = "(big endian)";
@@ -217,6 +384,65 @@ static const char sRtsPinStr[] = "RTS pin";
 /* structures =============================================================== */
 typedef struct xChipIoContext xChipIoContext;
 
+// Groupe de scrutation : un bloc lu avec sa propre période
+typedef struct xPollGroup {
+  int iIndex;
+  eFunctions eFunction;
+  eFormats eFormat;
+  int iStartRef;
+  int iCount;
+  int iPollRate;
+  xReadPlan xPlan; // le bloc du groupe, découpé en PDU
+  xPollTimer xTimer;
+} xPollGroup;
+
+// Echantillon : les valeurs d'un bloc lu sur un esclave, ou son erreur
+typedef struct xSample {
+  struct timespec xTime; // heure de la lecture (UTC)
+  uint64_t ulMonotonic; // horloge monotone de la lecture en ns
+  const char * sWhere; // port série ou hôte:port
+  int iSource; // indice de sWhere dans la table des sources du flux binaire
+  int iSlave;
+  eFunctions eFunction;
+  eFormats eFormat;
+  int iRef;
+  int iCount;
+  const void * pvData;
+  const void * pvValue; // valeurs de 32 ou 64 bits décodées par vReportSample()
+  const uint64_t * pullBits; // bits rangés par vReportSample(), ou NULL
+  int iError; // 0 si la lecture a réussi
+  // mode texte : entête de l'esclave, affiché avant le premier échantillon
+  // puis vidé, un cycle sans changement avec --rbe n'affiche donc rien
+  char * sHeader;
+} xSample;
+
+// Destination d'un flux binaire, les octets lui sont transmis par morceaux
+typedef void (*vSinkWrite) (void * pvSink, const void * pvData, size_t ulLen);
+
+// Zone mémoire agrandie au fur et à mesure
+typedef struct xMemSink {
+  uint8_t * pucData;
+  size_t ulLen;
+} xMemSink;
+
+// Bus série scruté par son propre thread, avec ses réglages et ses esclaves
+typedef struct xSerialBus {
+  char * sDevice;
+  xSerialIos xIos;
+  int * piSlaveAddr;
+  int iSlaveCount;
+  modbus_t * xBus;
+  xReadPlan xPlan; // chaque thread a ses propres zones de lecture
+  unsigned long ulTxCount;
+  unsigned long ulRxCount;
+  unsigned long ulErrorCount;
+  xPollTimer xTimer;
+  xOutBuffer xOut;
+#ifdef MBPOLL_SERIAL_BUSES
+  pthread_t xThread;
+#endif
+} xSerialBus;
+
 typedef struct xMbPollContext {
 
   // Paramètres
@@ -226,12 +452,44 @@ typedef struct xMbPollContext {
   int * piSlaveAddr;
   int iSlaveCount;
   int * piStartRef;
+  int * piRefCount; // nombre de valeurs lues à chaque référence
   int iStartCount;
   int iCount;
   int iPollRate;
+  ePollOverrun eOverrun;
+  bool bIsSweep;
+  int iGap;
+  char ** psGroupSpec;
+  int iGroupCount;
   double dTimeout;
   char * sTcpPort;
   char * sDevice;
+  char ** psHost;
+  char ** psHostPort;
+  int iHostCount;
+  int iWindow;
+  int iThreads;
+  int iMergeGap;
+  eOutputs eOutput;
+  eBits eBits;
+  bool bIsRbe;
+  int iRbeRefresh; // période de signalement de toutes les valeurs en s
+  xRbeBand * pxBand;
+  int iBandCount;
+  char * sShmName; // anneau en mémoire partagée, NULL si absent
+  int iShmSize; // taille de l'anneau en Kio
+  char * sImageName; // image des registres en mémoire partagée, NULL si absente
+  char * sTsFile; // fichier de séries temporelles, NULL si absent
+  int iTsChunk; // durée d'un tronçon du fichier en s
+  int iQueueSize; // file du thread d'écriture en Kio, 0 si écriture directe
+  bool bQueueBlock; // attendre plutôt que perdre lorsque la file est pleine
+  char * sPubPath; // socket Unix de publication, NULL si absente
+  int iPubQueue; // file d'un client de la socket en Kio
+  char * sMetricsHost; // adresse d'écoute de --metrics
+  char * sMetricsPort; // port de --metrics, NULL si absent
+  char * sMapFile; // description des champs d'un bloc, NULL si absente
+  char ** psBusSpec;
+  int iBusCount;
   xSerialIos xRtu;
   int iRtuBaudrate;
   eSerialDataBits eRtuDatabits;
@@ -246,24 +504,54 @@ typedef struct xMbPollContext {
   int iPduOffset;
   bool bWriteSingleAsMany;
   bool bIsChipIo;
-  bool bIsBigEndian;
+  eRegOrder eOrder;
   bool bIsQuiet;
 #ifdef MBPOLL_GPIO_RTS
   int iRtsPin;
 #endif
 
   // Variables de travail
+  volatile sig_atomic_t bIsInterrupted; // CTRL+C reçu, voir vSigIntHandler()
   modbus_t * xBus;
   void * pvData;
   int iTxCount;
   int iRxCount;
   int iErrorCount;
+  xPollTimer xTimer;
+  xPollGroup * pxGroup;
+  xTcpEngine * xEngine;
+  xMbTcpRequest * pxRequest;
+  uint16_t usTid;
+  xSerialBus * pxBus;
+  xReadPlan xPlan;
+  xRegOrder xOrder32; // permutations de --order, valeurs de 32 et 64 bits
+  xRegOrder xOrder64;
+  xRegMap xMap; // champs de --map
+  xOutBuffer xOut;
+  xRbe xRbe;
+#ifdef MBPOLL_SHM
+  xMbShmWriter xShm;
+  xMbImageWriter xImage;
+#endif
+  xMbTsWriter xTs;
+#ifdef MBPOLL_OUT_QUEUE
+  xOutQueue xQueue;
+#endif
+#ifdef MBPOLL_PUB
+  xMbPubServer xPub;
+#endif
+#ifdef MBPOLL_METRICS
+  xMbMetricsServer xMetrics;
+#endif
 
   xChipIoContext * xChip; // TODO: séparer la partie chipio
 } xMbPollContext;
 
 /* private variables ======================================================== */
 
+// texte d'un cycle, écrit par un seul write()
+static char cOutBuffer[OUTPUT_BUFFER_SIZE];
+
 static xMbPollContext ctx = {
   // Paramètres
   .eMode = DEFAULT_MODE,
@@ -272,12 +560,42 @@ static xMbPollContext ctx = {
   .piSlaveAddr = NULL,
   .iSlaveCount = -1,
   .piStartRef = NULL,
+  .piRefCount = NULL,
   .iStartCount = -1,
   .iCount = DEFAULT_NUMOFVALUES,
   .iPollRate = DEFAULT_POLLRATE,
+  .eOverrun = ePollOverrunSkip,
+  .bIsSweep = false,
+  .iGap = 0,
+  .psGroupSpec = NULL,
+  .iGroupCount = 0,
   .dTimeout = DEFAULT_TIMEOUT,
   .sTcpPort = DEFAULT_TCP_PORT,
   .sDevice = NULL,
+  .psHost = NULL,
+  .psHostPort = NULL,
+  .iHostCount = 0,
+  .iWindow = DEFAULT_TCP_WINDOW,
+  .iThreads = DEFAULT_TCP_THREADS,
+  .iMergeGap = DEFAULT_MERGE_GAP,
+  .eOutput = eOutputText,
+  .eBits = eBitsList,
+  .bIsRbe = false,
+  .iRbeRefresh = 0,
+  .sShmName = NULL,
+  .iShmSize = DEFAULT_SHM_SIZE,
+  .sImageName = NULL,
+  .sTsFile = NULL,
+  .iTsChunk = DEFAULT_TS_CHUNK,
+  .iQueueSize = 0,
+  .bQueueBlock = false,
+  .sPubPath = NULL,
+  .iPubQueue = DEFAULT_PUB_QUEUE,
+  .sMetricsHost = NULL,
+  .sMetricsPort = NULL,
+  .sMapFile = NULL,
+  .psBusSpec = NULL,
+  .iBusCount = 0,
   .xRtu = {
     .baud = DEFAULT_RTU_BAUDRATE,
     .dbits = DEFAULT_RTU_DATABITS,
@@ -294,7 +612,7 @@ static xMbPollContext ctx = {
   .iPduOffset = 1,
   .bWriteSingleAsMany = false,
   .bIsChipIo = false,
-  .bIsBigEndian = false,
+  .eOrder = eRegOrderCDAB,
   .bIsQuiet = false,
 #ifdef MBPOLL_GPIO_RTS
   .iRtsPin = -1,
@@ -302,7 +620,12 @@ static xMbPollContext ctx = {
 
   // Variables de travail
   .xBus = NULL,
-  .pvData = NULL
+  .pvData = NULL,
+  .pxGroup = NULL,
+  .xEngine = NULL,
+  .pxRequest = NULL,
+  .usTid = 0,
+  .pxBus = NULL
 };
 
 #ifdef USE_CHIPIO
@@ -336,9 +659,64 @@ static const char * short_options = "m:a:r:c:t:1l:o:p:b:d:s:P:u0WRFhVvwBq";
 // -----------------------------------------------------------------------------
 #endif /* USE_CHIPIO == 0 */
 
+static const struct option long_options[] = {
+  {"overrun", required_argument, NULL, eOptOverrun},
+  {"sweep", no_argument, NULL, eOptSweep},
+  {"gap", required_argument, NULL, eOptGap},
+  {"group", required_argument, NULL, eOptGroup},
+  {"window", required_argument, NULL, eOptWindow},
+  {"bus", required_argument, NULL, eOptBus},
+  {"threads", required_argument, NULL, eOptThreads},
+  {"merge", required_argument, NULL, eOptMerge},
+  {"output", required_argument, NULL, eOptOutput},
+  {"rbe", required_argument, NULL, eOptRbe},
+  {"deadband", required_argument, NULL, eOptDeadband},
+  {"shm", required_argument, NULL, eOptShm},
+  {"image", required_argument, NULL, eOptImage},
+  {"ts", required_argument, NULL, eOptTs},
+  {"queue", required_argument, NULL, eOptQueue},
+  {"pub", required_argument, NULL, eOptPub},
+  {"metrics", required_argument, NULL, eOptMetrics},
+  {"order", required_argument, NULL, eOptOrder},
+  {"map", required_argument, NULL, eOptMap},
+  {"bits", required_argument, NULL, eOptBits},
+  {NULL, 0, NULL, 0}
+};
+
 /* private functions ======================================================== */
 void vAllocate (xMbPollContext * ctx);
-void vPrintReadValues (int iAddr, int iCount, xMbPollContext * ctx);
+void * pvAllocateData (eFunctions eFunction, eFormats eFormat, int iCount);
+int iRegCount (eFormats eFormat, int iCount);
+int iFunctionCode (eFunctions eFunction);
+int iReadValues (modbus_t * xBus, eFunctions eFunction, int iStartReg,
+                 int iNbReg, void * pvData);
+void vPrintReadValues (xOutBuffer * o, int iAddr, int iCount,
+                       eFormats eFormat, const void * pvData);
+void vFlushOutput (xOutBuffer * o);
+void vNewReadPlan (xReadPlan * p, const xMbPollContext * ctx);
+int iReadPlan (modbus_t * xBus, eFunctions eFunction, xReadPlan * p);
+void vPrintReadPlan (xOutBuffer * o, const xReadPlan * p,
+                     const xMbPollContext * ctx, int iSlave,
+                     const char * sWhere, int iSource, char * sHeader);
+void vSampleNow (xSample * xSmp);
+void vPrintSample (xOutBuffer * o, const xSample * xSmp);
+void vReportSample (xOutBuffer * o, const xSample * xSmp);
+void vPrintRecordHeader (void);
+void vWriteStreamHeader (vSinkWrite vWrite, void * pvSink);
+void vMemSinkWrite (void * pvSink, const void * pvData, size_t ulLen);
+#ifdef MBPOLL_SHM
+void vCreateImage (void);
+#endif
+#ifdef MBPOLL_METRICS
+void vCountPlanMetrics (const xReadPlan * p, int iSource, int iSlave);
+#endif
+void vGetGroup (const char * sSpec, xPollGroup * g, const xMbPollContext * ctx);
+void vPollGroups (xMbPollContext * ctx);
+void vGetHostList (const char * sList, xMbPollContext * ctx);
+void vPollHosts (xMbPollContext * ctx);
+void vReadPipeline (xMbPollContext * ctx, int iSlave);
+void vGetBus (const char * sSpec, xSerialBus * b, const xMbPollContext * ctx);
+void vPollBuses (xMbPollContext * ctx);
 void vPrintConfig (const xMbPollContext * ctx);
 void vPrintCommunicationSetup (const xMbPollContext * ctx);
 void vReportSlaveID (const xMbPollContext * ctx);
@@ -351,9 +729,15 @@ void vFailureExit (bool bHelp, const char *format, ...);
 #define vIoErrorExit(fmt,...) vFailureExit(false,fmt,##__VA_ARGS__)
 void vCheckEnum (const char * sName, int iElmt, const int * iList, int iSize);
 void vCheckIntRange (const char * sName, int i, int min, int max);
+void vCheckReadRange (int iStartReg, int iNbReg);
 void vCheckDoubleRange (const char * sName, double d, double min, double max);
 int iGetInt (const char * sName, const char * sNum, int iBase);
+int64_t llGetInt64 (const char * sName, const char * sNum);
+uint64_t ullGetUInt64 (const char * sName, const char * sNum);
 int * iGetIntList (const char * sName, const char * sList, int * iLen);
+xRbeBand * pxGetBandList (const char * sName, const char * sList, int * iLen);
+int * iGetRefList (const char * sName, const char * sList, int * iLen,
+                   int ** piCount);
 void vPrintIntList (int * iList, int iLen);
 double dGetDouble (const char * sName, const char * sNum);
 int iGetEnum (const char * sName, char * sElmt, const char ** psStrList,
@@ -363,9 +747,9 @@ const char * sEnumToStr (int iElmt, const int * iList,
 const char * sFunctionToStr (eFunctions eFunction);
 const char * sModeToStr (eModes eMode);
 void vSigIntHandler (int sig);
-float fSwapFloat (float f);
-int32_t lSwapLong (int32_t l);
+void vTerminate (void);
 void mb_delay (unsigned long d);
+void vPollWait (xMbPollContext * ctx);
 
 #if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
 // Portage des fonctions Microsoft
@@ -387,6 +771,10 @@ _strlwr (char * str) {
 // posix
 #define strcasecmp _stricmp
 
+// -----------------------------------------------------------------------------
+// posix, strtok_s() de C11 annexe K a les mêmes paramètres
+#define strtok_r strtok_s
+
 // -----------------------------------------------------------------------------
 // posix
 static char *
@@ -435,6 +823,21 @@ index (const char *s, int c) {
   return NULL;
 }
 
+// -----------------------------------------------------------------------------
+// posix
+static char *
+rindex (const char *s, int c) {
+  const char * p = NULL;
+
+  while ( (s) && (*s)) {
+    if (c == *s) {
+      p = s;
+    }
+    s++;
+  }
+  return (char *) p;
+}
+
 #endif
 
 /* main ===================================================================== */
@@ -445,10 +848,11 @@ main (int argc, char **argv) {
   char * p;
 
   progname = argv[0];
+  vOutBufferInit (&ctx.xOut, STDOUT_FILENO, cOutBuffer, sizeof (cOutBuffer));
 
   do  {
 
-    iNextOption = getopt (argc, argv, short_options);
+    iNextOption = getopt_long (argc, argv, short_options, long_options, NULL);
     opterr = 0;
     switch (iNextOption) {
 
@@ -469,7 +873,9 @@ main (int argc, char **argv) {
         break;
 
       case 'r':
-        ctx.piStartRef = iGetIntList (sStartRefStr, optarg, &ctx.iStartCount);
+        free (ctx.piRefCount);
+        ctx.piStartRef = iGetRefList (sStartRefStr, optarg, &ctx.iStartCount,
+                                      &ctx.piRefCount);
         break;
 
       case 'c':
@@ -499,7 +905,21 @@ main (int argc, char **argv) {
         break;
 
       case 'B':
-        ctx.bIsBigEndian = true;
+        ctx.eOrder = eRegOrderABCD;
+        break;
+
+      case eOptOrder:
+        ctx.eOrder = iGetEnum (sOrderStr, optarg, sOrderList, iOrderList,
+                               SIZEOF_ILIST (iOrderList));
+        break;
+
+      case eOptMap:
+        ctx.sMapFile = optarg;
+        break;
+
+      case eOptBits:
+        ctx.eBits = iGetEnum (sBitsStr, optarg, sBitsList, iBitsList,
+                              SIZEOF_ILIST (iBitsList));
         break;
 
       case 'R':
@@ -536,6 +956,247 @@ main (int argc, char **argv) {
         }
         break;
 
+      case eOptOverrun:
+        ctx.eOverrun = iGetEnum (sOverrunStr, optarg, sOverrunList,
+                                 iOverrunList, SIZEOF_ILIST (iOverrunList));
+        break;
+
+      case eOptSweep:
+        ctx.bIsSweep = true;
+        break;
+
+      case eOptGap:
+        ctx.iGap = iGetInt (sGapStr, optarg, 0);
+        vCheckIntRange (sGapStr, ctx.iGap, 0, INT_MAX);
+        ctx.bIsSweep = true;
+        break;
+
+      case eOptGroup:
+        ctx.psGroupSpec = realloc (ctx.psGroupSpec,
+                                   (ctx.iGroupCount + 1) * sizeof (char *));
+        assert (ctx.psGroupSpec);
+        ctx.psGroupSpec[ctx.iGroupCount++] = optarg;
+        break;
+
+      case eOptWindow:
+        ctx.iWindow = iGetInt (sWindowStr, optarg, 0);
+        vCheckIntRange (sWindowStr, ctx.iWindow, 1, MBTCP_WINDOW_MAX);
+#ifndef MBPOLL_TCP_PIPELINE
+        if (ctx.iWindow > 1) {
+
+          vSyntaxErrorExit ("%s is not supported on this platform", sWindowStr);
+        }
+#endif
+        break;
+
+      case eOptBus:
+        ctx.psBusSpec = realloc (ctx.psBusSpec,
+                                 (ctx.iBusCount + 1) * sizeof (char *));
+        assert (ctx.psBusSpec);
+        ctx.psBusSpec[ctx.iBusCount++] = optarg;
+        break;
+
+      case eOptThreads:
+        ctx.iThreads = iGetInt (sThreadsStr, optarg, 0);
+        vCheckIntRange (sThreadsStr, ctx.iThreads, 0, TCP_THREADS_MAX);
+        if (ctx.iThreads == 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+          // un worker par coeur
+          ctx.iThreads = MIN (MAX (sysconf (_SC_NPROCESSORS_ONLN), 1),
+                              TCP_THREADS_MAX);
+#else
+          ctx.iThreads = 1;
+#endif
+        }
+        break;
+
+      case eOptMerge:
+        ctx.iMergeGap = iGetInt (sMergeStr, optarg, 0);
+        vCheckIntRange (sMergeStr, ctx.iMergeGap, -1, MODBUS_MAX_READ_BITS);
+        break;
+
+      case eOptOutput:
+        ctx.eOutput = iGetEnum (sOutputStr, optarg, sOutputList, iOutputList,
+                                SIZEOF_ILIST (iOutputList));
+        // seuls les enregistrements sont écrits sur la sortie standard
+        ctx.bIsQuiet |= (ctx.eOutput != eOutputText);
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+        if ( (ctx.eOutput == eOutputBinary) && isatty (STDOUT_FILENO)) {
+
+          vSyntaxErrorExit ("binary output must be redirected to a file or a pipe");
+        }
+#endif
+        break;
+
+      case eOptRbe:
+        ctx.bIsRbe = true;
+        ctx.iRbeRefresh = iGetInt (sRbeStr, optarg, 0);
+        vCheckIntRange (sRbeStr, ctx.iRbeRefresh, 0, RBE_REFRESH_MAX);
+        break;
+
+      case eOptDeadband:
+        // sans --rbe, les valeurs ne sont jamais toutes signalées
+        ctx.bIsRbe = true;
+        free (ctx.pxBand);
+        ctx.pxBand = pxGetBandList (sDeadbandStr, optarg, &ctx.iBandCount);
+        break;
+
+      case eOptShm: {
+#ifdef MBPOLL_SHM
+        char * p;
+
+        // nom[:taille en Kio]
+        free (ctx.sShmName);
+        ctx.sShmName = strdup (optarg);
+        assert (ctx.sShmName);
+        p = strchr (ctx.sShmName, ':');
+        if (p) {
+
+          *p++ = 0;
+          ctx.iShmSize = iGetInt (sShmStr, p, 0);
+          vCheckIntRange (sShmStr, ctx.iShmSize, SHM_SIZE_MIN, SHM_SIZE_MAX);
+        }
+        if ( (ctx.sShmName[0] != '/') || (strchr (&ctx.sShmName[1], '/'))) {
+
+          vSyntaxErrorExit ("Illegal %s name: %s", sShmStr, ctx.sShmName);
+        }
+#else
+        vSyntaxErrorExit ("%s is not supported on this platform", sShmStr);
+#endif
+      }
+      break;
+
+      case eOptImage:
+#ifdef MBPOLL_SHM
+        free (ctx.sImageName);
+        ctx.sImageName = strdup (optarg);
+        assert (ctx.sImageName);
+        if ( (ctx.sImageName[0] != '/') || (strchr (&ctx.sImageName[1], '/'))) {
+
+          vSyntaxErrorExit ("Illegal %s name: %s", sImageStr, ctx.sImageName);
+        }
+#else
+        vSyntaxErrorExit ("%s is not supported on this platform", sImageStr);
+#endif
+        break;
+
+      case eOptTs: {
+        char * p;
+
+        // fichier[:durée d'un tronçon en s]
+        free (ctx.sTsFile);
+        ctx.sTsFile = strdup (optarg);
+        assert (ctx.sTsFile);
+        p = strrchr (ctx.sTsFile, ':');
+        if (p) {
+
+          *p++ = 0;
+          ctx.iTsChunk = iGetInt (sTsStr, p, 0);
+          vCheckIntRange (sTsStr, ctx.iTsChunk, TS_CHUNK_MIN, TS_CHUNK_MAX);
+        }
+      }
+      break;
+
+      case eOptQueue: {
+#ifdef MBPOLL_OUT_QUEUE
+        char * sPolicy = strdup (optarg);
+        char * p;
+
+        // politique[:taille en Kio]
+        assert (sPolicy);
+        ctx.iQueueSize = DEFAULT_QUEUE_SIZE;
+        p = strchr (sPolicy, ':');
+        if (p) {
+
+          *p++ = 0;
+          ctx.iQueueSize = iGetInt (sQueueStr, p, 0);
+          vCheckIntRange (sQueueStr, ctx.iQueueSize, QUEUE_SIZE_MIN,
+                          QUEUE_SIZE_MAX);
+        }
+        if (strcasecmp (sPolicy, "drop") == 0) {
+
+          ctx.bQueueBlock = false;
+        }
+        else if (strcasecmp (sPolicy, "block") == 0) {
+
+          ctx.bQueueBlock = true;
+        }
+        else {
+
+          vSyntaxErrorExit ("Illegal %s policy: %s", sQueueStr, sPolicy);
+        }
+        free (sPolicy);
+#else
+        vSyntaxErrorExit ("%s is not supported on this platform", sQueueStr);
+#endif
+      }
+      break;
+
+      case eOptPub: {
+#ifdef MBPOLL_PUB
+        char * p;
+
+        // chemin[:taille de la file d'un client en Kio]
+        free (ctx.sPubPath);
+        ctx.sPubPath = strdup (optarg);
+        assert (ctx.sPubPath);
+        p = strrchr (ctx.sPubPath, ':');
+        if (p) {
+
+          *p++ = 0;
+          ctx.iPubQueue = iGetInt (sPubStr, p, 0);
+          vCheckIntRange (sPubStr, ctx.iPubQueue, PUB_QUEUE_MIN, PUB_QUEUE_MAX);
+        }
+#else
+        vSyntaxErrorExit ("%s is not supported on this platform", sPubStr);
+#endif
+      }
+      break;
+
+      case eOptMetrics: {
+#ifdef MBPOLL_METRICS
+        char * sArg = strdup (optarg);
+        char * p;
+        size_t ulLen;
+
+        // [adresse:]port, une adresse IPv6 entre crochets
+        assert (sArg);
+        free (ctx.sMetricsHost);
+        free (ctx.sMetricsPort);
+        p = strrchr (sArg, ':');
+        if (p) {
+
+          *p++ = 0;
+        }
+        else {
+
+          p = sArg;
+        }
+        vCheckIntRange (sMetricsStr, iGetInt (sMetricsStr, p, 0), 1, 65535);
+        ctx.sMetricsPort = strdup (p);
+        ulLen = (p == sArg) ? 0 : strlen (sArg);
+        if (ulLen == 0) {
+
+          // seul le port est donné, l'écoute reste locale
+          ctx.sMetricsHost = strdup (DEFAULT_METRICS_HOST);
+        }
+        else if ( (ulLen > 2) && (sArg[0] == '[') && (sArg[ulLen - 1] == ']')) {
+
+          sArg[ulLen - 1] = 0;
+          ctx.sMetricsHost = strdup (&sArg[1]);
+        }
+        else {
+
+          ctx.sMetricsHost = strdup (sArg);
+        }
+        assert (ctx.sMetricsHost && ctx.sMetricsPort);
+        free (sArg);
+#else
+        vSyntaxErrorExit ("%s is not supported on this platform", sMetricsStr);
+#endif
+      }
+      break;
+
       case 'o':
         ctx.dTimeout = dGetDouble (sTimeoutStr, optarg);
         vCheckDoubleRange (sTimeoutStr, ctx.dTimeout, TIMEOUT_MIN, TIMEOUT_MAX);
@@ -610,6 +1271,8 @@ main (int argc, char **argv) {
     ctx.piStartRef = malloc (sizeof (int));
     assert (ctx.piStartRef);
     ctx.piStartRef[0] = DEFAULT_STARTREF;
+    ctx.piRefCount = calloc (1, sizeof (int));
+    assert (ctx.piRefCount);
     ctx.iStartCount = 1;
   }
 
@@ -626,11 +1289,72 @@ main (int argc, char **argv) {
                       STARTREF_MIN - 1, STARTREF_MAX - 1);
     }
   }
+  // les bandes mortes sont comparées aux références des échantillons, qui
+  // comprennent le décalage de -0
+  for (i = 0; i < ctx.iBandCount; i++) {
+    const xRbeBand * b = &ctx.pxBand[i];
+
+    if (b->iFirst >= 0) {
+
+      vCheckIntRange (sStartRefStr, b->iFirst,
+                      STARTREF_MIN - 1 + ctx.iPduOffset,
+                      STARTREF_MAX - 1 + ctx.iPduOffset);
+      vCheckIntRange (sStartRefStr, b->iLast, b->iFirst,
+                      STARTREF_MAX - 1 + ctx.iPduOffset);
+    }
+  }
+
+  if (ctx.sMapFile) {
+    int iLine;
+
+    // un bloc de registres 16 bits lu en une fois, décodé champ par champ
+    if ( (ctx.eFunction != eFuncInputReg) &&
+         (ctx.eFunction != eFuncHoldingReg)) {
+
+      vSyntaxErrorExit ("%s is only available with -t 3 or -t 4", sMapStr);
+    }
+    if ( (iRegCount (ctx.eFormat, 1) > 1) || (ctx.eFormat == eFormatString)) {
+
+      vSyntaxErrorExit ("%s reads 16-bit registers, the data type must be "
+                        "int16, hex or the default", sMapStr);
+    }
+    if (argc - optind > 1) {
+
+      vSyntaxErrorExit ("%s can not be used for writing", sMapStr);
+    }
+    if (iRegMapLoad (&ctx.xMap, ctx.sMapFile, ctx.eOrder, &iLine) != 0) {
+
+      if (iLine) {
+
+        vIoErrorExit ("Illegal %s field at line %d of %s", sMapStr, iLine,
+                      ctx.sMapFile);
+      }
+      vIoErrorExit ("Unable to load %s %s: %s", sMapStr, ctx.sMapFile,
+                    strerror (errno));
+    }
+    // le bloc couvre tous les champs, -c est remplacé
+    ctx.iCount = ctx.xMap.iRegCount;
+    vCheckIntRange (sNumOfValuesStr, ctx.iCount, NUMOFVALUES_MIN,
+                    NUMOFVALUES_MAX);
+  }
 
-  // ignore iCount > 1 if start ref list contains more then one value
-  if ((ctx.iStartCount > 1) && (ctx.iCount > 1)) {
+  // ignore iCount > 1 if start ref list contains more then one value,
+  // unless some references give their own count (ref:+count)
+  for (i = 0; i < ctx.iStartCount; i++) {
+    if (ctx.piRefCount[i] != 0) {
+      break;
+    }
+  }
+  if ((ctx.iStartCount > 1) && (ctx.iCount > 1) && (!ctx.sMapFile) &&
+      (i == ctx.iStartCount)) {
     ctx.iCount = 1;
   }
+  // les références sans nombre de valeurs (ref:+count) utilisent -c
+  for (i = 0; i < ctx.iStartCount; i++) {
+    if (ctx.piRefCount[i] == 0) {
+      ctx.piRefCount[i] = ctx.iCount;
+    }
+  }
 
   // Coils et Discrete inputs toujours en binaire
   if ( (ctx.eFunction == eFuncCoil) || (ctx.eFunction == eFuncDiscreteInput)) {
@@ -638,14 +1362,76 @@ main (int argc, char **argv) {
     ctx.eFormat = eFormatBin;
   }
 
+  // les lectures sont découpées en PDU mais restent dans l'espace d'adressage
+  for (i = 0; i < ctx.iStartCount; i++) {
+
+    vCheckReadRange (ctx.piStartRef[i] - ctx.iPduOffset,
+                     iRegCount (ctx.eFormat, ctx.piRefCount[i]));
+  }
+
+  // Groupes de scrutation, -t, -r et -c fournissent les valeurs par défaut
+  if (ctx.iGroupCount) {
+
+    ctx.pxGroup = calloc (ctx.iGroupCount, sizeof (xPollGroup));
+    assert (ctx.pxGroup);
+    for (i = 0; i < ctx.iGroupCount; i++) {
+
+      ctx.pxGroup[i].iIndex = i + 1;
+      vGetGroup (ctx.psGroupSpec[i], &ctx.pxGroup[i], &ctx);
+    }
+  }
+
   // Lecture du port série ou de l'hôte
-  if (optind == argc) {
+  if (optind < argc) {
+
+    ctx.sDevice = argv[optind];
+  }
+  else if (ctx.iBusCount == 0) {
 
     vSyntaxErrorExit ("device or host parameter missing");
   }
-  ctx.sDevice = argv[optind];
 
-  if ( (strcasestr (ctx.sDevice, "com") || strcasestr (ctx.sDevice, "tty") ||
+  if (ctx.iBusCount) {
+
+    // Plusieurs bus série, le port de la ligne de commande est le premier
+    if (ctx.bIsDefaultMode) {
+
+      ctx.eMode = eModeRtu;
+    }
+    else if (ctx.eMode != eModeRtu) {
+
+      vSyntaxErrorExit ("A %s is only available in RTU mode", sBusStr);
+    }
+#ifndef MBPOLL_SERIAL_BUSES
+    vSyntaxErrorExit ("A %s is not supported on this platform", sBusStr);
+#endif
+    if (ctx.sDevice) {
+
+      ctx.psBusSpec = realloc (ctx.psBusSpec,
+                               (ctx.iBusCount + 1) * sizeof (char *));
+      assert (ctx.psBusSpec);
+      memmove (&ctx.psBusSpec[1], &ctx.psBusSpec[0],
+               ctx.iBusCount++ * sizeof (char *));
+      ctx.psBusSpec[0] = ctx.sDevice;
+    }
+  }
+  else if ( (index (ctx.sDevice, ',') != NULL) || (ctx.sDevice[0] == '@')) {
+
+    // Liste d'hôtes Modbus/TCP : host1,host2:1502,... ou @fichier
+    if (ctx.bIsDefaultMode) {
+
+      ctx.eMode = eModeTcp;
+    }
+    else if (ctx.eMode != eModeTcp) {
+
+      vSyntaxErrorExit ("A host list is only available in TCP mode");
+    }
+#ifndef MBPOLL_TCP_ENGINE
+    vSyntaxErrorExit ("A host list is not supported on this platform");
+#endif
+    vGetHostList (ctx.sDevice, &ctx);
+  }
+  else if ( (strcasestr (ctx.sDevice, "com") || strcasestr (ctx.sDevice, "tty") ||
         strcasestr (ctx.sDevice, "ser")) && ctx.bIsDefaultMode) {
 
     // Mode par défaut si port série
@@ -697,6 +1483,10 @@ main (int argc, char **argv) {
     vSyntaxErrorExit ("-u is available only in RTU mode");
   }
 
+  // Les permutations de --order sont calculées une fois pour toutes
+  vRegOrderInit (&ctx.xOrder32, ctx.eOrder, 2);
+  vRegOrderInit (&ctx.xOrder64, ctx.eOrder, 4);
+
   if (! ctx.bIsReportSlaveID) {
 
     // Calcul du nombre de données à écrire
@@ -742,16 +1532,48 @@ main (int argc, char **argv) {
             break;
 
           case eFuncHoldingReg:
+            // les valeurs de 32 et 64 bits sont rangées dans les registres
+            // dans l'ordre choisi par --order ou -B
             if (ctx.eFormat == eFormatInt) {
-              DINT32 (ctx.pvData, i) = lSwapLong (iGetInt (sDataStr, argv[arg], 10));
-              PDEBUG ("Int[%d]=%"PRId32"\n", i, lSwapLong (DINT32 (ctx.pvData, i)));
+              int32_t lValue = iGetInt (sDataStr, argv[arg], 10);
+
+              vRegEncode (&DUINT16 (ctx.pvData, 2 * i), &lValue, 1,
+                          &ctx.xOrder32);
+              PDEBUG ("Int[%d]=%"PRId32"\n", i, lValue);
             }
             else if (ctx.eFormat == eFormatFloat) {
+              float fValue;
+
               dValue = dGetDouble (sDataStr, argv[arg]);
               PDEBUG ("%g,%g\n", FLT_MIN, FLT_MAX);
               vCheckDoubleRange (sDataStr, dValue, -FLT_MAX, FLT_MAX);
-              DFLOAT (ctx.pvData, i) = fSwapFloat ( (float) dValue);
-              PDEBUG ("Float[%d]=%g\n", i, fSwapFloat (DFLOAT (ctx.pvData, i)));
+              fValue = (float) dValue;
+              vRegEncode (&DUINT16 (ctx.pvData, 2 * i), &fValue, 1,
+                          &ctx.xOrder32);
+              PDEBUG ("Float[%d]=%g\n", i, fValue);
+            }
+            else if ( (ctx.eFormat == eFormatInt64) ||
+                      (ctx.eFormat == eFormatUInt64) ||
+                      (ctx.eFormat == eFormatDouble)) {
+              uint64_t ullValue;
+
+              if (ctx.eFormat == eFormatInt64) {
+                int64_t llValue = llGetInt64 (sDataStr, argv[arg]);
+
+                memcpy (&ullValue, &llValue, sizeof (ullValue));
+              }
+              else if (ctx.eFormat == eFormatUInt64) {
+
+                ullValue = ullGetUInt64 (sDataStr, argv[arg]);
+              }
+              else {
+
+                dValue = dGetDouble (sDataStr, argv[arg]);
+                memcpy (&ullValue, &dValue, sizeof (ullValue));
+              }
+              vRegEncode (&DUINT16 (ctx.pvData, 4 * i), &ullValue, 1,
+                          &ctx.xOrder64);
+              PDEBUG ("Value[%d]=0x%016"PRIX64"\n", i, ullValue);
             }
             else if (ctx.eFormat == eFormatString) {
                 vSyntaxErrorExit ("You can use string format only for output");
@@ -785,6 +1607,40 @@ main (int argc, char **argv) {
     vSyntaxErrorExit ("You can give a start ref list only for reading");
   }
 
+  if ( (ctx.iGroupCount) && ( (ctx.bIsWrite) || (ctx.bIsReportSlaveID))) {
+    vSyntaxErrorExit ("You can define poll groups only for reading");
+  }
+
+  if ( (ctx.iHostCount) && (ctx.bIsWrite)) {
+    vSyntaxErrorExit ("You can give a host list only for reading");
+  }
+
+  if ( (ctx.iHostCount) && (ctx.iGroupCount)) {
+    vSyntaxErrorExit ("Poll groups are not available with a host list");
+  }
+
+  if ( (ctx.iThreads > 1) && (ctx.iHostCount == 0)) {
+    vSyntaxErrorExit ("Several threads are only available with a host list");
+  }
+
+  if ( (ctx.iBusCount) && ( (ctx.bIsWrite) || (ctx.bIsReportSlaveID))) {
+    vSyntaxErrorExit ("You can give several serial buses only for reading");
+  }
+
+  if ( (ctx.iBusCount) && (ctx.iGroupCount)) {
+    vSyntaxErrorExit ("Poll groups are not available with several serial buses");
+  }
+
+  if (ctx.iWindow > 1) {
+
+    if (ctx.eMode != eModeTcp) {
+      vSyntaxErrorExit ("A %s is only available in TCP mode", sWindowStr);
+    }
+    if (ctx.bIsWrite) {
+      vSyntaxErrorExit ("A %s is only available for reading", sWindowStr);
+    }
+  }
+
   if (ctx.iSlaveCount == -1) {
 
     ctx.piSlaveAddr = malloc (sizeof (int));
@@ -793,6 +1649,18 @@ main (int argc, char **argv) {
     ctx.iSlaveCount = 1;
   }
 
+  // Bus série, -a, -b, -d, -s et -P fournissent les valeurs par défaut
+  if (ctx.iBusCount) {
+
+    ctx.pxBus = calloc (ctx.iBusCount, sizeof (xSerialBus));
+    assert (ctx.pxBus);
+    for (i = 0; i < ctx.iBusCount; i++) {
+
+      vGetBus (ctx.psBusSpec[i], &ctx.pxBus[i], &ctx);
+    }
+    ctx.sDevice = ctx.pxBus[0].sDevice;
+  }
+
   // Fin de vérification des valeurs de paramètres et création des contextes
   switch (ctx.eMode) {
     case eModeRtu:
@@ -800,8 +1668,11 @@ main (int argc, char **argv) {
         vCheckIntRange (sSlaveAddrStr, ctx.piSlaveAddr[i],
                         RTU_SLAVEADDR_MIN, SLAVEADDR_MAX);
       }
-      ctx.xBus = modbus_new_rtu (ctx.sDevice, ctx.xRtu.baud, ctx.xRtu.parity,
-                                 ctx.xRtu.dbits, ctx.xRtu.sbits);
+      if (ctx.iBusCount == 0) {
+
+        ctx.xBus = modbus_new_rtu (ctx.sDevice, ctx.xRtu.baud, ctx.xRtu.parity,
+                                   ctx.xRtu.dbits, ctx.xRtu.sbits);
+      }
       break;
 
     case eModeTcp:
@@ -809,27 +1680,144 @@ main (int argc, char **argv) {
         vCheckIntRange (sSlaveAddrStr, ctx.piSlaveAddr[i],
                         TCP_SLAVEADDR_MIN, SLAVEADDR_MAX);
       }
-      ctx.xBus = modbus_new_tcp_pi (ctx.sDevice, ctx.sTcpPort);
+      if (ctx.iHostCount == 0) {
+
+        ctx.xBus = modbus_new_tcp_pi (ctx.sDevice, ctx.sTcpPort);
+      }
       break;
 
     default:
       break;
   }
 
-  if (ctx.xBus == NULL) {
-
-    vIoErrorExit ("Unable to create the libmodbus context");
-  }
-  modbus_set_debug (ctx.xBus, ctx.bIsVerbose);
+  if ( (!ctx.bIsWrite) && (!ctx.bIsReportSlaveID)) {
 
-  if (false == ctx.bIsQuiet) {
-    vHello();
-  }
+    if ( (ctx.bIsRbe) && (iRbeInit (&ctx.xRbe, ctx.pxBand, ctx.iBandCount,
+                                    ctx.iRbeRefresh * 1000UL) != 0)) {
 
-  if ( (ctx.iRtuMode != MODBUS_RTU_RTS_NONE) && (ctx.eMode == eModeRtu) &&
-       !ctx.bIsChipIo) {
+      vIoErrorExit ("Unable to allocate the report by exception table");
+    }
+#ifdef MBPOLL_SHM
+    if (ctx.sShmName) {
+      xMemSink xHeader = { NULL, 0 };
+      int iRet;
+
+      vWriteStreamHeader (vMemSinkWrite, &xHeader);
+      iRet = iMbShmCreate (&ctx.xShm, ctx.sShmName, ctx.iShmSize * 1024UL,
+                           xHeader.pucData, xHeader.ulLen);
+      free (xHeader.pucData);
+      if (iRet != 0) {
+
+        vIoErrorExit ("Unable to create %s %s: %s", sShmStr, ctx.sShmName,
+                      strerror (errno));
+      }
+    }
+    if (ctx.sImageName) {
 
-#ifdef MBPOLL_GPIO_RTS
+      vCreateImage();
+    }
+#endif
+    if (ctx.sTsFile) {
+      xMemSink xHeader = { NULL, 0 };
+      int iRet;
+
+      vWriteStreamHeader (vMemSinkWrite, &xHeader);
+      iRet = iMbTsCreate (&ctx.xTs, ctx.sTsFile, ctx.iTsChunk, xHeader.pucData,
+                          xHeader.ulLen);
+      free (xHeader.pucData);
+      if (iRet != 0) {
+
+        vIoErrorExit ("Unable to create %s %s: %s", sTsStr, ctx.sTsFile,
+                      strerror (errno));
+      }
+    }
+#ifdef MBPOLL_PUB
+    if (ctx.sPubPath) {
+      xMemSink xHeader = { NULL, 0 };
+      int iRet;
+
+      vWriteStreamHeader (vMemSinkWrite, &xHeader);
+      iRet = iMbPubCreate (&ctx.xPub, ctx.sPubPath, ctx.iPubQueue * 1024UL,
+                           xHeader.pucData, xHeader.ulLen);
+      free (xHeader.pucData);
+      if (iRet != 0) {
+
+        vIoErrorExit ("Unable to create %s %s: %s", sPubStr, ctx.sPubPath,
+                      strerror (errno));
+      }
+    }
+#endif
+#ifdef MBPOLL_METRICS
+    if (ctx.sMetricsPort) {
+      xMemSink xHeader = { NULL, 0 };
+      int iRet;
+
+      vWriteStreamHeader (vMemSinkWrite, &xHeader);
+      iRet = iMbMetricsCreate (&ctx.xMetrics, ctx.sMetricsHost,
+                               ctx.sMetricsPort, xHeader.pucData,
+                               xHeader.ulLen);
+      free (xHeader.pucData);
+      if (iRet != 0) {
+
+        vIoErrorExit ("Unable to create %s %s:%s: %s", sMetricsStr,
+                      ctx.sMetricsHost, ctx.sMetricsPort, strerror (errno));
+      }
+    }
+#endif
+    vPrintRecordHeader();
+#ifdef MBPOLL_OUT_QUEUE
+    if (ctx.iQueueSize) {
+
+      // les en-têtes sont déjà écrits, les cycles passent par la file
+      if (iOutQueueCreate (&ctx.xQueue, STDOUT_FILENO, ctx.iQueueSize * 1024UL,
+                           ctx.bQueueBlock ? eOutQueueBlock :
+                           eOutQueueDrop) != 0) {
+
+        vIoErrorExit ("Unable to create %s: %s", sQueueStr, strerror (errno));
+      }
+      ctx.xOut.pxQueue = &ctx.xQueue;
+    }
+#endif
+  }
+
+  if (ctx.iHostCount) {
+
+    // Tous les hôtes sont scrutés par le moteur événementiel, sans libmodbus
+    if (false == ctx.bIsQuiet) {
+      vHello();
+      vPrintConfig (&ctx);
+    }
+    signal (SIGINT, vSigIntHandler);
+    vPollHosts (&ctx);
+    vTerminate();
+  }
+
+  if (ctx.iBusCount) {
+
+    // Chaque bus est scruté par son propre thread
+    if (false == ctx.bIsQuiet) {
+      vHello();
+      vPrintConfig (&ctx);
+    }
+    signal (SIGINT, vSigIntHandler);
+    vPollBuses (&ctx);
+    vTerminate();
+  }
+
+  if (ctx.xBus == NULL) {
+
+    vIoErrorExit ("Unable to create the libmodbus context");
+  }
+  modbus_set_debug (ctx.xBus, ctx.bIsVerbose);
+
+  if (false == ctx.bIsQuiet) {
+    vHello();
+  }
+
+  if ( (ctx.iRtuMode != MODBUS_RTU_RTS_NONE) && (ctx.eMode == eModeRtu) &&
+       !ctx.bIsChipIo) {
+
+#ifdef MBPOLL_GPIO_RTS
     if (ctx.iRtsPin >= 0) {
       double t = 11 / (double) ctx.xRtu.baud / 2 * 1e6; // delay 1/2 car
 
@@ -878,6 +1866,13 @@ main (int argc, char **argv) {
 
     vReportSlaveID (&ctx);
   }
+  else if (ctx.iGroupCount) {
+
+    if (false == ctx.bIsQuiet) {
+      vPrintConfig (&ctx);
+    }
+    vPollGroups (&ctx);
+  }
   else {
     int iNbReg, iStartReg;
     // Affichage complet de la configuration
@@ -886,8 +1881,11 @@ main (int argc, char **argv) {
     }
 
     // int32 et float utilisent 2 registres 16 bits
-    iNbReg = ( (ctx.eFormat == eFormatInt) || (ctx.eFormat == eFormatFloat)) ?
-             ctx.iCount * 2 : ctx.iCount;
+    iNbReg = iRegCount (ctx.eFormat, ctx.iCount);
+
+    // Les échéances sont absolues, la durée des échanges n'entre pas
+    // dans la période de scrutation
+    vPollTimerInit (&ctx.xTimer, ctx.iPollRate, ctx.eOverrun);
 
     // Début de la boucle de scrutation
     do {
@@ -947,78 +1945,63 @@ main (int argc, char **argv) {
         // Fin écriture --------------------------------------------------------
       }
       else {
+        char sHeader[HEADER_SIZE];
         int i;
 
         // Lecture -------------------------------------------------------------
-        for (i = 0; i < ctx.iSlaveCount; i++) {
+        for (i = 0; (i < ctx.iSlaveCount) && (!ctx.bIsInterrupted); i++) {
 
           modbus_set_slave (ctx.xBus, ctx.piSlaveAddr[i]);
-          ctx.iTxCount++;
 
-          printf ("-- Polling slave %d...", ctx.piSlaveAddr[i]);
-          if (ctx.bIsPolling) {
+          snprintf (sHeader, sizeof (sHeader), "-- Polling slave %d%s",
+                    ctx.piSlaveAddr[i], ctx.bIsPolling ?
+                    "... Ctrl-C to stop)\n" : "...\n");
 
-            printf (" Ctrl-C to stop)\n");
+          if (ctx.iWindow > 1) {
+
+            // toutes les lectures de l'esclave sont demandées en rafale
+            vReadPipeline (&ctx, ctx.piSlaveAddr[i]);
           }
           else {
 
-            putchar ('\n');
+            iRet = iReadPlan (ctx.xBus, ctx.eFunction, &ctx.xPlan);
+            ctx.iTxCount += ctx.xPlan.iChunkCount;
+            ctx.iRxCount += iRet;
+            ctx.iErrorCount += ctx.xPlan.iChunkCount - iRet;
           }
+          vPrintReadPlan (&ctx.xOut, &ctx.xPlan, &ctx, ctx.piSlaveAddr[i],
+                          NULL, 0, sHeader);
+          if ( (!ctx.bIsSweep) || (ctx.iGap > 0)) {
 
-          int j;
-          for (j = 0; j < ctx.iStartCount; j++) {
-            // libmodbus utilise les adresses PDU !
-            iStartReg = ctx.piStartRef[j] - ctx.iPduOffset;
-
-            switch (ctx.eFunction) {
-              case eFuncDiscreteInput:
-                iRet = modbus_read_input_bits (ctx.xBus, iStartReg, iNbReg,
-                                               ctx.pvData);
-                break;
-
-              case eFuncCoil:
-                iRet = modbus_read_bits (ctx.xBus, iStartReg, iNbReg,
-                                         ctx.pvData);
-                break;
-
-              case eFuncInputReg:
-                iRet = modbus_read_input_registers (ctx.xBus, iStartReg, iNbReg,
-                                                    ctx.pvData);
-                break;
-
-              case eFuncHoldingReg:
-                iRet = modbus_read_registers (ctx.xBus, iStartReg, iNbReg,
-                                              ctx.pvData);
-                break;
+            // un balayage sans délai est écrit en une fois à la fin
+            vFlushOutput (&ctx.xOut);
+          }
+          if (ctx.bIsPolling) {
 
-              default: // Impossible, la valeur a été vérifiée, évite un warning de gcc
-                break;
+            if (!ctx.bIsSweep) {
 
+              vPollWait (&ctx);
             }
-            if (iRet == iNbReg) {
+            else if ( (ctx.iGap > 0) && (i < (ctx.iSlaveCount - 1))) {
 
-              ctx.iRxCount++;
-              vPrintReadValues (ctx.piStartRef[j], ctx.iCount, &ctx);
-            }
-            else {
-              ctx.iErrorCount++;
-              fprintf (stderr, "Read %s failed: %s\n",
-                       sFunctionToStr (ctx.eFunction),
-                       modbus_strerror (errno));
+              // la période s'applique au balayage complet, seul un délai
+              // éventuel sépare deux esclaves
+              mb_delay (ctx.iGap);
             }
           }
-          if (ctx.bIsPolling) {
+        }
+        vFlushOutput (&ctx.xOut);
+        if ( (ctx.bIsPolling) && (ctx.bIsSweep)) {
 
-            mb_delay (ctx.iPollRate);
-          }
+          vPollWait (&ctx);
         }
         // Fin lecture ---------------------------------------------------------
       }
     }
-    while (ctx.bIsPolling);
+    while ( (ctx.bIsPolling) && (!ctx.bIsInterrupted));
   }
 
-  vSigIntHandler (SIGTERM);
+  vTerminate();
   return 0;
 }
 
@@ -1026,275 +2009,2636 @@ main (int argc, char **argv) {
 /* private functions ======================================================== */
 
 // -----------------------------------------------------------------------------
+// Code fonction Modbus de lecture correspondant au type de données
+int
+iFunctionCode (eFunctions eFunction) {
+
+  switch (eFunction) {
+    case eFuncCoil:
+      return MBTCP_READ_COILS;
+    case eFuncDiscreteInput:
+      return MBTCP_READ_DISCRETE_INPUTS;
+    case eFuncInputReg:
+      return MBTCP_READ_INPUT_REGISTERS;
+    default:
+      break;
+  }
+  return MBTCP_READ_HOLDING_REGISTERS;
+}
+
+// -----------------------------------------------------------------------------
+// Lecture de iNbReg éléments (bits ou registres) à partir de iStartReg (PDU)
+int
+iReadValues (modbus_t * xBus, eFunctions eFunction, int iStartReg, int iNbReg,
+             void * pvData) {
+  int iRet = -1;
+
+  switch (eFunction) {
+    case eFuncDiscreteInput:
+      iRet = modbus_read_input_bits (xBus, iStartReg, iNbReg, pvData);
+      break;
+
+    case eFuncCoil:
+      iRet = modbus_read_bits (xBus, iStartReg, iNbReg, pvData);
+      break;
+
+    case eFuncInputReg:
+      iRet = modbus_read_input_registers (xBus, iStartReg, iNbReg, pvData);
+      break;
+
+    case eFuncHoldingReg:
+      iRet = modbus_read_registers (xBus, iStartReg, iNbReg, pvData);
+      break;
+
+    default: // Impossible, la valeur a été vérifiée, évite un warning de gcc
+      break;
+  }
+  return iRet;
+}
+
+// -----------------------------------------------------------------------------
+// Plan de lecture des blocs de -r : les blocs voisins sont lus ensemble, dans
+// la limite d'une PDU
 void
-vPrintReadValues (int iAddr, int iCount, xMbPollContext * ctx) {
+vNewReadPlan (xReadPlan * p, const xMbPollContext * ctx) {
+  int * piAddr = calloc (ctx->iStartCount, sizeof (int));
+  int * piNb = calloc (ctx->iStartCount, sizeof (int));
   int i;
-  for (i = 0; i < iCount; i++) {
 
-    printf ("[%d]: \t", iAddr);
+  assert (piAddr && piNb);
+  for (i = 0; i < ctx->iStartCount; i++) {
 
-    switch (ctx->eFormat) {
+    // libmodbus utilise les adresses PDU !
+    piAddr[i] = ctx->piStartRef[i] - ctx->iPduOffset;
+    piNb[i] = iRegCount (ctx->eFormat, ctx->piRefCount[i]);
+  }
+  if (iReadPlanInit (p, piAddr, piNb, ctx->iStartCount,
+                     (ctx->eFunction == eFuncCoil) ||
+                     (ctx->eFunction == eFuncDiscreteInput),
+                     iRegCount (ctx->eFormat, 1), ctx->iMergeGap)) {
 
-      case eFormatBin:
-        printf ("%c", (DUINT8 (ctx->pvData, i) != FALSE) ? '1' : '0');
-        iAddr++;
-        break;
+    vIoErrorExit ("Unable to allocate read data");
+  }
+  free (piAddr);
+  free (piNb);
+}
 
-      case eFormatDec: {
-        uint16_t v = DUINT16 (ctx->pvData, i);
-        if (v & 0x8000) {
+// -----------------------------------------------------------------------------
+// Exécute toutes les lectures d'un plan, retourne le nombre de lectures
+// réussies
+int
+iReadPlan (modbus_t * xBus, eFunctions eFunction, xReadPlan * p) {
+  int i, iOk = 0;
 
-          printf ("%u (%d)", v, (int) (int16_t) v);
-        }
-        else {
+  for (i = 0; i < p->iChunkCount; i++) {
+    xReadChunk * c = &p->pxChunk[i];
+    uint64_t ulStart = ulPollTimerNow();
 
-          printf ("%u", v);
-        }
-        iAddr++;
+    c->iRet = iReadValues (xBus, eFunction, c->iAddr, c->iNb, c->pvData);
+    c->iError = errno;
+    if (c->iRet == c->iNb) {
+      iOk++;
+    }
+    // une exception Modbus est une réponse, un délai dépassé n'en est pas une
+    c->ulLatency = (c->iError == ETIMEDOUT) ? 0 : ulPollTimerNow() - ulStart;
+  }
+  vReadPlanScatter (p);
+  return iOk;
+}
+
+// -----------------------------------------------------------------------------
+// Affichage des blocs d'un plan dans l'ordre des références demandées
+void
+vPrintReadPlan (xOutBuffer * o, const xReadPlan * p,
+                const xMbPollContext * ctx, int iSlave, const char * sWhere,
+                int iSource, char * sHeader) {
+  xSample xSmp = {
+    .sWhere = sWhere ? sWhere : ctx->sDevice,
+    .iSource = iSource,
+    .iSlave = iSlave,
+    .eFunction = ctx->eFunction,
+    .eFormat = ctx->eFormat,
+    .sHeader = (ctx->eOutput == eOutputText) ? sHeader : NULL
+  };
+  int i;
+
+#ifdef MBPOLL_METRICS
+  if (ctx->sMetricsPort) {
+    vCountPlanMetrics (p, iSource, iSlave);
+  }
+#endif
+  vSampleNow (&xSmp);
+  for (i = 0; i < p->iBlockCount; i++) {
+    const xReadBlock * b = &p->pxBlock[i];
+
+    // en mode enregistrement, l'erreur fait partie de l'échantillon
+    xSmp.iRef = b->iAddr + ctx->iPduOffset;
+    xSmp.iCount = b->iNb / p->iStep;
+    xSmp.pvData = b->pvData;
+    xSmp.iError = (b->iRet == b->iNb) ? 0 : b->iError;
+    vReportSample (o, &xSmp);
+    if ( (xSmp.iError == 0) || (ctx->eOutput != eOutputText)) {
+      continue;
+    }
+
+    // le message d'erreur suit les valeurs déjà construites
+    vFlushOutput (o);
+    if (sWhere) {
+
+      fprintf (stderr, "Read %s on %s failed: %s\n",
+               sFunctionToStr (ctx->eFunction), sWhere,
+               modbus_strerror (b->iError));
+    }
+    else {
+
+      fprintf (stderr, "Read %s failed: %s\n",
+               sFunctionToStr (ctx->eFunction), modbus_strerror (b->iError));
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Chaîne csv, entre guillemets si elle contient un séparateur
+static void
+vPutCsvString (xOutBuffer * o, const char * str) {
+
+  if (strpbrk (str, ",\"\r\n") == NULL) {
+
+    vOutBufferPuts (o, str);
+    return;
+  }
+  vOutBufferPutc (o, '"');
+  for (; *str; str++) {
+
+    if (*str == '"') {
+      vOutBufferPutc (o, '"');
+    }
+    vOutBufferPutc (o, *str);
+  }
+  vOutBufferPutc (o, '"');
+}
+
+// -----------------------------------------------------------------------------
+// Chaîne JSON entre guillemets, les caractères de contrôle sont échappés
+static void
+vPutJsonString (xOutBuffer * o, const char * str) {
+
+  vOutBufferPutc (o, '"');
+  for (; *str; str++) {
+    unsigned char c = *str;
+
+    if ( (c == '"') || (c == '\\')) {
+
+      vOutBufferPutc (o, '\\');
+      vOutBufferPutc (o, c);
+    }
+    else if (c < 0x20) {
+
+      vOutBufferPuts (o, "\\u00");
+      vOutBufferPutc (o, "0123456789abcdef"[c >> 4]);
+      vOutBufferPutc (o, "0123456789abcdef"[c & 0xF]);
+    }
+    else {
+
+      vOutBufferPutc (o, c);
+    }
+  }
+  vOutBufferPutc (o, '"');
+}
+
+// -----------------------------------------------------------------------------
+// Horodatage ISO 8601 UTC à la milliseconde : 2023-01-31T12:34:56.789Z
+static void
+vPutTimestamp (xOutBuffer * o, const struct timespec * t) {
+  struct tm xTm;
+  char sTime[32];
+  int iMs = t->tv_nsec / 1000000;
+
+#ifdef _WIN32
+  gmtime_s (&xTm, &t->tv_sec);
+#else
+  gmtime_r (&t->tv_sec, &xTm);
+#endif
+  strftime (sTime, sizeof (sTime), "%Y-%m-%dT%H:%M:%S.", &xTm);
+  vOutBufferPuts (o, sTime);
+  vOutBufferPutc (o, '0' + iMs / 100);
+  vOutBufferPutc (o, '0' + (iMs / 10) % 10);
+  vOutBufferPutc (o, '0' + iMs % 10);
+  vOutBufferPutc (o, 'Z');
+}
+
+// -----------------------------------------------------------------------------
+// Valeur i d'un échantillon, un nombre en JSON sauf pour l'hexadécimal
+static void
+vPutSampleValue (xOutBuffer * o, const xSample * xSmp, int i, bool bIsJson) {
+
+  switch (xSmp->eFormat) {
+
+    case eFormatBin:
+      vOutBufferPutc (o, (DUINT8 (xSmp->pvData, i) != FALSE) ? '1' : '0');
+      break;
+
+    case eFormatDec:
+      vOutBufferUint (o, DUINT16 (xSmp->pvData, i));
+      break;
 
+    case eFormatInt16:
+      vOutBufferInt (o, (int16_t) (DUINT16 (xSmp->pvData, i)));
+      break;
+
+    case eFormatHex:
+      if (bIsJson) {
+        vOutBufferPutc (o, '"');
+      }
+      vOutBufferHex (o, DUINT16 (xSmp->pvData, i), 4);
+      if (bIsJson) {
+        vOutBufferPutc (o, '"');
       }
       break;
 
-      case eFormatInt16:
-        printf ("%d", (int) (int16_t) (DUINT16 (ctx->pvData, i)));
-        iAddr++;
-        break;
+    case eFormatInt:
+      vOutBufferInt (o, DINT32 (xSmp->pvValue, i));
+      break;
 
-      case eFormatHex:
-        printf ("0x%04X", DUINT16 (ctx->pvData, i));
-        iAddr++;
-        break;
+    case eFormatInt64:
+      vOutBufferInt (o, DINT64 (xSmp->pvValue, i));
+      break;
 
-      case eFormatString:
-        printf ("%c%c", (char) ((int) (DUINT16 (ctx->pvData, i) / 256)), (char) (DUINT16 (ctx->pvData, i) % 256));
-        iAddr++;
-        break;
+    case eFormatUInt64:
+      vOutBufferUint (o, DUINT64 (xSmp->pvValue, i));
+      break;
 
-      case eFormatInt:
-        printf ("%d", lSwapLong (DINT32 (ctx->pvData, i)));
-        iAddr += 2;
-        break;
+    case eFormatFloat:
+    case eFormatDouble: {
+      double d = (xSmp->eFormat == eFormatFloat) ?
+                 DFLOAT (xSmp->pvValue, i) : DDOUBLE (xSmp->pvValue, i);
 
-      case eFormatFloat:
-        printf ("%g", fSwapFloat (DFLOAT (ctx->pvData, i)));
-        iAddr += 2;
-        break;
+      if (bIsJson && ! isfinite (d)) {
 
-      default:  // Impossible normalement
-        break;
+        // JSON n'a pas de NaN ni d'infini
+        vOutBufferPuts (o, "null");
+      }
+      else if (xSmp->eFormat == eFormatFloat) {
+
+        vOutBufferDouble (o, d);
+      }
+      else {
+
+        vOutBufferDoubleDigits (o, d, DOUBLE_DIGITS);
+      }
     }
-    putchar ('\n');
+    break;
+
+    default:
+      break;
   }
 }
 
 // -----------------------------------------------------------------------------
+static void
+vOutBufferSink (void * pvSink, const void * pvData, size_t ulLen) {
+
+  vOutBufferWrite ( (xOutBuffer *) pvSink, pvData, ulLen);
+}
+
+#ifdef MBPOLL_SHM
+// -----------------------------------------------------------------------------
+static void
+vShmSink (void * pvSink, const void * pvData, size_t ulLen) {
+
+  vMbShmAppend ( (xMbShmWriter *) pvSink, pvData, ulLen);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// En-tête du flux binaire et table des sources : les hôtes, ou le port
+// principal suivi des bus
 void
-vReportSlaveID (const xMbPollContext * ctx) {
-  uint8_t ucReport[256];
+vWriteStreamHeader (vSinkWrite vWrite, void * pvSink) {
+  uint8_t ucHeader[MBREC_STREAM_HEADER_SIZE];
+  int i, iCount = ctx.iHostCount ? ctx.iHostCount : ctx.iBusCount + 1;
 
-  modbus_set_slave (ctx->xBus, ctx->piSlaveAddr[0]);
-  // Affichage de la configuration
-  printf ("Protocol configuration: Modbus %s\n", sModeList[ctx->eMode]);
-  printf ("Slave configuration...: address = %d, report slave id\n",
-          ctx->piSlaveAddr[0]);
+  vWrite (pvSink, ucHeader, ulMbRecStreamHeaderEncode (ucHeader, iCount));
+  for (i = 0; i < iCount; i++) {
+    char sWhere[256];
 
-  vPrintCommunicationSetup (ctx);
+    if (ctx.iHostCount) {
 
-  int iRet = modbus_report_slave_id (ctx->xBus, 256, ucReport);
+      snprintf (sWhere, sizeof (sWhere), "%s:%s", ctx.psHost[i],
+                ctx.psHostPort[i]);
+    }
+    else {
 
-  if (iRet < 0) {
+      snprintf (sWhere, sizeof (sWhere), "%s",
+                i ? ctx.pxBus[i - 1].sDevice : ctx.sDevice);
+    }
+    vMbRecPut16 (ucHeader, strlen (sWhere));
+    vWrite (pvSink, ucHeader, 2);
+    vWrite (pvSink, sWhere, strlen (sWhere));
+  }
+}
 
-    fprintf (stderr, "Report slave ID failed(%d): %s\n", iRet,
-             modbus_strerror (errno));
+// -----------------------------------------------------------------------------
+void
+vMemSinkWrite (void * pvSink, const void * pvData, size_t ulLen) {
+  xMemSink * m = (xMemSink *) pvSink;
+
+  m->pucData = realloc (m->pucData, m->ulLen + ulLen);
+  assert (m->pucData);
+  memcpy (&m->pucData[m->ulLen], pvData, ulLen);
+  m->ulLen += ulLen;
+}
+
+// -----------------------------------------------------------------------------
+// Ecriture dans une zone assez grande pour tout recevoir
+static void
+vBufSinkWrite (void * pvSink, const void * pvData, size_t ulLen) {
+  xMemSink * m = (xMemSink *) pvSink;
+
+  memcpy (&m->pucData[m->ulLen], pvData, ulLen);
+  m->ulLen += ulLen;
+}
+
+// -----------------------------------------------------------------------------
+// Ligne d'entête du format csv, les valeurs occupent les dernières colonnes
+void
+vPrintRecordHeader (void) {
+
+  if (ctx.eOutput == eOutputCsv) {
+
+    vOutBufferPuts (&ctx.xOut,
+                    "time,source,slave,function,reference,count,status,values\n");
   }
-  else {
+  else if (ctx.eOutput == eOutputBinary) {
+
+    vWriteStreamHeader (vOutBufferSink, &ctx.xOut);
+  }
+  vFlushOutput (&ctx.xOut);
+}
+
+// -----------------------------------------------------------------------------
+// Horodatage d'un échantillon
+void
+vSampleNow (xSample * xSmp) {
+
+  timespec_get (&xSmp->xTime, TIME_UTC);
+  xSmp->ulMonotonic = ulPollTimerNow();
+}
+
+// -----------------------------------------------------------------------------
+// Taille de l'enregistrement binaire d'un échantillon
+static size_t
+ulSampleRecordSize (const xSample * xSmp) {
+
+  if (xSmp->iError) {
+    return MBREC_RECORD_HEADER_SIZE;
+  }
+  return MBREC_RECORD_HEADER_SIZE +
+         iRegCount (xSmp->eFormat, xSmp->iCount) *
+         ( (xSmp->eFormat == eFormatBin) ? 1 : 2);
+}
+
+// -----------------------------------------------------------------------------
+// Ordre des valeurs de 32 et 64 bits d'un enregistrement binaire
+static uint8_t
+ucRecFlags (void) {
+
+  return (ctx.xOrder32.bWordSwap ? MBREC_FLAG_WORD_SWAP : 0) |
+         (ctx.xOrder32.bByteSwap ? MBREC_FLAG_BYTE_SWAP : 0);
+}
+
+// -----------------------------------------------------------------------------
+// Format d'un enregistrement binaire
+static eMbRecFormat
+eRecFormat (eFormats eFormat) {
+  static const struct {
+    eFormats eFormat;
+    eMbRecFormat eRecFormat;
+  } xFormat[] = {
+    { eFormatBin, eMbRecFormatBin },
+    { eFormatDec, eMbRecFormatDec },
+    { eFormatInt16, eMbRecFormatInt16 },
+    { eFormatHex, eMbRecFormatHex },
+    { eFormatString, eMbRecFormatString },
+    { eFormatInt, eMbRecFormatInt },
+    { eFormatFloat, eMbRecFormatFloat },
+    { eFormatInt64, eMbRecFormatInt64 },
+    { eFormatUInt64, eMbRecFormatUInt64 },
+    { eFormatDouble, eMbRecFormatDouble },
+  };
+  unsigned i;
+
+  for (i = 0; i < sizeof (xFormat) / sizeof (xFormat[0]); i++) {
+    if (xFormat[i].eFormat == eFormat) {
+      return xFormat[i].eRecFormat;
+    }
+  }
+  return eMbRecFormatDec;
+}
+
+// -----------------------------------------------------------------------------
+// Enregistrement binaire : en-tête suivi des éléments lus, voir mb-record.h.
+// Il est transmis par morceaux à vWrite().
+static void
+vWriteSampleRecord (vSinkWrite vWrite, void * pvSink, const xSample * xSmp) {
+  uint8_t ucBuf[MBREC_RECORD_HEADER_SIZE + 2 * MODBUS_MAX_READ_REGISTERS];
+  xMbRecord r = {
+    .usSource = xSmp->iSource,
+    .ucSlave = xSmp->iSlave,
+    .ucFunction = xSmp->eFunction,
+    .ucFormat = eRecFormat (xSmp->eFormat),
+    .ucFlags = ucRecFlags (),
+    .usElementSize = (xSmp->eFormat == eFormatBin) ? 1 : 2,
+    .ulRef = xSmp->iRef,
+    .ulCount = xSmp->iCount,
+    .lStatus = xSmp->iError,
+    .ullMonotonic = xSmp->ulMonotonic,
+    .ullRealtime = (uint64_t) xSmp->xTime.tv_sec * 1000000000ULL +
+                   xSmp->xTime.tv_nsec
+  };
+  size_t ulLen;
+  unsigned i, j;
+
+  if (xSmp->iError == 0) {
+
+    r.ulElements = iRegCount (xSmp->eFormat, xSmp->iCount);
+  }
+  r.ulSize = ulSampleRecordSize (xSmp);
+  ulLen = ulMbRecHeaderEncode (ucBuf, &r);
+
+  if (r.usElementSize == 1) {
+
+    // bits : un octet par bit, tel que lu
+    vWrite (pvSink, ucBuf, ulLen);
+    vWrite (pvSink, xSmp->pvData, r.ulElements);
+    return;
+  }
+
+  // registres en little endian, convertis par paquets
+  for (i = 0; i < r.ulElements; i = j) {
+
+    for (j = i; (j < r.ulElements) && (ulLen < sizeof (ucBuf)); j++) {
+
+      vMbRecPut16 (&ucBuf[ulLen], DUINT16 (xSmp->pvData, j));
+      ulLen += 2;
+    }
+    vWrite (pvSink, ucBuf, ulLen);
+    ulLen = 0;
+  }
+  vWrite (pvSink, ucBuf, ulLen);
+}
+
+// -----------------------------------------------------------------------------
+// Caractères des iCount registres d'une chaîne, les caractères nuls de
+// remplissage sont omis
+static void
+vGetRegString (char * sString, size_t ulSize, const uint16_t * pusReg,
+               int iCount) {
+  size_t ulLen = 0;
+  int i;
+
+  for (i = 0; i < iCount; i++) {
+    uint16_t v = pusReg[i];
+
+    if (ulLen >= ulSize - 2) {
+      break;
+    }
+    if (v >> 8) {
+      sString[ulLen++] = v >> 8;
+    }
+    if (v & 0xFF) {
+      sString[ulLen++] = v & 0xFF;
+    }
+  }
+  sString[ulLen] = 0;
+}
+
+// -----------------------------------------------------------------------------
+// Chaîne des iCount registres, sous la forme de la sortie choisie. Une lecture
+// peut couvrir bien plus de registres qu'une trame, la chaîne n'est jamais
+// tronquée.
+static void
+vPutRegString (xOutBuffer * o, const uint16_t * pusReg, int iCount) {
+  char sStack[2 * MODBUS_MAX_READ_REGISTERS + 1];
+  char * sString = sStack;
+  size_t ulSize = 2 * (size_t) iCount + 1;
+
+  if (ulSize > sizeof (sStack)) {
+
+    sString = malloc (ulSize);
+    assert (sString);
+  }
+  vGetRegString (sString, ulSize, pusReg, iCount);
+  if (ctx.eOutput == eOutputJsonl) {
+
+    vPutJsonString (o, sString);
+  }
+  else if (ctx.eOutput == eOutputCsv) {
+
+    vPutCsvString (o, sString);
+  }
+  else {
+
+    vOutBufferPuts (o, sString);
+  }
+  if (sString != sStack) {
+    free (sString);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Début d'un enregistrement csv ou jsonl, jusqu'à l'état de la lecture
+static void
+vPutSampleStart (xOutBuffer * o, const xSample * xSmp, bool bIsJson) {
+  const char * sFunction = sEnumToStr (xSmp->eFunction, iFunctionList,
+                                       sFunctionKeyList,
+                                       SIZEOF_ILIST (iFunctionList));
+  const char * sStatus = xSmp->iError ? modbus_strerror (xSmp->iError) : "ok";
+
+  if (bIsJson) {
+
+    vOutBufferPuts (o, "{\"time\":\"");
+    vPutTimestamp (o, &xSmp->xTime);
+    vOutBufferPuts (o, "\",\"source\":");
+    vPutJsonString (o, xSmp->sWhere);
+    vOutBufferPuts (o, ",\"slave\":");
+    vOutBufferUint (o, xSmp->iSlave);
+    vOutBufferPuts (o, ",\"function\":\"");
+    vOutBufferPuts (o, sFunction);
+    vOutBufferPuts (o, "\",\"reference\":");
+    vOutBufferUint (o, xSmp->iRef);
+    vOutBufferPuts (o, ",\"count\":");
+    vOutBufferUint (o, xSmp->iCount);
+    vOutBufferPuts (o, ",\"status\":");
+    vPutJsonString (o, sStatus);
+  }
+  else {
+
+    vPutTimestamp (o, &xSmp->xTime);
+    vOutBufferPutc (o, ',');
+    vPutCsvString (o, xSmp->sWhere);
+    vOutBufferPutc (o, ',');
+    vOutBufferUint (o, xSmp->iSlave);
+    vOutBufferPutc (o, ',');
+    vOutBufferPuts (o, sFunction);
+    vOutBufferPutc (o, ',');
+    vOutBufferUint (o, xSmp->iRef);
+    vOutBufferPutc (o, ',');
+    vOutBufferUint (o, xSmp->iCount);
+    vOutBufferPutc (o, ',');
+    vPutCsvString (o, sStatus);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Bits iFirst à iFirst + iCount - 1 rangés, sous la forme choisie par --bits :
+// les octets dans l'ordre d'une trame Modbus en hexadécimal, un caractère 0 ou
+// 1 par bit sinon. iFirst est un multiple de 8.
+static void
+vPutBits (xOutBuffer * o, const uint64_t * pullBits, int iFirst, int iCount) {
+  static const char cHex[] = "0123456789ABCDEF";
+  int i;
+
+  if (ctx.eBits == eBitsHex) {
+
+    vOutBufferPuts (o, "0x");
+    for (i = iFirst / 8; i < (iFirst + iCount + 7) / 8; i++) {
+      uint8_t ucByte = ucBitByte (pullBits, i);
+
+      vOutBufferPutc (o, cHex[ucByte >> 4]);
+      vOutBufferPutc (o, cHex[ucByte & 0xF]);
+    }
+  }
+  else for (i = iFirst; i < iFirst + iCount; i++) {
+
+    vOutBufferPutc (o, ( (pullBits[i / 64] >> (i % 64)) & 1) ? '1' : '0');
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Un enregistrement csv, jsonl ou binaire par échantillon, construit directement à
+// partir des données lues. Le format string donne une seule valeur : les
+// caractères de tous les registres, de même que les bits rangés de --bits.
+void
+vPrintSample (xOutBuffer * o, const xSample * xSmp) {
+  bool bIsJson = (ctx.eOutput == eOutputJsonl);
+  int i;
+
+  if (ctx.eOutput == eOutputBinary) {
+
+    vWriteSampleRecord (vOutBufferSink, o, xSmp);
+    return;
+  }
+
+  vPutSampleStart (o, xSmp, bIsJson);
+  if (bIsJson) {
+    vOutBufferPuts (o, ",\"values\":[");
+  }
+
+  if (xSmp->iError == 0) {
+
+    if (xSmp->eFormat == eFormatString) {
+
+      if (!bIsJson) {
+        vOutBufferPutc (o, ',');
+      }
+      vPutRegString (o, xSmp->pvData, xSmp->iCount);
+    }
+    else if (xSmp->pullBits && (ctx.eBits != eBitsList)) {
+
+      if (!bIsJson) {
+        vOutBufferPutc (o, ',');
+      }
+      else {
+        vOutBufferPutc (o, '"');
+      }
+      vPutBits (o, xSmp->pullBits, 0, xSmp->iCount);
+      if (bIsJson) {
+        vOutBufferPutc (o, '"');
+      }
+    }
+    else for (i = 0; i < xSmp->iCount; i++) {
+
+      if ( (i > 0) || (!bIsJson)) {
+        vOutBufferPutc (o, ',');
+      }
+      vPutSampleValue (o, xSmp, i, bIsJson);
+    }
+  }
+  vOutBufferPuts (o, bIsJson ? "]}\n" : "\n");
+}
+
+// -----------------------------------------------------------------------------
+// Echantillon décodé par --map : des registres 16 bits couvrant tous les champs
+static bool
+bIsMapSample (const xSample * xSmp) {
+
+  return (ctx.xMap.iFieldCount > 0) &&
+         ( (xSmp->eFunction == eFuncInputReg) ||
+           (xSmp->eFunction == eFuncHoldingReg)) &&
+         (iRegCount (xSmp->eFormat, 1) == 1) &&
+         (xSmp->eFormat != eFormatString) &&
+         (xSmp->iCount >= ctx.xMap.iRegCount);
+}
+
+// -----------------------------------------------------------------------------
+// Valeur d'un champ de --map, un nombre en JSON sauf pour l'hexadécimal et les
+// chaînes
+static void
+vPutFieldValue (xOutBuffer * o, const xRegField * f, const xRegValue * v) {
+  bool bIsJson = (ctx.eOutput == eOutputJsonl);
+
+  switch (f->pxType->eType) {
+
+    case eRegTypeInt16:
+    case eRegTypeInt32:
+    case eRegTypeInt64:
+      vOutBufferInt (o, v->llValue);
+      break;
+
+    case eRegTypeHex:
+      if (bIsJson) {
+        vOutBufferPutc (o, '"');
+      }
+      vOutBufferHex (o, v->ullValue, 4);
+      if (bIsJson) {
+        vOutBufferPutc (o, '"');
+      }
+      break;
+
+    case eRegTypeFloat:
+    case eRegTypeDouble:
+      if (bIsJson && ! isfinite (v->dValue)) {
+
+        // JSON n'a pas de NaN ni d'infini
+        vOutBufferPuts (o, "null");
+      }
+      else if (f->pxType->eType == eRegTypeFloat) {
+
+        vOutBufferDouble (o, v->dValue);
+      }
+      else {
+
+        vOutBufferDoubleDigits (o, v->dValue, DOUBLE_DIGITS);
+      }
+      break;
+
+    case eRegTypeString:
+      vPutRegString (o, v->pusText, f->usRegs);
+      break;
+
+    default:
+      vOutBufferUint (o, v->ullValue);
+      break;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Affichage des champs de --map d'un bloc : une ligne par champ en mode texte,
+// les valeurs dans l'ordre de la description en csv, un objet en jsonl
+static void
+vPrintMapSample (xOutBuffer * o, const xSample * xSmp) {
+  bool bIsJson = (ctx.eOutput == eOutputJsonl);
+  const xRegMap * m = &ctx.xMap;
+  xRegValue xValue[RBE_STACK_VALUES];
+  xRegValue * pxValue = xValue;
+  int i;
+
+  if (xSmp->iError == 0) {
+
+    if (m->iFieldCount > RBE_STACK_VALUES) {
+
+      pxValue = malloc (m->iFieldCount * sizeof (xRegValue));
+      assert (pxValue);
+    }
+    vRegMapDecode (m, xSmp->pvData, pxValue);
+  }
+
+  if (ctx.eOutput == eOutputText) {
+
+    for (i = 0; (xSmp->iError == 0) && (i < m->iFieldCount); i++) {
+      const xRegField * f = &m->pxField[i];
+
+      vOutBufferPutc (o, '[');
+      vOutBufferUint (o, xSmp->iRef + f->usOffset);
+      vOutBufferPuts (o, "] ");
+      vOutBufferPuts (o, f->sName);
+      vOutBufferPuts (o, ": \t");
+      vPutFieldValue (o, f, &pxValue[i]);
+      vOutBufferPutc (o, '\n');
+    }
+  }
+  else {
+
+    vPutSampleStart (o, xSmp, bIsJson);
+    if (bIsJson) {
+      vOutBufferPuts (o, ",\"values\":{");
+    }
+    for (i = 0; (xSmp->iError == 0) && (i < m->iFieldCount); i++) {
+
+      if ( (i > 0) || (!bIsJson)) {
+        vOutBufferPutc (o, ',');
+      }
+      if (bIsJson) {
+
+        vPutJsonString (o, m->pxField[i].sName);
+        vOutBufferPutc (o, ':');
+      }
+      vPutFieldValue (o, &m->pxField[i], &pxValue[i]);
+    }
+    vOutBufferPuts (o, bIsJson ? "}}\n" : "\n");
+  }
+
+  if (pxValue != xValue) {
+    free (pxValue);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Valeur i d'un échantillon, telle qu'elle est affichée
+static double
+dSampleValue (const xSample * xSmp, int i) {
+
+  switch (xSmp->eFormat) {
+
+    case eFormatBin:
+      return DUINT8 (xSmp->pvData, i);
+    case eFormatInt16:
+      return (int16_t) DUINT16 (xSmp->pvData, i);
+    case eFormatInt:
+      return DINT32 (xSmp->pvValue, i);
+    case eFormatFloat:
+      return DFLOAT (xSmp->pvValue, i);
+    case eFormatInt64:
+      return DINT64 (xSmp->pvValue, i);
+    case eFormatUInt64:
+      return DUINT64 (xSmp->pvValue, i);
+    case eFormatDouble:
+      return DDOUBLE (xSmp->pvValue, i);
+    default:
+      return DUINT16 (xSmp->pvData, i);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Affichage d'un échantillon sous la forme choisie par --output, et
+// publication dans l'anneau de --shm
+static void
+vEmitSample (xOutBuffer * o, const xSample * xSmp) {
+
+  if (xSmp->sHeader && xSmp->sHeader[0]) {
+
+    // l'entête n'est affiché qu'une fois par esclave et par cycle
+    vOutBufferPuts (o, xSmp->sHeader);
+    xSmp->sHeader[0] = '\0';
+  }
+#ifdef MBPOLL_SHM
+  if ( (ctx.sShmName) &&
+       (iMbShmBegin (&ctx.xShm, ulSampleRecordSize (xSmp)) == 0)) {
+
+    // les lecteurs reçoivent aussi les erreurs, quelle que soit la sortie
+    vWriteSampleRecord (vShmSink, &ctx.xShm, xSmp);
+    vMbShmCommit (&ctx.xShm);
+  }
+#endif
+  if ( (ctx.eOutput != eOutputBinary) && bIsMapSample (xSmp)) {
+
+    vPrintMapSample (o, xSmp);
+  }
+  else if (ctx.eOutput == eOutputText) {
+
+    if ( (xSmp->iError == 0) && xSmp->pullBits && (ctx.eBits != eBitsList)) {
+      int i;
+
+      // une ligne par tranche de 64 bits
+      for (i = 0; i < xSmp->iCount; i += 64) {
+
+        vOutBufferPutc (o, '[');
+        vOutBufferUint (o, xSmp->iRef + i);
+        vOutBufferPuts (o, "]: \t");
+        vPutBits (o, xSmp->pullBits, i, MIN (64, xSmp->iCount - i));
+        vOutBufferPutc (o, '\n');
+      }
+    }
+    else if (xSmp->iError == 0) {
+      vPrintReadValues (o, xSmp->iRef, xSmp->iCount, xSmp->eFormat,
+                        xSmp->pvValue ? xSmp->pvValue : xSmp->pvData);
+    }
+  }
+  else {
+
+    vPrintSample (o, xSmp);
+  }
+  // le tampon n'est découpé qu'entre deux échantillons
+  vOutBufferEndRecord (o);
+}
+
+#ifdef MBPOLL_SHM
+// -----------------------------------------------------------------------------
+// Bloc de l'image de --image : iCount valeurs lues sur un esclave
+static void
+vAddImageBlock (xMbImageBlock ** ppxBlock, unsigned long * pulCount,
+                int iSource, int iSlave, eFunctions eFunction,
+                eFormats eFormat, int iRef, int iCount) {
+  xMbImageBlock * b;
+
+  *ppxBlock = realloc (*ppxBlock, (*pulCount + 1) * sizeof (xMbImageBlock));
+  assert (*ppxBlock);
+  b = &(*ppxBlock)[ (*pulCount)++];
+  memset (b, 0, sizeof (*b));
+  b->usSource = iSource;
+  b->ucSlave = iSlave;
+  b->ucFunction = eFunction;
+  b->ucFormat = eRecFormat (eFormat);
+  b->ucFlags = ucRecFlags ();
+  b->ucElementSize = (eFormat == eFormatBin) ? 1 : 2;
+  b->ulRef = iRef;
+  b->ulElements = iRegCount (eFormat, iCount);
+}
+
+// -----------------------------------------------------------------------------
+// Création de l'image de --image : les plages lues (-r et -c ou --group) sur
+// chaque esclave de chaque source, numérotées comme dans le flux binaire
+void
+vCreateImage (void) {
+  xMbImageBlock * pxBlock = NULL;
+  unsigned long ulCount = 0;
+  xMemSink xHeader = { NULL, 0 };
+  int iSource, iSourceCount, i, j;
+
+  // avec plusieurs bus, la source 0 n'est pas scrutée pour elle-même
+  iSource = ctx.iBusCount ? 1 : 0;
+  iSourceCount = ctx.iHostCount ? ctx.iHostCount : ctx.iBusCount + 1;
+  for (; iSource < iSourceCount; iSource++) {
+    const int * piSlave = ctx.piSlaveAddr;
+    int iSlaveCount = ctx.iSlaveCount;
+
+    if ( (ctx.iHostCount == 0) && (iSource > 0)) {
+
+      piSlave = ctx.pxBus[iSource - 1].piSlaveAddr;
+      iSlaveCount = ctx.pxBus[iSource - 1].iSlaveCount;
+    }
+    for (i = 0; i < iSlaveCount; i++) {
+
+      if (ctx.iGroupCount) {
+
+        for (j = 0; j < ctx.iGroupCount; j++) {
+          const xPollGroup * g = &ctx.pxGroup[j];
+
+          vAddImageBlock (&pxBlock, &ulCount, iSource, piSlave[i],
+                          g->eFunction, g->eFormat, g->iStartRef, g->iCount);
+        }
+      }
+      else for (j = 0; j < ctx.iStartCount; j++) {
+
+        vAddImageBlock (&pxBlock, &ulCount, iSource, piSlave[i],
+                        ctx.eFunction, ctx.eFormat, ctx.piStartRef[j],
+                        ctx.piRefCount[j]);
+      }
+    }
+  }
+
+  vWriteStreamHeader (vMemSinkWrite, &xHeader);
+  if (iMbImageCreate (&ctx.xImage, ctx.sImageName, pxBlock, ulCount,
+                      xHeader.pucData, xHeader.ulLen) != 0) {
+
+    vIoErrorExit ("Unable to create %s %s: %s", sImageStr, ctx.sImageName,
+                  strerror (errno));
+  }
+  free (xHeader.pucData);
+  free (pxBlock);
+}
+
+// -----------------------------------------------------------------------------
+// Mise à jour de l'image de --image, une erreur n'en change que la qualité
+static void
+vUpdateImage (const xSample * xSmp) {
+  xMbRecord r = {
+    .usSource = xSmp->iSource,
+    .ucSlave = xSmp->iSlave,
+    .ucFunction = xSmp->eFunction,
+    .ulRef = xSmp->iRef,
+    .ulElements = iRegCount (xSmp->eFormat, xSmp->iCount),
+    .lStatus = xSmp->iError,
+    .ullMonotonic = xSmp->ulMonotonic,
+    .ullRealtime = (uint64_t) xSmp->xTime.tv_sec * 1000000000ULL +
+                   xSmp->xTime.tv_nsec
+  };
+
+  vMbImageUpdate (&ctx.xImage, &r, xSmp->pvData);
+}
+#endif
+
+#ifdef MBPOLL_PUB
+// -----------------------------------------------------------------------------
+// Envoi d'un échantillon aux clients abonnés de --pub
+static void
+vPublishSample (const xSample * xSmp) {
+  uint8_t ucRecord[MBREC_RECORD_HEADER_SIZE + MODBUS_MAX_READ_BITS];
+  size_t ulSize = ulSampleRecordSize (xSmp);
+  xMemSink xRecord = { ucRecord, 0 };
+
+  if (ulSize > sizeof (ucRecord)) {
+
+    xRecord.pucData = malloc (ulSize);
+    assert (xRecord.pucData);
+  }
+  vWriteSampleRecord (vBufSinkWrite, &xRecord, xSmp);
+  vMbPubPublish (&ctx.xPub, xRecord.pucData, xRecord.ulLen);
+  if (xRecord.pucData != ucRecord) {
+    free (xRecord.pucData);
+  }
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// Valeur i d'un échantillon sur 64 bits : l'entier lui-même pour les formats
+// int64 et uint64, qu'un double arrondirait, les bits de dSampleValue() sinon
+static uint64_t
+ullSampleWord (const xSample * xSmp, int i) {
+  uint64_t v;
+  double d;
+
+  if ( (xSmp->eFormat == eFormatInt64) || (xSmp->eFormat == eFormatUInt64)) {
+    return DUINT64 (xSmp->pvValue, i);
+  }
+  d = dSampleValue (xSmp, i);
+  memcpy (&v, &d, sizeof (v));
+  return v;
+}
+
+// -----------------------------------------------------------------------------
+// Décodage des valeurs d'une lecture réussie et de sa description. Une valeur
+// string y est une valeur par registre. Retourne pullBuf s'il suffit, sinon
+// une zone allouée à libérer.
+static uint64_t *
+pullDecodeSample (const xSample * xSmp, xMbRecord * r, uint64_t * pullBuf) {
+  int iCount = (xSmp->eFormat == eFormatString) ?
+               iRegCount (xSmp->eFormat, xSmp->iCount) : xSmp->iCount;
+  uint64_t * pullValue = pullBuf;
+  int i;
+
+  memset (r, 0, sizeof (*r));
+  r->usSource = xSmp->iSource;
+  r->ucSlave = xSmp->iSlave;
+  r->ucFunction = xSmp->eFunction;
+  r->ucFormat = eRecFormat (xSmp->eFormat);
+  r->ucFlags = ucRecFlags ();
+  r->ulRef = xSmp->iRef;
+  r->ulCount = iCount;
+  r->ullRealtime = (uint64_t) xSmp->xTime.tv_sec * 1000000000ULL +
+                   xSmp->xTime.tv_nsec;
+
+  if (iCount > RBE_STACK_VALUES) {
+
+    pullValue = malloc (iCount * sizeof (uint64_t));
+    assert (pullValue);
+  }
+  for (i = 0; i < iCount; i++) {
+    pullValue[i] = ullSampleWord (xSmp, i);
+  }
+  return pullValue;
+}
+
+// -----------------------------------------------------------------------------
+// Ajout d'une lecture réussie au fichier de --ts, chaque valeur en est une
+// colonne
+static void
+vAppendTs (const xSample * xSmp) {
+  uint64_t ullValue[RBE_STACK_VALUES];
+  xMbRecord r;
+  uint64_t * pullValue = pullDecodeSample (xSmp, &r, ullValue);
+
+  if (iMbTsAppend (&ctx.xTs, &r, pullValue) != 0) {
+
+    vIoErrorExit ("Unable to write %s %s: %s", sTsStr, ctx.sTsFile,
+                  strerror (errno));
+  }
+  if (pullValue != ullValue) {
+    free (pullValue);
+  }
+}
+
+#ifdef MBPOLL_METRICS
+// -----------------------------------------------------------------------------
+// Mise à jour des valeurs de --metrics par une lecture réussie
+static void
+vUpdateMetrics (const xSample * xSmp) {
+  uint64_t ullValue[RBE_STACK_VALUES];
+  xMbRecord r;
+  uint64_t * pullValue = pullDecodeSample (xSmp, &r, ullValue);
+
+  vMbMetricsUpdate (&ctx.xMetrics, &r, pullValue);
+  if (pullValue != ullValue) {
+    free (pullValue);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Comptage des lectures d'un plan pour --metrics
+void
+vCountPlanMetrics (const xReadPlan * p, int iSource, int iSlave) {
+  int i;
+
+  for (i = 0; i < p->iChunkCount; i++) {
+    const xReadChunk * c = &p->pxChunk[i];
+
+    vMbMetricsTransaction (&ctx.xMetrics, iSource, iSlave, c->iRet == c->iNb,
+                           c->ulLatency);
+  }
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// --rbe pour des bobines ou des entrées : les bits rangés par vReportSample()
+// sont comparés 64 à la fois. Les suites de bits changés sont affichées, ou le
+// bloc entier sous la forme choisie par --bits.
+static void
+vDispatchBits (xOutBuffer * o, const xSample * xSmp, const xRbeKey * k) {
+  uint64_t ullChanged[RBE_STACK_VALUES];
+  uint64_t * pullChanged = ullChanged;
+  xRbeEntry * e = pxRbeBitEntry (&ctx.xRbe, k);
+  int i, j;
+
+  if (e == NULL) {
+
+    vIoErrorExit ("Unable to allocate the report by exception table");
+  }
+  if (xSmp->iError) {
+
+    // le retour de l'esclave sera signalé en entier
+    vRbeInvalidate (e);
+    vEmitSample (o, xSmp);
+    return;
+  }
+
+  if (BIT_WORDS (xSmp->iCount) > RBE_STACK_VALUES) {
+
+    pullChanged = malloc (BIT_WORDS (xSmp->iCount) * sizeof (uint64_t));
+    assert (pullChanged);
+  }
+
+  if (iRbeCompareBits (&ctx.xRbe, e, xSmp->pullBits, ulPollTimerNow(),
+                       pullChanged) > 0) {
+
+    if (ctx.eBits != eBitsList) {
+
+      vEmitSample (o, xSmp);
+    }
+    else for (i = iBitFind (pullChanged, 0, xSmp->iCount, true);
+                i < xSmp->iCount;
+                i = iBitFind (pullChanged, j, xSmp->iCount, true)) {
+      xSample xRun = *xSmp;
+
+      j = iBitFind (pullChanged, i, xSmp->iCount, false);
+      xRun.iRef = xSmp->iRef + i;
+      xRun.iCount = j - i;
+      xRun.pvData = (const uint8_t *) xSmp->pvData + i;
+      xRun.pullBits = NULL;
+      vEmitSample (o, &xRun);
+    }
+  }
+
+  if (pullChanged != ullChanged) {
+    free (pullChanged);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Affichage d'un échantillon. Avec --rbe, seules les valeurs qui ont changé
+// depuis leur dernier signalement sont affichées, chaque suite de valeurs
+// consécutives formant un échantillon. Une erreur n'est affichée qu'en mode
+// enregistrement, l'appelant l'affiche en mode texte.
+static void
+vDispatchSample (xOutBuffer * o, const xSample * xSmp) {
+  bool bIsString = (xSmp->eFormat == eFormatString);
+  bool bIsInt64 = (xSmp->eFormat == eFormatInt64) ||
+                  (xSmp->eFormat == eFormatUInt64);
+  int iStep = iRegCount (xSmp->eFormat, 1);
+  size_t ulSize = ( (xSmp->eFunction == eFuncCoil) ||
+                    (xSmp->eFunction == eFuncDiscreteInput)) ? 1 : 2;
+  double dValue[RBE_STACK_VALUES];
+  bool bChanged[RBE_STACK_VALUES];
+  double * pdValue = dValue;
+  bool * pbChanged = bChanged;
+  xRbeKey xKey = {
+    .iSource = xSmp->iSource,
+    .iSlave = xSmp->iSlave,
+    .iFunction = xSmp->eFunction,
+    .iFormat = xSmp->eFormat,
+    .iRef = xSmp->iRef,
+    .iCount = xSmp->iCount
+  };
+  xRbeEntry * e;
+  int i, j, iChanged;
+
+#ifdef MBPOLL_SHM
+  if (ctx.sImageName) {
+
+    // l'image reçoit toutes les lectures, avant le filtrage de --rbe
+    vUpdateImage (xSmp);
+  }
+#endif
+#ifdef MBPOLL_PUB
+  if (ctx.sPubPath) {
+
+    // les clients reçoivent toutes les lectures, erreurs comprises
+    vPublishSample (xSmp);
+  }
+#endif
+  if ( (ctx.sTsFile) && (xSmp->iError == 0)) {
+
+    // le fichier reçoit aussi toutes les lectures réussies
+    vAppendTs (xSmp);
+  }
+#ifdef MBPOLL_METRICS
+  if ( (ctx.sMetricsPort) && (xSmp->iError == 0)) {
+
+    // une erreur laisse la dernière valeur lue, mbpoll_up la signale
+    vUpdateMetrics (xSmp);
+  }
+#endif
+  if (!ctx.bIsRbe) {
+
+    vEmitSample (o, xSmp);
+    return;
+  }
+  if (xSmp->eFormat == eFormatBin) {
+
+    vDispatchBits (o, xSmp, &xKey);
+    return;
+  }
+
+  // une valeur string couvre tous les registres, chacun est comparé
+  if (bIsInt64) {
+    e = pxRbeIntEntry (&ctx.xRbe, &xKey, iStep);
+  }
+  else {
+    e = pxRbeEntry (&ctx.xRbe, &xKey, iStep, !bIsString &&
+                    (xSmp->eFormat != eFormatBin) &&
+                    (xSmp->eFormat != eFormatHex));
+  }
+  if (e == NULL) {
+
+    vIoErrorExit ("Unable to allocate the report by exception table");
+  }
+  if (xSmp->iError) {
+
+    // le retour de l'esclave sera signalé en entier
+    vRbeInvalidate (e);
+    vEmitSample (o, xSmp);
+    return;
+  }
+
+  if (xSmp->iCount > RBE_STACK_VALUES) {
+
+    pdValue = malloc (xSmp->iCount * sizeof (double));
+    pbChanged = malloc (xSmp->iCount * sizeof (bool));
+    assert (pdValue && pbChanged);
+  }
+  if (bIsInt64) {
+
+    // les entiers de 64 bits sont comparés exactement, sans passer par un
+    // double
+    iChanged = iRbeCompareInt (&ctx.xRbe, e, (const uint64_t *) xSmp->pvValue,
+                               xSmp->eFormat == eFormatInt64, ulPollTimerNow(),
+                               pbChanged);
+  }
+  else {
+
+    for (i = 0; i < xSmp->iCount; i++) {
+      pdValue[i] = dSampleValue (xSmp, i);
+    }
+    iChanged = iRbeCompare (&ctx.xRbe, e, pdValue, ulPollTimerNow(),
+                            pbChanged);
+  }
+
+  if (iChanged > 0) {
+
+    if (bIsString || bIsMapSample (xSmp)) {
+
+      // les champs de --map sont décodés depuis le bloc entier
+      vEmitSample (o, xSmp);
+    }
+    else for (i = 0; i < xSmp->iCount; i = j) {
+      xSample xRun = *xSmp;
+
+      if (!pbChanged[i]) {
+        j = i + 1;
+        continue;
+      }
+      for (j = i + 1; (j < xSmp->iCount) && pbChanged[j]; j++)
+        ;
+      xRun.iRef = xSmp->iRef + i * iStep;
+      xRun.iCount = j - i;
+      xRun.pvData = (const uint8_t *) xSmp->pvData + i * iStep * ulSize;
+      if (xSmp->pvValue) {
+        // une valeur décodée occupe autant d'octets que ses registres
+        xRun.pvValue = (const uint8_t *) xSmp->pvValue + i * iStep * 2;
+      }
+      vEmitSample (o, &xRun);
+    }
+  }
+
+  if (pdValue != dValue) {
+
+    free (pdValue);
+    free (pbChanged);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Signalement d'un échantillon : les valeurs de 32 et 64 bits sont décodées
+// une seule fois pour tout le bloc, toutes les sorties utilisent ce résultat.
+// Les bits sont rangés 64 par mot lorsque --rbe ou --bits s'en servent.
+void
+vReportSample (xOutBuffer * o, const xSample * xSmp) {
+  int iWidth = iRegCount (xSmp->eFormat, 1);
+  uint64_t ullValue[RBE_STACK_VALUES];
+  uint64_t * pullValue = ullValue;
+  xSample xDecoded;
+
+  if ( (xSmp->iError == 0) && (xSmp->eFormat == eFormatBin) &&
+       (ctx.bIsRbe || (ctx.eBits != eBitsList))) {
+
+    if (BIT_WORDS (xSmp->iCount) > RBE_STACK_VALUES) {
+
+      pullValue = malloc (BIT_WORDS (xSmp->iCount) * sizeof (uint64_t));
+      assert (pullValue);
+    }
+    vBitPack (pullValue, xSmp->pvData, xSmp->iCount);
+    xDecoded = *xSmp;
+    xDecoded.pullBits = pullValue;
+  }
+  else if ( (xSmp->iError != 0) || (iWidth == 1) ||
+            (xSmp->eFormat == eFormatString)) {
+
+    vDispatchSample (o, xSmp);
+    return;
+  }
+  else {
+
+    if (xSmp->iCount > RBE_STACK_VALUES) {
+
+      pullValue = malloc (xSmp->iCount * sizeof (uint64_t));
+      assert (pullValue);
+    }
+    vRegDecode (pullValue, xSmp->pvData, xSmp->iCount,
+                (iWidth == 2) ? &ctx.xOrder32 : &ctx.xOrder64);
+    xDecoded = *xSmp;
+    xDecoded.pvValue = pullValue;
+  }
+  vDispatchSample (o, &xDecoded);
+  if (pullValue != ullValue) {
+    free (pullValue);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Les valeurs sont construites dans o, sans appel à stdio, voir vFlushOutput().
+// Les valeurs de 32 et 64 bits sont celles décodées par vRegDecode().
+void
+vPrintReadValues (xOutBuffer * o, int iAddr, int iCount, eFormats eFormat,
+                  const void * pvData) {
+  int i;
+  for (i = 0; i < iCount; i++) {
+
+    vOutBufferPutc (o, '[');
+    vOutBufferUint (o, iAddr);
+    vOutBufferPuts (o, "]: \t");
+
+    switch (eFormat) {
+
+      case eFormatBin:
+        vOutBufferPutc (o, (DUINT8 (pvData, i) != FALSE) ? '1' : '0');
+        iAddr++;
+        break;
+
+      case eFormatDec: {
+        uint16_t v = DUINT16 (pvData, i);
+        vOutBufferUint (o, v);
+        if (v & 0x8000) {
+
+          vOutBufferPuts (o, " (");
+          vOutBufferInt (o, (int16_t) v);
+          vOutBufferPutc (o, ')');
+        }
+        iAddr++;
+
+      }
+      break;
+
+      case eFormatInt16:
+        vOutBufferInt (o, (int16_t) (DUINT16 (pvData, i)));
+        iAddr++;
+        break;
+
+      case eFormatHex:
+        vOutBufferHex (o, DUINT16 (pvData, i), 4);
+        iAddr++;
+        break;
+
+      case eFormatString:
+        vOutBufferPutc (o, (char) ((int) (DUINT16 (pvData, i) / 256)));
+        vOutBufferPutc (o, (char) (DUINT16 (pvData, i) % 256));
+        iAddr++;
+        break;
+
+      case eFormatInt:
+        vOutBufferInt (o, DINT32 (pvData, i));
+        iAddr += 2;
+        break;
+
+      case eFormatFloat:
+        vOutBufferDouble (o, DFLOAT (pvData, i));
+        iAddr += 2;
+        break;
+
+      case eFormatInt64:
+        vOutBufferInt (o, DINT64 (pvData, i));
+        iAddr += 4;
+        break;
+
+      case eFormatUInt64:
+        vOutBufferUint (o, DUINT64 (pvData, i));
+        iAddr += 4;
+        break;
+
+      case eFormatDouble:
+        vOutBufferDoubleDigits (o, DDOUBLE (pvData, i), DOUBLE_DIGITS);
+        iAddr += 4;
+        break;
+
+      default:  // Impossible normalement
+        break;
+    }
+    vOutBufferPutc (o, '\n');
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Ecriture du texte construit par un seul write(), après ce qui est encore
+// dans le tampon de stdout (configuration, messages)
+void
+vFlushOutput (xOutBuffer * o) {
+
+  LOCK_OUTPUT();
+  fflush (stdout);
+  iOutBufferFlush (o);
+  UNLOCK_OUTPUT();
+}
+
+// -----------------------------------------------------------------------------
+void
+vReportSlaveID (const xMbPollContext * ctx) {
+  uint8_t ucReport[256];
+
+  modbus_set_slave (ctx->xBus, ctx->piSlaveAddr[0]);
+  // Affichage de la configuration
+  printf ("Protocol configuration: Modbus %s\n", sModeList[ctx->eMode]);
+  printf ("Slave configuration...: address = %d, report slave id\n",
+          ctx->piSlaveAddr[0]);
+
+  vPrintCommunicationSetup (ctx);
+
+  int iRet = modbus_report_slave_id (ctx->xBus, 256, ucReport);
+
+  if (iRet < 0) {
+
+    fprintf (stderr, "Report slave ID failed(%d): %s\n", iRet,
+             modbus_strerror (errno));
+  }
+  else {
+
+    if (iRet > 1) {
+      int iLen = iRet - 2;
+
+      printf (
+        "Length: %d\n"
+        "Id    : 0x%02X\n"
+        "Status: %s\n"
+        , iRet
+        , ucReport[0]
+        , (ucReport[1]) ? "On" : "Off"
+      );
+
+      if (iLen > 0) {
+        int i;
+        printf ("Data  : ");
+        for (i = 2; i < (iLen + 2); i++) {
+
+          if (isprint (ucReport[i])) {
+
+            putchar (ucReport[i]);
+          }
+          else {
+
+            printf ("\\%02X", ucReport[i]);
+          }
+        }
+        putchar ('\n');
+      }
+    }
+    else {
+
+      fprintf (stderr, "no data available\n");
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vPrintCommunicationSetup (const xMbPollContext * ctx) {
+
+  if (ctx->iBusCount) {
+    int i;
+
+    for (i = 0; i < ctx->iBusCount; i++) {
+      const xSerialBus * b = &ctx->pxBus[i];
+
+      printf ("%s%s, %s, address = "
+              , i ? "                        " : "Communication.........: "
+              , b->sDevice
+              , sSerialAttrToStr (&b->xIos));
+      vPrintIntList (b->piSlaveAddr, b->iSlaveCount);
+      putchar ('\n');
+    }
+    printf ("                        t/o %.2f s, poll rate %d ms"
+            , ctx->dTimeout
+            , ctx->iPollRate);
+  }
+  else if (ctx->eMode == eModeRtu) {
+#ifndef USE_CHIPIO
+// -----------------------------------------------------------------------------
+    const char sAddStr[] = "";
+#else /* USE_CHIPIO defined */
+// -----------------------------------------------------------------------------
+    const char * sAddStr;
+    if (ctx->bIsChipIo) {
+      sAddStr = " via ChipIo serial port";
+    }
+    else {
+
+      sAddStr = "";
+    }
+// -----------------------------------------------------------------------------
+#endif /* USE_CHIPIO defined */
+
+    printf ("Communication.........: %s%s, %s\n"
+            "                        t/o %.2f s, poll rate %d ms"
+            , ctx->sDevice
+            , sAddStr
+            , sSerialAttrToStr (&ctx->xRtu)
+            , ctx->dTimeout
+            , ctx->iPollRate);
+  }
+  else if (ctx->iHostCount) {
+
+    printf ("Communication.........: %d hosts, port %s, t/o %.2f s, poll rate %d ms"
+            , ctx->iHostCount
+            , ctx->sTcpPort
+            , ctx->dTimeout
+            , ctx->iPollRate);
+  }
+  else {
+
+    printf ("Communication.........: %s, port %s, t/o %.2f s, poll rate %d ms"
+            , ctx->sDevice
+            , ctx->sTcpPort
+            , ctx->dTimeout
+            , ctx->iPollRate);
+  }
+  if (ctx->bIsSweep) {
+
+    printf (" per sweep, gap %d ms", ctx->iGap);
+  }
+  putchar ('\n');
+}
+
+// -----------------------------------------------------------------------------
+// Format des registres lus ou écrits
+static void
+vPrintRegFormat (const xMbPollContext * ctx) {
+  const char * sFormat;
+
+  switch (ctx->eFormat) {
+
+    case eFormatInt:
+      sFormat = sIntStr;
+      break;
+    case eFormatFloat:
+      sFormat = sFloatStr;
+      break;
+    case eFormatInt64:
+      sFormat = sInt64Str;
+      break;
+    case eFormatUInt64:
+      sFormat = sUInt64Str;
+      break;
+    case eFormatDouble:
+      sFormat = sDoubleStr;
+      break;
+    default:
+      if (ctx->sMapFile) {
+
+        printf ("%s %s, %d fields", sMapStr, ctx->sMapFile,
+                ctx->xMap.iFieldCount);
+      }
+      else {
+
+        printf ("%s", sWordStr);
+      }
+      return;
+  }
+  switch (ctx->eOrder) {
+
+    case eRegOrderCDAB:
+      printf ("%s %s", sFormat, sLittleEndianStr);
+      break;
+    case eRegOrderABCD:
+      printf ("%s %s", sFormat, sBigEndianStr);
+      break;
+    default:
+      printf ("%s (%s order)", sFormat, sEnumToStr (ctx->eOrder, iOrderList,
+              sOrderList, SIZEOF_ILIST (iOrderList)));
+      break;
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vPrintConfig (const xMbPollContext * ctx) {
+
+  // Affichage de la configuration
+  printf ("Protocol configuration: Modbus %s\n", sModeList[ctx->eMode]);
+  printf ("Slave configuration...: address = ");
+  if (ctx->iBusCount) {
+
+    // les adresses sont données pour chaque bus
+    printf ("per bus");
+  }
+  else {
+
+    vPrintIntList (ctx->piSlaveAddr, ctx->iSlaveCount);
+  }
+  if (ctx->iGroupCount) {
+    int i;
+
+    putchar ('\n');
+    for (i = 0; i < ctx->iGroupCount; i++) {
+      const xPollGroup * g = &ctx->pxGroup[i];
+
+      printf ("                        group %d: %s %s, start reference = %d, "
+              "count = %d, every %d ms\n"
+              , g->iIndex
+              , sFunctionToStr (g->eFunction)
+              , sEnumToStr (g->eFormat, iFormatList, sFormatList,
+                            SIZEOF_ILIST (iFormatList))
+              , g->iStartRef
+              , g->iCount
+              , g->iPollRate);
+    }
+  }
+  else if (ctx->iStartCount > 1) {
+    int i;
+
+    printf ("\n                        start reference = [");
+    for (i = 0; i < ctx->iStartCount; i++) {
+
+      printf ("%s%d", i ? "," : "", ctx->piStartRef[i]);
+      if (ctx->piRefCount[i] > 1) {
+
+        printf (":+%d", ctx->piRefCount[i]);
+      }
+    }
+    printf ("], %d read%s per slave\n", ctx->xPlan.iChunkCount,
+            ctx->xPlan.iChunkCount > 1 ? "s" : "");
+  }
+  else {
+    printf ("\n                        start reference = %d, count = %d",
+            ctx->piStartRef[0], ctx->iCount);
+    if (ctx->xPlan.iChunkCount > 1) {
+
+      printf (", %d reads per slave", ctx->xPlan.iChunkCount);
+    }
+    putchar ('\n');
+  }
+  vPrintCommunicationSetup (ctx);
+  if (ctx->iGroupCount) {
+    // le type de données est donné pour chaque groupe
+    putchar ('\n');
+    return;
+  }
+  printf ("Data type.............: ");
+  switch (ctx->eFunction) {
+
+    case eFuncDiscreteInput:
+      printf ("discrete input\n");
+      break;
+
+    case eFuncCoil:
+      printf ("discrete output (coil)\n");
+      break;
+
+    case eFuncInputReg:
+      vPrintRegFormat (ctx);
+      printf (", input register table\n");
+      break;
+
+    case eFuncHoldingReg:
+      vPrintRegFormat (ctx);
+      printf (", output (holding) register table\n");
+      break;
+
+    default: // Impossible, la valeur a été vérifiée, évite un warning de gcc
+      break;
+  }
+  putchar ('\n');
+}
+
+// -----------------------------------------------------------------------------
+// Allocation de la mémoire pour les données à écrire ou à lire
+void
+vAllocate (xMbPollContext * ctx) {
+
+  ctx->pvData = pvAllocateData (ctx->eFunction, ctx->eFormat, ctx->iCount);
+  if (!ctx->bIsWrite) {
+
+    // les blocs de -r et leurs lectures sont alloués une fois pour toutes
+    vNewReadPlan (&ctx->xPlan, ctx);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Nombre de registres 16 bits occupés par iCount valeurs
+int
+iRegCount (eFormats eFormat, int iCount) {
+
+  switch (eFormat) {
+
+    // int32 et float utilisent 2 registres 16 bits
+    case eFormatInt:
+    case eFormatFloat:
+      return iCount * 2;
+
+    // int64, uint64 et double en utilisent 4
+    case eFormatInt64:
+    case eFormatUInt64:
+    case eFormatDouble:
+      return iCount * 4;
+
+    default:
+      return iCount;
+  }
+}
+
+// -----------------------------------------------------------------------------
+void *
+pvAllocateData (eFunctions eFunction, eFormats eFormat, int iCount) {
+  void * pvData;
+
+  size_t ulDataSize = iCount;
+  switch (eFunction) {
+
+    case eFuncCoil:
+    case eFuncDiscreteInput:
+      // 1 bit est stocké dans un octet
+      break;
+
+    case eFuncInputReg:
+    case eFuncHoldingReg:
+      // Registres 16-bits, 2 ou 4 par valeur de 32 ou 64 bits
+      ulDataSize = iRegCount (eFormat, iCount) * sizeof (uint16_t);
+      break;
+
+    default: // Impossible, la valeur a été vérifiée, évite un warning de gcc
+      break;
+  }
+  pvData = calloc (1, ulDataSize);
+  assert (pvData);
+  return pvData;
+}
+
+// -----------------------------------------------------------------------------
+// Décodage d'un groupe de scrutation : t=4:float,r=1,c=10,l=100
+// Les clés absentes prennent la valeur des options -t, -r, -c et -l
+void
+vGetGroup (const char * sSpec, xPollGroup * g, const xMbPollContext * ctx) {
+  char * sDup = strdup (sSpec);
+  char * sSave = NULL;
+  char * sItem;
+  int iStartReg, iNbReg;
+
+  assert (sDup);
+  g->eFunction = ctx->eFunction;
+  g->eFormat = ctx->eFormat;
+  g->iStartRef = ctx->piStartRef[0];
+  g->iCount = (ctx->iStartCount > 1) ? 1 : ctx->iCount;
+  g->iPollRate = ctx->iPollRate;
+
+  for (sItem = strtok_r (sDup, ",", &sSave); sItem;
+       sItem = strtok_r (NULL, ",", &sSave)) {
+    char * sValue = index (sItem, '=');
+
+    if ( (sValue == NULL) || (sValue[1] == 0) || ( (sValue - sItem) != 1)) {
+
+      vSyntaxErrorExit ("Illegal %s item: %s", sGroupStr, sItem);
+    }
+    sValue++;
+
+    switch (sItem[0]) {
+
+      case 't': {
+        char * p = index (sValue, ':');
+
+        g->eFunction = iGetInt (sFunctionStr, sValue, 0);
+        vCheckEnum (sFunctionStr, g->eFunction,
+                    iFunctionList, SIZEOF_ILIST (iFunctionList));
+        g->eFormat = eFormatDec;
+        if (p) {
+          g->eFormat = iGetEnum (sFormatStr, p + 1, sFormatList, iFormatList,
+                                 SIZEOF_ILIST (iFormatList));
+        }
+      }
+      break;
+
+      case 'r':
+        g->iStartRef = iGetInt (sStartRefStr, sValue, 0);
+        break;
+
+      case 'c':
+        g->iCount = iGetInt (sNumOfValuesStr, sValue, 0);
+        break;
+
+      case 'l':
+        g->iPollRate = iGetInt (sPollRateStr, sValue, 0);
+        break;
+
+      default:
+        vSyntaxErrorExit ("Illegal %s item: %s", sGroupStr, sItem);
+        break;
+    }
+  }
+  free (sDup);
+
+  if ( (g->eFunction == eFuncCoil) || (g->eFunction == eFuncDiscreteInput)) {
+
+    g->eFormat = eFormatBin;
+  }
+  // mêmes bornes que -r, la référence 0 n'existe qu'avec -0
+  vCheckIntRange (sStartRefStr, g->iStartRef,
+                  STARTREF_MIN - 1 + ctx->iPduOffset,
+                  STARTREF_MAX - 1 + ctx->iPduOffset);
+  vCheckIntRange (sNumOfValuesStr, g->iCount, NUMOFVALUES_MIN, NUMOFVALUES_MAX);
+  if (g->iPollRate < POLLRATE_MIN) {
+
+    vSyntaxErrorExit ("Illegal %s: %d", sPollRateStr, g->iPollRate);
+  }
+  vCheckReadRange (g->iStartRef - ctx->iPduOffset,
+                   iRegCount (g->eFormat, g->iCount));
+  iNbReg = iRegCount (g->eFormat, g->iCount);
+  iStartReg = g->iStartRef - ctx->iPduOffset;
+  if (iReadPlanInit (&g->xPlan, &iStartReg, &iNbReg, 1,
+                     g->eFormat == eFormatBin, iRegCount (g->eFormat, 1), -1)) {
+
+    vIoErrorExit ("Unable to allocate %s data", sGroupStr);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Ajoute un hôte de la forme host ou host:port
+static void
+vAddHost (const char * sHost, xMbPollContext * ctx) {
+  char * sDup = strdup (sHost);
+  char * p;
+
+  assert (sDup);
+  ctx->psHost = realloc (ctx->psHost, (ctx->iHostCount + 1) * sizeof (char *));
+  ctx->psHostPort = realloc (ctx->psHostPort,
+                             (ctx->iHostCount + 1) * sizeof (char *));
+  assert (ctx->psHost && ctx->psHostPort);
+
+  ctx->psHostPort[ctx->iHostCount] = ctx->sTcpPort;
+  p = rindex (sDup, ':');
+  if ( (p) && (index (sDup, ':') == p)) {
+
+    // un seul ':', ce n'est pas une adresse IPv6
+    *p++ = 0;
+    vCheckIntRange (sTcpPortStr, iGetInt (sTcpPortStr, p, 10),
+                    TCP_PORT_MIN, TCP_PORT_MAX);
+    ctx->psHostPort[ctx->iHostCount] = p;
+  }
+  ctx->psHost[ctx->iHostCount++] = sDup;
+}
+
+// -----------------------------------------------------------------------------
+// Liste d'hôtes séparés par des virgules ou fichier (@fichier) contenant un
+// hôte par ligne, les lignes vides et celles commençant par # sont ignorées
+void
+vGetHostList (const char * sList, xMbPollContext * ctx) {
+  char * sItem;
+  char * sSave = NULL;
+
+  if (sList[0] == '@') {
+    FILE * f = fopen (sList + 1, "r");
+    char sLine[256];
+
+    if (f == NULL) {
+
+      vIoErrorExit ("Unable to open %s: %s", sList + 1, strerror (errno));
+    }
+    while (fgets (sLine, sizeof (sLine), f)) {
+
+      sItem = strtok_r (sLine, " \t\r\n", &sSave);
+      if ( (sItem) && (sItem[0] != '#')) {
+
+        vAddHost (sItem, ctx);
+      }
+    }
+    fclose (f);
+  }
+  else {
+    char * sDup = strdup (sList);
+
+    assert (sDup);
+    for (sItem = strtok_r (sDup, ",", &sSave); sItem;
+         sItem = strtok_r (NULL, ",", &sSave)) {
+
+      vAddHost (sItem, ctx);
+    }
+    free (sDup);
+  }
+
+  if (ctx->iHostCount == 0) {
+
+    vSyntaxErrorExit ("Empty host list");
+  }
+}
+
+#ifdef MBPOLL_TCP_ENGINE
+// -----------------------------------------------------------------------------
+// Affichage du résultat d'une transaction du moteur multi-hôtes
+static void
+vPrintHostResult (const xTcpResult * r, void * pvUser) {
+  xMbPollContext * ctx = (xMbPollContext *) pvUser;
+
+  const xReadPlan * p = &ctx->xPlan;
+  const xReadChunk * c = &p->pxChunk[r->iStartIndex];
+  char cBuf[OUTPUT_BUFFER_SIZE];
+  char sWhere[256];
+  char sHeader[HEADER_SIZE];
+  xOutBuffer xOut;
+  xSample xSmp = {
+    .sWhere = sWhere,
+    .iSlave = r->iSlave,
+    .eFunction = ctx->eFunction,
+    .iSource = r->iHost,
+    .eFormat = ctx->eFormat,
+    .iError = r->iRet >= 0 ? 0 : r->iError,
+    .sHeader = (ctx->eOutput == eOutputText) ? sHeader : NULL
+  };
+  int i;
+
+#ifdef MBPOLL_METRICS
+  if (ctx->sMetricsPort) {
+    vMbMetricsTransaction (&ctx->xMetrics, r->iHost, r->iSlave, r->iRet >= 0,
+                           r->ulLatency);
+  }
+#endif
+  // les réponses des hôtes sont entrelacées, chaque bloc a son entête.
+  // Les compteurs sont ceux du moteur, cette fonction peut être appelée
+  // simultanément par plusieurs workers, chacun construit son bloc dans sa
+  // pile
+  vOutBufferInit (&xOut, STDOUT_FILENO, cBuf, sizeof (cBuf));
+#ifdef MBPOLL_OUT_QUEUE
+  xOut.pxQueue = ctx->xOut.pxQueue;
+#endif
+  snprintf (sWhere, sizeof (sWhere), "%s:%s", r->sHost, r->sPort);
+  snprintf (sHeader, sizeof (sHeader), "-- Polling slave %d on %s...\n",
+            r->iSlave, sWhere);
+  vSampleNow (&xSmp);
+
+  // chaque référence couverte par la lecture
+  for (i = 0; i < c->iSegmentCount; i++) {
+    const xReadSegment * s = &p->pxSegment[c->iFirstSegment + i];
+    uint32_t ulValues[MODBUS_MAX_READ_BITS / sizeof (uint32_t)];
+
+    xSmp.iRef = p->pxBlock[s->iBlock].iAddr + s->iBlockOffset +
+                ctx->iPduOffset;
+    xSmp.iCount = s->iNb / p->iStep;
+    if (r->iRet >= 0) {
+
+      // copie alignée, un segment peut commencer sur un registre impair
+      memcpy (ulValues,
+              (const uint8_t *) r->pvData + s->iChunkOffset * p->ulSize,
+              s->iNb * p->ulSize);
+      xSmp.pvData = ulValues;
+    }
+    vReportSample (&xOut, &xSmp);
+  }
+
+  if ( (r->iRet < 0) && (ctx->eOutput == eOutputText)) {
+
+    LOCK_OUTPUT();
+    vFlushOutput (&xOut);
+    fprintf (stderr, "Read %s on %s failed: %s\n",
+             sFunctionToStr (ctx->eFunction), sWhere,
+             modbus_strerror (r->iError));
+    UNLOCK_OUTPUT();
+    return;
+  }
+  vFlushOutput (&xOut);
+}
+#endif
+
+// -----------------------------------------------------------------------------
+// Scrutation simultanée d'une liste d'hôtes Modbus/TCP
+void
+vPollHosts (xMbPollContext * ctx) {
+#ifdef MBPOLL_TCP_ENGINE
+  xTcpEngineConfig xConfig = {
+    .iFunction = iFunctionCode (ctx->eFunction),
+    .piSlave = ctx->piSlaveAddr,
+    .iSlaveCount = ctx->iSlaveCount,
+    .iStartCount = ctx->xPlan.iChunkCount,
+    .iWindow = ctx->iWindow,
+    .iThreads = ctx->iThreads,
+    .iPollRate = ctx->bIsPolling ? ctx->iPollRate : 0,
+    .eOverrun = ctx->eOverrun,
+    .dTimeout = ctx->dTimeout,
+    .pbStop = &ctx->bIsInterrupted,
+    .vResult = vPrintHostResult,
+    .pvUser = ctx
+  };
+  int * piStartReg = calloc (ctx->xPlan.iChunkCount, sizeof (int));
+  int * piNbReg = calloc (ctx->xPlan.iChunkCount, sizeof (int));
+  int i;
+
+  assert (piStartReg && piNbReg);
+  for (i = 0; i < ctx->xPlan.iChunkCount; i++) {
+
+    // une transaction par lecture du plan, adresses PDU
+    piStartReg[i] = ctx->xPlan.pxChunk[i].iAddr;
+    piNbReg[i] = ctx->xPlan.pxChunk[i].iNb;
+  }
+  xConfig.piStartReg = piStartReg;
+  xConfig.piNbReg = piNbReg;
+
+  ctx->xEngine = xTcpEngineNew (&xConfig);
+  if (ctx->xEngine == NULL) {
+
+    vIoErrorExit ("Unable to create the TCP engine: %s", strerror (errno));
+  }
+  free (piStartReg);
+  free (piNbReg);
+  for (i = 0; i < ctx->iHostCount; i++) {
+
+    if (iTcpEngineAddHost (ctx->xEngine, ctx->psHost[i],
+                           ctx->psHostPort[i]) != 0) {
+
+      vIoErrorExit ("Unable to resolve %s:%s", ctx->psHost[i],
+                    ctx->psHostPort[i]);
+    }
+  }
+  if (iTcpEngineRun (ctx->xEngine) != 0) {
+
+    vIoErrorExit ("TCP engine failure: %s", strerror (errno));
+  }
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Lecture de toutes les références d'un esclave en gardant jusqu'à iWindow
+// requêtes en vol sur le socket de libmodbus
+void
+vReadPipeline (xMbPollContext * ctx, int iSlave) {
+#ifdef MBPOLL_TCP_PIPELINE
+  xReadPlan * p = &ctx->xPlan;
+  int j;
+
+  if (ctx->pxRequest == NULL) {
+
+    // une requête par lecture du plan, les données vont dans ses zones
+    ctx->pxRequest = calloc (p->iChunkCount, sizeof (xMbTcpRequest));
+    assert (ctx->pxRequest);
+    for (j = 0; j < p->iChunkCount; j++) {
+      xMbTcpRequest * r = &ctx->pxRequest[j];
+
+      r->iFunction = iFunctionCode (ctx->eFunction);
+      r->iAddr = p->pxChunk[j].iAddr;
+      r->iNb = p->pxChunk[j].iNb;
+      r->pvData = p->pxChunk[j].pvData;
+    }
+  }
+
+  for (j = 0; j < p->iChunkCount; j++) {
+
+    ctx->pxRequest[j].iUnit = iSlave;
+  }
+
+  if (iMbTcpPipeline (modbus_get_socket (ctx->xBus), ctx->pxRequest,
+                      p->iChunkCount, ctx->iWindow, ctx->dTimeout,
+                      &ctx->usTid) < 0) {
+
+    // connexion perdue, elle sera rétablie au prochain cycle
+    modbus_close (ctx->xBus);
+    if ( (modbus_connect (ctx->xBus) == -1) && ctx->bIsVerbose) {
+
+      fprintf (stderr, "Reconnection failed: %s\n", modbus_strerror (errno));
+    }
+  }
+
+  for (j = 0; j < p->iChunkCount; j++) {
+    xMbTcpRequest * r = &ctx->pxRequest[j];
+
+    p->pxChunk[j].iRet = r->iRet;
+    p->pxChunk[j].iError = r->iError;
+    p->pxChunk[j].ulLatency = r->ulLatency;
+    ctx->iTxCount++;
+    if (r->iRet == r->iNb) {
+
+      ctx->iRxCount++;
+    }
+    else {
+
+      ctx->iErrorCount++;
+    }
+  }
+  vReadPlanScatter (p);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Décodage d'un bus série : device[:b=9600,d=8,s=1,P=none,a=1:4,a=10]
+// Les clés absentes prennent la valeur des options -b, -d, -s, -P et -a
+void
+vGetBus (const char * sSpec, xSerialBus * b, const xMbPollContext * ctx) {
+  char * sSave = NULL;
+  char * sItem;
+  char * p;
+  int i;
+
+  b->sDevice = strdup (sSpec);
+  assert (b->sDevice);
+  b->xIos = ctx->xRtu;
+
+  p = index (b->sDevice, ':');
+  if (p) {
+
+    *p++ = 0;
+    for (sItem = strtok_r (p, ",", &sSave); sItem;
+         sItem = strtok_r (NULL, ",", &sSave)) {
+      char * sValue = index (sItem, '=');
+
+      if ( (sValue == NULL) || (sValue[1] == 0) || ( (sValue - sItem) != 1)) {
+
+        vSyntaxErrorExit ("Illegal %s item: %s", sBusStr, sItem);
+      }
+      sValue++;
+
+      switch (sItem[0]) {
+
+        case 'b':
+          b->xIos.baud = iGetInt (sRtuBaudrateStr, sValue, 0);
+          vCheckIntRange (sRtuBaudrateStr, b->xIos.baud, RTU_BAUDRATE_MIN,
+                          RTU_BAUDRATE_MAX);
+          break;
+
+        case 'd':
+          b->xIos.dbits = iGetEnum (sRtuDatabitsStr, sValue, sDatabitsList,
+                                    iDatabitsList, SIZEOF_ILIST (iDatabitsList));
+          break;
+
+        case 's':
+          b->xIos.sbits = iGetEnum (sRtuStopbitsStr, sValue, sStopbitsList,
+                                    iStopbitsList, SIZEOF_ILIST (iStopbitsList));
+          break;
+
+        case 'P':
+          b->xIos.parity = iGetEnum (sRtuParityStr, sValue, sParityList,
+                                     iParityList, SIZEOF_ILIST (iParityList));
+          break;
+
+        case 'a': {
+          // une adresse ou une plage first:last, la clé peut être répétée
+          int iLen;
+          int * piList = iGetIntList (sSlaveAddrStr, sValue, &iLen);
+
+          b->piSlaveAddr = realloc (b->piSlaveAddr,
+                                    (b->iSlaveCount + iLen) * sizeof (int));
+          assert (b->piSlaveAddr);
+          memcpy (&b->piSlaveAddr[b->iSlaveCount], piList, iLen * sizeof (int));
+          b->iSlaveCount += iLen;
+          free (piList);
+        }
+        break;
+
+        default:
+          vSyntaxErrorExit ("Illegal %s item: %s", sBusStr, sItem);
+          break;
+      }
+    }
+  }
+
+  if (b->iSlaveCount == 0) {
+
+    b->piSlaveAddr = malloc (ctx->iSlaveCount * sizeof (int));
+    assert (b->piSlaveAddr);
+    memcpy (b->piSlaveAddr, ctx->piSlaveAddr, ctx->iSlaveCount * sizeof (int));
+    b->iSlaveCount = ctx->iSlaveCount;
+  }
+  for (i = 0; i < b->iSlaveCount; i++) {
+
+    vCheckIntRange (sSlaveAddrStr, b->piSlaveAddr[i],
+                    RTU_SLAVEADDR_MIN, SLAVEADDR_MAX);
+  }
+}
+
+#ifdef MBPOLL_SERIAL_BUSES
+// -----------------------------------------------------------------------------
+// Attente de la prochaine échéance d'un bus
+static void
+vBusWait (xSerialBus * b) {
+  // le CTRL+C est reçu par le thread principal, le bus s'arrête à la fin de
+  // l'attente en cours
+  int iMissed = iPollTimerWait (&b->xTimer, &ctx.bIsInterrupted);
+
+  if ( (iMissed > 0) && (!ctx.bIsQuiet)) {
+
+    fprintf (stderr, "-- Poll cycle overrun on %s, %d period(s) %s\n",
+             b->sDevice, iMissed,
+             ctx.eOverrun == ePollOverrunSkip ? "skipped" : "late");
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Thread de scrutation d'un bus : les lectures d'un esclave sont faites sans
+// verrou, seul l'affichage du bloc est sérialisé avec les autres bus
+static void *
+pvPollBus (void * pvBus) {
+  xSerialBus * b = (xSerialBus *) pvBus;
+  char sHeader[HEADER_SIZE];
+  int i;
+
+  vPollTimerInit (&b->xTimer, ctx.iPollRate, ctx.eOverrun);
+  do {
+
+    for (i = 0; (i < b->iSlaveCount) && (!ctx.bIsInterrupted); i++) {
+
+      int iOk;
 
-    if (iRet > 1) {
-      int iLen = iRet - 2;
+      modbus_set_slave (b->xBus, b->piSlaveAddr[i]);
+      iOk = iReadPlan (b->xBus, ctx.eFunction, &b->xPlan);
+      b->ulTxCount += b->xPlan.iChunkCount;
+      b->ulRxCount += iOk;
+      b->ulErrorCount += b->xPlan.iChunkCount - iOk;
 
-      printf (
-        "Length: %d\n"
-        "Id    : 0x%02X\n"
-        "Status: %s\n"
-        , iRet
-        , ucReport[0]
-        , (ucReport[1]) ? "On" : "Off"
-      );
+      // le bloc d'un esclave est écrit d'un coup, sans être entrelacé avec
+      // ceux des autres bus
+      snprintf (sHeader, sizeof (sHeader), "-- Polling slave %d on %s...\n",
+                b->piSlaveAddr[i], b->sDevice);
+      LOCK_OUTPUT();
+      vPrintReadPlan (&b->xOut, &b->xPlan, &ctx, b->piSlaveAddr[i],
+                      b->sDevice, 1 + (b - ctx.pxBus), sHeader);
+      vFlushOutput (&b->xOut);
+      UNLOCK_OUTPUT();
 
-      if (iLen > 0) {
-        int i;
-        printf ("Data  : ");
-        for (i = 2; i < (iLen + 2); i++) {
+      if (ctx.bIsPolling) {
 
-          if (isprint (ucReport[i])) {
+        if (!ctx.bIsSweep) {
 
-            putchar (ucReport[i]);
-          }
-          else {
+          vBusWait (b);
+        }
+        else if ( (ctx.iGap > 0) && (i < (b->iSlaveCount - 1))) {
 
-            printf ("\\%02X", ucReport[i]);
-          }
+          mb_delay (ctx.iGap);
         }
-        putchar ('\n');
       }
     }
-    else {
+    if ( (ctx.bIsPolling) && (ctx.bIsSweep)) {
 
-      fprintf (stderr, "no data available\n");
+      vBusWait (b);
     }
   }
+  while ( (ctx.bIsPolling) && (!ctx.bIsInterrupted));
+  return NULL;
 }
+#endif
 
 // -----------------------------------------------------------------------------
+// Scrutation simultanée de plusieurs bus série, un thread par bus
 void
-vPrintCommunicationSetup (const xMbPollContext * ctx) {
+vPollBuses (xMbPollContext * ctx) {
+#ifdef MBPOLL_SERIAL_BUSES
+  uint32_t sec = (uint32_t) ctx->dTimeout;
+  uint32_t usec = (uint32_t) ( (ctx->dTimeout - sec) * 1E6);
+  sigset_t xMask, xOldMask;
+  char * pcBuf;
+  int i;
 
-  if (ctx->eMode == eModeRtu) {
-#ifndef USE_CHIPIO
-// -----------------------------------------------------------------------------
-    const char sAddStr[] = "";
-#else /* USE_CHIPIO defined */
-// -----------------------------------------------------------------------------
-    const char * sAddStr;
-    if (ctx->bIsChipIo) {
-      sAddStr = " via ChipIo serial port";
+  // tous les bus sont ouverts avant de commencer la scrutation
+  for (i = 0; i < ctx->iBusCount; i++) {
+    xSerialBus * b = &ctx->pxBus[i];
+
+    b->xBus = modbus_new_rtu (b->sDevice, b->xIos.baud, b->xIos.parity,
+                              b->xIos.dbits, b->xIos.sbits);
+    if (b->xBus == NULL) {
+
+      vIoErrorExit ("Unable to create the libmodbus context for %s",
+                    b->sDevice);
     }
-    else {
+    modbus_set_debug (b->xBus, ctx->bIsVerbose);
+    if (ctx->iRtuMode != MODBUS_RTU_RTS_NONE) {
 
-      sAddStr = "";
+      modbus_rtu_set_serial_mode (b->xBus, MODBUS_RTU_RS485);
+      modbus_rtu_set_rts (b->xBus, ctx->iRtuMode);
     }
-// -----------------------------------------------------------------------------
-#endif /* USE_CHIPIO defined */
+    if (modbus_connect (b->xBus) == -1) {
 
-    printf ("Communication.........: %s%s, %s\n"
-            "                        t/o %.2f s, poll rate %d ms\n"
-            , ctx->sDevice
-            , sAddStr
-            , sSerialAttrToStr (&ctx->xRtu)
-            , ctx->dTimeout
-            , ctx->iPollRate);
+      vIoErrorExit ("Connection to %s failed: %s", b->sDevice,
+                    modbus_strerror (errno));
+    }
+    modbus_set_response_timeout (b->xBus, sec, usec);
+
+    vNewReadPlan (&b->xPlan, ctx);
+    pcBuf = malloc (OUTPUT_BUFFER_SIZE);
+    assert (pcBuf);
+    vOutBufferInit (&b->xOut, STDOUT_FILENO, pcBuf, OUTPUT_BUFFER_SIZE);
+#ifdef MBPOLL_OUT_QUEUE
+    b->xOut.pxQueue = ctx->xOut.pxQueue;
+#endif
   }
-  else {
+  // voir main(), impulsion à l'ouverture des ports
+  mb_delay (20);
 
-    printf ("Communication.........: %s, port %s, t/o %.2f s, poll rate %d ms\n"
-            , ctx->sDevice
-            , ctx->sTcpPort
-            , ctx->dTimeout
-            , ctx->iPollRate);
+  // seul le thread principal traite le CTRL+C, les threads héritent du masque
+  sigemptyset (&xMask);
+  sigaddset (&xMask, SIGINT);
+  pthread_sigmask (SIG_BLOCK, &xMask, &xOldMask);
+  for (i = 0; i < ctx->iBusCount; i++) {
+
+    if (pthread_create (&ctx->pxBus[i].xThread, NULL, pvPollBus,
+                        &ctx->pxBus[i]) != 0) {
+
+      vIoErrorExit ("Unable to start the thread of %s", ctx->pxBus[i].sDevice);
+    }
+  }
+  pthread_sigmask (SIG_SETMASK, &xOldMask, NULL);
+
+  for (i = 0; i < ctx->iBusCount; i++) {
+
+    pthread_join (ctx->pxBus[i].xThread, NULL);
+  }
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Scrutation d'un groupe sur tous les esclaves
+static void
+vPollGroup (xMbPollContext * ctx, xPollGroup * g) {
+  char sHeader[HEADER_SIZE];
+  int i;
+
+  const xReadBlock * b = &g->xPlan.pxBlock[0];
+
+  for (i = 0; i < ctx->iSlaveCount; i++) {
+    int iRet;
+
+    modbus_set_slave (ctx->xBus, ctx->piSlaveAddr[i]);
+
+    snprintf (sHeader, sizeof (sHeader), "-- Polling slave %d, group %d...\n",
+              ctx->piSlaveAddr[i], g->iIndex);
+    iRet = iReadPlan (ctx->xBus, g->eFunction, &g->xPlan);
+    ctx->iTxCount += g->xPlan.iChunkCount;
+    ctx->iRxCount += iRet;
+    ctx->iErrorCount += g->xPlan.iChunkCount - iRet;
+    xSample xSmp = {
+      .sWhere = ctx->sDevice,
+      .iSlave = ctx->piSlaveAddr[i],
+      .eFunction = g->eFunction,
+      .eFormat = g->eFormat,
+      .iRef = g->iStartRef,
+      .iCount = g->iCount,
+      .pvData = b->pvData,
+      .iError = (b->iRet == b->iNb) ? 0 : b->iError,
+      .sHeader = (ctx->eOutput == eOutputText) ? sHeader : NULL
+    };
+
+    vSampleNow (&xSmp);
+    vReportSample (&ctx->xOut, &xSmp);
+    if ( (xSmp.iError != 0) && (ctx->eOutput == eOutputText)) {
+      vFlushOutput (&ctx->xOut);
+      fprintf (stderr, "Read %s failed: %s\n",
+               sFunctionToStr (g->eFunction), modbus_strerror (b->iError));
+    }
   }
+  vFlushOutput (&ctx->xOut);
 }
 
 // -----------------------------------------------------------------------------
+// Boucle de scrutation multi-cadence : une seule file de priorité ordonnée
+// par échéance remplace la boucle à période unique
 void
-vPrintConfig (const xMbPollContext * ctx) {
+vPollGroups (xMbPollContext * ctx) {
+  xPollQueue xQueue;
+  uint64_t ulStart;
+  int i;
 
-  // Affichage de la configuration
-  printf ("Protocol configuration: Modbus %s\n", sModeList[ctx->eMode]);
-  printf ("Slave configuration...: address = ");
-  vPrintIntList (ctx->piSlaveAddr, ctx->iSlaveCount);
-  if (ctx->iStartCount > 1) {
-    printf ("\n                        start reference = ");
-    vPrintIntList (ctx->piStartRef, ctx->iStartCount);
-    printf ("\n");
+  if (iPollQueueInit (&xQueue, ctx->iGroupCount) != 0) {
+
+    vIoErrorExit ("Unable to allocate the poll group queue");
   }
-  else {
-    printf ("\n                        start reference = %d, count = %d\n",
-            ctx->piStartRef[0], ctx->iCount);
+
+  ulStart = ulPollTimerNow();
+  for (i = 0; i < ctx->iGroupCount; i++) {
+    xPollGroup * g = &ctx->pxGroup[i];
+
+    vPollTimerInit (&g->xTimer, g->iPollRate, ctx->eOverrun);
+    g->xTimer.ulDeadline = ulStart;
+    iPollQueuePush (&xQueue, ulStart, g);
   }
-  vPrintCommunicationSetup (ctx);
-  printf ("Data type.............: ");
-  switch (ctx->eFunction) {
 
-    case eFuncDiscreteInput:
-      printf ("discrete input\n");
-      break;
+  while ( (xQueue.iSize > 0) && (!ctx->bIsInterrupted)) {
+    uint64_t ulDeadline;
+    xPollGroup * g = pvPollQueuePop (&xQueue, &ulDeadline);
 
-    case eFuncCoil:
-      printf ("discrete output (coil)\n");
+    vPollTimerSleepUntil (ulDeadline, &ctx->bIsInterrupted);
+    if (ctx->bIsInterrupted) {
       break;
+    }
+    vPollGroup (ctx, g);
 
-    case eFuncInputReg:
-      if (ctx->eFormat == eFormatInt) {
-        printf ("%s %s", sIntStr, ctx->bIsBigEndian ? sBigEndianStr : sLittleEndianStr);
-      }
-      else if (ctx->eFormat == eFormatFloat) {
-        printf ("%s %s", sFloatStr, ctx->bIsBigEndian ? sBigEndianStr : sLittleEndianStr);
-      }
-      else {
-        printf ("%s", sWordStr);
-      }
-      printf (", input register table\n");
-      break;
+    if (ctx->bIsPolling) {
+      int iMissed = iPollTimerAdvance (&g->xTimer);
 
-    case eFuncHoldingReg:
-      if (ctx->eFormat == eFormatInt) {
-        printf ("%s %s", sIntStr, ctx->bIsBigEndian ? sBigEndianStr : sLittleEndianStr);
-      }
-      else if (ctx->eFormat == eFormatFloat) {
-        printf ("%s %s", sFloatStr, ctx->bIsBigEndian ? sBigEndianStr : sLittleEndianStr);
-      }
-      else {
-        printf ("%s", sWordStr);
-      }
-      printf (", output (holding) register table\n");
-      break;
+      if ( (iMissed > 0) && (!ctx->bIsQuiet)) {
 
-    default: // Impossible, la valeur a été vérifiée, évite un warning de gcc
-      break;
+        fprintf (stderr, "-- Poll group %d overrun, %d period(s) %s\n",
+                 g->iIndex, iMissed,
+                 ctx->eOverrun == ePollOverrunSkip ? "skipped" : "late");
+      }
+      iPollQueuePush (&xQueue, g->xTimer.ulDeadline, g);
+    }
   }
-  putchar ('\n');
+  vPollQueueFree (&xQueue);
 }
 
 // -----------------------------------------------------------------------------
-// Allocation de la mémoire pour les données à écrire ou à lire
+// Le CTRL+C ne fait que positionner un indicateur : les boucles de scrutation
+// se terminent, leurs threads sont attendus, et vTerminate() libère les
+// ressources hors du contexte du signal. Un second CTRL+C termine le programme
+// immédiatement.
 void
-vAllocate (xMbPollContext * ctx) {
+vSigIntHandler (int sig) {
 
-  size_t ulDataSize = ctx->iCount;
-  switch (ctx->eFunction) {
+  ctx.bIsInterrupted = 1;
+  signal (sig, SIG_DFL);
+}
 
-    case eFuncCoil:
-    case eFuncDiscreteInput:
-      // 1 bit est stocké dans un octet
-      break;
+// -----------------------------------------------------------------------------
+// Affichage des statistiques et libération des ressources, tous les threads
+// de scrutation sont terminés
+void
+vTerminate (void) {
 
-    case eFuncInputReg:
-    case eFuncHoldingReg:
-      if ( (ctx->eFormat == eFormatInt) || (ctx->eFormat == eFormatFloat)) {
-        // Registres 32-bits
-        ulDataSize *= 4;
+  // les statistiques ne se mêlent pas aux enregistrements
+  FILE * xInfo = (ctx.eOutput == eOutputText) ? stdout : stderr;
+  int i;
+
+  // le cycle interrompu est affiché avant les statistiques
+  vFlushOutput (&ctx.xOut);
+#ifdef MBPOLL_OUT_QUEUE
+  if (ctx.xOut.pxQueue) {
+
+    // ce qui est encore dans la file est écrit
+    vOutQueueClose (&ctx.xQueue);
+    ctx.xOut.pxQueue = NULL;
+  }
+#endif
+
+  // les bus et les hôtes ont leurs propres compteurs
+  for (i = 0; i < ctx.iBusCount; i++) {
+    const xSerialBus * b = &ctx.pxBus[i];
+
+    ctx.iTxCount += b->ulTxCount;
+    ctx.iRxCount += b->ulRxCount;
+    ctx.iErrorCount += b->ulErrorCount;
+  }
+#ifdef MBPOLL_TCP_ENGINE
+  if (ctx.xEngine) {
+
+    for (i = 0; i < iTcpEngineHostCount (ctx.xEngine); i++) {
+      const xTcpHostStats * s = pxTcpEngineHostStats (ctx.xEngine, i);
+
+      ctx.iTxCount += s->ulTxCount;
+      ctx.iRxCount += s->ulRxCount;
+      ctx.iErrorCount += s->ulErrorCount;
+    }
+  }
+#endif
+
+  if ( (ctx.bIsPolling) && (!ctx.bIsWrite)) {
+
+    fprintf (xInfo, "--- %s poll statistics ---\n"
+             "%d frames transmitted, %d received, %d errors, %.1f%% frame loss\n",
+             ctx.sDevice,
+             ctx.iTxCount,
+             ctx.iRxCount,
+             ctx.iErrorCount,
+             (double) (ctx.iTxCount - ctx.iRxCount) * 100.0 /
+             (double) ctx.iTxCount);
+    unsigned long ulOverrun = ctx.xTimer.ulOverrunCount;
+    unsigned long ulSkip = ctx.xTimer.ulSkipCount;
+
+    for (i = 0; i < ctx.iGroupCount; i++) {
+      ulOverrun += ctx.pxGroup[i].xTimer.ulOverrunCount;
+      ulSkip += ctx.pxGroup[i].xTimer.ulSkipCount;
+    }
+    for (i = 0; i < ctx.iBusCount; i++) {
+      ulOverrun += ctx.pxBus[i].xTimer.ulOverrunCount;
+      ulSkip += ctx.pxBus[i].xTimer.ulSkipCount;
+    }
+    if (ulOverrun) {
+      fprintf (xInfo, "%lu cycle overruns, %lu periods skipped\n",
+               ulOverrun, ulSkip);
+    }
+    for (i = 0; i < ctx.iBusCount; i++) {
+      const xSerialBus * b = &ctx.pxBus[i];
+
+      fprintf (xInfo, "%s: %lu transmitted, %lu received, %lu errors, "
+               "%lu overruns\n", b->sDevice, b->ulTxCount, b->ulRxCount,
+               b->ulErrorCount, b->xTimer.ulOverrunCount);
+    }
+#ifdef MBPOLL_TCP_ENGINE
+    if (ctx.xEngine) {
+
+      for (i = 0; i < iTcpEngineHostCount (ctx.xEngine); i++) {
+        const xTcpHostStats * s = pxTcpEngineHostStats (ctx.xEngine, i);
+
+        fprintf (xInfo, "%s:%s: %lu transmitted, %lu received, %lu errors, "
+                 "%lu overruns\n", s->sHost, s->sPort, s->ulTxCount,
+                 s->ulRxCount, s->ulErrorCount, s->ulOverrunCount);
       }
-      else {
-        // Registres 16-bits
-        ulDataSize *= 2;
+      if (iTcpEngineWorkerCount (ctx.xEngine) > 1) {
+
+        fprintf (xInfo, "%d workers, %lu jobs stolen\n",
+                 iTcpEngineWorkerCount (ctx.xEngine),
+                 ulTcpEngineStealCount (ctx.xEngine));
       }
-      break;
+    }
+#endif
+#ifdef MBPOLL_OUT_QUEUE
+    if (ctx.xQueue.ullSize) {
+      const xOutQueue * q = &ctx.xQueue;
+
+      fprintf (xInfo, "%s: %llu bytes max depth of %llu, %lu blocks dropped "
+               "(%llu bytes), %lu waits, %lu write errors\n", sQueueStr,
+               (unsigned long long) q->ullMaxDepth,
+               (unsigned long long) q->ullSize, q->ulDropCount,
+               (unsigned long long) q->ullDropBytes, q->ulWaitCount,
+               q->ulWriteErrors);
+    }
+#endif
+#ifdef MBPOLL_PUB
+    if (ctx.sPubPath) {
 
-    default: // Impossible, la valeur a été vérifiée, évite un warning de gcc
-      break;
+      fprintf (xInfo, "%s: %lu clients, %lu evicted, %lu records sent\n",
+               sPubStr, ctx.xPub.ulAccepted, ctx.xPub.ulEvicted,
+               ctx.xPub.ulRecords);
+    }
+#endif
+#ifdef MBPOLL_METRICS
+    if (ctx.sMetricsPort) {
+
+      fprintf (xInfo, "%s: %lu scrapes\n", sMetricsStr,
+               ctx.xMetrics.ulScrapes);
+    }
+#endif
   }
-  ctx->pvData = calloc (1, ulDataSize);
-  assert (ctx->pvData);
-}
 
-// -----------------------------------------------------------------------------
-void
-vSigIntHandler (int sig) {
+  if (ctx.pxGroup) {
+    int i;
 
-  if ( (ctx.bIsPolling) && (!ctx.bIsWrite)) {
+    for (i = 0; i < ctx.iGroupCount; i++) {
+      vReadPlanFree (&ctx.pxGroup[i].xPlan);
+    }
+    free (ctx.pxGroup);
+  }
+  free (ctx.psGroupSpec);
+  free (ctx.pxRequest);
+  vReadPlanFree (&ctx.xPlan);
+  if (ctx.pxBus) {
+
+    for (int i = 0; i < ctx.iBusCount; i++) {
+      xSerialBus * b = &ctx.pxBus[i];
+
+      modbus_close (b->xBus);
+      modbus_free (b->xBus);
+      vReadPlanFree (&b->xPlan);
+      free (b->xOut.pcZone);
+      free (b->piSlaveAddr);
+      free (b->sDevice);
+    }
+    free (ctx.pxBus);
+  }
+  free (ctx.psBusSpec);
+  vRbeFree (&ctx.xRbe);
+  // les entrées de la table désignent leurs bandes mortes
+  free (ctx.pxBand);
+#ifdef MBPOLL_SHM
+  if (ctx.sShmName) {
+
+    vMbShmDelete (&ctx.xShm);
+    free (ctx.sShmName);
+  }
+  if (ctx.sImageName) {
+
+    vMbImageDelete (&ctx.xImage);
+    free (ctx.sImageName);
+  }
+#endif
+  if (ctx.sTsFile) {
+
+    // le tronçon en cours est écrit
+    if (iMbTsClose (&ctx.xTs) != 0) {
+
+      fprintf (stderr, "Unable to write %s %s: %s\n", sTsStr, ctx.sTsFile,
+               strerror (errno));
+    }
+    free (ctx.sTsFile);
+  }
+#ifdef MBPOLL_PUB
+  if (ctx.sPubPath) {
+
+    // les clients sont déconnectés
+    vMbPubDelete (&ctx.xPub);
+    free (ctx.sPubPath);
+  }
+#endif
+  vRegMapDelete (&ctx.xMap);
+#ifdef MBPOLL_METRICS
+  if (ctx.sMetricsPort) {
 
-    printf ("--- %s poll statistics ---\n"
-            "%d frames transmitted, %d received, %d errors, %.1f%% frame loss\n",
-            ctx.sDevice,
-            ctx.iTxCount,
-            ctx.iRxCount,
-            ctx.iErrorCount,
-            (double) (ctx.iTxCount - ctx.iRxCount) * 100.0 /
-            (double) ctx.iTxCount);
+    vMbMetricsDelete (&ctx.xMetrics);
+    free (ctx.sMetricsPort);
+    free (ctx.sMetricsHost);
   }
+#endif
+#ifdef MBPOLL_TCP_ENGINE
+  vTcpEngineDelete (ctx.xEngine);
+#endif
+  if (ctx.psHost) {
 
+    for (int i = 0; i < ctx.iHostCount; i++) {
+      free (ctx.psHost[i]);
+    }
+    free (ctx.psHost);
+    free (ctx.psHostPort);
+  }
   free (ctx.pvData);
   free (ctx.piSlaveAddr);
+  free (ctx.piStartRef);
+  free (ctx.piRefCount);
   modbus_close (ctx.xBus);
   modbus_free (ctx.xBus);
 #ifdef USE_CHIPIO
@@ -1303,13 +4647,14 @@ vSigIntHandler (int sig) {
   iChipIoClose (xChip);
 // -----------------------------------------------------------------------------
 #endif /* USE_CHIPIO defined */
-  if (sig == SIGINT) {
-    printf ("\neverything was closed.\nHave a nice day !\n");
+  if (ctx.bIsInterrupted) {
+    fprintf (xInfo, "\neverything was closed.\nHave a nice day !\n");
   }
   else {
-    putchar ('\n');
+    fputc ('\n', xInfo);
   }
   fflush (stdout);
+  fflush (xInfo);
   exit (ctx.iErrorCount == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
@@ -1398,6 +4743,10 @@ vUsage (FILE * stream, int exit_msg) {
 // -----------------------------------------------------------------------------
 #endif /* USE_CHIPIO defined */
            "  host          Host name or dotted IP address when using ModBus/TCP protocol\n"
+           "                For reading, it is possible to give a host list separated\n"
+           "                by commas (host1,host2:1502,...) or a file containing one\n"
+           "                host per line (@hosts.txt). All hosts are polled\n"
+           "                concurrently (Linux only), see --threads\n"
            "  writevalues   List of values to be written.\n"
 //          01234567890123456789012345678901234567890123456789012345678901234567890123456789
            "                If none specified (default) %s reads data.\n"
@@ -1417,8 +4766,15 @@ vUsage (FILE * stream, int exit_msg) {
            "                -a 32,33,34,36:40 read [32,33,34,36,37,38,39,40]\n"
            "  -r #          Start reference (%d is default)\n"
            "                for reading, it is possible to give a reference list\n"
-           "                separated by commas or colons\n"
-           "  -c #          Number of values to read (%d-%d, %d is default)\n"
+           "                separated by commas or colons, a reference followed\n"
+           "                by :+count reads a block of count values, for example :\n"
+           "                -r 3000:+40,3100:+12,4000:+6 reads 3 blocks per slave\n"
+           "  --merge #     Largest hole in registers or bits read to merge references\n"
+           "                of a list into one request (%d is default). Adjacent\n"
+           "                references are merged unless merging is disabled\n"
+           "                by -1, which also keeps adjacent references apart\n"
+           "  -c #          Number of values to read (%d-%d, %d is default), several\n"
+           "                requests are sent when they do not fit in one PDU\n"
            "  -u            Read the description of the type, the current status, and other\n"
            "                information specific to a remote device (RTU only)\n"
            "  -t 0          Discrete output (coil) data type (binary 0 or 1)\n"
@@ -1430,6 +4786,11 @@ vUsage (FILE * stream, int exit_msg) {
            "  -t 3:int      32-bit integer data type in input register table\n"
 #ifndef MBPOLL_FLOAT_DISABLE
            "  -t 3:float    32-bit float data type in input register table\n"
+#endif
+           "  -t 3:int64    64-bit integer data type in input register table\n"
+           "  -t 3:uint64   64-bit unsigned integer data type in input register table\n"
+#ifndef MBPOLL_FLOAT_DISABLE
+           "  -t 3:double   64-bit float data type in input register table\n"
 #endif
            "  -t 4          16-bit output (holding) register data type (default)\n"
            "  -t 4:int16    16-bit output (holding) register data type with signed int display\n"
@@ -1438,16 +4799,91 @@ vUsage (FILE * stream, int exit_msg) {
            "  -t 4:int      32-bit integer data type in output (holding) register table\n"
 #ifndef MBPOLL_FLOAT_DISABLE
            "  -t 4:float    32-bit float data type in output (holding) register table\n"
+#endif
+           "  -t 4:int64    64-bit integer data type in output (holding) register table\n"
+           "  -t 4:uint64   64-bit unsigned integer data type in output (holding) register table\n"
+#ifndef MBPOLL_FLOAT_DISABLE
+           "  -t 4:double   64-bit float data type in output (holding) register table\n"
 #endif
            "  -0            First reference is 0 (PDU addressing) instead 1\n"
            "  -W            Using function 10 for write a single register\n"
-           "  -B            Big endian word order for 32-bit integer and float\n"
+           "  -B            Big endian word order for 32 and 64-bit integer and float\n"
+           "  --order #     Byte order of 32 and 64-bit integer and float on the line,\n"
+           "                A being the most significant byte : ABCD (same as -B),\n"
+           "                CDAB (default), BADC or DCBA. A 64-bit value follows\n"
+           "                the same rule word by word\n"
+           "  --map #       Register map file : the block read is decoded field by\n"
+           "                field, one field per line : offset type[:length] name\n"
+           "                [order]. offset is counted from the start reference, type\n"
+           "                is uint16, int16, hex, uint32, int32, float, uint64, int64,\n"
+           "                double or string (length in registers), order is that of\n"
+           "                --order. The count is that of the map\n"
+           "  --bits #      Output of coils and discrete inputs (-t 0 and -t 1),\n"
+           "                list: one value per reference (default), hex: bytes\n"
+           "                in frame order, first reference in the lowest bit,\n"
+           "                string: one 0 or 1 per reference\n"
            "  -1            Poll only once only, otherwise every poll rate interval\n"
            "  -l #          Poll rate in ms, ( > %d, %d is default)\n"
+           "  --overrun #   Policy when a poll cycle misses its deadline\n"
+           "                skip: resume on the next period boundary (default)\n"
+           "                catchup: run the missed cycles without waiting\n"
+           "  --sweep       Poll rate applies to a whole pass over the slave list\n"
+           "                instead of to each slave\n"
+           "  --gap #       Delay in ms between two slaves of a sweep (implies --sweep,\n"
+           "                0 is default)\n"
+           "  --group #     Poll group with its own data type, start reference, count\n"
+           "                and poll rate, can be repeated. Missing keys take the\n"
+           "                value of -t, -r, -c and -l, for example :\n"
+           "                --group t=3:float,r=1,c=8,l=100 --group t=4,r=100,l=1000\n"
            "  -o #          Time-out in seconds (%.2f - %.2f, %.2f s is default)\n"
            "  -q            Quiet mode.  Minimum output only\n"
+           "  --output #    Output format : text (default), csv, jsonl or binary.\n"
+           "                Other than text write one timestamped record per block\n"
+           "                read on a slave, imply -q and send the statistics to\n"
+           "                stderr. binary is compact and is read by mbpoll-dump\n"
+           "  --rbe #       Report by exception : only the values that changed since\n"
+           "                they were last printed are printed, and all of them every\n"
+           "                # seconds (0-%d, 0 for never)\n"
+           "  --deadband #  Deadbands for --rbe (implied), a list of value, value%%\n"
+           "                of the last printed value, ref=value or ref:ref=value,\n"
+           "                for example : 0.5,100:109=2%%. The last match applies,\n"
+           "                binary, hex and string values report any change\n"
+           "  --shm #       Also publish every record, errors included, in a POSIX\n"
+           "                shared memory ring : name[:size in KiB] (%d KiB is\n"
+           "                default), for example /mbpoll:4096. Readers use the\n"
+           "                mb-shm.h API, mbpoll-dump -s name prints them\n"
+           "  --image #     Keep the last values read on each slave in a POSIX\n"
+           "                shared memory register image named #, for example\n"
+           "                /mbpoll-image. Each block read has its age and quality,\n"
+           "                readers use the mb-image.h API and never block polling,\n"
+           "                mbpoll-dump -i name prints a snapshot\n"
+           "  --ts #        Also store the values read in a compressed time series\n"
+           "                file : file[:chunk duration in s] (%d-%d, %d s is\n"
+           "                default). Each value is a column of a chunk,\n"
+           "                mbpoll-dump -t file prints them\n"
+           "  --queue #     Hand the output to a writer thread through a queue so\n"
+           "                that a slow disk or pipe does not delay polling :\n"
+           "                policy[:size in KiB] (%d-%d, %d KiB is default). With\n"
+           "                drop a block that does not fit in the queue is lost,\n"
+           "                with block polling waits for the writer\n"
+           "  --pub #       Also send the values read to the local clients of a\n"
+           "                Unix socket : path[:client queue in KiB] (%d-%d, %d\n"
+           "                KiB is default). Clients subscribe with lines such as\n"
+           "                'sub 1 100-109' or 'sub *' and receive the records of\n"
+           "                --output=binary, a client that falls behind is\n"
+           "                disconnected. mbpoll-dump -u path prints them\n"
+           "  --metrics #   Serve the last values read and the transactions, errors\n"
+           "                and response times of each slave in OpenMetrics text\n"
+           "                format over HTTP : [address:]port, the address is\n"
+           "                %s by default. Scrapes only copy the values that\n"
+           "                changed since the previous one\n"
            "Options for ModBus / TCP : \n"
            "  -p #          TCP port number (%s is default)\n"
+           "  --window #    Number of requests in flight on a connection (1-%d, %d is\n"
+           "                default). Replies are matched by transaction identifier\n"
+           "  --threads #   Number of worker threads polling a host list (0 for one per\n"
+           "                CPU, 1-%d, %d is default). Each host stays on one worker,\n"
+           "                idle workers steal the decoding of replies from busy ones\n"
            "Options for ModBus RTU : \n"
            "  -b #          Baudrate (%d-%d, %d is default)\n"
            "  -d #          Databits (7 or 8, %s for RTU)\n"
@@ -1462,6 +4898,10 @@ vUsage (FILE * stream, int exit_msg) {
            "  -R            RS-485 mode (/RTS on (0) after sending)\n"
            "  -F            RS-485 mode (/RTS on (0) when sending)\n"
 #endif
+           "  --bus #       Additional serial bus polled by its own thread, can be\n"
+           "                repeated. Keys b, d, s and P take the place of the options\n"
+           "                above and a gives a slave address or range, for example :\n"
+           "                --bus /dev/ttyUSB1:b=9600,P=none,a=1:4,a=10\n"
 #ifdef USE_CHIPIO
 // -----------------------------------------------------------------------------
            "Options for ModBus RTU for ChipIo serial port : \n"
@@ -1481,6 +4921,7 @@ vUsage (FILE * stream, int exit_msg) {
            , SLAVEADDR_MAX
            , DEFAULT_SLAVEADDR
            , DEFAULT_STARTREF
+           , DEFAULT_MERGE_GAP
            , NUMOFVALUES_MIN
            , NUMOFVALUES_MAX
            , DEFAULT_NUMOFVALUES
@@ -1489,7 +4930,23 @@ vUsage (FILE * stream, int exit_msg) {
            , TIMEOUT_MIN
            , TIMEOUT_MAX
            , DEFAULT_TIMEOUT
+           , RBE_REFRESH_MAX
+           , DEFAULT_SHM_SIZE
+           , TS_CHUNK_MIN
+           , TS_CHUNK_MAX
+           , DEFAULT_TS_CHUNK
+           , QUEUE_SIZE_MIN
+           , QUEUE_SIZE_MAX
+           , DEFAULT_QUEUE_SIZE
+           , PUB_QUEUE_MIN
+           , PUB_QUEUE_MAX
+           , DEFAULT_PUB_QUEUE
+           , DEFAULT_METRICS_HOST
            , DEFAULT_TCP_PORT
+           , MBTCP_WINDOW_MAX
+           , DEFAULT_TCP_WINDOW
+           , TCP_THREADS_MAX
+           , DEFAULT_TCP_THREADS
            , RTU_BAUDRATE_MIN
            , RTU_BAUDRATE_MAX
            , DEFAULT_RTU_BAUDRATE
@@ -1532,6 +4989,19 @@ vCheckIntRange (const char * sName, int i, int min, int max) {
   }
 }
 
+// -----------------------------------------------------------------------------
+// Une lecture, même découpée en plusieurs PDU, ne dépasse pas le dernier
+// registre
+void
+vCheckReadRange (int iStartReg, int iNbReg) {
+
+  if ( (iStartReg < 0) || (iStartReg + iNbReg > STARTREF_MAX)) {
+
+    vSyntaxErrorExit ("%s out of range (%d elements from PDU address %d)",
+                      sNumOfValuesStr, iNbReg, iStartReg);
+  }
+}
+
 // -----------------------------------------------------------------------------
 void
 vCheckDoubleRange (const char * sName, double d, double min, double max) {
@@ -1588,6 +5058,130 @@ sFunctionToStr (eFunctions eFunction) {
                      SIZEOF_ILIST (iFunctionList));
 }
 
+// -----------------------------------------------------------------------------
+// Liste de blocs de la forme 3000:+40,3100:+12,4000 : chaque élément est un
+// élément de iGetIntList() ou une référence suivie de son nombre de valeurs.
+// *piCount reçoit le nombre de valeurs de chaque référence, 0 si absent
+int *
+iGetRefList (const char * sName, const char * sList, int * iLen,
+             int ** piCount) {
+  char * sDup = strdup (sList);
+  char * sSave = NULL;
+  char * sItem;
+  int * piList = NULL;
+  int * piNb = NULL;
+  int iCount = 0;
+
+  assert (sDup);
+  for (sItem = strtok_r (sDup, ",", &sSave); sItem;
+       sItem = strtok_r (NULL, ",", &sSave)) {
+    char * p = strstr (sItem, ":+");
+    int * piItem;
+    int iItemLen, i;
+
+    if (p) {
+
+      // bloc ref:+count
+      *p = 0;
+      piItem = malloc (sizeof (int));
+      assert (piItem);
+      piItem[0] = iGetInt (sName, sItem, 0);
+      iItemLen = 1;
+      i = iGetInt (sNumOfValuesStr, p + 2, 0);
+      vCheckIntRange (sNumOfValuesStr, i, NUMOFVALUES_MIN, NUMOFVALUES_MAX);
+    }
+    else {
+
+      piItem = iGetIntList (sName, sItem, &iItemLen);
+      i = 0;
+    }
+
+    piList = realloc (piList, (iCount + iItemLen) * sizeof (int));
+    piNb = realloc (piNb, (iCount + iItemLen) * sizeof (int));
+    assert (piList && piNb);
+    memcpy (&piList[iCount], piItem, iItemLen * sizeof (int));
+    while (iItemLen--) {
+
+      piNb[iCount++] = i;
+    }
+    free (piItem);
+  }
+  free (sDup);
+
+  if (iCount == 0) {
+
+    vSyntaxErrorExit ("Illegal %s value: %s", sName, sList);
+  }
+  *iLen = iCount;
+  *piCount = piNb;
+  return piList;
+}
+
+// -----------------------------------------------------------------------------
+// Liste de bandes mortes : [ref[:ref]=]valeur[%],...
+xRbeBand *
+pxGetBandList (const char * sName, const char * sList, int * iLen) {
+  char * sDup = strdup (sList);
+  char * sSave = NULL;
+  char * sItem;
+  xRbeBand * pxList = NULL;
+  int iCount = 0;
+
+  assert (sDup);
+  for (sItem = strtok_r (sDup, ",", &sSave); sItem;
+       sItem = strtok_r (NULL, ",", &sSave)) {
+    xRbeBand b = { .iFirst = -1, .iLast = -1 };
+    char * sValue = strchr (sItem, '=');
+    char * p;
+
+    if (sValue) {
+      char * sLast;
+
+      // plage de références
+      *sValue++ = 0;
+      sLast = strchr (sItem, ':');
+      if (sLast) {
+        *sLast++ = 0;
+      }
+      b.iFirst = iGetInt (sName, sItem, 0);
+      b.iLast = sLast ? iGetInt (sName, sLast, 0) : b.iFirst;
+      // -0 peut suivre, les bornes exactes sont vérifiées par main()
+      vCheckIntRange (sStartRefStr, b.iFirst, STARTREF_MIN - 1, STARTREF_MAX);
+      vCheckIntRange (sStartRefStr, b.iLast, b.iFirst, STARTREF_MAX);
+    }
+    else {
+
+      sValue = sItem;
+    }
+    p = strchr (sValue, '%');
+    if (p) {
+
+      if (p[1] != 0) {
+        vSyntaxErrorExit ("Illegal %s value: %s", sName, sValue);
+      }
+      *p = 0;
+      b.bPercent = true;
+    }
+    b.dValue = dGetDouble (sName, sValue);
+    if (b.dValue < 0) {
+
+      vSyntaxErrorExit ("Illegal %s value: %s", sName, sValue);
+    }
+
+    pxList = realloc (pxList, (iCount + 1) * sizeof (xRbeBand));
+    assert (pxList);
+    pxList[iCount++] = b;
+  }
+  free (sDup);
+
+  if (iCount == 0) {
+
+    vSyntaxErrorExit ("Illegal %s value: %s", sName, sList);
+  }
+  *iLen = iCount;
+  return pxList;
+}
+
 // -----------------------------------------------------------------------------
 void
 vPrintIntList (int * iList, int iLen) {
@@ -1740,48 +5334,66 @@ iGetInt (const char * name, const char * num, int base) {
 }
 
 // -----------------------------------------------------------------------------
-double
-dGetDouble (const char * name, const char * num) {
+int64_t
+llGetInt64 (const char * name, const char * num) {
   char * endptr;
+  long long ll;
 
-  double d = strtod (num, &endptr);
-  if (endptr == num) {
+  errno = 0;
+  ll = strtoll (num, &endptr, 0);
+  if ( (endptr == num) || (errno == ERANGE)) {
 
     vSyntaxErrorExit ("Illegal %s value: %s", name, num);
   }
 
-  PDEBUG ("Set %s=%g\n", name, d);
-  return d;
+  PDEBUG ("Set %s=%lld\n", name, ll);
+  return ll;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t
+ullGetUInt64 (const char * name, const char * num) {
+  char * endptr;
+  unsigned long long ull;
+
+  // strtoull() accepte un signe moins et renvoie alors le complément
+  errno = 0;
+  ull = strtoull (num, &endptr, 0);
+  if ( (endptr == num) || (errno == ERANGE) || (strchr (num, '-') != NULL)) {
+
+    vSyntaxErrorExit ("Illegal %s value: %s", name, num);
+  }
+
+  PDEBUG ("Set %s=%llu\n", name, ull);
+  return ull;
 }
 
 // -----------------------------------------------------------------------------
-float
-fSwapFloat (float f) {
-  float ret = f;
+double
+dGetDouble (const char * name, const char * num) {
+  char * endptr;
 
-  if (ctx.bIsBigEndian) {
+  double d = strtod (num, &endptr);
+  if (endptr == num) {
 
-    uint16_t *in = (uint16_t *) &f;
-    uint16_t *out = (uint16_t *) &ret;
-    out[0] = in[1];
-    out[1] = in[0];
+    vSyntaxErrorExit ("Illegal %s value: %s", name, num);
   }
-  return ret;
+
+  PDEBUG ("Set %s=%g\n", name, d);
+  return d;
 }
 
 // -----------------------------------------------------------------------------
-int32_t
-lSwapLong (int32_t l) {
-  int32_t ret = l;
+// Attente de la prochaine échéance de scrutation
+void
+vPollWait (xMbPollContext * ctx) {
+  int iMissed = iPollTimerWait (&ctx->xTimer, &ctx->bIsInterrupted);
 
-  if (ctx.bIsBigEndian) {
+  if ( (iMissed > 0) && (!ctx->bIsQuiet)) {
 
-    uint16_t *in = (uint16_t *) &l;
-    uint16_t *out = (uint16_t *) &ret;
-    out[0] = in[1];
-    out[1] = in[0];
+    fprintf (stderr, "-- Poll cycle overrun, %d period(s) %s\n", iMissed,
+             ctx->eOverrun == ePollOverrunSkip ? "skipped" : "late");
   }
-  return ret;
 }
 
 // -----------------------------------------------------------------------------
@@ -0,0 +1,296 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <string.h>
+#include <modbus.h>
+#include "mbtcp.h"
+#ifdef MBPOLL_TCP_PIPELINE
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "poll-timer.h"
+#endif
+
+/* constants ================================================================ */
+#ifndef EMBBADDATA
+#define EMBBADDATA EINVAL
+#endif
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iMbTcpReadRequest (uint8_t * pucFrame, uint16_t usTid, int iUnit,
+                   int iFunction, int iAddr, int iNb) {
+
+  // MBAP : transaction, protocole (0), longueur, unité
+  pucFrame[0] = usTid >> 8;
+  pucFrame[1] = usTid & 0xFF;
+  pucFrame[2] = 0;
+  pucFrame[3] = 0;
+  pucFrame[4] = 0;
+  pucFrame[5] = 6;
+  pucFrame[6] = (uint8_t) iUnit;
+  // PDU : fonction, adresse, quantité
+  pucFrame[7] = (uint8_t) iFunction;
+  pucFrame[8] = (iAddr >> 8) & 0xFF;
+  pucFrame[9] = iAddr & 0xFF;
+  pucFrame[10] = (iNb >> 8) & 0xFF;
+  pucFrame[11] = iNb & 0xFF;
+  return MBTCP_REQUEST_LENGTH;
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTcpFrameLength (const uint8_t * pucFrame, int iLen) {
+  int iLength;
+
+  if (iLen < MBTCP_HEADER_LENGTH) {
+
+    return 0;
+  }
+  iLength = (pucFrame[4] << 8) | pucFrame[5];
+  if ( (pucFrame[2] != 0) || (pucFrame[3] != 0) || (iLength < 2) ||
+       ( (iLength + MBTCP_HEADER_LENGTH - 1) > MBTCP_MAX_ADU_LENGTH)) {
+
+    return -1;
+  }
+  // la longueur MBAP compte l'octet d'unité
+  return iLength + MBTCP_HEADER_LENGTH - 1;
+}
+
+// -----------------------------------------------------------------------------
+uint16_t
+usMbTcpTid (const uint8_t * pucFrame) {
+
+  return (pucFrame[0] << 8) | pucFrame[1];
+}
+
+// -----------------------------------------------------------------------------
+int
+iMbTcpReadResponse (const uint8_t * pucFrame, int iLen, int iFunction,
+                    int iNb, void * pvData) {
+  const uint8_t * pdu = &pucFrame[MBTCP_HEADER_LENGTH];
+  int iPduLen = iLen - MBTCP_HEADER_LENGTH;
+  int iBytes, i;
+
+  if (iPduLen < 2) {
+
+    errno = EMBBADDATA;
+    return -1;
+  }
+
+  if (pdu[0] == (iFunction | 0x80)) {
+
+    // réponse d'exception
+#ifdef MODBUS_ENOBASE
+    errno = MODBUS_ENOBASE + pdu[1];
+#else
+    errno = EIO;
+#endif
+    return -1;
+  }
+
+  if (pdu[0] != iFunction) {
+
+    errno = EMBBADDATA;
+    return -1;
+  }
+
+  iBytes = pdu[1];
+  if ( (iFunction == MBTCP_READ_COILS) ||
+       (iFunction == MBTCP_READ_DISCRETE_INPUTS)) {
+    uint8_t * pucDest = (uint8_t *) pvData;
+
+    if ( (iBytes != (iNb + 7) / 8) || (iPduLen < iBytes + 2)) {
+
+      errno = EMBBADDATA;
+      return -1;
+    }
+    for (i = 0; i < iNb; i++) {
+
+      pucDest[i] = (pdu[2 + i / 8] >> (i % 8)) & 1;
+    }
+  }
+  else {
+    uint16_t * pusDest = (uint16_t *) pvData;
+
+    if ( (iBytes != iNb * 2) || (iPduLen < iBytes + 2)) {
+
+      errno = EMBBADDATA;
+      return -1;
+    }
+    for (i = 0; i < iNb; i++) {
+
+      pusDest[i] = (pdu[2 + 2 * i] << 8) | pdu[3 + 2 * i];
+    }
+  }
+  return iNb;
+}
+
+#ifdef MBPOLL_TCP_PIPELINE
+// -----------------------------------------------------------------------------
+int
+iMbTcpPipeline (int iFd, xMbTcpRequest * pxReq, int iCount, int iWindow,
+                double dTimeout, uint16_t * pusTid) {
+  struct {
+    uint16_t usTid;
+    int iReq;
+    uint64_t ulDeadline;
+  } xFlight[MBTCP_WINDOW_MAX];
+  uint8_t ucTx[MBTCP_WINDOW_MAX * MBTCP_REQUEST_LENGTH];
+  uint8_t ucRx[MBTCP_MAX_ADU_LENGTH];
+  uint64_t ulTimeout = (uint64_t) (dTimeout * 1e9);
+  int iNext = 0, iPending = 0, iRxLen = 0, iOk = 0;
+  int i;
+
+  if (iWindow > MBTCP_WINDOW_MAX) {
+    iWindow = MBTCP_WINDOW_MAX;
+  }
+
+  while ( (iNext < iCount) || (iPending > 0)) {
+    struct pollfd xPoll = { .fd = iFd, .events = POLLIN };
+    uint64_t ulNow, ulFirst;
+    int iTxLen = 0;
+
+    // remplissage de la fenêtre, les requêtes partent en une seule écriture
+    ulNow = ulPollTimerNow();
+    while ( (iPending < iWindow) && (iNext < iCount)) {
+      xMbTcpRequest * r = &pxReq[iNext];
+
+      xFlight[iPending].usTid = ++ (*pusTid);
+      xFlight[iPending].iReq = iNext;
+      xFlight[iPending].ulDeadline = ulNow + ulTimeout;
+      iTxLen += iMbTcpReadRequest (&ucTx[iTxLen], *pusTid, r->iUnit,
+                                   r->iFunction, r->iAddr, r->iNb);
+      iPending++;
+      iNext++;
+    }
+    if (iTxLen > 0) {
+      int iSent = 0;
+
+      while (iSent < iTxLen) {
+        ssize_t n = send (iFd, &ucTx[iSent], iTxLen - iSent, MSG_NOSIGNAL);
+
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          goto lost;
+        }
+        iSent += n;
+      }
+    }
+
+    // attente jusqu'à la plus proche échéance de réponse
+    ulFirst = xFlight[0].ulDeadline;
+    for (i = 1; i < iPending; i++) {
+      if (xFlight[i].ulDeadline < ulFirst) {
+        ulFirst = xFlight[i].ulDeadline;
+      }
+    }
+    ulNow = ulPollTimerNow();
+    i = poll (&xPoll, 1, ulFirst > ulNow ?
+              (int) ( (ulFirst - ulNow + 999999ULL) / 1000000ULL) : 0);
+    if ( (i < 0) && (errno != EINTR)) {
+      goto lost;
+    }
+
+    if (i > 0) {
+      ssize_t n = recv (iFd, &ucRx[iRxLen], sizeof (ucRx) - iRxLen, 0);
+
+      if (n <= 0) {
+        if (n == 0) {
+          errno = ECONNRESET;
+        }
+        if ( (n < 0) && (errno == EINTR)) {
+          continue;
+        }
+        goto lost;
+      }
+      iRxLen += n;
+      ulNow = ulPollTimerNow();
+
+      for (;;) {
+        int iLen = iMbTcpFrameLength (ucRx, iRxLen);
+
+        if (iLen < 0) {
+          errno = EPROTO;
+          goto lost;
+        }
+        if ( (iLen == 0) || (iLen > iRxLen)) {
+          break;
+        }
+        for (i = 0; i < iPending; i++) {
+          if (xFlight[i].usTid == usMbTcpTid (ucRx)) {
+            xMbTcpRequest * r = &pxReq[xFlight[i].iReq];
+
+            r->iRet = iMbTcpReadResponse (ucRx, iLen, r->iFunction, r->iNb,
+                                          r->pvData);
+            r->iError = (r->iRet < 0) ? errno : 0;
+            r->ulLatency = ulNow - (xFlight[i].ulDeadline - ulTimeout);
+            if (r->iRet >= 0) {
+              iOk++;
+            }
+            xFlight[i] = xFlight[--iPending];
+            break;
+          }
+        }
+        // une réponse sans requête en vol (tardive) est ignorée
+        memmove (ucRx, &ucRx[iLen], iRxLen - iLen);
+        iRxLen -= iLen;
+      }
+    }
+
+    // requêtes sans réponse dans le délai
+    ulNow = ulPollTimerNow();
+    for (i = 0; i < iPending;) {
+      if (xFlight[i].ulDeadline <= ulNow) {
+        xMbTcpRequest * r = &pxReq[xFlight[i].iReq];
+
+        r->iRet = -1;
+        r->iError = ETIMEDOUT;
+        r->ulLatency = 0;
+        xFlight[i] = xFlight[--iPending];
+      }
+      else {
+        i++;
+      }
+    }
+  }
+  return iOk;
+
+lost:
+  // la connexion est perdue, les requêtes restantes échouent
+  {
+    int iError = errno;
+
+    for (i = 0; i < iPending; i++) {
+      pxReq[xFlight[i].iReq].iRet = -1;
+      pxReq[xFlight[i].iReq].iError = iError;
+      pxReq[xFlight[i].iReq].ulLatency = 0;
+    }
+    for (i = iNext; i < iCount; i++) {
+      pxReq[i].iRet = -1;
+      pxReq[i].iError = iError;
+      pxReq[i].ulLatency = 0;
+    }
+    errno = iError;
+  }
+  return -1;
+}
+#endif /* MBPOLL_TCP_PIPELINE defined */
+/* ========================================================================== */
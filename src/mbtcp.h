@@ -0,0 +1,129 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_MBTCP_H_
+#define _MBPOLL_MBTCP_H_
+
+#include <stdint.h>
+
+/* constants ================================================================ */
+#define MBTCP_HEADER_LENGTH   7   /**< Taille de l'entête MBAP */
+#define MBTCP_REQUEST_LENGTH  12  /**< Taille d'une requête de lecture */
+#define MBTCP_MAX_ADU_LENGTH  260 /**< Taille maximale d'une trame */
+#define MBTCP_WINDOW_MAX      64  /**< Nombre maximal de requêtes en vol */
+
+/* conditionals ============================================================= */
+// L'envoi en rafale sur le socket de libmodbus utilise poll()
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#define MBPOLL_TCP_PIPELINE 1
+#endif
+
+/**
+ * @enum eMbTcpFunction
+ * @brief Codes fonction Modbus de lecture
+ */
+typedef enum {
+  MBTCP_READ_COILS = 0x01,
+  MBTCP_READ_DISCRETE_INPUTS = 0x02,
+  MBTCP_READ_HOLDING_REGISTERS = 0x03,
+  MBTCP_READ_INPUT_REGISTERS = 0x04
+} eMbTcpFunction;
+
+/* structures =============================================================== */
+/**
+ * Requête de lecture traitée par iMbTcpPipeline()
+ */
+typedef struct xMbTcpRequest {
+  int iUnit; /**< Adresse de l'esclave */
+  int iFunction; /**< Code fonction (eMbTcpFunction) */
+  int iAddr; /**< Adresse PDU du premier élément */
+  int iNb; /**< Nombre d'éléments */
+  void * pvData; /**< Destination des éléments lus */
+  int iRet; /**< Résultat : iNb, -1 si erreur */
+  int iError; /**< Code d'erreur si iRet < 0 */
+  uint64_t ulLatency; /**< Délai de réponse en ns, 0 si aucune réponse */
+} xMbTcpRequest;
+
+/* internal public functions ================================================ */
+
+/**
+ * Construit une requête de lecture Modbus/TCP
+ *
+ * @param pucFrame tampon d'au moins MBTCP_REQUEST_LENGTH octets
+ * @param usTid identifiant de transaction
+ * @param iUnit adresse de l'esclave (unit identifier)
+ * @param iFunction code fonction (eMbTcpFunction)
+ * @param iAddr adresse PDU du premier élément
+ * @param iNb nombre d'éléments (bits ou registres)
+ * @return la taille de la trame
+ */
+int iMbTcpReadRequest (uint8_t * pucFrame, uint16_t usTid, int iUnit,
+                       int iFunction, int iAddr, int iNb);
+
+/**
+ * Taille de la trame en cours de réception
+ *
+ * @param pucFrame octets reçus
+ * @param iLen nombre d'octets reçus
+ * @return la taille totale de la trame (entête compris) si l'entête est
+ * complet, 0 s'il manque des octets pour le savoir, -1 si l'entête est invalide
+ */
+int iMbTcpFrameLength (const uint8_t * pucFrame, int iLen);
+
+/**
+ * Identifiant de transaction d'une trame
+ */
+uint16_t usMbTcpTid (const uint8_t * pucFrame);
+
+/**
+ * Décode la réponse à une requête de lecture
+ *
+ * Les registres sont rangés dans un tableau de uint16_t dans l'ordre de
+ * l'hôte, les bits à raison d'un bit par octet, comme le fait libmodbus.
+ *
+ * @param pucFrame trame complète
+ * @param iLen taille de la trame
+ * @param iFunction code fonction de la requête
+ * @param iNb nombre d'éléments demandés
+ * @param pvData destination des éléments
+ * @return iNb, -1 si erreur (errno est positionné, les exceptions Modbus
+ * utilisent les codes d'erreur de libmodbus)
+ */
+int iMbTcpReadResponse (const uint8_t * pucFrame, int iLen, int iFunction,
+                        int iNb, void * pvData);
+
+#ifdef MBPOLL_TCP_PIPELINE
+/**
+ * Exécute une suite de lectures en gardant jusqu'à iWindow requêtes en vol
+ *
+ * Les réponses sont associées aux requêtes par leur identifiant de
+ * transaction, elles peuvent arriver dans le désordre. Une réponse qui
+ * n'arrive pas dans le délai dTimeout après l'envoi de sa requête est comptée
+ * en erreur (ETIMEDOUT), une réponse tardive est ignorée.
+ *
+ * @param iFd socket connecté (celui de libmodbus par exemple)
+ * @param pxReq requêtes, iRet et iError sont renseignés au retour
+ * @param iCount nombre de requêtes
+ * @param iWindow nombre maximal de requêtes en vol (1 à MBTCP_WINDOW_MAX)
+ * @param dTimeout délai de réponse en s
+ * @param pusTid dernier identifiant utilisé, mis à jour
+ * @return le nombre de requêtes réussies, -1 si la connexion est perdue
+ */
+int iMbTcpPipeline (int iFd, xMbTcpRequest * pxReq, int iCount, int iWindow,
+                    double dTimeout, uint16_t * pusTid);
+#endif
+
+/* ========================================================================== */
+#endif /* _MBPOLL_MBTCP_H_ */
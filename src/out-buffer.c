@@ -0,0 +1,280 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "out-buffer.h"
+
+/* constants ================================================================ */
+// place réservée pour la conversion d'un nombre
+#define NUMBER_MAX 32
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+// Ecrit ulLen octets, ou les ajoute à la file d'attente
+static int
+iWrite (xOutBuffer * o, const char * pcData, size_t ulLen) {
+  size_t ulSent = 0;
+
+#ifdef MBPOLL_OUT_QUEUE
+  if (o->pxQueue) {
+
+    return iOutQueuePush (o->pxQueue, pcData, ulLen);
+  }
+#endif
+  while (ulSent < ulLen) {
+    int n = write (o->iFd, &pcData[ulSent], ulLen - ulSent);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // la sortie est perdue, le cycle suivant repart d'un tampon vide
+      return -1;
+    }
+    ulSent += n;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Rend ulLen octets libres sans couper l'enregistrement en cours
+static void
+vMakeRoom (xOutBuffer * o, size_t ulLen) {
+  size_t ulPart = o->ulLen - o->ulMark;
+
+  if (o->ulMark > 0) {
+
+    // les enregistrements complets sont écrits, celui en cours est ramené au
+    // début, dans la zone de l'appelant s'il y tient
+    iWrite (o, o->pcBuf, o->ulMark);
+    if ( (o->pcBuf != o->pcZone) && (ulPart + ulLen <= o->ulZoneSize)) {
+
+      memcpy (o->pcZone, &o->pcBuf[o->ulMark], ulPart);
+      free (o->pcBuf);
+      o->pcBuf = o->pcZone;
+      o->ulSize = o->ulZoneSize;
+    }
+    else {
+
+      memmove (o->pcBuf, &o->pcBuf[o->ulMark], ulPart);
+    }
+    o->ulLen = ulPart;
+    o->ulMark = 0;
+  }
+
+  if (o->ulSize - o->ulLen < ulLen) {
+    size_t ulSize = o->ulSize * 2;
+    char * pcBuf;
+
+    // l'enregistrement en cours est plus grand que la zone
+    while (ulSize - o->ulLen < ulLen) {
+      ulSize *= 2;
+    }
+    pcBuf = (o->pcBuf == o->pcZone) ? malloc (ulSize) :
+            realloc (o->pcBuf, ulSize);
+    if (pcBuf == NULL) {
+
+      // faute de mémoire, l'enregistrement est écrit en plusieurs fois
+      iWrite (o, o->pcBuf, o->ulLen);
+      o->ulLen = 0;
+      return;
+    }
+    if (o->pcBuf == o->pcZone) {
+      memcpy (pcBuf, o->pcZone, o->ulLen);
+    }
+    o->pcBuf = pcBuf;
+    o->ulSize = ulSize;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Garantit ulLen octets libres dans le tampon
+static inline char *
+pcReserve (xOutBuffer * o, size_t ulLen) {
+
+  if (o->ulSize - o->ulLen < ulLen) {
+
+    vMakeRoom (o, ulLen);
+  }
+  return &o->pcBuf[o->ulLen];
+}
+
+// -----------------------------------------------------------------------------
+// Recopie les caractères convertis, de pcFirst à pcEnd
+static inline void
+vPutDigits (xOutBuffer * o, const char * pcFirst, const char * pcEnd) {
+  size_t ulLen = pcEnd - pcFirst;
+
+  memcpy (pcReserve (o, ulLen), pcFirst, ulLen);
+  o->ulLen += ulLen;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferInit (xOutBuffer * o, int iFd, char * pcBuf, size_t ulSize) {
+
+  o->iFd = iFd;
+  o->pcBuf = o->pcZone = pcBuf;
+  o->ulSize = o->ulZoneSize = ulSize;
+  o->ulLen = o->ulMark = 0;
+#ifdef MBPOLL_OUT_QUEUE
+  o->pxQueue = NULL;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferEndRecord (xOutBuffer * o) {
+
+  o->ulMark = o->ulLen;
+}
+
+// -----------------------------------------------------------------------------
+int
+iOutBufferFlush (xOutBuffer * o) {
+  int iRet = 0;
+
+  if (o->ulLen > 0) {
+    iRet = iWrite (o, o->pcBuf, o->ulLen);
+  }
+  o->ulLen = o->ulMark = 0;
+  if (o->pcBuf != o->pcZone) {
+
+    free (o->pcBuf);
+    o->pcBuf = o->pcZone;
+    o->ulSize = o->ulZoneSize;
+  }
+  return iRet;
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferPutc (xOutBuffer * o, char c) {
+
+  *pcReserve (o, 1) = c;
+  o->ulLen++;
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferPuts (xOutBuffer * o, const char * s) {
+
+  vOutBufferWrite (o, s, strlen (s));
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferWrite (xOutBuffer * o, const void * pvData, size_t ulLen) {
+  const char * s = (const char *) pvData;
+
+  while (ulLen > 0) {
+    size_t ulFree = o->ulSize - o->ulLen;
+    size_t ulCopy;
+
+    if (ulFree == 0) {
+
+      vMakeRoom (o, ulLen < o->ulZoneSize ? ulLen : o->ulZoneSize);
+      ulFree = o->ulSize - o->ulLen;
+    }
+    ulCopy = ulLen < ulFree ? ulLen : ulFree;
+    memcpy (&o->pcBuf[o->ulLen], s, ulCopy);
+    o->ulLen += ulCopy;
+    s += ulCopy;
+    ulLen -= ulCopy;
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferUint (xOutBuffer * o, uint64_t ullValue) {
+  char cTmp[NUMBER_MAX];
+  char * p = &cTmp[NUMBER_MAX];
+
+  do {
+    *--p = '0' + (ullValue % 10);
+    ullValue /= 10;
+  }
+  while (ullValue);
+  vPutDigits (o, p, &cTmp[NUMBER_MAX]);
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferInt (xOutBuffer * o, int64_t llValue) {
+
+  if (llValue < 0) {
+
+    vOutBufferPutc (o, '-');
+    // -INT64_MIN n'est pas représentable en int64_t
+    vOutBufferUint (o, - (uint64_t) llValue);
+  }
+  else {
+
+    vOutBufferUint (o, (uint64_t) llValue);
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferHex (xOutBuffer * o, unsigned long ulValue, int iDigits) {
+  static const char cHex[] = "0123456789ABCDEF";
+  char cTmp[NUMBER_MAX];
+  char * p = &cTmp[NUMBER_MAX];
+
+  if (iDigits > NUMBER_MAX - 2) {
+    iDigits = NUMBER_MAX - 2;
+  }
+  do {
+    *--p = cHex[ulValue & 0xF];
+    ulValue >>= 4;
+    iDigits--;
+  }
+  while (ulValue || (iDigits > 0));
+  *--p = 'x';
+  *--p = '0';
+  vPutDigits (o, p, &cTmp[NUMBER_MAX]);
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferDouble (xOutBuffer * o, double dValue) {
+
+  vOutBufferDoubleDigits (o, dValue, 6);
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutBufferDoubleDigits (xOutBuffer * o, double dValue, int iDigits) {
+  // %.17g tient toujours dans NUMBER_MAX caractères
+  int n = snprintf (pcReserve (o, NUMBER_MAX), NUMBER_MAX, "%.*g",
+                    iDigits > 17 ? 17 : iDigits, dValue);
+
+  if (n > 0) {
+    o->ulLen += n < NUMBER_MAX ? n : NUMBER_MAX - 1;
+  }
+}
+
+/* ========================================================================== */
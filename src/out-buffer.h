@@ -0,0 +1,115 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_OUT_BUFFER_H_
+#define _MBPOLL_OUT_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "out-queue.h"
+
+/* structures =============================================================== */
+/**
+ * Tampon de sortie
+ *
+ * Le texte d'un cycle complet est construit dans une zone fournie par
+ * l'appelant puis transmis par un seul appel à write(). Avec une file
+ * d'attente, le contenu y est ajouté et c'est le thread d'écriture qui appelle
+ * write().
+ *
+ * Le contenu n'est découpé qu'aux fins d'enregistrements marquées par
+ * vOutBufferEndRecord() : si la zone est pleine, les enregistrements complets
+ * sont écrits et celui en cours est ramené au début de la zone. Un
+ * enregistrement plus grand que la zone est construit dans un tampon alloué,
+ * libéré à l'écriture suivante. Une file d'attente reçoit ainsi toujours des
+ * enregistrements entiers.
+ */
+typedef struct xOutBuffer {
+  int iFd; /**< Descripteur de destination */
+  char * pcBuf; /**< Zone de construction, pcZone ou un tampon alloué */
+  size_t ulSize; /**< Taille de pcBuf */
+  size_t ulLen; /**< Nombre d'octets en attente */
+  size_t ulMark; /**< Fin du dernier enregistrement complet */
+  char * pcZone; /**< Zone fournie par l'appelant */
+  size_t ulZoneSize;
+#ifdef MBPOLL_OUT_QUEUE
+  xOutQueue * pxQueue; /**< File du thread d'écriture, NULL si write() direct */
+#endif
+} xOutBuffer;
+
+/* internal public functions ================================================ */
+
+/**
+ * Initialise un tampon sur une zone de ulSize octets (au moins 64)
+ */
+void vOutBufferInit (xOutBuffer * o, int iFd, char * pcBuf, size_t ulSize);
+
+/**
+ * Marque la fin d'un enregistrement
+ */
+void vOutBufferEndRecord (xOutBuffer * o);
+
+/**
+ * Ecrit le contenu du tampon, ou l'ajoute à la file d'attente, et le vide
+ *
+ * @return 0, -1 si erreur d'écriture (errno) ou si le contenu est perdu car
+ * la file est pleine
+ */
+int iOutBufferFlush (xOutBuffer * o);
+
+/**
+ * Ajoute un caractère
+ */
+void vOutBufferPutc (xOutBuffer * o, char c);
+
+/**
+ * Ajoute ulLen octets quelconques
+ */
+void vOutBufferWrite (xOutBuffer * o, const void * pvData, size_t ulLen);
+
+/**
+ * Ajoute une chaîne terminée par un zéro
+ */
+void vOutBufferPuts (xOutBuffer * o, const char * s);
+
+/**
+ * Ajoute un entier en décimal
+ */
+void vOutBufferInt (xOutBuffer * o, int64_t llValue);
+
+/**
+ * Ajoute un entier non signé en décimal
+ */
+void vOutBufferUint (xOutBuffer * o, uint64_t ullValue);
+
+/**
+ * Ajoute un entier en hexadécimal majuscule préfixé par 0x, sur au moins
+ * iDigits chiffres
+ */
+void vOutBufferHex (xOutBuffer * o, unsigned long ulValue, int iDigits);
+
+/**
+ * Ajoute un réel au format %g
+ */
+void vOutBufferDouble (xOutBuffer * o, double dValue);
+
+/**
+ * Ajoute un réel au format %.*g avec iDigits chiffres significatifs (au plus
+ * 17)
+ */
+void vOutBufferDoubleDigits (xOutBuffer * o, double dValue, int iDigits);
+
+/* ========================================================================== */
+#endif /* _MBPOLL_OUT_BUFFER_H_ */
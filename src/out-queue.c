@@ -0,0 +1,213 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "out-queue.h"
+
+#ifdef MBPOLL_OUT_QUEUE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+// Thread d'écriture : écrit ce qui est dans l'anneau, par portions contiguës
+static void *
+pvWriterThread (void * pvArg) {
+  xOutQueue * q = (xOutQueue *) pvArg;
+  uint64_t ullTail = q->ullTail;
+
+  for (;;) {
+    uint64_t ullHead = __atomic_load_n (&q->ullHead, __ATOMIC_ACQUIRE);
+    uint64_t ullOffset, ullLen;
+    ssize_t n;
+
+    if (ullHead == ullTail) {
+
+      // file vide, iIdle et ullHead sont relus sous le verrou pour ne pas
+      // manquer un ajout
+      pthread_mutex_lock (&q->xLock);
+      __atomic_store_n (&q->iIdle, 1, __ATOMIC_SEQ_CST);
+      while ( (__atomic_load_n (&q->ullHead, __ATOMIC_SEQ_CST) == ullTail) &&
+              (!q->bStop)) {
+
+        pthread_cond_wait (&q->xData, &q->xLock);
+      }
+      __atomic_store_n (&q->iIdle, 0, __ATOMIC_RELAXED);
+      if ( (__atomic_load_n (&q->ullHead, __ATOMIC_ACQUIRE) == ullTail) &&
+           (q->bStop)) {
+
+        pthread_mutex_unlock (&q->xLock);
+        break;
+      }
+      pthread_mutex_unlock (&q->xLock);
+      continue;
+    }
+
+    ullOffset = ullTail % q->ullSize;
+    ullLen = ullHead - ullTail;
+    if (ullLen > q->ullSize - ullOffset) {
+      ullLen = q->ullSize - ullOffset;
+    }
+
+    n = write (q->iFd, &q->pucRing[ullOffset], ullLen);
+    if (n < 0) {
+
+      if (errno == EINTR) {
+        continue;
+      }
+      // comme pour une écriture directe, la portion est perdue
+      __atomic_add_fetch (&q->ulWriteErrors, 1, __ATOMIC_RELAXED);
+      n = ullLen;
+    }
+
+    // la place libérée est publiée avant de réveiller un producteur qui
+    // attendrait
+    ullTail += n;
+    __atomic_store_n (&q->ullTail, ullTail, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&q->iFull, __ATOMIC_SEQ_CST)) {
+
+      pthread_mutex_lock (&q->xLock);
+      pthread_cond_broadcast (&q->xSpace);
+      pthread_mutex_unlock (&q->xLock);
+    }
+  }
+  return NULL;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iOutQueueCreate (xOutQueue * q, int iFd, size_t ulSize,
+                 eOutQueuePolicy ePolicy) {
+  sigset_t xMask, xOldMask;
+  int iErr;
+
+  memset (q, 0, sizeof (*q));
+  q->iFd = iFd;
+  q->ullSize = ulSize;
+  q->ePolicy = ePolicy;
+  q->pucRing = malloc (ulSize);
+  if (q->pucRing == NULL) {
+
+    return -1;
+  }
+  pthread_mutex_init (&q->xLock, NULL);
+  pthread_cond_init (&q->xData, NULL);
+  pthread_cond_init (&q->xSpace, NULL);
+
+  // le thread d'écriture ne traite aucun signal, vOutQueueClose() l'attend
+  sigfillset (&xMask);
+  pthread_sigmask (SIG_BLOCK, &xMask, &xOldMask);
+  iErr = pthread_create (&q->xThread, NULL, pvWriterThread, q);
+  pthread_sigmask (SIG_SETMASK, &xOldMask, NULL);
+  if (iErr != 0) {
+
+    pthread_cond_destroy (&q->xSpace);
+    pthread_cond_destroy (&q->xData);
+    pthread_mutex_destroy (&q->xLock);
+    free (q->pucRing);
+    q->pucRing = NULL;
+    errno = iErr;
+    return -1;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int
+iOutQueuePush (xOutQueue * q, const void * pvData, size_t ulLen) {
+  uint64_t ullHead, ullOffset, ullDepth;
+  const uint8_t * pucData = (const uint8_t *) pvData;
+
+  if (ulLen == 0) {
+    return 0;
+  }
+
+  pthread_mutex_lock (&q->xLock);
+  ullHead = q->ullHead;
+  ullDepth = ullHead - __atomic_load_n (&q->ullTail, __ATOMIC_ACQUIRE);
+
+  while (q->ullSize - ullDepth < ulLen) {
+
+    if ( (q->ePolicy == eOutQueueDrop) || (ulLen > q->ullSize)) {
+
+      q->ulDropCount++;
+      q->ullDropBytes += ulLen;
+      pthread_mutex_unlock (&q->xLock);
+      return -1;
+    }
+
+    // iFull est publié avant de relire ullTail : le thread d'écriture voit
+    // l'un ou l'autre et ne peut pas manquer le réveil
+    __atomic_store_n (&q->iFull, 1, __ATOMIC_SEQ_CST);
+    ullDepth = ullHead - __atomic_load_n (&q->ullTail, __ATOMIC_SEQ_CST);
+    if (q->ullSize - ullDepth < ulLen) {
+
+      q->ulWaitCount++;
+      pthread_cond_wait (&q->xSpace, &q->xLock);
+      ullDepth = ullHead - __atomic_load_n (&q->ullTail, __ATOMIC_ACQUIRE);
+    }
+  }
+  __atomic_store_n (&q->iFull, 0, __ATOMIC_RELAXED);
+
+  // recopie en deux parties si le bloc fait le tour de l'anneau
+  ullOffset = ullHead % q->ullSize;
+  if (ulLen > q->ullSize - ullOffset) {
+    size_t ulFirst = q->ullSize - ullOffset;
+
+    memcpy (&q->pucRing[ullOffset], pucData, ulFirst);
+    memcpy (q->pucRing, &pucData[ulFirst], ulLen - ulFirst);
+  }
+  else {
+
+    memcpy (&q->pucRing[ullOffset], pucData, ulLen);
+  }
+  __atomic_store_n (&q->ullHead, ullHead + ulLen, __ATOMIC_SEQ_CST);
+
+  ullDepth += ulLen;
+  if (ullDepth > q->ullMaxDepth) {
+    q->ullMaxDepth = ullDepth;
+  }
+  if (__atomic_load_n (&q->iIdle, __ATOMIC_SEQ_CST)) {
+
+    pthread_cond_signal (&q->xData);
+  }
+  pthread_mutex_unlock (&q->xLock);
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+void
+vOutQueueClose (xOutQueue * q) {
+
+  pthread_mutex_lock (&q->xLock);
+  q->bStop = true;
+  pthread_cond_signal (&q->xData);
+  pthread_mutex_unlock (&q->xLock);
+  pthread_join (q->xThread, NULL);
+
+  pthread_cond_destroy (&q->xSpace);
+  pthread_cond_destroy (&q->xData);
+  pthread_mutex_destroy (&q->xLock);
+  free (q->pucRing);
+  q->pucRing = NULL;
+}
+
+#endif /* MBPOLL_OUT_QUEUE defined */
+/* ========================================================================== */
@@ -0,0 +1,109 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_OUT_QUEUE_H_
+#define _MBPOLL_OUT_QUEUE_H_
+
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#define MBPOLL_OUT_QUEUE
+#endif
+
+#ifdef MBPOLL_OUT_QUEUE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* constants ================================================================ */
+/**
+ * Politique appliquée lorsque la file est pleine
+ */
+typedef enum {
+  eOutQueueDrop = 0, /**< Le texte à écrire est perdu, la scrutation continue */
+  eOutQueueBlock /**< La scrutation attend que le thread d'écriture avance */
+} eOutQueuePolicy;
+
+/* structures =============================================================== */
+/**
+ * File d'attente du thread d'écriture
+ *
+ * Anneau d'octets entre les threads qui produisent du texte (bus, hôtes,
+ * groupes) et un thread d'écriture. L'ajout n'est pas sans verrou : chaque
+ * iOutQueuePush() prend xLock, qui sérialise les producteurs, et ullHead n'est
+ * modifié que sous ce verrou. ullTail n'est modifié que par le thread
+ * d'écriture, qui lit ullHead et publie ullTail par des accès atomiques sans
+ * prendre xLock, sauf pour s'endormir lorsque la file est vide. write() n'est
+ * ainsi jamais appelé sous le verrou et un producteur n'attend le thread
+ * d'écriture qu'avec la politique eOutQueueBlock.
+ *
+ * Un bloc ajouté par iOutQueuePush() est écrit en entier ou perdu en entier.
+ * xOutBuffer n'y ajoute que des enregistrements entiers (out-buffer.h) : un
+ * enregistrement n'est jamais tronqué.
+ */
+typedef struct xOutQueue {
+  int iFd; /**< Descripteur de destination */
+  uint8_t * pucRing;
+  uint64_t ullSize; /**< Taille de l'anneau en octets */
+  uint64_t ullHead; /**< Octets ajoutés depuis la création */
+  uint64_t ullTail; /**< Octets écrits (ou perdus sur erreur) */
+  eOutQueuePolicy ePolicy;
+  int iIdle; /**< Le thread d'écriture attend des données */
+  int iFull; /**< Le producteur attend de la place */
+  bool bStop; /**< Le thread d'écriture se termine une fois la file vide */
+  // compteurs, modifiés sous xLock sauf ulWriteErrors
+  uint64_t ullMaxDepth; /**< Plus grand remplissage atteint en octets */
+  unsigned long ulDropCount; /**< Blocs perdus car la file était pleine */
+  uint64_t ullDropBytes;
+  unsigned long ulWaitCount; /**< Attentes du producteur (eOutQueueBlock) */
+  unsigned long ulWriteErrors; /**< Erreurs de write() */
+  pthread_mutex_t xLock;
+  pthread_cond_t xData; /**< Signalée lorsque des données sont ajoutées */
+  pthread_cond_t xSpace; /**< Signalée lorsque de la place est libérée */
+  pthread_t xThread;
+} xOutQueue;
+
+/* internal public functions ================================================ */
+
+/**
+ * Crée la file et démarre le thread d'écriture
+ *
+ * @param ulSize taille de l'anneau en octets, supérieure au plus grand bloc
+ * qui sera ajouté
+ * @return 0, -1 si erreur (errno)
+ */
+int iOutQueueCreate (xOutQueue * q, int iFd, size_t ulSize,
+                     eOutQueuePolicy ePolicy);
+
+/**
+ * Ajoute un bloc à écrire
+ *
+ * Peut être appelée par plusieurs threads.
+ *
+ * @return 0, -1 si le bloc est perdu (file pleine avec eOutQueueDrop ou
+ * bloc plus grand que la file)
+ */
+int iOutQueuePush (xOutQueue * q, const void * pvData, size_t ulLen);
+
+/**
+ * Ecrit le contenu de la file, arrête le thread d'écriture et libère la file
+ *
+ * Les threads qui ajoutent des blocs doivent être terminés, la file ne doit
+ * plus être utilisée.
+ */
+void vOutQueueClose (xOutQueue * q);
+
+#endif /* MBPOLL_OUT_QUEUE defined */
+/* ========================================================================== */
+#endif /* _MBPOLL_OUT_QUEUE_H_ */
@@ -0,0 +1,277 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "poll-timer.h"
+
+/* constants ================================================================ */
+#define NS_PER_SEC  1000000000ULL
+#define NS_PER_MS   1000000ULL
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+// Une seule attente, interrompue par un signal intercepté
+static void
+vSleepUntil (uint64_t ulDeadline) {
+#if defined (TIMER_ABSTIME) && !defined (_WIN32)
+  struct timespec ts;
+
+  // attente absolue, insensible au temps passé entre le calcul et l'appel
+  ts.tv_sec  = ulDeadline / NS_PER_SEC;
+  ts.tv_nsec = ulDeadline % NS_PER_SEC;
+  clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+#else
+  uint64_t ulNow = ulPollTimerNow();
+
+  if (ulDeadline > ulNow) {
+    uint64_t ulDelay = ulDeadline - ulNow;
+#ifdef _WIN32
+    Sleep ( (DWORD) ( (ulDelay + NS_PER_MS - 1) / NS_PER_MS));
+#else
+    struct timespec dt;
+
+    dt.tv_sec  = ulDelay / NS_PER_SEC;
+    dt.tv_nsec = ulDelay % NS_PER_SEC;
+    nanosleep (&dt, NULL);
+#endif
+  }
+#endif
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+uint64_t
+ulPollTimerNow (void) {
+#ifdef _WIN32
+  static LARGE_INTEGER xFreq;
+  LARGE_INTEGER xCount;
+
+  if (xFreq.QuadPart == 0) {
+    QueryPerformanceFrequency (&xFreq);
+  }
+  QueryPerformanceCounter (&xCount);
+  return (uint64_t) (xCount.QuadPart / xFreq.QuadPart) * NS_PER_SEC +
+         (uint64_t) (xCount.QuadPart % xFreq.QuadPart) * NS_PER_SEC /
+         (uint64_t) xFreq.QuadPart;
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * NS_PER_SEC + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+void
+vPollTimerSleepUntil (uint64_t ulDeadline,
+                      const volatile sig_atomic_t * pbStop) {
+
+  // une attente interrompue par un signal reprend si rien ne l'arrête
+  while ( (pbStop == NULL) || (*pbStop == 0)) {
+    uint64_t ulNow = ulPollTimerNow();
+    uint64_t ulEnd = ulDeadline;
+
+    if (ulNow >= ulDeadline) {
+      break;
+    }
+    if ( (pbStop) && (ulDeadline - ulNow > POLL_TIMER_STOP_MS * NS_PER_MS)) {
+      ulEnd = ulNow + POLL_TIMER_STOP_MS * NS_PER_MS;
+    }
+    vSleepUntil (ulEnd);
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vPollTimerInit (xPollTimer * t, unsigned long ulPeriodMs,
+                ePollOverrun eOverrun) {
+
+  t->ulPeriod = (uint64_t) ulPeriodMs * NS_PER_MS;
+  t->ulDeadline = ulPollTimerNow();
+  t->eOverrun = eOverrun;
+  t->ulOverrunCount = 0;
+  t->ulSkipCount = 0;
+}
+
+// -----------------------------------------------------------------------------
+int
+iPollTimerAdvance (xPollTimer * t) {
+  uint64_t ulNow;
+  int iMissed = 0;
+
+  t->ulDeadline += t->ulPeriod;
+  ulNow = ulPollTimerNow();
+
+  if (ulNow > t->ulDeadline) {
+
+    // l'échéance est dépassée, nombre de périodes manquées
+    iMissed = (int) ( (ulNow - t->ulDeadline) / t->ulPeriod) + 1;
+    t->ulOverrunCount++;
+
+    if (t->eOverrun == ePollOverrunSkip) {
+
+      // on se recale sur la prochaine échéance de la grille
+      t->ulDeadline += (uint64_t) iMissed * t->ulPeriod;
+      t->ulSkipCount += iMissed;
+    }
+    // sinon on repart immédiatement, l'échéance n'est pas décalée
+  }
+  return iMissed;
+}
+
+// -----------------------------------------------------------------------------
+int
+iPollTimerWait (xPollTimer * t, const volatile sig_atomic_t * pbStop) {
+  int iMissed = iPollTimerAdvance (t);
+
+  vPollTimerSleepUntil (t->ulDeadline, pbStop);
+  return iMissed;
+}
+
+// -----------------------------------------------------------------------------
+static bool
+bPollQueueLess (const struct xPollQueueItem * a,
+                const struct xPollQueueItem * b) {
+
+  if (a->ulDeadline != b->ulDeadline) {
+
+    return a->ulDeadline < b->ulDeadline;
+  }
+  return a->ulSeq < b->ulSeq;
+}
+
+// -----------------------------------------------------------------------------
+int
+iPollQueueInit (xPollQueue * q, int iCapacity) {
+
+  q->pxItem = calloc (iCapacity, sizeof (struct xPollQueueItem));
+  q->iSize = 0;
+  q->iCapacity = q->pxItem ? iCapacity : 0;
+  q->ulSeq = 0;
+  return q->pxItem ? 0 : -1;
+}
+
+// -----------------------------------------------------------------------------
+void
+vPollQueueFree (xPollQueue * q) {
+
+  free (q->pxItem);
+  q->pxItem = NULL;
+  q->iSize = q->iCapacity = 0;
+}
+
+// -----------------------------------------------------------------------------
+int
+iPollQueuePush (xPollQueue * q, uint64_t ulDeadline, void * pvTask) {
+  struct xPollQueueItem xItem;
+  int i;
+
+  if (q->iSize >= q->iCapacity) {
+    int iCapacity = q->iCapacity ? q->iCapacity * 2 : 16;
+    struct xPollQueueItem * pxItem;
+
+    pxItem = realloc (q->pxItem, iCapacity * sizeof (struct xPollQueueItem));
+    if (pxItem == NULL) {
+
+      return -1;
+    }
+    q->pxItem = pxItem;
+    q->iCapacity = iCapacity;
+  }
+  xItem.ulDeadline = ulDeadline;
+  xItem.ulSeq = q->ulSeq++;
+  xItem.pvTask = pvTask;
+
+  // remontée vers la racine
+  i = q->iSize++;
+  while (i > 0) {
+    int iParent = (i - 1) / 2;
+
+    if (!bPollQueueLess (&xItem, &q->pxItem[iParent])) {
+      break;
+    }
+    q->pxItem[i] = q->pxItem[iParent];
+    i = iParent;
+  }
+  q->pxItem[i] = xItem;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+void *
+pvPollQueuePop (xPollQueue * q, uint64_t * pulDeadline) {
+  struct xPollQueueItem xTop, xLast;
+  int i = 0;
+
+  if (q->iSize == 0) {
+
+    return NULL;
+  }
+  xTop = q->pxItem[0];
+  xLast = q->pxItem[--q->iSize];
+
+  // descente du dernier élément depuis la racine
+  for (;;) {
+    int iChild = 2 * i + 1;
+
+    if (iChild >= q->iSize) {
+      break;
+    }
+    if ( (iChild + 1 < q->iSize) &&
+         bPollQueueLess (&q->pxItem[iChild + 1], &q->pxItem[iChild])) {
+      iChild++;
+    }
+    if (!bPollQueueLess (&q->pxItem[iChild], &xLast)) {
+      break;
+    }
+    q->pxItem[i] = q->pxItem[iChild];
+    i = iChild;
+  }
+  if (q->iSize) {
+    q->pxItem[i] = xLast;
+  }
+
+  if (pulDeadline) {
+    *pulDeadline = xTop.ulDeadline;
+  }
+  return xTop.pvTask;
+}
+
+// -----------------------------------------------------------------------------
+void *
+pvPollQueuePeek (const xPollQueue * q, uint64_t * pulDeadline) {
+
+  if (q->iSize == 0) {
+
+    return NULL;
+  }
+  if (pulDeadline) {
+    *pulDeadline = q->pxItem[0].ulDeadline;
+  }
+  return q->pxItem[0].pvTask;
+}
+/* ========================================================================== */
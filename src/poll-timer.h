@@ -0,0 +1,155 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_POLL_TIMER_H_
+#define _MBPOLL_POLL_TIMER_H_
+
+#include <stdint.h>
+#include <signal.h>
+
+/* constants ================================================================ */
+/**
+ * Intervalle maximal en ms entre deux vérifications de l'indicateur d'arrêt
+ * pendant une attente
+ */
+#define POLL_TIMER_STOP_MS 100
+
+/**
+ * @enum ePollOverrun
+ * @brief Comportement lorsqu'une échéance est dépassée
+ */
+typedef enum {
+  ePollOverrunSkip = 0, /**< Les périodes manquées sont sautées, on se recale sur la grille */
+  ePollOverrunCatchUp = 1, /**< Les périodes manquées sont rattrapées sans attente */
+  ePollOverrunUnknown = -1
+} ePollOverrun;
+
+/* structures =============================================================== */
+/**
+ * Cadenceur à échéances absolues
+ *
+ * Les échéances sont calculées sur une horloge monotone à partir de l'instant
+ * de démarrage : deadline(n) = start + n * period. La durée du traitement
+ * n'intervient donc pas dans la période et il n'y a pas de dérive.
+ */
+typedef struct xPollTimer {
+  uint64_t ulPeriod; /**< Période en ns */
+  uint64_t ulDeadline; /**< Prochaine échéance (horloge monotone, ns) */
+  ePollOverrun eOverrun; /**< Politique en cas de dépassement */
+  unsigned long ulOverrunCount; /**< Nombre d'échéances dépassées */
+  unsigned long ulSkipCount; /**< Nombre de périodes sautées */
+} xPollTimer;
+
+/**
+ * File de priorité (tas binaire) ordonnée par échéance croissante
+ *
+ * Permet de cadencer plusieurs tâches de périodes différentes avec une seule
+ * boucle : la tâche dont l'échéance est la plus proche est toujours en tête.
+ */
+typedef struct xPollQueue {
+  struct xPollQueueItem {
+    uint64_t ulDeadline; /**< Echéance (horloge monotone, ns) */
+    unsigned long ulSeq; /**< Ordre d'insertion, départage les ex aequo */
+    void * pvTask; /**< Tâche associée */
+  } * pxItem;
+  int iSize; /**< Nombre d'éléments présents */
+  int iCapacity; /**< Nombre d'éléments alloués */
+  unsigned long ulSeq;
+} xPollQueue;
+
+/* internal public functions ================================================ */
+
+/**
+ * Horloge monotone
+ *
+ * @return le temps écoulé depuis une origine arbitraire en ns
+ */
+uint64_t ulPollTimerNow (void);
+
+/**
+ * Initialise le cadenceur, la première échéance est l'instant présent
+ *
+ * @param ulPeriodMs période en ms
+ * @param eOverrun politique en cas de dépassement
+ */
+void vPollTimerInit (xPollTimer * t, unsigned long ulPeriodMs,
+                     ePollOverrun eOverrun);
+
+/**
+ * Passe à l'échéance suivante sans attendre
+ *
+ * @return 0 si l'échéance suivante est dans le futur, sinon le nombre de
+ * périodes manquées (qui ont été sautées ou qui seront rattrapées suivant la
+ * politique)
+ */
+int iPollTimerAdvance (xPollTimer * t);
+
+/**
+ * Attend l'échéance suivante
+ *
+ * @param pbStop voir vPollTimerSleepUntil()
+ * @return 0 si l'échéance a été respectée, sinon le nombre de périodes
+ * manquées (qui ont été sautées ou qui seront rattrapées suivant la politique)
+ */
+int iPollTimerWait (xPollTimer * t, const volatile sig_atomic_t * pbStop);
+
+/**
+ * Attend jusqu'à une date absolue de l'horloge monotone
+ *
+ * @param pbStop si non NULL, l'attente se termine dès que *pbStop est non nul.
+ * L'indicateur est positionné par un gestionnaire de signal et peut concerner
+ * un thread où le signal est bloqué, il est donc vérifié au moins toutes les
+ * POLL_TIMER_STOP_MS.
+ */
+void vPollTimerSleepUntil (uint64_t ulDeadline,
+                           const volatile sig_atomic_t * pbStop);
+
+/**
+ * Initialise une file vide pouvant contenir iCapacity tâches
+ *
+ * @return 0, -1 si erreur d'allocation
+ */
+int iPollQueueInit (xPollQueue * q, int iCapacity);
+
+/**
+ * Libère la mémoire allouée par la file
+ */
+void vPollQueueFree (xPollQueue * q);
+
+/**
+ * Ajoute une tâche à la file, la capacité est augmentée si nécessaire
+ *
+ * @return 0, -1 si erreur d'allocation
+ */
+int iPollQueuePush (xPollQueue * q, uint64_t ulDeadline, void * pvTask);
+
+/**
+ * Retire la tâche dont l'échéance est la plus proche
+ *
+ * @param pulDeadline si non NULL, reçoit l'échéance de la tâche
+ * @return la tâche, NULL si la file est vide
+ */
+void * pvPollQueuePop (xPollQueue * q, uint64_t * pulDeadline);
+
+/**
+ * Tâche dont l'échéance est la plus proche, sans la retirer
+ *
+ * @param pulDeadline si non NULL, reçoit l'échéance de la tâche
+ * @return la tâche, NULL si la file est vide
+ */
+void * pvPollQueuePeek (const xPollQueue * q, uint64_t * pulDeadline);
+
+/* ========================================================================== */
+#endif /* _MBPOLL_POLL_TIMER_H_ */
@@ -0,0 +1,355 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "rbe.h"
+#include "bit-pack.h"
+
+/* constants ================================================================ */
+#define RBE_BUCKET_COUNT 1024
+
+#ifdef MBPOLL_RBE_LOCK
+#define RBE_LOCK(r)   pthread_mutex_lock (&(r)->xLock)
+#define RBE_UNLOCK(r) pthread_mutex_unlock (&(r)->xLock)
+#else
+#define RBE_LOCK(r)
+#define RBE_UNLOCK(r)
+#endif
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+static unsigned
+uHash (const xRbeKey * k) {
+  unsigned h = 2166136261u;
+
+  // FNV-1a sur les champs, pas d'octets de bourrage dans xRbeKey
+  h = (h ^ k->iSource) * 16777619u;
+  h = (h ^ k->iSlave) * 16777619u;
+  h = (h ^ k->iFunction) * 16777619u;
+  h = (h ^ k->iFormat) * 16777619u;
+  h = (h ^ k->iRef) * 16777619u;
+  h = (h ^ k->iCount) * 16777619u;
+  return h;
+}
+
+// -----------------------------------------------------------------------------
+static bool
+bKeyEqual (const xRbeKey * a, const xRbeKey * b) {
+
+  return (a->iSource == b->iSource) && (a->iSlave == b->iSlave) &&
+         (a->iFunction == b->iFunction) && (a->iFormat == b->iFormat) &&
+         (a->iRef == b->iRef) && (a->iCount == b->iCount);
+}
+
+// -----------------------------------------------------------------------------
+static xRbeEntry *
+pxNewEntry (const xRbe * r, const xRbeKey * k, int iStep, bool bAnalog,
+            bool bInteger) {
+  xRbeEntry * e = calloc (1, sizeof (xRbeEntry));
+  int i, j;
+
+  if (e == NULL) {
+    return NULL;
+  }
+  e->xKey = *k;
+  if (iStep == 0) {
+
+    // bloc de bits
+    e->pullLast = calloc (BIT_WORDS (k->iCount), sizeof (uint64_t));
+    if (e->pullLast == NULL) {
+
+      free (e);
+      return NULL;
+    }
+    return e;
+  }
+  if (bInteger) {
+    e->pullLast = calloc (k->iCount, sizeof (uint64_t));
+  }
+  else {
+    e->pdLast = calloc (k->iCount, sizeof (double));
+  }
+  e->ppxBand = calloc (k->iCount, sizeof (xRbeBand *));
+  if ( ( (e->pdLast == NULL) && (e->pullLast == NULL)) ||
+       (e->ppxBand == NULL)) {
+
+    free (e->pdLast);
+    free (e->pullLast);
+    free (e->ppxBand);
+    free (e);
+    return NULL;
+  }
+
+  // la bande de chaque valeur est cherchée une fois pour toutes
+  for (i = 0; bAnalog && (i < k->iCount); i++) {
+    int iRef = k->iRef + i * iStep;
+
+    for (j = 0; j < r->iBandCount; j++) {
+      const xRbeBand * b = &r->pxBand[j];
+
+      if ( (b->iFirst < 0) || ( (iRef >= b->iFirst) && (iRef <= b->iLast))) {
+        e->ppxBand[i] = b;
+      }
+    }
+  }
+  return e;
+}
+
+// -----------------------------------------------------------------------------
+// true si toutes les valeurs doivent être signalées (première lecture ou
+// rafraîchissement complet)
+static bool
+bRefreshAll (const xRbe * r, xRbeEntry * e, uint64_t ulNow) {
+
+  if (!e->bValid) {
+
+    e->ulRefresh = ulNow + r->ulRefreshPeriod;
+    return true;
+  }
+  if ( (r->ulRefreshPeriod > 0) && (ulNow >= e->ulRefresh)) {
+
+    // rafraîchissement complet, les échéances restent sur la même grille
+    e->ulRefresh += r->ulRefreshPeriod;
+    if (e->ulRefresh <= ulNow) {
+      e->ulRefresh = ulNow + r->ulRefreshPeriod;
+    }
+    return true;
+  }
+  return false;
+}
+
+// -----------------------------------------------------------------------------
+// Entrée d'un bloc, créée si nécessaire
+static xRbeEntry *
+pxEntry (xRbe * r, const xRbeKey * k, int iStep, bool bAnalog,
+         bool bInteger) {
+  xRbeEntry ** ppxHead = &r->ppxBucket[uHash (k) % r->iBucketCount];
+  xRbeEntry * e;
+
+  RBE_LOCK (r);
+  for (e = *ppxHead; e; e = e->pxNext) {
+
+    if (bKeyEqual (&e->xKey, k)) {
+      break;
+    }
+  }
+  if (e == NULL) {
+
+    e = pxNewEntry (r, k, iStep, bAnalog, bInteger);
+    if (e) {
+      e->pxNext = *ppxHead;
+      *ppxHead = e;
+    }
+  }
+  RBE_UNLOCK (r);
+  return e;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iRbeInit (xRbe * r, const xRbeBand * pxBand, int iBandCount,
+          unsigned long ulRefreshMs) {
+
+  r->ppxBucket = calloc (RBE_BUCKET_COUNT, sizeof (xRbeEntry *));
+  if (r->ppxBucket == NULL) {
+    return -1;
+  }
+  r->iBucketCount = RBE_BUCKET_COUNT;
+  r->pxBand = pxBand;
+  r->iBandCount = iBandCount;
+  r->ulRefreshPeriod = (uint64_t) ulRefreshMs * 1000000ULL;
+#ifdef MBPOLL_RBE_LOCK
+  pthread_mutex_init (&r->xLock, NULL);
+#endif
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+void
+vRbeFree (xRbe * r) {
+  int i;
+
+  if (r->ppxBucket == NULL) {
+    return;
+  }
+  for (i = 0; i < r->iBucketCount; i++) {
+    xRbeEntry * e = r->ppxBucket[i];
+
+    while (e) {
+      xRbeEntry * pxNext = e->pxNext;
+
+      free (e->pdLast);
+      free (e->pullLast);
+      free (e->ppxBand);
+      free (e);
+      e = pxNext;
+    }
+  }
+  free (r->ppxBucket);
+  r->ppxBucket = NULL;
+#ifdef MBPOLL_RBE_LOCK
+  pthread_mutex_destroy (&r->xLock);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+xRbeEntry *
+pxRbeEntry (xRbe * r, const xRbeKey * k, int iStep, bool bAnalog) {
+
+  return pxEntry (r, k, iStep, bAnalog, false);
+}
+
+// -----------------------------------------------------------------------------
+xRbeEntry *
+pxRbeBitEntry (xRbe * r, const xRbeKey * k) {
+
+  // iStep à 0 : un bloc de bits
+  return pxEntry (r, k, 0, false, false);
+}
+
+// -----------------------------------------------------------------------------
+xRbeEntry *
+pxRbeIntEntry (xRbe * r, const xRbeKey * k, int iStep) {
+
+  return pxEntry (r, k, iStep, true, true);
+}
+
+// -----------------------------------------------------------------------------
+int
+iRbeCompare (xRbe * r, xRbeEntry * e, const double * pdValue,
+             uint64_t ulNow, bool * pbChanged) {
+  bool bAll = bRefreshAll (r, e, ulNow);
+  int i, iCount = 0;
+
+  for (i = 0; i < e->xKey.iCount; i++) {
+    double v = pdValue[i];
+    double dLast = e->pdLast[i];
+    bool bChanged = bAll;
+
+    if ( (!bChanged) && (memcmp (&v, &dLast, sizeof (double)) != 0)) {
+      const xRbeBand * b = e->ppxBand[i];
+
+      if (b == NULL) {
+
+        bChanged = true;
+      }
+      else {
+        double dBand = b->bPercent ? fabs (dLast) * b->dValue / 100. :
+                       b->dValue;
+
+        // un NaN est toujours signalé
+        bChanged = ! (fabs (v - dLast) <= dBand);
+      }
+    }
+    if (bChanged) {
+
+      e->pdLast[i] = v;
+      iCount++;
+    }
+    pbChanged[i] = bChanged;
+  }
+  e->bValid = true;
+  return iCount;
+}
+
+// -----------------------------------------------------------------------------
+// Les entiers ne passent pas par un double, qui les arrondit au-delà de 2^53 :
+// l'écart à la dernière valeur est exact, seule la bande est un double
+int
+iRbeCompareInt (xRbe * r, xRbeEntry * e, const uint64_t * pullValue,
+                bool bSigned, uint64_t ulNow, bool * pbChanged) {
+  bool bAll = bRefreshAll (r, e, ulNow);
+  int i, iCount = 0;
+
+  for (i = 0; i < e->xKey.iCount; i++) {
+    uint64_t v = pullValue[i];
+    uint64_t ullLast = e->pullLast[i];
+    bool bChanged = bAll;
+
+    if ( (!bChanged) && (v != ullLast)) {
+      const xRbeBand * b = e->ppxBand[i];
+
+      if (b == NULL) {
+
+        bChanged = true;
+      }
+      else {
+        bool bAbove = bSigned ? ( (int64_t) v > (int64_t) ullLast) :
+                      (v > ullLast);
+        // en complément à 2, la soustraction non signée donne l'écart exact
+        uint64_t ullDiff = bAbove ? v - ullLast : ullLast - v;
+        double dLast = bSigned ? (double) (int64_t) ullLast : (double) ullLast;
+        double dBand = b->bPercent ? fabs (dLast) * b->dValue / 100. :
+                       b->dValue;
+
+        // une bande d'au moins 2^64 ne laisse rien passer
+        bChanged = ! (dBand >= 0.) ||
+                   ( (dBand < 18446744073709551616.) &&
+                     (ullDiff > (uint64_t) dBand));
+      }
+    }
+    if (bChanged) {
+
+      e->pullLast[i] = v;
+      iCount++;
+    }
+    pbChanged[i] = bChanged;
+  }
+  e->bValid = true;
+  return iCount;
+}
+
+// -----------------------------------------------------------------------------
+// 64 bits par mot : un ou exclusif donne les changements, un comptage de
+// population leur nombre
+int
+iRbeCompareBits (xRbe * r, xRbeEntry * e, const uint64_t * pullBits,
+                 uint64_t ulNow, uint64_t * pullChanged) {
+  int iWords = BIT_WORDS (e->xKey.iCount);
+  int i, iCount = 0;
+
+  if (bRefreshAll (r, e, ulNow)) {
+
+    memset (pullChanged, 0xFF, iWords * sizeof (uint64_t));
+    if (e->xKey.iCount % 64) {
+      pullChanged[iWords - 1] = (1ULL << (e->xKey.iCount % 64)) - 1;
+    }
+    memcpy (e->pullLast, pullBits, iWords * sizeof (uint64_t));
+    e->bValid = true;
+    return e->xKey.iCount;
+  }
+
+  for (i = 0; i < iWords; i++) {
+
+    pullChanged[i] = pullBits[i] ^ e->pullLast[i];
+    e->pullLast[i] = pullBits[i];
+    iCount += uBitCount64 (pullChanged[i]);
+  }
+  return iCount;
+}
+
+// -----------------------------------------------------------------------------
+void
+vRbeInvalidate (xRbeEntry * e) {
+
+  e->bValid = false;
+}
+
+/* ========================================================================== */
@@ -0,0 +1,178 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_RBE_H_
+#define _MBPOLL_RBE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#if defined (__unix__) || (defined (__APPLE__) && defined (__MACH__))
+#include <pthread.h>
+#define MBPOLL_RBE_LOCK
+#endif
+
+/* structures =============================================================== */
+/**
+ * Bande morte d'une plage de références
+ *
+ * Une valeur n'est signalée que si elle s'écarte de la dernière valeur
+ * signalée de plus de dValue (ou de dValue % de celle-ci si bPercent).
+ */
+typedef struct xRbeBand {
+  int iFirst; /**< Première référence, -1 pour toutes */
+  int iLast; /**< Dernière référence */
+  double dValue; /**< Ecart absolu ou pourcentage */
+  bool bPercent; /**< dValue est un pourcentage */
+} xRbeBand;
+
+/**
+ * Identification d'un bloc lu : source, esclave et références
+ */
+typedef struct xRbeKey {
+  int iSource;
+  int iSlave;
+  int iFunction;
+  int iFormat;
+  int iRef; /**< Première référence */
+  int iCount; /**< Nombre de valeurs */
+} xRbeKey;
+
+/**
+ * Dernières valeurs signalées d'un bloc
+ */
+typedef struct xRbeEntry {
+  struct xRbeEntry * pxNext; /**< Entrée suivante de la même alvéole */
+  xRbeKey xKey;
+  bool bValid; /**< pdLast ou pullLast est renseigné */
+  uint64_t ulRefresh; /**< Prochain rafraîchissement complet (ns) */
+  double * pdLast; /**< Dernière valeur signalée de chaque valeur */
+  uint64_t * pullLast; /**< Derniers bits signalés, rangés (bit-pack.h), ou
+                          dernière valeur entière signalée de chaque valeur */
+  const xRbeBand ** ppxBand; /**< Bande morte de chaque valeur, ou NULL */
+} xRbeEntry;
+
+/**
+ * Signalement par exception
+ *
+ * Les entrées sont créées à la première lecture d'un bloc et rangées dans
+ * une table de hachage. La table peut être utilisée par plusieurs threads à
+ * condition qu'une entrée ne soit comparée que par un seul d'entre eux (une
+ * source par thread).
+ */
+typedef struct xRbe {
+  xRbeEntry ** ppxBucket;
+  int iBucketCount;
+  const xRbeBand * pxBand; /**< Bandes mortes, la dernière trouvée l'emporte */
+  int iBandCount;
+  uint64_t ulRefreshPeriod; /**< Période de rafraîchissement (ns), 0 jamais */
+#ifdef MBPOLL_RBE_LOCK
+  pthread_mutex_t xLock; /**< Protège la création des entrées */
+#endif
+} xRbe;
+
+/* internal public functions ================================================ */
+
+/**
+ * Initialise une table vide
+ *
+ * @param pxBand bandes mortes, conservées par l'appelant
+ * @param ulRefreshMs période de signalement de toutes les valeurs, 0 jamais
+ * @return 0, -1 si erreur d'allocation
+ */
+int iRbeInit (xRbe * r, const xRbeBand * pxBand, int iBandCount,
+              unsigned long ulRefreshMs);
+
+/**
+ * Libère la table et ses entrées
+ */
+void vRbeFree (xRbe * r);
+
+/**
+ * Entrée d'un bloc, créée si nécessaire
+ *
+ * @param iStep nombre de références par valeur
+ * @param bAnalog les bandes mortes s'appliquent, sinon tout changement est
+ * signalé
+ * @return l'entrée, NULL si erreur d'allocation
+ */
+xRbeEntry * pxRbeEntry (xRbe * r, const xRbeKey * k, int iStep, bool bAnalog);
+
+/**
+ * Entrée d'un bloc de bits (bobines ou entrées), créée si nécessaire
+ *
+ * Les bits sont conservés rangés 64 par mot, sans bande morte.
+ *
+ * @return l'entrée, NULL si erreur d'allocation
+ */
+xRbeEntry * pxRbeBitEntry (xRbe * r, const xRbeKey * k);
+
+/**
+ * Entrée d'un bloc d'entiers de 64 bits, créée si nécessaire
+ *
+ * Les valeurs sont conservées et comparées exactement, les bandes mortes
+ * s'appliquent.
+ *
+ * @param iStep nombre de références par valeur
+ * @return l'entrée, NULL si erreur d'allocation
+ */
+xRbeEntry * pxRbeIntEntry (xRbe * r, const xRbeKey * k, int iStep);
+
+/**
+ * Compare les valeurs lues aux dernières valeurs signalées
+ *
+ * Les valeurs à signaler deviennent les dernières valeurs signalées.
+ *
+ * @param pdValue les xKey.iCount valeurs lues
+ * @param ulNow horloge monotone en ns
+ * @param pbChanged reçoit pour chaque valeur true si elle doit être signalée
+ * @return le nombre de valeurs à signaler
+ */
+int iRbeCompare (xRbe * r, xRbeEntry * e, const double * pdValue,
+                 uint64_t ulNow, bool * pbChanged);
+
+/**
+ * Compare les entiers lus aux derniers entiers signalés (pxRbeIntEntry())
+ *
+ * Les valeurs à signaler deviennent les dernières valeurs signalées.
+ *
+ * @param pullValue les xKey.iCount valeurs lues
+ * @param bSigned les valeurs sont en complément à 2
+ * @param ulNow horloge monotone en ns
+ * @param pbChanged reçoit pour chaque valeur true si elle doit être signalée
+ * @return le nombre de valeurs à signaler
+ */
+int iRbeCompareInt (xRbe * r, xRbeEntry * e, const uint64_t * pullValue,
+                    bool bSigned, uint64_t ulNow, bool * pbChanged);
+
+/**
+ * Compare les bits lus aux derniers bits signalés
+ *
+ * Les bits lus deviennent les derniers bits signalés.
+ *
+ * @param pullBits les xKey.iCount bits lus, rangés (bit-pack.h)
+ * @param ulNow horloge monotone en ns
+ * @param pullChanged reçoit les bits à signaler, BIT_WORDS(xKey.iCount) mots
+ * @return le nombre de bits à signaler
+ */
+int iRbeCompareBits (xRbe * r, xRbeEntry * e, const uint64_t * pullBits,
+                     uint64_t ulNow, uint64_t * pullChanged);
+
+/**
+ * Oublie les dernières valeurs, la lecture suivante sera signalée en entier
+ */
+void vRbeInvalidate (xRbeEntry * e);
+
+/* ========================================================================== */
+#endif /* _MBPOLL_RBE_H_ */
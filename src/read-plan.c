@@ -0,0 +1,213 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <modbus.h>
+#include "read-plan.h"
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+static int
+iBlockCompare (const void * a, const void * b) {
+  const xReadBlock * x = * (const xReadBlock * const *) a;
+  const xReadBlock * y = * (const xReadBlock * const *) b;
+
+  if (x->iAddr != y->iAddr) {
+
+    return x->iAddr < y->iAddr ? -1 : 1;
+  }
+  // à adresse égale, le plus grand bloc d'abord
+  return y->iNb - x->iNb;
+}
+
+// -----------------------------------------------------------------------------
+static xReadChunk *
+pxChunkOpen (xReadPlan * p, int iAddr) {
+  xReadChunk * c = &p->pxChunk[p->iChunkCount++];
+
+  c->iAddr = iAddr;
+  c->iNb = 0;
+  c->iFirstSegment = p->iSegmentCount;
+  c->iSegmentCount = 0;
+  return c;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vChunkAdd (xReadPlan * p, xReadChunk * c, int iBlock, int iBlockOffset,
+           int iNb) {
+  xReadSegment * s = &p->pxSegment[p->iSegmentCount++];
+  int iEnd;
+
+  s->iBlock = iBlock;
+  s->iBlockOffset = iBlockOffset;
+  s->iChunkOffset = p->pxBlock[iBlock].iAddr + iBlockOffset - c->iAddr;
+  s->iNb = iNb;
+  iEnd = s->iChunkOffset + iNb;
+  if (iEnd > c->iNb) {
+    c->iNb = iEnd;
+  }
+  c->iSegmentCount++;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iReadPlanInit (xReadPlan * p, const int * piAddr, const int * piNb,
+               int iBlockCount, bool bIsBit, int iStep, int iGap) {
+  xReadBlock ** pxSorted;
+  xReadChunk * c = NULL;
+  int i, iMaxChunks;
+
+  memset (p, 0, sizeof (xReadPlan));
+  p->bIsBit = bIsBit;
+  p->iStep = (bIsBit || (iStep < 1)) ? 1 : iStep;
+  p->iMax = bIsBit ? MODBUS_MAX_READ_BITS :
+            (MODBUS_MAX_READ_REGISTERS / p->iStep) * p->iStep;
+  p->ulSize = bIsBit ? sizeof (uint8_t) : sizeof (uint16_t);
+
+  // au pire, chaque bloc est découpé sans être regroupé
+  iMaxChunks = 0;
+  for (i = 0; i < iBlockCount; i++) {
+    iMaxChunks += (piNb[i] + p->iMax - 1) / p->iMax;
+  }
+  p->pxBlock = calloc (iBlockCount, sizeof (xReadBlock));
+  p->pxChunk = calloc (iMaxChunks, sizeof (xReadChunk));
+  p->pxSegment = calloc (iMaxChunks, sizeof (xReadSegment));
+  pxSorted = calloc (iBlockCount, sizeof (xReadBlock *));
+  if ( (p->pxBlock == NULL) || (p->pxChunk == NULL) ||
+       (p->pxSegment == NULL) || (pxSorted == NULL)) {
+
+    free (pxSorted);
+    vReadPlanFree (p);
+    return -1;
+  }
+
+  p->iBlockCount = iBlockCount;
+  for (i = 0; i < iBlockCount; i++) {
+    xReadBlock * b = &p->pxBlock[i];
+
+    b->iAddr = piAddr[i];
+    b->iNb = piNb[i];
+    b->pvData = calloc (b->iNb, p->ulSize);
+    if (b->pvData == NULL) {
+
+      free (pxSorted);
+      vReadPlanFree (p);
+      return -1;
+    }
+    pxSorted[i] = b;
+  }
+  qsort (pxSorted, iBlockCount, sizeof (xReadBlock *), iBlockCompare);
+
+  for (i = 0; i < iBlockCount; i++) {
+    xReadBlock * b = pxSorted[i];
+    int iBlock = b - p->pxBlock;
+    int iEnd = b->iAddr + b->iNb;
+    int iOffset;
+
+    if ( (c) && (iGap >= 0) && (b->iAddr <= c->iAddr + c->iNb + iGap) &&
+         (iEnd - c->iAddr <= p->iMax)) {
+
+      // le bloc tient dans la lecture en cours
+      vChunkAdd (p, c, iBlock, 0, b->iNb);
+      continue;
+    }
+
+    // nouvelle lecture, le bloc est découpé s'il dépasse une PDU
+    for (iOffset = 0; b->iNb - iOffset > p->iMax; iOffset += p->iMax) {
+
+      c = pxChunkOpen (p, b->iAddr + iOffset);
+      vChunkAdd (p, c, iBlock, iOffset, p->iMax);
+    }
+    c = pxChunkOpen (p, b->iAddr + iOffset);
+    vChunkAdd (p, c, iBlock, iOffset, b->iNb - iOffset);
+  }
+  free (pxSorted);
+
+  for (i = 0; i < p->iChunkCount; i++) {
+    xReadChunk * c = &p->pxChunk[i];
+
+    c->pvData = calloc (c->iNb, p->ulSize);
+    if (c->pvData == NULL) {
+
+      vReadPlanFree (p);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+void
+vReadPlanScatter (xReadPlan * p) {
+  int i, j;
+
+  for (i = 0; i < p->iBlockCount; i++) {
+
+    p->pxBlock[i].iRet = p->pxBlock[i].iNb;
+    p->pxBlock[i].iError = 0;
+  }
+
+  for (i = 0; i < p->iChunkCount; i++) {
+    const xReadChunk * c = &p->pxChunk[i];
+
+    for (j = 0; j < c->iSegmentCount; j++) {
+      const xReadSegment * s = &p->pxSegment[c->iFirstSegment + j];
+      xReadBlock * b = &p->pxBlock[s->iBlock];
+
+      if (c->iRet == c->iNb) {
+
+        memcpy ( (uint8_t *) b->pvData + s->iBlockOffset * p->ulSize,
+                 (const uint8_t *) c->pvData + s->iChunkOffset * p->ulSize,
+                 s->iNb * p->ulSize);
+      }
+      else {
+
+        b->iRet = -1;
+        b->iError = c->iError;
+      }
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vReadPlanFree (xReadPlan * p) {
+  int i;
+
+  if (p->pxBlock) {
+
+    for (i = 0; i < p->iBlockCount; i++) {
+      free (p->pxBlock[i].pvData);
+    }
+  }
+  if (p->pxChunk) {
+
+    for (i = 0; i < p->iChunkCount; i++) {
+      free (p->pxChunk[i].pvData);
+    }
+  }
+  free (p->pxBlock);
+  free (p->pxChunk);
+  free (p->pxSegment);
+  memset (p, 0, sizeof (xReadPlan));
+}
+
+/* ========================================================================== */
@@ -0,0 +1,115 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_READ_PLAN_H_
+#define _MBPOLL_READ_PLAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* structures =============================================================== */
+/**
+ * Bloc demandé par l'utilisateur
+ *
+ * Les éléments sont des bits (un octet par bit) ou des registres (uint16_t
+ * dans l'ordre de l'hôte), comme pour libmodbus.
+ */
+typedef struct xReadBlock {
+  int iAddr; /**< Adresse PDU du premier élément */
+  int iNb; /**< Nombre d'éléments */
+  void * pvData; /**< Eléments lus, alloués par iReadPlanInit() */
+  int iRet; /**< iNb si toutes les lectures ont réussi, -1 sinon */
+  int iError; /**< Code d'erreur si iRet < 0 */
+} xReadBlock;
+
+/**
+ * Partie d'un bloc couverte par une lecture
+ */
+typedef struct xReadSegment {
+  int iBlock; /**< Indice du bloc */
+  int iBlockOffset; /**< Premier élément dans le bloc */
+  int iChunkOffset; /**< Premier élément dans la lecture */
+  int iNb; /**< Nombre d'éléments */
+} xReadSegment;
+
+/**
+ * Lecture Modbus (une PDU) regroupant un ou plusieurs segments
+ */
+typedef struct xReadChunk {
+  int iAddr; /**< Adresse PDU du premier élément */
+  int iNb; /**< Nombre d'éléments, au plus une PDU */
+  void * pvData; /**< Destination de la lecture */
+  int iRet; /**< Résultat de la lecture, renseigné par l'appelant */
+  int iError; /**< Code d'erreur si iRet < 0, renseigné par l'appelant */
+  uint64_t ulLatency; /**< Délai de réponse en ns, 0 si aucune réponse,
+                           renseigné par l'appelant */
+  int iFirstSegment; /**< Premier segment couvert */
+  int iSegmentCount; /**< Nombre de segments couverts */
+} xReadChunk;
+
+/**
+ * Plan de lecture
+ *
+ * Les blocs sont triés par adresse, les blocs adjacents ou séparés par au plus
+ * iGap éléments sont lus par une seule requête tant que la taille d'une PDU
+ * n'est pas dépassée (MODBUS_MAX_READ_REGISTERS ou MODBUS_MAX_READ_BITS).
+ * Un bloc trop grand est découpé sans couper une valeur de iStep registres.
+ */
+typedef struct xReadPlan {
+  bool bIsBit; /**< Bits (coils, entrées) ou registres */
+  int iStep; /**< Nombre de registres par valeur (1, 2 ou 4) */
+  int iMax; /**< Nombre maximal d'éléments par lecture */
+  size_t ulSize; /**< Taille en octets d'un élément */
+  xReadBlock * pxBlock;
+  int iBlockCount;
+  xReadChunk * pxChunk;
+  int iChunkCount;
+  xReadSegment * pxSegment;
+  int iSegmentCount;
+} xReadPlan;
+
+/* internal public functions ================================================ */
+
+/**
+ * Construit un plan de lecture et alloue les zones de données
+ *
+ * @param piAddr adresses PDU des blocs, dans l'ordre demandé
+ * @param piNb nombre d'éléments de chaque bloc
+ * @param iBlockCount nombre de blocs
+ * @param bIsBit true pour des bits, false pour des registres
+ * @param iStep nombre de registres par valeur, une valeur n'est jamais
+ * répartie sur deux lectures
+ * @param iGap nombre maximal d'éléments non demandés lus pour regrouper deux
+ * blocs, -1 pour ne jamais regrouper
+ * @return 0, -1 si erreur d'allocation
+ */
+int iReadPlanInit (xReadPlan * p, const int * piAddr, const int * piNb,
+                   int iBlockCount, bool bIsBit, int iStep, int iGap);
+
+/**
+ * Recopie les éléments lus dans les blocs et renseigne leur état
+ *
+ * A appeler lorsque iRet et iError de toutes les lectures sont renseignés.
+ */
+void vReadPlanScatter (xReadPlan * p);
+
+/**
+ * Libère les zones allouées par iReadPlanInit()
+ */
+void vReadPlanFree (xReadPlan * p);
+
+/* ========================================================================== */
+#endif /* _MBPOLL_READ_PLAN_H_ */
@@ -0,0 +1,144 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <string.h>
+#include "reg-decode.h"
+
+/* conditionals ============================================================= */
+#if defined (__SSSE3__)
+#include <tmmintrin.h>
+#define REG_DECODE_SSSE3 1
+#elif defined (__SSE2__)
+// sans pshufb, la permutation est faite par mots puis par octets
+#include <emmintrin.h>
+#define REG_DECODE_SSE2 1
+#elif defined (__ARM_NEON) && defined (__aarch64__)
+#include <arm_neon.h>
+#define REG_DECODE_NEON 1
+#endif
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+void
+vRegOrderInit (xRegOrder * o, eRegOrder eOrder, int iRegs) {
+  const uint16_t usOne = 1;
+  bool bLittleEndian = * (const uint8_t *) &usOne == 1;
+  int iSize = iRegs * 2;
+  int i;
+
+  o->ucSize = iSize;
+  o->bWordSwap = (eOrder == eRegOrderABCD) || (eOrder == eRegOrderBADC);
+  o->bByteSwap = (eOrder == eRegOrderBADC) || (eOrder == eRegOrderDCBA);
+  o->bIdentity = true;
+
+  for (i = 0; i < REG_ORDER_VECTOR; i++) {
+    int iBase = i - i % iSize;
+    // poids de l'octet i dans sa valeur, 0 pour celui de poids faible
+    int iWeight = bLittleEndian ? i % iSize : iSize - 1 - i % iSize;
+    int iWord = iWeight / 2;
+    int iByte = iWeight % 2;
+    int iReg = o->bWordSwap ? iRegs - 1 - iWord : iWord;
+
+    if (o->bByteSwap) {
+      iByte = 1 - iByte;
+    }
+    // octet de poids iByte du registre iReg, dans l'ordre de l'hôte
+    o->ucMask[i] = iBase + 2 * iReg + (bLittleEndian ? iByte : 1 - iByte);
+    if (o->ucMask[i] != i) {
+      o->bIdentity = false;
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vRegDecode (void * pvDst, const uint16_t * pusReg, int iCount,
+            const xRegOrder * o) {
+  const uint8_t * pucReg = (const uint8_t *) pusReg;
+  uint8_t * pucDst = (uint8_t *) pvDst;
+  size_t ulLen = (size_t) iCount * o->ucSize;
+  size_t i = 0, j;
+
+  if (o->bIdentity) {
+
+    // l'ordre des registres est celui de la mémoire de l'hôte
+    memcpy (pucDst, pucReg, ulLen);
+    return;
+  }
+
+#if defined (REG_DECODE_SSSE3)
+  __m128i m = _mm_loadu_si128 ( (const __m128i *) o->ucMask);
+
+  for (; i + REG_ORDER_VECTOR <= ulLen; i += REG_ORDER_VECTOR) {
+    __m128i x = _mm_loadu_si128 ( (const __m128i *) &pucReg[i]);
+
+    _mm_storeu_si128 ( (__m128i *) &pucDst[i], _mm_shuffle_epi8 (x, m));
+  }
+#elif defined (REG_DECODE_SSE2)
+  for (; i + REG_ORDER_VECTOR <= ulLen; i += REG_ORDER_VECTOR) {
+    __m128i x = _mm_loadu_si128 ( (const __m128i *) &pucReg[i]);
+
+    if (o->bWordSwap) {
+      if (o->ucSize == 4) {
+
+        x = _mm_shufflelo_epi16 (x, _MM_SHUFFLE (2, 3, 0, 1));
+        x = _mm_shufflehi_epi16 (x, _MM_SHUFFLE (2, 3, 0, 1));
+      }
+      else {
+
+        x = _mm_shufflelo_epi16 (x, _MM_SHUFFLE (0, 1, 2, 3));
+        x = _mm_shufflehi_epi16 (x, _MM_SHUFFLE (0, 1, 2, 3));
+      }
+    }
+    if (o->bByteSwap) {
+
+      x = _mm_or_si128 (_mm_slli_epi16 (x, 8), _mm_srli_epi16 (x, 8));
+    }
+    _mm_storeu_si128 ( (__m128i *) &pucDst[i], x);
+  }
+#elif defined (REG_DECODE_NEON)
+  uint8x16_t m = vld1q_u8 (o->ucMask);
+
+  for (; i + REG_ORDER_VECTOR <= ulLen; i += REG_ORDER_VECTOR) {
+
+    vst1q_u8 (&pucDst[i], vqtbl1q_u8 (vld1q_u8 (&pucReg[i]), m));
+  }
+#endif
+  for (; i < ulLen; i += o->ucSize) {
+    for (j = 0; j < o->ucSize; j++) {
+      pucDst[i + j] = pucReg[i + o->ucMask[j]];
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Les valeurs à écrire sont peu nombreuses, l'encodage reste scalaire
+void
+vRegEncode (uint16_t * pusReg, const void * pvSrc, int iCount,
+            const xRegOrder * o) {
+  const uint8_t * pucSrc = (const uint8_t *) pvSrc;
+  uint8_t * pucReg = (uint8_t *) pusReg;
+  size_t ulLen = (size_t) iCount * o->ucSize;
+  size_t i, j;
+
+  for (i = 0; i < ulLen; i += o->ucSize) {
+    for (j = 0; j < o->ucSize; j++) {
+      pucReg[i + o->ucMask[j]] = pucSrc[i + j];
+    }
+  }
+}
+
+/* ========================================================================== */
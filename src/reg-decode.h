@@ -0,0 +1,83 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_REG_DECODE_H_
+#define _MBPOLL_REG_DECODE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* constants ================================================================ */
+/**
+ * Ordre des octets d'une valeur de 32 bits sur la ligne, A étant l'octet de
+ * poids fort. Une valeur de 64 bits suit la même règle, mot par mot.
+ */
+typedef enum {
+  eRegOrderCDAB = 0, /**< mot de poids faible en tête (défaut) */
+  eRegOrderABCD,     /**< mot de poids fort en tête (-B) */
+  eRegOrderBADC,     /**< mot de poids fort en tête, octets inversés */
+  eRegOrderDCBA,     /**< mot de poids faible en tête, octets inversés */
+} eRegOrder;
+
+#define REG_ORDER_VECTOR 16
+
+/* structures =============================================================== */
+/**
+ * Permutation précalculée pour un ordre et une taille de valeur
+ *
+ * ucMask[i] est la position dans les registres (tels que les range
+ * libmodbus, dans l'ordre de l'hôte) de l'octet i de la valeur, dans l'ordre
+ * de l'hôte. Le masque couvre REG_ORDER_VECTOR octets, soit 4 valeurs de 32
+ * bits ou 2 de 64 bits, et sert tel quel aux permutations vectorielles.
+ */
+typedef struct xRegOrder {
+  uint8_t ucMask[REG_ORDER_VECTOR];
+  uint8_t ucSize; /**< Octets par valeur, 4 ou 8 */
+  bool bIdentity; /**< Les registres sont déjà dans l'ordre de l'hôte */
+  bool bWordSwap; /**< Ordre des mots inversé, pour SSE2 */
+  bool bByteSwap; /**< Octets inversés dans chaque mot, pour SSE2 */
+} xRegOrder;
+
+/* internal public functions ================================================ */
+
+/**
+ * Calcule la permutation d'un ordre
+ *
+ * @param iRegs registres par valeur, 2 ou 4
+ */
+void vRegOrderInit (xRegOrder * o, eRegOrder eOrder, int iRegs);
+
+/**
+ * Décode un bloc de valeurs de 32 ou 64 bits (int, float, int64, uint64 ou
+ * double)
+ *
+ * La permutation est appliquée à tout le bloc, par SSSE3, SSE2 ou NEON
+ * lorsqu'ils sont disponibles.
+ *
+ * @param pvDst iCount valeurs dans l'ordre de l'hôte, la zone n'a pas à
+ * être alignée
+ * @param pusReg iCount * o->ucSize / 2 registres
+ */
+void vRegDecode (void * pvDst, const uint16_t * pusReg, int iCount,
+                 const xRegOrder * o);
+
+/**
+ * Encode des valeurs dans des registres, opération inverse de vRegDecode()
+ */
+void vRegEncode (uint16_t * pusReg, const void * pvSrc, int iCount,
+                 const xRegOrder * o);
+
+/* ========================================================================== */
+#endif /* _MBPOLL_REG_DECODE_H_ */
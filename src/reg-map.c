@@ -0,0 +1,322 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "reg-map.h"
+
+/* conditionals ============================================================= */
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#define strtok_r strtok_s
+#else
+#include <strings.h>
+#endif
+
+/* private functions ======================================================== */
+
+// -----------------------------------------------------------------------------
+static void
+vDecodeUInt16 (xRegValue * v, const uint8_t * pucValue,
+               const uint16_t * pusReg) {
+  uint16_t usValue;
+
+  memcpy (&usValue, pucValue, sizeof (usValue));
+  v->ullValue = usValue;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vDecodeInt16 (xRegValue * v, const uint8_t * pucValue,
+              const uint16_t * pusReg) {
+  int16_t sValue;
+
+  memcpy (&sValue, pucValue, sizeof (sValue));
+  v->llValue = sValue;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vDecodeUInt32 (xRegValue * v, const uint8_t * pucValue,
+               const uint16_t * pusReg) {
+  uint32_t ulValue;
+
+  memcpy (&ulValue, pucValue, sizeof (ulValue));
+  v->ullValue = ulValue;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vDecodeInt32 (xRegValue * v, const uint8_t * pucValue,
+              const uint16_t * pusReg) {
+  int32_t lValue;
+
+  memcpy (&lValue, pucValue, sizeof (lValue));
+  v->llValue = lValue;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vDecodeFloat (xRegValue * v, const uint8_t * pucValue,
+              const uint16_t * pusReg) {
+  float fValue;
+
+  memcpy (&fValue, pucValue, sizeof (fValue));
+  v->dValue = fValue;
+}
+
+// -----------------------------------------------------------------------------
+// uint64, int64 et double : les 8 octets sont recopiés tels quels
+static void
+vDecode64 (xRegValue * v, const uint8_t * pucValue, const uint16_t * pusReg) {
+
+  memcpy (&v->ullValue, pucValue, sizeof (v->ullValue));
+}
+
+// -----------------------------------------------------------------------------
+// Une chaîne est affichée directement depuis les registres
+static void
+vDecodeString (xRegValue * v, const uint8_t * pucValue,
+               const uint16_t * pusReg) {
+
+  v->pusText = pusReg;
+}
+
+/* private variables ======================================================== */
+static const xRegType xTypeList[] = {
+  { "uint16", eRegTypeUInt16, 1, vDecodeUInt16 },
+  { "int16", eRegTypeInt16, 1, vDecodeInt16 },
+  { "hex", eRegTypeHex, 1, vDecodeUInt16 },
+  { "uint32", eRegTypeUInt32, 2, vDecodeUInt32 },
+  { "int32", eRegTypeInt32, 2, vDecodeInt32 },
+  { "float", eRegTypeFloat, 2, vDecodeFloat },
+  { "uint64", eRegTypeUInt64, 4, vDecode64 },
+  { "int64", eRegTypeInt64, 4, vDecode64 },
+  { "double", eRegTypeDouble, 4, vDecode64 },
+  { "string", eRegTypeString, 0, vDecodeString },
+};
+
+static const char * sOrderList[] = { "ABCD", "CDAB", "BADC", "DCBA" };
+static const eRegOrder eOrderList[] = {
+  eRegOrderABCD, eRegOrderCDAB, eRegOrderBADC, eRegOrderDCBA
+};
+
+// -----------------------------------------------------------------------------
+// Analyse d'une ligne, false si elle est incorrecte
+static bool
+bParseField (xRegField * f, char * sLine, eRegOrder eDefault) {
+  char * sOffset, * sType, * sName, * sOrder, * sLen, * p;
+  long lOffset, lLen;
+  unsigned i;
+
+  sOffset = strtok_r (sLine, " \t\r\n", &p);
+  sType = strtok_r (NULL, " \t\r\n", &p);
+  sName = strtok_r (NULL, " \t\r\n", &p);
+  sOrder = strtok_r (NULL, " \t\r\n", &p);
+  if ( (sName == NULL) || (strtok_r (NULL, " \t\r\n", &p) != NULL)) {
+
+    return false;
+  }
+
+  lOffset = strtol (sOffset, &p, 0);
+  if ( (p == sOffset) || (*p != 0) || (lOffset < 0) || (lOffset > UINT16_MAX)) {
+
+    return false;
+  }
+
+  sLen = strchr (sType, ':');
+  if (sLen) {
+    *sLen++ = 0;
+  }
+  f->pxType = NULL;
+  for (i = 0; i < sizeof (xTypeList) / sizeof (xTypeList[0]); i++) {
+
+    if (strcasecmp (sType, xTypeList[i].sName) == 0) {
+      f->pxType = &xTypeList[i];
+      break;
+    }
+  }
+  if (f->pxType == NULL) {
+
+    return false;
+  }
+
+  lLen = f->pxType->ucRegs;
+  if (f->pxType->eType == eRegTypeString) {
+
+    lLen = 1;
+    if (sLen) {
+
+      lLen = strtol (sLen, &p, 0);
+      if ( (p == sLen) || (*p != 0) || (lLen < 1)) {
+        return false;
+      }
+    }
+  }
+  else if (sLen) {
+
+    // seule une chaîne a une longueur
+    return false;
+  }
+  if (lOffset + lLen > UINT16_MAX + 1) {
+
+    return false;
+  }
+
+  f->eOrder = eDefault;
+  if (sOrder) {
+
+    for (i = 0; i < sizeof (sOrderList) / sizeof (sOrderList[0]); i++) {
+
+      if (strcasecmp (sOrder, sOrderList[i]) == 0) {
+        break;
+      }
+    }
+    if (i == sizeof (sOrderList) / sizeof (sOrderList[0])) {
+
+      return false;
+    }
+    f->eOrder = eOrderList[i];
+  }
+
+  f->usOffset = lOffset;
+  f->usRegs = lLen;
+  f->ucSize = f->pxType->ucRegs * 2;
+  if (f->ucSize) {
+    xRegOrder xOrder;
+
+    // la permutation de l'ordre choisi, pour une seule valeur
+    vRegOrderInit (&xOrder, f->eOrder, f->pxType->ucRegs);
+    memcpy (f->ucMask, xOrder.ucMask, f->ucSize);
+  }
+  f->sName = strdup (sName);
+  return f->sName != NULL;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+int
+iRegMapLoad (xRegMap * m, const char * sPath, eRegOrder eOrder,
+             int * piLine) {
+  char sLine[REG_MAP_LINE_MAX];
+  int iSize = 0, iLine = 0;
+  FILE * f;
+
+  memset (m, 0, sizeof (*m));
+  *piLine = 0;
+  f = fopen (sPath, "r");
+  if (f == NULL) {
+
+    return -1;
+  }
+
+  while (fgets (sLine, sizeof (sLine), f)) {
+    char * p = strchr (sLine, '#');
+    xRegField * pxField;
+
+    iLine++;
+    if (p) {
+      *p = 0;
+    }
+    if (strspn (sLine, " \t\r\n") == strlen (sLine)) {
+      // ligne vide ou commentaire
+      continue;
+    }
+
+    if (m->iFieldCount == iSize) {
+
+      iSize = iSize ? iSize * 2 : 16;
+      pxField = realloc (m->pxField, iSize * sizeof (xRegField));
+      if (pxField == NULL) {
+
+        goto error;
+      }
+      m->pxField = pxField;
+    }
+    pxField = &m->pxField[m->iFieldCount];
+    memset (pxField, 0, sizeof (*pxField));
+    if (!bParseField (pxField, sLine, eOrder)) {
+
+      *piLine = iLine;
+      errno = EINVAL;
+      goto error;
+    }
+    m->iFieldCount++;
+    if (pxField->usOffset + pxField->usRegs > m->iRegCount) {
+
+      m->iRegCount = pxField->usOffset + pxField->usRegs;
+    }
+  }
+
+  if (ferror (f)) {
+
+    goto error;
+  }
+  fclose (f);
+  if (m->iFieldCount == 0) {
+
+    vRegMapDelete (m);
+    errno = EINVAL;
+    return -1;
+  }
+  return 0;
+
+error: {
+    int iError = errno;
+
+    fclose (f);
+    vRegMapDelete (m);
+    errno = iError;
+  }
+  return -1;
+}
+
+// -----------------------------------------------------------------------------
+// Chaque champ rassemble ses octets avec son masque puis appelle le décodeur
+// de son type : la boucle ne dépend pas des types des champs
+void
+vRegMapDecode (const xRegMap * m, const uint16_t * pusReg,
+               xRegValue * pxValue) {
+  const uint8_t * pucReg = (const uint8_t *) pusReg;
+  int i, j;
+
+  for (i = 0; i < m->iFieldCount; i++) {
+    const xRegField * f = &m->pxField[i];
+    const uint8_t * pucField = &pucReg[2 * f->usOffset];
+    uint8_t ucValue[8];
+
+    for (j = 0; j < f->ucSize; j++) {
+      ucValue[j] = pucField[f->ucMask[j]];
+    }
+    f->pxType->vDecode (&pxValue[i], ucValue, &pusReg[f->usOffset]);
+  }
+}
+
+// -----------------------------------------------------------------------------
+void
+vRegMapDelete (xRegMap * m) {
+  int i;
+
+  for (i = 0; i < m->iFieldCount; i++) {
+    free (m->pxField[i].sName);
+  }
+  free (m->pxField);
+  memset (m, 0, sizeof (*m));
+}
+
+/* ========================================================================== */
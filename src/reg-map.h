@@ -0,0 +1,128 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_REG_MAP_H_
+#define _MBPOLL_REG_MAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "reg-decode.h"
+
+/* constants ================================================================ */
+/*
+ * Fichier de description d'un bloc de registres (--map), un champ par ligne :
+ *   offset  type[:longueur]  nom  [ordre]
+ * offset est le numéro du premier registre du champ depuis le début du
+ * bloc, type est uint16, int16, hex, uint32, int32, float, uint64, int64,
+ * double ou string, la longueur d'une chaîne est donnée en registres (1 par
+ * défaut). L'ordre est ABCD, CDAB, BADC ou DCBA, celui de --order par
+ * défaut. Un # commence un commentaire.
+ */
+#define REG_MAP_LINE_MAX 256
+
+/**
+ * Type d'un champ
+ */
+typedef enum {
+  eRegTypeUInt16 = 0,
+  eRegTypeInt16,
+  eRegTypeHex,
+  eRegTypeUInt32,
+  eRegTypeInt32,
+  eRegTypeFloat,
+  eRegTypeUInt64,
+  eRegTypeInt64,
+  eRegTypeDouble,
+  eRegTypeString,
+} eRegType;
+
+/* structures =============================================================== */
+/**
+ * Valeur décodée d'un champ
+ */
+typedef union xRegValue {
+  uint64_t ullValue; /**< uint16, hex, uint32 et uint64 */
+  int64_t llValue; /**< int16, int32 et int64 */
+  double dValue; /**< float et double */
+  const uint16_t * pusText; /**< string : premier registre de la chaîne */
+} xRegValue;
+
+/**
+ * Description d'un type, le décodeur d'un champ est celui de son type
+ */
+typedef struct xRegType {
+  const char * sName;
+  eRegType eType;
+  uint8_t ucRegs; /**< Registres occupés, 0 pour une chaîne */
+  /** Décode les octets rassemblés d'un champ, dans l'ordre de l'hôte */
+  void (*vDecode) (xRegValue * v, const uint8_t * pucValue,
+                   const uint16_t * pusReg);
+} xRegType;
+
+/**
+ * Champ d'un bloc
+ *
+ * ucMask[i] est la position, depuis le premier octet du champ dans les
+ * registres, de l'octet i de sa valeur dans l'ordre de l'hôte : l'ordre des
+ * octets est résolu au chargement.
+ */
+typedef struct xRegField {
+  char * sName;
+  const xRegType * pxType;
+  eRegOrder eOrder;
+  uint16_t usOffset; /**< Premier registre depuis le début du bloc */
+  uint16_t usRegs; /**< Registres occupés */
+  uint8_t ucSize; /**< Octets à rassembler, 0 pour une chaîne */
+  uint8_t ucMask[8];
+} xRegField;
+
+/**
+ * Description d'un bloc
+ */
+typedef struct xRegMap {
+  xRegField * pxField;
+  int iFieldCount;
+  int iRegCount; /**< Registres à lire, jusqu'à la fin du dernier champ */
+} xRegMap;
+
+/* internal public functions ================================================ */
+
+/**
+ * Charge un fichier de description
+ *
+ * @param eOrder ordre des champs qui n'en précisent pas
+ * @param piLine numéro de la ligne en erreur, 0 si l'erreur n'est pas liée à
+ * une ligne
+ * @return 0, -1 si erreur (errno, EINVAL pour une ligne incorrecte)
+ */
+int iRegMapLoad (xRegMap * m, const char * sPath, eRegOrder eOrder,
+                 int * piLine);
+
+/**
+ * Décode les champs d'un bloc lu
+ *
+ * @param pusReg au moins m->iRegCount registres, dans l'ordre de l'hôte
+ * @param pxValue m->iFieldCount valeurs
+ */
+void vRegMapDecode (const xRegMap * m, const uint16_t * pusReg,
+                    xRegValue * pxValue);
+
+/**
+ * Libère une description
+ */
+void vRegMapDelete (xRegMap * m);
+
+/* ========================================================================== */
+#endif /* _MBPOLL_REG_MAP_H_ */
@@ -0,0 +1,1046 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "tcp-engine.h"
+
+#ifdef MBPOLL_TCP_ENGINE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "mbtcp.h"
+
+/* constants ================================================================ */
+#define EPOLL_EVENTS_MAX  64
+
+/* structures =============================================================== */
+typedef enum {
+  eHostIdle,        // attente du prochain cycle
+  eHostConnecting,  // connexion en cours
+  eHostBusy,        // cycle en cours, requêtes en vol
+  eHostDone         // scrutation unique terminée
+} eHostState;
+
+typedef struct xTcpWorker xTcpWorker;
+typedef struct xTcpJob xTcpJob;
+
+typedef struct xTcpFlight {
+  uint16_t usTid;
+  int iTrans; // transaction : iSlave * iStartCount + iStart
+  uint64_t ulDeadline;
+} xTcpFlight;
+
+typedef struct xTcpHost {
+  xTcpWorker * w; // seul ce worker accède à la connexion
+  struct addrinfo * xAddr;
+  int iFd;
+  eHostState eState;
+  int iNext; // prochaine transaction du cycle à émettre
+  int iPending; // nombre de requêtes en vol
+  xTcpFlight xFlight[MBTCP_WINDOW_MAX];
+  uint16_t usTid;
+  uint8_t ucRx[MBTCP_MAX_ADU_LENGTH];
+  int iRxLen;
+  uint8_t ucTx[MBTCP_WINDOW_MAX * MBTCP_REQUEST_LENGTH];
+  int iTxLen;
+  uint64_t ulWake; // prochaine échéance (début de cycle ou timeout)
+  xPollTimer xTimer;
+  xTcpHostStats xStats;
+  // travaux de l'hôte, dans l'ordre des transactions, protégés par le verrou
+  // de la file de son worker
+  xTcpJob * pxJobHead;
+  xTcpJob * pxJobTail;
+  bool bQueued; // présent dans la file ou en cours d'exécution
+} xTcpHost;
+
+// Résultat d'une transaction, réponse à décoder ou erreur, à transmettre à
+// l'application
+struct xTcpJob {
+  xTcpJob * pxNext;
+  int iTrans;
+  int iLen; // longueur de la trame, 0 si erreur
+  int iError; // code d'erreur si iLen == 0
+  uint64_t ulLatency; // délai de réponse en ns
+  uint8_t ucFrame[MBTCP_MAX_ADU_LENGTH];
+  uint8_t ucData[]; // éléments décodés
+};
+
+// File des hôtes ayant des travaux en attente. Un hôte n'y figure qu'une fois
+// et n'est exécuté que par un seul worker à la fois, ses résultats sont ainsi
+// transmis dans l'ordre. Le propriétaire et les voleurs la vident par la tête.
+typedef struct xTcpRunQueue {
+  pthread_mutex_t xLock;
+  xTcpHost ** pxHost;
+  int iHead;
+  int iCount;
+  int iCapacity;
+} xTcpRunQueue;
+
+struct xTcpWorker {
+  xTcpEngine * e;
+  int iIndex;
+  int iEpfd;
+  int iWakeFd; // eventfd, réveil d'un worker inactif
+  int iIdle;
+  int iActive; // hôtes du worker dont la scrutation n'est pas terminée
+  xPollQueue xQueue;
+  xTcpRunQueue xRun;
+  pthread_t xThread;
+  unsigned long ulStealCount;
+};
+
+struct xTcpEngine {
+  xTcpEngineConfig xCfg;
+  xTcpHost * pxHost;
+  int iHostCount;
+  xTcpWorker * pxWorker;
+  int iWorkerCount;
+  int iTransCount; // transactions par cycle et par hôte
+  size_t ulDataSize; // taille des éléments décodés d'une transaction
+  uint64_t ulTimeout; // ns
+  int * piTable; // copie des esclaves et des blocs de xCfg
+};
+
+/* private functions ======================================================== */
+static void vHostPump (xTcpWorker * w, xTcpHost * h);
+
+// -----------------------------------------------------------------------------
+// Un hôte n'est présent qu'une fois, iCapacity hôtes au plus
+static int
+iRunQueueInit (xTcpRunQueue * q, int iCapacity) {
+
+  q->pxHost = calloc (iCapacity, sizeof (xTcpHost *));
+  q->iHead = q->iCount = 0;
+  q->iCapacity = iCapacity;
+  if (q->pxHost == NULL) {
+
+    return -1;
+  }
+  return pthread_mutex_init (&q->xLock, NULL);
+}
+
+// -----------------------------------------------------------------------------
+static void
+vRunQueueFree (xTcpRunQueue * q) {
+
+  if (q->pxHost) {
+
+    free (q->pxHost);
+    q->pxHost = NULL;
+    pthread_mutex_destroy (&q->xLock);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Retrait de l'hôte le plus ancien, par le propriétaire ou par un voleur
+static xTcpHost *
+pxRunQueuePop (xTcpRunQueue * q) {
+  xTcpHost * h = NULL;
+
+  pthread_mutex_lock (&q->xLock);
+  if (q->iCount > 0) {
+
+    h = q->pxHost[q->iHead];
+    q->iHead = (q->iHead + 1) % q->iCapacity;
+    q->iCount--;
+  }
+  pthread_mutex_unlock (&q->xLock);
+  return h;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vHostSetWake (xTcpWorker * w, xTcpHost * h, uint64_t ulWake) {
+
+  // les entrées périmées de la file sont ignorées à leur sortie
+  h->ulWake = ulWake;
+  iPollQueuePush (&w->xQueue, ulWake, h);
+}
+
+// -----------------------------------------------------------------------------
+// Transmission d'un résultat, appelée par n'importe quel worker
+static void
+vHostResult (xTcpEngine * e, xTcpHost * h, int iTrans, int iRet, int iError,
+             const void * pvData, uint64_t ulLatency) {
+  xTcpResult r;
+
+  r.sHost = h->xStats.sHost;
+  r.sPort = h->xStats.sPort;
+  r.iHost = h - e->pxHost;
+  r.iSlave = e->xCfg.piSlave[iTrans / e->xCfg.iStartCount];
+  r.iStartIndex = iTrans % e->xCfg.iStartCount;
+  r.iRet = iRet;
+  r.iError = iError;
+  r.pvData = pvData;
+  r.ulLatency = ulLatency;
+  if (iRet < 0) {
+
+    __atomic_add_fetch (&h->xStats.ulErrorCount, 1, __ATOMIC_RELAXED);
+  }
+  else {
+
+    __atomic_add_fetch (&h->xStats.ulRxCount, 1, __ATOMIC_RELAXED);
+  }
+  if (e->xCfg.vResult) {
+
+    e->xCfg.vResult (&r, e->xCfg.pvUser);
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Décodage d'une réponse et transmission du résultat
+static void
+vJobRun (xTcpEngine * e, xTcpHost * h, xTcpJob * j) {
+
+  if (j->iLen > 0) {
+    int iNb = e->xCfg.piNbReg[j->iTrans % e->xCfg.iStartCount];
+    int iRet = iMbTcpReadResponse (j->ucFrame, j->iLen, e->xCfg.iFunction,
+                                   iNb, j->ucData);
+
+    vHostResult (e, h, j->iTrans, iRet, iRet < 0 ? errno : 0, j->ucData,
+                 j->ulLatency);
+  }
+  else {
+
+    vHostResult (e, h, j->iTrans, -1, j->iError, NULL, 0);
+  }
+  free (j);
+}
+
+// -----------------------------------------------------------------------------
+// Exécute les travaux d'un hôte retiré d'une file jusqu'à ce qu'il n'en ait
+// plus, les travaux ajoutés entre-temps par son worker sont pris à la suite
+// @return le nombre de travaux exécutés
+static int
+iHostRunJobs (xTcpEngine * e, xTcpHost * h) {
+  xTcpRunQueue * q = &h->w->xRun;
+  int iCount = 0;
+
+  for (;;) {
+    xTcpJob * j;
+
+    pthread_mutex_lock (&q->xLock);
+    j = h->pxJobHead;
+    if (j) {
+
+      h->pxJobHead = j->pxNext;
+      if (h->pxJobHead == NULL) {
+        h->pxJobTail = NULL;
+      }
+    }
+    else {
+
+      h->bQueued = false;
+    }
+    pthread_mutex_unlock (&q->xLock);
+    if (j == NULL) {
+
+      return iCount;
+    }
+    vJobRun (e, h, j);
+    iCount++;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Ajoute un travail à la suite de ceux de l'hôte et range l'hôte dans la file
+// de son worker s'il n'y est pas déjà
+static void
+vHostPost (xTcpWorker * w, xTcpHost * h, xTcpJob * j) {
+  xTcpRunQueue * q = &w->xRun;
+
+  j->pxNext = NULL;
+  pthread_mutex_lock (&q->xLock);
+  if (h->pxJobTail) {
+
+    h->pxJobTail->pxNext = j;
+  }
+  else {
+
+    h->pxJobHead = j;
+  }
+  h->pxJobTail = j;
+  if (!h->bQueued) {
+
+    // chaque hôte du worker y figure au plus une fois, la file ne déborde pas
+    h->bQueued = true;
+    q->pxHost[ (q->iHead + q->iCount++) % q->iCapacity] = h;
+  }
+  pthread_mutex_unlock (&q->xLock);
+}
+
+// -----------------------------------------------------------------------------
+// Une réponse reçue devient un travail de l'hôte, le décodage et l'affichage
+// peuvent ainsi être faits par un worker inactif
+static void
+vHostFrame (xTcpWorker * w, xTcpHost * h, int iTrans, int iLen,
+            uint64_t ulLatency) {
+  xTcpJob * j = malloc (sizeof (xTcpJob) + w->e->ulDataSize);
+
+  if (j == NULL) {
+
+    // faute de mémoire, le résultat ne peut pas être différé
+    vHostResult (w->e, h, iTrans, -1, ENOMEM, NULL, 0);
+    return;
+  }
+  j->iTrans = iTrans;
+  j->iLen = iLen;
+  j->iError = 0;
+  j->ulLatency = ulLatency;
+  memcpy (j->ucFrame, h->ucRx, iLen);
+  vHostPost (w, h, j);
+}
+
+// -----------------------------------------------------------------------------
+// Une erreur suit le même chemin que les réponses, pour ne pas les devancer
+static void
+vHostError (xTcpWorker * w, xTcpHost * h, int iTrans, int iError) {
+  xTcpJob * j = malloc (sizeof (xTcpJob));
+
+  if (j == NULL) {
+
+    vHostResult (w->e, h, iTrans, -1, iError, NULL, 0);
+    return;
+  }
+  j->iTrans = iTrans;
+  j->iLen = 0;
+  j->iError = iError;
+  j->ulLatency = 0;
+  vHostPost (w, h, j);
+}
+
+// -----------------------------------------------------------------------------
+// Retire la requête en vol la plus ancienne dont l'échéance est atteinte
+// (ulNow = UINT64_MAX pour toutes les requêtes)
+// @return la transaction, -1 si aucune
+static int
+iHostTakeFlight (xTcpHost * h, uint64_t ulNow) {
+  int i, iFirst = -1;
+
+  for (i = 0; i < h->iPending; i++) {
+
+    if ( (h->xFlight[i].ulDeadline <= ulNow) &&
+         ( (iFirst < 0) || (h->xFlight[i].iTrans < h->xFlight[iFirst].iTrans))) {
+      iFirst = i;
+    }
+  }
+  if (iFirst >= 0) {
+    int iTrans = h->xFlight[iFirst].iTrans;
+
+    h->xFlight[iFirst] = h->xFlight[--h->iPending];
+    return iTrans;
+  }
+  return -1;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vHostClose (xTcpHost * h) {
+
+  if (h->iFd >= 0) {
+
+    // la fermeture retire le descripteur de l'ensemble epoll
+    close (h->iFd);
+    h->iFd = -1;
+  }
+  h->iRxLen = 0;
+  h->iTxLen = 0;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vHostEndCycle (xTcpWorker * w, xTcpHost * h) {
+
+  if (w->e->xCfg.iPollRate > 0) {
+
+    if (iPollTimerAdvance (&h->xTimer) > 0) {
+
+      h->xStats.ulOverrunCount++;
+    }
+    h->eState = eHostIdle;
+    vHostSetWake (w, h, h->xTimer.ulDeadline);
+  }
+  else {
+
+    h->eState = eHostDone;
+    h->ulWake = 0;
+    w->iActive--;
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Erreur de connexion : les requêtes en vol et les transactions restantes du
+// cycle échouent
+static void
+vHostFail (xTcpWorker * w, xTcpHost * h, int iError) {
+  xTcpEngine * e = w->e;
+  int iTrans;
+
+  vHostClose (h);
+  while ( (iTrans = iHostTakeFlight (h, UINT64_MAX)) >= 0) {
+
+    vHostError (w, h, iTrans, iError);
+  }
+  while (h->iNext < e->iTransCount) {
+
+    h->xStats.ulTxCount++;
+    vHostError (w, h, h->iNext++, iError);
+  }
+  vHostEndCycle (w, h);
+}
+
+// -----------------------------------------------------------------------------
+static int
+iHostFlush (xTcpWorker * w, xTcpHost * h) {
+
+  while (h->iTxLen > 0) {
+    ssize_t n = send (h->iFd, h->ucTx, h->iTxLen, MSG_NOSIGNAL);
+
+    if (n < 0) {
+
+      if ( (errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = h };
+
+        // reprise de l'envoi lorsque le socket sera disponible
+        epoll_ctl (w->iEpfd, EPOLL_CTL_MOD, h->iFd, &ev);
+        return 0;
+      }
+      return -1;
+    }
+    memmove (h->ucTx, h->ucTx + n, h->iTxLen - n);
+    h->iTxLen -= n;
+  }
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+static void
+vHostConnect (xTcpWorker * w, xTcpHost * h) {
+  struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = h };
+  int iOne = 1;
+
+  h->iFd = socket (h->xAddr->ai_family,
+                   SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (h->iFd < 0) {
+
+    vHostFail (w, h, errno);
+    return;
+  }
+  setsockopt (h->iFd, IPPROTO_TCP, TCP_NODELAY, &iOne, sizeof (iOne));
+
+  if ( (connect (h->iFd, h->xAddr->ai_addr, h->xAddr->ai_addrlen) != 0) &&
+       (errno != EINPROGRESS)) {
+
+    vHostFail (w, h, errno);
+    return;
+  }
+  if (epoll_ctl (w->iEpfd, EPOLL_CTL_ADD, h->iFd, &ev) != 0) {
+
+    vHostFail (w, h, errno);
+    return;
+  }
+  h->eState = eHostConnecting;
+  vHostSetWake (w, h, ulPollTimerNow() + w->e->ulTimeout);
+}
+
+// -----------------------------------------------------------------------------
+static void
+vHostConnected (xTcpWorker * w, xTcpHost * h) {
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = h };
+  int iError = 0;
+  socklen_t len = sizeof (iError);
+
+  if ( (getsockopt (h->iFd, SOL_SOCKET, SO_ERROR, &iError, &len) != 0) ||
+       (iError != 0)) {
+
+    vHostFail (w, h, iError ? iError : errno);
+    return;
+  }
+  epoll_ctl (w->iEpfd, EPOLL_CTL_MOD, h->iFd, &ev);
+  h->eState = eHostBusy;
+  vHostPump (w, h);
+}
+
+// -----------------------------------------------------------------------------
+// Remplit la fenêtre de requêtes en vol, termine le cycle lorsque toutes les
+// transactions ont abouti
+static void
+vHostPump (xTcpWorker * w, xTcpHost * h) {
+  xTcpEngine * e = w->e;
+  uint64_t ulNow = ulPollTimerNow();
+  uint64_t ulFirst;
+  int i;
+
+  while ( (h->iPending < e->xCfg.iWindow) && (h->iNext < e->iTransCount)) {
+    xTcpFlight * f = &h->xFlight[h->iPending++];
+    int iSlave = e->xCfg.piSlave[h->iNext / e->xCfg.iStartCount];
+    int iStart = e->xCfg.piStartReg[h->iNext % e->xCfg.iStartCount];
+    int iNb = e->xCfg.piNbReg[h->iNext % e->xCfg.iStartCount];
+
+    f->usTid = ++h->usTid;
+    f->iTrans = h->iNext++;
+    f->ulDeadline = ulNow + e->ulTimeout;
+    h->iTxLen += iMbTcpReadRequest (&h->ucTx[h->iTxLen], f->usTid, iSlave,
+                                    e->xCfg.iFunction, iStart, iNb);
+    h->xStats.ulTxCount++;
+  }
+
+  if (h->iPending == 0) {
+
+    vHostEndCycle (w, h);
+    return;
+  }
+
+  if (iHostFlush (w, h) != 0) {
+
+    vHostFail (w, h, errno);
+    return;
+  }
+
+  // réveil à l'échéance de la requête la plus ancienne
+  ulFirst = h->xFlight[0].ulDeadline;
+  for (i = 1; i < h->iPending; i++) {
+    if (h->xFlight[i].ulDeadline < ulFirst) {
+      ulFirst = h->xFlight[i].ulDeadline;
+    }
+  }
+  if (ulFirst != h->ulWake) {
+    vHostSetWake (w, h, ulFirst);
+  }
+}
+
+// -----------------------------------------------------------------------------
+static void
+vHostRead (xTcpWorker * w, xTcpHost * h) {
+
+  for (;;) {
+    ssize_t n = recv (h->iFd, h->ucRx + h->iRxLen,
+                      sizeof (h->ucRx) - h->iRxLen, 0);
+    uint64_t ulNow;
+
+    if (n == 0) {
+
+      vHostFail (w, h, ECONNRESET);
+      return;
+    }
+    if (n < 0) {
+
+      if ( (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+
+        vHostFail (w, h, errno);
+      }
+      return;
+    }
+    h->iRxLen += n;
+    ulNow = ulPollTimerNow();
+
+    for (;;) {
+      int iLen = iMbTcpFrameLength (h->ucRx, h->iRxLen);
+      int i;
+
+      if (iLen < 0) {
+
+        vHostFail (w, h, EPROTO);
+        return;
+      }
+      if ( (iLen == 0) || (iLen > h->iRxLen)) {
+        break;
+      }
+
+      // une réponse sans requête en vol (arrivée après son timeout) est ignorée
+      for (i = 0; i < h->iPending; i++) {
+
+        if (h->xFlight[i].usTid == usMbTcpTid (h->ucRx)) {
+          int iTrans = h->xFlight[i].iTrans;
+          uint64_t ulLatency = ulNow -
+                               (h->xFlight[i].ulDeadline - w->e->ulTimeout);
+
+          h->xFlight[i] = h->xFlight[--h->iPending];
+          vHostFrame (w, h, iTrans, iLen, ulLatency);
+          break;
+        }
+      }
+      memmove (h->ucRx, h->ucRx + iLen, h->iRxLen - iLen);
+      h->iRxLen -= iLen;
+    }
+
+    if (h->eState == eHostBusy) {
+
+      vHostPump (w, h);
+      if (h->iFd < 0) {
+        return;
+      }
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Echéance atteinte : début de cycle ou timeout
+static void
+vHostWake (xTcpWorker * w, xTcpHost * h) {
+  int iTrans;
+
+  switch (h->eState) {
+
+    case eHostIdle:
+      h->iNext = 0;
+      h->iPending = 0;
+      if (h->iFd < 0) {
+
+        vHostConnect (w, h);
+      }
+      else {
+
+        h->eState = eHostBusy;
+        vHostPump (w, h);
+      }
+      break;
+
+    case eHostConnecting:
+      vHostFail (w, h, ETIMEDOUT);
+      break;
+
+    case eHostBusy:
+      // l'esclave ne répond pas, la connexion reste ouverte
+      while ( (iTrans = iHostTakeFlight (h, ulPollTimerNow())) >= 0) {
+
+        vHostError (w, h, iTrans, ETIMEDOUT);
+      }
+      vHostPump (w, h);
+      break;
+
+    default:
+      break;
+  }
+}
+
+// -----------------------------------------------------------------------------
+static bool
+bStopRequested (const xTcpEngine * e) {
+
+  return (e->xCfg.pbStop) && (*e->xCfg.pbStop != 0);
+}
+
+// -----------------------------------------------------------------------------
+// Réveille un worker inactif pour qu'il vienne voler du travail
+static void
+vWorkerCallHelp (xTcpWorker * w) {
+  xTcpEngine * e = w->e;
+  int i;
+
+  for (i = 1; i < e->iWorkerCount; i++) {
+    xTcpWorker * o = &e->pxWorker[ (w->iIndex + i) % e->iWorkerCount];
+
+    if (__atomic_exchange_n (&o->iIdle, 0, __ATOMIC_ACQ_REL)) {
+      uint64_t ulOne = 1;
+
+      if (write (o->iWakeFd, &ulOne, sizeof (ulOne)) < 0) {
+        // le compteur est déjà non nul, le worker sera réveillé
+      }
+      return;
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Exécute les travaux de ses propres hôtes puis ceux des hôtes volés aux
+// autres workers
+// @return le nombre de travaux volés
+static int
+iWorkerDrain (xTcpWorker * w) {
+  xTcpEngine * e = w->e;
+  xTcpHost * h;
+  int i, iStolen = 0;
+
+  while ( (h = pxRunQueuePop (&w->xRun)) != NULL) {
+
+    iHostRunJobs (e, h);
+  }
+  for (i = 1; i < e->iWorkerCount; i++) {
+    xTcpWorker * o = &e->pxWorker[ (w->iIndex + i) % e->iWorkerCount];
+
+    while ( (h = pxRunQueuePop (&o->xRun)) != NULL) {
+
+      iStolen += iHostRunJobs (e, h);
+    }
+  }
+  w->ulStealCount += iStolen;
+  return iStolen;
+}
+
+// -----------------------------------------------------------------------------
+// Boucle d'un worker : entrées-sorties de ses propres hôtes, décodage et
+// affichage de toutes les réponses disponibles
+static void *
+pvWorkerRun (void * pvWorker) {
+  xTcpWorker * w = (xTcpWorker *) pvWorker;
+  struct epoll_event xEvents[EPOLL_EVENTS_MAX];
+  int i;
+
+  while ( (w->iActive > 0) && !bStopRequested (w->e)) {
+    uint64_t ulNow = ulPollTimerNow();
+    uint64_t ulDeadline;
+    int iWait = -1;
+    int n;
+
+    // traitement des échéances atteintes
+    while (pvPollQueuePeek (&w->xQueue, &ulDeadline) && (ulDeadline <= ulNow)) {
+      xTcpHost * h = pvPollQueuePop (&w->xQueue, NULL);
+
+      if ( (h->ulWake == ulDeadline) && (h->eState != eHostDone)) {
+
+        h->ulWake = 0;
+        vHostWake (w, h);
+      }
+    }
+    if (iWorkerDrain (w) > 0) {
+      // du travail a été volé, d'autres échéances ont pu être atteintes
+      continue;
+    }
+    if ( (w->iActive == 0) || bStopRequested (w->e)) {
+      break;
+    }
+
+    if (pvPollQueuePeek (&w->xQueue, &ulDeadline)) {
+      ulNow = ulPollTimerNow();
+
+      iWait = (ulDeadline > ulNow) ?
+              (int) ( (ulDeadline - ulNow + 999999ULL) / 1000000ULL) : 0;
+    }
+    if ( (w->e->xCfg.pbStop) &&
+         ( (iWait < 0) || (iWait > POLL_TIMER_STOP_MS))) {
+
+      // l'indicateur d'arrêt est positionné par un autre thread
+      iWait = POLL_TIMER_STOP_MS;
+    }
+
+    __atomic_store_n (&w->iIdle, 1, __ATOMIC_RELEASE);
+    n = epoll_wait (w->iEpfd, xEvents, EPOLL_EVENTS_MAX, iWait);
+    __atomic_store_n (&w->iIdle, 0, __ATOMIC_RELEASE);
+    if (n < 0) {
+
+      if (errno == EINTR) {
+        continue;
+      }
+      return (void *) -1;
+    }
+
+    for (i = 0; i < n; i++) {
+      xTcpHost * h = xEvents[i].data.ptr;
+      uint32_t ulEv = xEvents[i].events;
+
+      if (h == NULL) {
+        uint64_t ulCount;
+
+        // réveil par un autre worker
+        if (read (w->iWakeFd, &ulCount, sizeof (ulCount)) < 0) {
+          // rien à lire, un autre événement a déjà été traité
+        }
+        continue;
+      }
+      if (h->iFd < 0) {
+        // fermé lors du traitement d'un événement précédent
+        continue;
+      }
+      if (h->eState == eHostConnecting) {
+
+        vHostConnected (w, h);
+        continue;
+      }
+      if ( (ulEv & EPOLLOUT) && (h->iTxLen > 0)) {
+
+        if (iHostFlush (w, h) != 0) {
+
+          vHostFail (w, h, errno);
+          continue;
+        }
+        if (h->iTxLen == 0) {
+          struct epoll_event ev = { .events = EPOLLIN, .data.ptr = h };
+
+          epoll_ctl (w->iEpfd, EPOLL_CTL_MOD, h->iFd, &ev);
+        }
+      }
+      if (ulEv & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+
+        vHostRead (w, h);
+      }
+    }
+
+    if (__atomic_load_n (&w->xRun.iCount, __ATOMIC_RELAXED) > 1) {
+
+      // plusieurs hôtes en attente, un autre worker peut en prendre
+      vWorkerCallHelp (w);
+    }
+  }
+
+  // les travaux restants sont pris par les workers encore actifs ou ici
+  iWorkerDrain (w);
+  return NULL;
+}
+
+/* internal public functions ================================================ */
+
+// -----------------------------------------------------------------------------
+xTcpEngine *
+xTcpEngineNew (const xTcpEngineConfig * xConfig) {
+  xTcpEngine * e = calloc (1, sizeof (xTcpEngine));
+
+  if (e) {
+    int iSlaves = xConfig->iSlaveCount;
+    int iStarts = xConfig->iStartCount;
+    int i;
+
+    // les tables sont copiées, les workers les lisent jusqu'à la fin
+    e->piTable = malloc ( (iSlaves + 2 * iStarts) * sizeof (int));
+    if (e->piTable == NULL) {
+
+      free (e);
+      return NULL;
+    }
+    memcpy (e->piTable, xConfig->piSlave, iSlaves * sizeof (int));
+    memcpy (&e->piTable[iSlaves], xConfig->piStartReg, iStarts * sizeof (int));
+    memcpy (&e->piTable[iSlaves + iStarts], xConfig->piNbReg,
+            iStarts * sizeof (int));
+    e->xCfg = *xConfig;
+    e->xCfg.piSlave = e->piTable;
+    e->xCfg.piStartReg = &e->piTable[iSlaves];
+    e->xCfg.piNbReg = &e->piTable[iSlaves + iStarts];
+    if (e->xCfg.iWindow < 1) {
+      e->xCfg.iWindow = 1;
+    }
+    else if (e->xCfg.iWindow > MBTCP_WINDOW_MAX) {
+      e->xCfg.iWindow = MBTCP_WINDOW_MAX;
+    }
+    if (e->xCfg.iThreads < 1) {
+      e->xCfg.iThreads = 1;
+    }
+    e->iTransCount = xConfig->iSlaveCount * xConfig->iStartCount;
+    // les registres sont décodés en uint16_t, les bits à raison d'un octet,
+    // la zone d'un travail est dimensionnée pour le plus grand bloc
+    for (i = 0; i < xConfig->iStartCount; i++) {
+      if (xConfig->piNbReg[i] * sizeof (uint16_t) > e->ulDataSize) {
+        e->ulDataSize = xConfig->piNbReg[i] * sizeof (uint16_t);
+      }
+    }
+    e->ulTimeout = (uint64_t) (xConfig->dTimeout * 1e9);
+  }
+  return e;
+}
+
+// -----------------------------------------------------------------------------
+int
+iTcpEngineAddHost (xTcpEngine * e, const char * sHost, const char * sPort) {
+  struct addrinfo xHints = { .ai_socktype = SOCK_STREAM };
+  xTcpHost * pxHost;
+  xTcpHost * h;
+
+  pxHost = realloc (e->pxHost, (e->iHostCount + 1) * sizeof (xTcpHost));
+  if (pxHost == NULL) {
+
+    return -1;
+  }
+  e->pxHost = pxHost;
+  h = &e->pxHost[e->iHostCount];
+  memset (h, 0, sizeof (xTcpHost));
+  h->iFd = -1;
+
+  if (getaddrinfo (sHost, sPort, &xHints, &h->xAddr) != 0) {
+
+    errno = EHOSTUNREACH;
+    return -1;
+  }
+  h->xStats.sHost = strdup (sHost);
+  h->xStats.sPort = strdup (sPort);
+  if ( (h->xStats.sHost == NULL) || (h->xStats.sPort == NULL)) {
+
+    free ( (char *) h->xStats.sHost);
+    free ( (char *) h->xStats.sPort);
+    freeaddrinfo (h->xAddr);
+    return -1;
+  }
+  e->iHostCount++;
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
+int
+iTcpEngineRun (xTcpEngine * e) {
+  sigset_t xMask, xOldMask;
+  uint64_t ulStart;
+  int i, iStarted, iRet = 0;
+
+  // pas plus de workers que d'hôtes
+  e->iWorkerCount = e->xCfg.iThreads;
+  if (e->iWorkerCount > e->iHostCount) {
+    e->iWorkerCount = e->iHostCount > 0 ? e->iHostCount : 1;
+  }
+  e->pxWorker = calloc (e->iWorkerCount, sizeof (xTcpWorker));
+  if (e->pxWorker == NULL) {
+
+    return -1;
+  }
+  for (i = 0; i < e->iWorkerCount; i++) {
+
+    e->pxWorker[i].iEpfd = e->pxWorker[i].iWakeFd = -1;
+  }
+  for (i = 0; i < e->iWorkerCount; i++) {
+    xTcpWorker * w = &e->pxWorker[i];
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+    w->e = e;
+    w->iIndex = i;
+    w->iEpfd = epoll_create1 (EPOLL_CLOEXEC);
+    w->iWakeFd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ( (w->iEpfd < 0) || (w->iWakeFd < 0) ||
+         (epoll_ctl (w->iEpfd, EPOLL_CTL_ADD, w->iWakeFd, &ev) != 0) ||
+         (iPollQueueInit (&w->xQueue, 16) != 0) ||
+         (iRunQueueInit (&w->xRun, e->iHostCount) != 0)) {
+
+      return -1;
+    }
+  }
+
+  // chaque hôte est attaché définitivement à un worker
+  ulStart = ulPollTimerNow();
+  for (i = 0; i < e->iHostCount; i++) {
+    xTcpHost * h = &e->pxHost[i];
+
+    h->w = &e->pxWorker[i % e->iWorkerCount];
+    vPollTimerInit (&h->xTimer, e->xCfg.iPollRate, e->xCfg.eOverrun);
+    h->xTimer.ulDeadline = ulStart;
+    h->eState = eHostIdle;
+    vHostSetWake (h->w, h, ulStart);
+    h->w->iActive++;
+  }
+
+  if (e->iWorkerCount == 1) {
+
+    // un seul worker, la boucle tourne dans le thread appelant
+    return pvWorkerRun (&e->pxWorker[0]) == NULL ? 0 : -1;
+  }
+
+  // les signaux restent traités par le thread appelant
+  sigfillset (&xMask);
+  pthread_sigmask (SIG_BLOCK, &xMask, &xOldMask);
+  for (iStarted = 0; iStarted < e->iWorkerCount; iStarted++) {
+
+    if (pthread_create (&e->pxWorker[iStarted].xThread, NULL, pvWorkerRun,
+                        &e->pxWorker[iStarted]) != 0) {
+
+      // les workers déjà démarrés sont attendus
+      iRet = -1;
+      break;
+    }
+  }
+  pthread_sigmask (SIG_SETMASK, &xOldMask, NULL);
+  for (i = 0; i < iStarted; i++) {
+    void * pvRet;
+
+    pthread_join (e->pxWorker[i].xThread, &pvRet);
+    if (pvRet != NULL) {
+      iRet = -1;
+    }
+  }
+  return iRet;
+}
+
+// -----------------------------------------------------------------------------
+int
+iTcpEngineHostCount (const xTcpEngine * e) {
+
+  return e->iHostCount;
+}
+
+// -----------------------------------------------------------------------------
+const xTcpHostStats *
+pxTcpEngineHostStats (const xTcpEngine * e, int i) {
+
+  return &e->pxHost[i].xStats;
+}
+
+// -----------------------------------------------------------------------------
+int
+iTcpEngineWorkerCount (const xTcpEngine * e) {
+
+  return e->iWorkerCount;
+}
+
+// -----------------------------------------------------------------------------
+unsigned long
+ulTcpEngineStealCount (const xTcpEngine * e) {
+  unsigned long ulCount = 0;
+  int i;
+
+  for (i = 0; i < e->iWorkerCount; i++) {
+    ulCount += e->pxWorker[i].ulStealCount;
+  }
+  return ulCount;
+}
+
+// -----------------------------------------------------------------------------
+void
+vTcpEngineDelete (xTcpEngine * e) {
+
+  if (e) {
+    int i;
+
+    for (i = 0; i < e->iHostCount; i++) {
+      xTcpHost * h = &e->pxHost[i];
+
+      vHostClose (h);
+      while (h->pxJobHead) {
+        xTcpJob * j = h->pxJobHead;
+
+        h->pxJobHead = j->pxNext;
+        free (j);
+      }
+      freeaddrinfo (h->xAddr);
+      free ( (char *) h->xStats.sHost);
+      free ( (char *) h->xStats.sPort);
+    }
+    free (e->pxHost);
+    if (e->pxWorker) {
+
+      for (i = 0; i < e->iWorkerCount; i++) {
+        xTcpWorker * w = &e->pxWorker[i];
+
+        vPollQueueFree (&w->xQueue);
+        vRunQueueFree (&w->xRun);
+        if (w->iEpfd >= 0) {
+          close (w->iEpfd);
+        }
+        if (w->iWakeFd >= 0) {
+          close (w->iWakeFd);
+        }
+      }
+      free (e->pxWorker);
+    }
+    free (e->piTable);
+    free (e);
+  }
+}
+
+#endif /* MBPOLL_TCP_ENGINE defined */
+/* ========================================================================== */
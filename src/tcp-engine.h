@@ -0,0 +1,146 @@
+/* Copyright (c) 2015-2023 Pascal JEAN, All rights reserved.
+ *
+ * mbpoll is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mbpoll is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mbpoll.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MBPOLL_TCP_ENGINE_H_
+#define _MBPOLL_TCP_ENGINE_H_
+
+#include "poll-timer.h"
+
+/* conditionals ============================================================= */
+// Le moteur repose sur epoll et eventfd, il n'est disponible que sous Linux
+#if defined (__linux__)
+#define MBPOLL_TCP_ENGINE 1
+#endif
+
+/* structures =============================================================== */
+typedef struct xTcpEngine xTcpEngine;
+
+/**
+ * Résultat d'une transaction
+ */
+typedef struct xTcpResult {
+  const char * sHost; /**< Hôte interrogé */
+  const char * sPort; /**< Port TCP */
+  int iHost; /**< Indice de l'hôte, dans l'ordre d'ajout */
+  int iSlave; /**< Adresse de l'esclave (unit identifier) */
+  int iStartIndex; /**< Indice du bloc dans piStartReg */
+  int iRet; /**< Nombre d'éléments lus, -1 si erreur */
+  int iError; /**< Code d'erreur (errno) si iRet < 0 */
+  const void * pvData; /**< Eléments lus (format libmodbus), valides pendant l'appel */
+  uint64_t ulLatency; /**< Délai de réponse en ns, 0 si aucune réponse */
+} xTcpResult;
+
+/**
+ * Statistiques d'un hôte
+ */
+typedef struct xTcpHostStats {
+  const char * sHost;
+  const char * sPort;
+  unsigned long ulTxCount; /**< Requêtes transmises */
+  unsigned long ulRxCount; /**< Réponses valides reçues */
+  unsigned long ulErrorCount; /**< Erreurs */
+  unsigned long ulOverrunCount; /**< Cycles ayant dépassé leur échéance */
+} xTcpHostStats;
+
+/**
+ * Paramètres du moteur, communs à tous les hôtes
+ */
+typedef struct xTcpEngineConfig {
+  int iFunction; /**< Code fonction de lecture (eMbTcpFunction) */
+  const int * piSlave; /**< Esclaves interrogés sur chaque hôte */
+  int iSlaveCount;
+  const int * piStartReg; /**< Adresses PDU des blocs lus */
+  int iStartCount;
+  const int * piNbReg; /**< Nombre d'éléments de chaque bloc */
+  int iWindow; /**< Nombre maximal de requêtes en vol par hôte */
+  int iThreads; /**< Nombre de workers, 1 pour scruter depuis le thread appelant */
+  int iPollRate; /**< Période en ms, 0 pour une seule scrutation */
+  ePollOverrun eOverrun;
+  double dTimeout; /**< Timeout de connexion et de réponse en s */
+  /**
+   * Si non NULL, la scrutation s'arrête dès que *pbStop est non nul, il est
+   * vérifié au moins toutes les POLL_TIMER_STOP_MS
+   */
+  const volatile sig_atomic_t * pbStop;
+  /**
+   * Appelée à chaque transaction, simultanément par plusieurs workers si
+   * iThreads > 1, mais jamais simultanément pour un même hôte : les résultats
+   * d'un hôte, erreurs comprises, sont transmis dans l'ordre de leur arrivée
+   */
+  void (*vResult) (const xTcpResult * r, void * pvUser);
+  void * pvUser;
+} xTcpEngineConfig;
+
+/* internal public functions ================================================ */
+
+/**
+ * Création d'un moteur
+ *
+ * Les tables de xConfig sont copiées.
+ *
+ * @return le moteur, NULL si erreur
+ */
+xTcpEngine * xTcpEngineNew (const xTcpEngineConfig * xConfig);
+
+/**
+ * Ajoute un hôte à scruter, avant l'appel à iTcpEngineRun()
+ *
+ * @return 0, -1 si l'adresse ne peut pas être résolue
+ */
+int iTcpEngineAddHost (xTcpEngine * e, const char * sHost, const char * sPort);
+
+/**
+ * Scrute tous les hôtes en parallèle
+ *
+ * Chaque hôte est cadencé indépendamment : un hôte lent ou injoignable ne
+ * retarde pas les autres. Les hôtes sont répartis entre iThreads workers et
+ * chaque connexion reste attachée à son worker. Le décodage et la transmission
+ * des réponses sont des travaux rangés à la suite de ceux de leur hôte, un
+ * worker inactif vole aux autres des hôtes entiers. La fonction ne retourne
+ * qu'en cas d'erreur, lorsque l'arrêt est demandé par pbStop ou, pour une
+ * scrutation unique, lorsque tous les hôtes ont été interrogés. Tous les
+ * workers sont alors terminés.
+ *
+ * @return 0, -1 si erreur
+ */
+int iTcpEngineRun (xTcpEngine * e);
+
+/**
+ * Nombre d'hôtes
+ */
+int iTcpEngineHostCount (const xTcpEngine * e);
+
+/**
+ * Statistiques de l'hôte d'indice i
+ */
+const xTcpHostStats * pxTcpEngineHostStats (const xTcpEngine * e, int i);
+
+/**
+ * Nombre de workers démarrés par iTcpEngineRun()
+ */
+int iTcpEngineWorkerCount (const xTcpEngine * e);
+
+/**
+ * Nombre de travaux exécutés par un autre worker que leur propriétaire
+ */
+unsigned long ulTcpEngineStealCount (const xTcpEngine * e);
+
+/**
+ * Ferme les connexions et libère le moteur
+ */
+void vTcpEngineDelete (xTcpEngine * e);
+
+/* ========================================================================== */
+#endif /* _MBPOLL_TCP_ENGINE_H_ */